@@ -0,0 +1,232 @@
+// cmdline_benchmark_resolver.cc
+//
+//   This program is free software; you can redistribute it and/or
+//   modify it under the terms of the GNU General Public License as
+//   published by the Free Software Foundation; either version 2 of
+//   the License, or (at your option) any later version.
+
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//   General Public License for more details.
+
+//   You should have received a copy of the GNU General Public License
+//   along with this program; see the file COPYING.  If not, write to
+//   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+//   Boston, MA 02110-1301, USA.
+//
+// Time the resolver with and without a compiled universe
+// (debugging/profiling tool).
+
+#include "cmdline_benchmark_resolver.h"
+
+#include "cmdline_util.h"
+
+#include <aptitude.h>
+
+#include <generic/apt/apt.h>
+#include <generic/apt/aptitude_resolver_compiled_universe.h>
+#include <generic/apt/aptitude_resolver_universe.h>
+#include <generic/apt/config_signal.h>
+#include <generic/problemresolver/cost_limits.h>
+#include <generic/problemresolver/exceptions.h>
+#include <generic/problemresolver/problemresolver.h>
+
+#include <apt-pkg/error.h>
+#include <apt-pkg/progress.h>
+
+#include <sys/time.h>
+
+#include <iomanip>
+#include <iostream>
+#include <memory>
+
+using namespace std;
+
+namespace
+{
+  double now()
+  {
+    timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+  }
+
+  /** \brief Counters gathered by walking a universe. */
+  struct walk_counts
+  {
+    unsigned long packages;
+    unsigned long versions;
+    unsigned long deps;
+    unsigned long solvers;
+    unsigned long revdeps;
+
+    walk_counts()
+      : packages(0), versions(0), deps(0), solvers(0), revdeps(0)
+    {
+    }
+
+    bool operator==(const walk_counts &other) const
+    {
+      return packages == other.packages &&
+	versions == other.versions &&
+	deps == other.deps &&
+	solvers == other.solvers &&
+	revdeps == other.revdeps;
+    }
+  };
+
+  /** \brief Visit every edge that the resolver can follow. */
+  walk_counts walk_universe(const aptitude_universe &u)
+  {
+    walk_counts rval;
+
+    for(aptitude_universe::package_iterator pi = u.packages_begin();
+	!pi.end(); ++pi)
+      {
+	++rval.packages;
+
+	for(aptitude_universe::package::version_iterator vi = (*pi).versions_begin();
+	    !vi.end(); ++vi)
+	  {
+	    ++rval.versions;
+
+	    for(aptitude_universe::version::dep_iterator di = (*vi).deps_begin();
+		!di.end(); ++di)
+	      {
+		++rval.deps;
+
+		for(aptitude_universe::dep::solver_iterator si = (*di).solvers_begin();
+		    !si.end(); ++si)
+		  ++rval.solvers;
+	      }
+
+	    for(aptitude_universe::version::revdep_iterator rdi = (*vi).revdeps_begin();
+		!rdi.end(); ++rdi)
+	      ++rval.revdeps;
+	  }
+      }
+
+    return rval;
+  }
+
+  /** \brief Run the resolver until it produces its first solution.
+   *
+   *  \return the number of choices in the solution, or -1 if no
+   *  solution was found.
+   */
+  int run_resolver(const aptitude_universe &u, int max_steps)
+  {
+    typedef generic_problem_resolver<aptitude_universe> resolver;
+
+    resolver r(aptcfg->FindI(PACKAGE "::ProblemResolver::StepScore", -10),
+	       aptcfg->FindI(PACKAGE "::ProblemResolver::BrokenScore", -100),
+	       aptcfg->FindI(PACKAGE "::ProblemResolver::UnfixedSoftScore", -200),
+	       aptcfg->FindI(PACKAGE "::ProblemResolver::Infinity", 1000000),
+	       aptcfg->FindI(PACKAGE "::ProblemResolver::ResolutionScore", 50),
+	       cost_limits::minimum_cost,
+	       aptcfg->FindI(PACKAGE "::ProblemResolver::FutureHorizon", 50),
+	       imm::map<aptitude_universe::package, aptitude_universe::version>(),
+	       u);
+
+    try
+      {
+	return r.find_next_solution(max_steps, NULL).get_choices().size();
+      }
+    catch(NoMoreSolutions &)
+      {
+	return -1;
+      }
+    catch(NoMoreTime &)
+      {
+	return -1;
+      }
+  }
+
+  void print_timing(const char *what, double adapter_time, double compiled_time)
+  {
+    cout << setw(20) << left << what
+	 << fixed << setprecision(3)
+	 << "adapter " << adapter_time << "s, "
+	 << "compiled " << compiled_time << "s";
+    if(compiled_time > 0)
+      cout << " (" << setprecision(1) << adapter_time / compiled_time << "x)";
+    cout << endl;
+  }
+}
+
+int cmdline_benchmark_resolver(int argc, char *argv[],
+			       const char *status_fname)
+{
+  aptitude::cmdline::on_apt_errors_print_and_die();
+
+  OpProgress progress;
+  bool operation_needs_lock = false;
+  apt_init(&progress, true, operation_needs_lock, status_fname);
+
+  aptitude::cmdline::on_apt_errors_print_and_die();
+
+  const int max_steps = aptcfg->FindI(PACKAGE "::ProblemResolver::StepLimit", 5000);
+
+  aptitude_universe u(*apt_cache_file);
+
+  // Nothing has been compiled yet, so this walks the cache.
+  double start = now();
+  const walk_counts adapter_counts = walk_universe(u);
+  const double adapter_walk_time = now() - start;
+
+  start = now();
+  const int adapter_solution_size = run_resolver(u, max_steps);
+  const double adapter_search_time = now() - start;
+
+  start = now();
+  const std::shared_ptr<const aptitude_compiled_universe> compiled =
+    get_compiled_universe(*apt_cache_file);
+  const double compile_time = now() - start;
+
+  if(compiled.get() == NULL)
+    {
+      cout << "The compiled universe is disabled by "
+	   << PACKAGE "::ProblemResolver::Compile-Universe." << endl;
+      return 1;
+    }
+
+  cout << "Compiled " << compiled->get_version_count() << " versions and "
+       << compiled->get_dep_count() << " dependencies in "
+       << fixed << setprecision(3) << compile_time << "s." << endl;
+
+  const aptitude_universe compiled_u(*apt_cache_file, compiled);
+
+  start = now();
+  const walk_counts compiled_counts = walk_universe(compiled_u);
+  const double compiled_walk_time = now() - start;
+
+  print_timing("Graph walk:", adapter_walk_time, compiled_walk_time);
+
+  if(!(adapter_counts == compiled_counts))
+    {
+      cout << "The compiled universe does not match the adapter: "
+	   << adapter_counts.deps << "/" << compiled_counts.deps << " deps, "
+	   << adapter_counts.solvers << "/" << compiled_counts.solvers << " solvers, "
+	   << adapter_counts.revdeps << "/" << compiled_counts.revdeps << " reverse deps."
+	   << endl;
+      return 1;
+    }
+
+  start = now();
+  const int compiled_solution_size = run_resolver(compiled_u, max_steps);
+  const double compiled_search_time = now() - start;
+
+  print_timing("First solution:", adapter_search_time, compiled_search_time);
+
+  if(adapter_solution_size != compiled_solution_size)
+    {
+      cout << "The resolver found different solutions: "
+	   << adapter_solution_size << " actions on the adapter, "
+	   << compiled_solution_size << " actions on the compiled universe."
+	   << endl;
+      return 1;
+    }
+
+  return 0;
+}
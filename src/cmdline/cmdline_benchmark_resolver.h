@@ -0,0 +1,30 @@
+// cmdline_benchmark_resolver.h                     -*-c++-*-
+//
+//   This program is free software; you can redistribute it and/or
+//   modify it under the terms of the GNU General Public License as
+//   published by the Free Software Foundation; either version 2 of
+//   the License, or (at your option) any later version.
+
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//   General Public License for more details.
+
+//   You should have received a copy of the GNU General Public License
+//   along with this program; see the file COPYING.  If not, write to
+//   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+//   Boston, MA 02110-1301, USA.
+
+#ifndef CMDLINE_BENCHMARK_RESOLVER
+#define CMDLINE_BENCHMARK_RESOLVER
+
+/** \file cmdline_benchmark_resolver.h
+ */
+
+/** \brief Compare the cost of walking and searching the
+ *  aptitude_universe adapter when it walks the APT cache and when it
+ *  reads the compiled universe of the same cache (debugging tool).
+ */
+int cmdline_benchmark_resolver(int argc, char *argv[], const char *status_fname);
+
+#endif
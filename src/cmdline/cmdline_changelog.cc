@@ -152,11 +152,15 @@ namespace
     // Where to store the changelog file, if any.
     std::string out_changelog_file;
 
+    // Set when the download succeeded or failed.
+    bool finished;
+
     changelog_download_callbacks(const std::string &short_description,
                                  const std::shared_ptr<terminal_metrics> &term_metrics)
       : single_download_progress(short_description,
 				 aptcfg->FindI("Quiet", 0) > 0,
-                                 term_metrics)
+                                 term_metrics),
+	finished(false)
     {
     }
 
@@ -165,6 +169,7 @@ namespace
       single_download_progress::success(filename);
 
       out_changelog_file = filename;
+      finished = true;
 
       aptitude::cmdline::exit_main();
     }
@@ -175,11 +180,24 @@ namespace
 
       _error->Error(_("Changelog download failed: %s"), msg.c_str());
       _error->DumpErrors();
+      finished = true;
 
       aptitude::cmdline::exit_main();
     }
   };
 
+  /** \brief Run the main loop until the given download is finished.
+   *
+   *  Other downloads might be running at the same time, and each of
+   *  them stops the main loop when it finishes, so the loop is
+   *  restarted until this one is done.
+   */
+  void wait_for_changelog(const changelog_download_callbacks &callbacks)
+  {
+    while(!callbacks.finished)
+      aptitude::cmdline::main_loop();
+  }
+
 
   /** \brief Get a package's changelog.
    *
@@ -201,7 +219,7 @@ namespace
 
     aptitude::apt::get_changelog(info, callbacks, aptitude::cmdline::post_thunk);
 
-    aptitude::cmdline::main_loop();
+    wait_for_changelog(*callbacks);
 
     std::string changelog_filepath = callbacks->out_changelog_file;
     if (fs::is_regular_file(changelog_filepath))
@@ -210,24 +228,6 @@ namespace
       return "";
   }
 
-  /** \brief Get a package's changelog.
-   *
-   *  \param ver Version iterator for which to get the changelog
-   *  \param term_metrics Data about the terminal
-   *
-   *  @return File path of the changelog, empty if invalid
-   *
-   *  This routine exits once the download is complete.
-   */
-  std::string get_changelog(const pkgCache::VerIterator &ver,
-			    const std::shared_ptr<terminal_metrics> &term_metrics)
-  {
-    std::shared_ptr<aptitude::apt::changelog_info> info =
-      aptitude::apt::changelog_info::create(ver);
-
-    return get_changelog(info, term_metrics);
-  }
-
   /** \brief download a source package's changelog.
    *
    *  \param srcpkg the source package name
@@ -283,6 +283,155 @@ std::string changelog_by_version(const std::string &pkg,
 
   return filename;
 }
+
+  /** \brief A package whose changelog was requested. */
+  struct changelog_request
+  {
+    std::string input;
+    std::string package;
+    cmdline_version_source source;
+    std::string sourcestr;
+
+    // The version that was found, if any.
+    pkgCache::VerIterator ver;
+
+    // Set if the changelog shouldn't be fetched at all.
+    bool skip;
+
+    // The changelog to fetch first, or NULL if there is none.
+    std::shared_ptr<aptitude::apt::changelog_info> info;
+    // If this is \b true, info describes the source package that was
+    // found, and there is nothing to fall back to.
+    bool info_is_source;
+    std::shared_ptr<changelog_download_callbacks> callbacks;
+
+    changelog_request()
+      : source(cmdline_version_cand), skip(false), info_is_source(false)
+    {
+    }
+  };
+
+  /** \brief Work out which changelog to fetch first for each input. */
+  void find_changelog_requests(const vector<string> &packages,
+			       std::vector<changelog_request> &requests)
+  {
+    for(vector<string>::const_iterator i=packages.begin(); i!=packages.end(); ++i)
+      {
+	changelog_request req;
+	req.input = *i;
+
+	if(!cmdline_parse_source(req.input, req.source, req.package, req.sourcestr))
+	  {
+	    _error->DumpErrors();
+	    req.skip = true;
+	  }
+	else
+	  {
+	    pkgCache::PkgIterator pkg=(*apt_cache_file)->FindPkg(req.package);
+
+	    // For real packages/versions, we can do a sanity check on the
+	    // version and warn the user if it looks like it doesn't have a
+	    // corresponding source package.
+	    if(!pkg.end())
+	      req.ver = cmdline_find_ver(pkg, req.source, req.sourcestr);
+
+	    if(!req.ver.end())
+	      {
+		// check if we know the origin
+		if ( ! aptitude::apt::check_valid_origin(req.ver) )
+		  {
+		    _error->DumpErrors();
+		    req.skip = true;
+		  }
+		else
+		  req.info = aptitude::apt::changelog_info::create(req.ver);
+	      }
+	    else
+	      {
+		aptitude::cmdline::source_package p =
+		  aptitude::cmdline::find_source_package(req.package,
+							 req.source,
+							 req.sourcestr);
+
+		if(p.valid())
+		  {
+		    req.info = aptitude::apt::changelog_info::create(p.get_package(),
+								     p.get_version(),
+								     p.get_section(),
+								     p.get_package());
+		    req.info_is_source = true;
+		  }
+	      }
+	  }
+
+	requests.push_back(req);
+      }
+  }
+
+  /** \brief Fetch a package's changelog some other way, after the
+   *  first attempt failed.
+   *
+   *  @return File path of the changelog, empty if invalid
+   */
+  std::string get_fallback_changelog(const changelog_request &req,
+				     const std::shared_ptr<terminal_metrics> &term_metrics)
+  {
+    std::string filename;
+
+    if(req.info_is_source)
+      return filename;
+
+    aptitude::cmdline::source_package p;
+    if(!req.ver.end())
+      p = aptitude::cmdline::find_source_package(req.package,
+						 req.source,
+						 req.sourcestr);
+
+    // Use the source package if one was found; otherwise try to
+    // use an explicit version.
+    if(p.valid())
+      {
+	filename = get_changelog_from_source(p.get_package(),
+					     p.get_version(),
+					     p.get_section(),
+					     p.get_package(),
+					     term_metrics);
+      }
+    else
+      {
+	// We couldn't find a real or source package with the
+	// given name and version.
+	//
+	// If the user didn't specify a version or selected a
+	// candidate and we couldn't find anything, we have no
+	// recourse.  But if they passed a version number, we
+	// can fall back to just blindly guessing that the
+	// version exists.
+
+	// TODO: We can try using the path "current" rather than
+	// "SOURCE_VERSION" in the default case, because this is
+	// supported on http://packages.debian.org/changelogs to
+	// fetch details for the latest version.
+
+	switch(req.source)
+	  {
+	  case cmdline_version_cand:
+	    break;
+
+	  case cmdline_version_curr_or_cand:
+	    break;
+
+	  case cmdline_version_archive:
+	    break;
+
+	  case cmdline_version_version:
+	    filename = changelog_by_version(req.package, req.sourcestr, term_metrics);
+	    break;
+	  }
+      }
+
+    return filename;
+  }
 }
 
 void do_cmdline_changelog(const vector<string> &packages,
@@ -300,7 +449,33 @@ void do_cmdline_changelog(const vector<string> &packages,
 	pager="more";
     }
 
-  for(vector<string>::const_iterator i=packages.begin(); i!=packages.end(); ++i)
+  std::vector<changelog_request> requests;
+  find_changelog_requests(packages, requests);
+
+  // Start fetching every changelog we know how to find, so that they
+  // download while the earlier ones are being read.
+  std::vector<std::shared_ptr<aptitude::apt::changelog_info> > infos;
+  std::vector<std::shared_ptr<aptitude::download_callbacks> > callbacks;
+  for(std::vector<changelog_request>::iterator it = requests.begin();
+      it != requests.end(); ++it)
+    if(!it->skip && it->info.get() != NULL)
+      {
+	const std::string short_description =
+	  cwidget::util::ssprintf(_("Changelog of %s"), it->info->get_display_name().c_str());
+
+	it->callbacks = std::make_shared<changelog_download_callbacks>(short_description,
+								       term_metrics);
+	infos.push_back(it->info);
+	callbacks.push_back(it->callbacks);
+      }
+
+  std::shared_ptr<aptitude::download_request> batch;
+  if(!infos.empty())
+    batch = aptitude::apt::get_changelogs(infos, callbacks,
+					  aptitude::cmdline::post_thunk);
+
+  for(std::vector<changelog_request>::const_iterator it = requests.begin();
+      it != requests.end(); ++it)
     {
       // We need to do this because some code (see above) checks
       // PendingError to see whether everything is OK.  In addition,
@@ -308,92 +483,36 @@ void do_cmdline_changelog(const vector<string> &packages,
       // (this will be true even if the PendingError check is removed
       // ... which it arguably should be).
       _error->DumpErrors();
-      string input=*i;
-
-      cmdline_version_source source;
-      string package, sourcestr;
 
-      if(!cmdline_parse_source(input, source, package, sourcestr))
+      if(it->skip)
 	continue;
 
-      pkgCache::PkgIterator pkg=(*apt_cache_file)->FindPkg(package);
-
       std::string filename;
 
-      // For real packages/versions, we can do a sanity check on the
-      // version and warn the user if it looks like it doesn't have a
-      // corresponding source package.
-      if(!pkg.end())
+      // The results arrive in order, so this only waits for
+      // changelogs that are still being downloaded.
+      if(it->callbacks.get() != NULL)
 	{
-	  pkgCache::VerIterator ver=cmdline_find_ver(pkg,
-						     source, sourcestr);
-
-	  if (!ver.end())
-	    {
-	      // check if we know the origin
-	      if ( ! aptitude::apt::check_valid_origin(ver) )
-		{
-		  _error->DumpErrors();
-		  continue;
-		}
-
-              filename = get_changelog(ver, term_metrics);
-	    }
-        }
+	  wait_for_changelog(*it->callbacks);
+	  filename = it->callbacks->out_changelog_file;
+	}
 
       if (!fs::is_regular_file(filename))
-        {
-	  aptitude::cmdline::source_package p =
-	    aptitude::cmdline::find_source_package(package,
-						   source,
-						   sourcestr);
-
-	  // Use the source package if one was found; otherwise try to
-	  // use an explicit version.
-	  if(p.valid())
-	    {
-	      filename = get_changelog_from_source(p.get_package(),
-                                                   p.get_version(),
-                                                   p.get_section(),
-                                                   p.get_package(),
-                                                   term_metrics);
-	    }
-	  else
-	    {
-	      // We couldn't find a real or source package with the
-	      // given name and version.
-	      //
-	      // If the user didn't specify a version or selected a
-	      // candidate and we couldn't find anything, we have no
-	      // recourse.  But if they passed a version number, we
-	      // can fall back to just blindly guessing that the
-	      // version exists.
-
-              // TODO: We can try using the path "current" rather than
-              // "SOURCE_VERSION" in the default case, because this is
-              // supported on http://packages.debian.org/changelogs to
-              // fetch details for the latest version.
-
-	      switch(source)
-		{
-		case cmdline_version_cand:
-		  break;
-
-		case cmdline_version_curr_or_cand:
-		  break;
-
-		case cmdline_version_archive:
-		  break;
-
-		case cmdline_version_version:
-		  filename = changelog_by_version(package, sourcestr, term_metrics);
-		  break;
-		}
-	    }
+	{
+	  // The download queue won't start a second download of a URI
+	  // that is already being fetched, and the fallbacks might ask
+	  // for a changelog that's still in the batch, so let the
+	  // batch finish first.
+	  for(std::vector<changelog_request>::const_iterator later = it;
+	      later != requests.end(); ++later)
+	    if(later->callbacks.get() != NULL)
+	      wait_for_changelog(*later->callbacks);
+
+	  filename = get_fallback_changelog(*it, term_metrics);
 	}
 
       if (!fs::is_regular_file(filename))
-	_error->Error(_("Couldn't find a changelog for %s"), input.c_str());
+	_error->Error(_("Couldn't find a changelog for %s"), it->input.c_str());
       else
 	// Run the user's pager.
 	if (system((string(pager) + " " + filename).c_str()) != 0)
@@ -401,7 +520,6 @@ void do_cmdline_changelog(const vector<string> &packages,
     }
 }
 
-// TODO: fetch them all in one go.
 int cmdline_changelog(int argc, char *argv[])
 {
   std::shared_ptr<terminal_io> term = create_terminal();
@@ -138,8 +138,7 @@ namespace
       }
     else
       {
-	std::sort(output.begin(), output.end(),
-		  aptitude::cmdline::package_results_lt(sort_policy));
+	aptitude::cmdline::sort_package_results(output, sort_policy);
 
 	output.erase(std::unique(output.begin(), output.end(),
 				 aptitude::cmdline::package_results_eq()),
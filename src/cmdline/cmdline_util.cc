@@ -762,11 +762,11 @@ namespace aptitude
 	      bool applicable = false;
 	      if(it->get_pattern().valid())
 		{
-		  if(matching::get_match(it->get_pattern(),
-					 pkg,
-					 search_info,
-					 *apt_cache_file,
-					 *apt_package_records).valid())
+		  if(matching::matches(it->get_pattern(),
+				       pkg,
+				       search_info,
+				       *apt_cache_file,
+				       *apt_package_records))
 		    applicable = true;
 		}
 	      else
@@ -286,29 +286,35 @@ namespace aptitude
       }
     };
 
-    /** Compare pairs whose first elements are package iterators,
+    /** \brief Sort pairs whose first elements are package iterators
      *  according to a sorting policy.
      *
-     *  When a version is needed to do a comparison, I arbitrarily decided
-     *  to use the candidate version.
+     *  When a version is needed to do a comparison, I arbitrarily
+     *  decided to use the candidate version.  The sort keys of each
+     *  package are computed once (see pkg_sort_keys), and the sort is
+     *  stable.
      */
-    class package_results_lt
+    template<typename T>
+    void sort_package_results(std::vector<std::pair<pkgCache::PkgIterator, T> > &results,
+                              const pkg_sortpolicy *s)
     {
-      pkg_sortpolicy *s;
-
-    public:
-      package_results_lt(pkg_sortpolicy *_s):s(_s) {}
-
-      template<typename T, typename U>
-      bool operator()(const std::pair<pkgCache::PkgIterator, T> &a,
-                      const std::pair<pkgCache::PkgIterator, U> &b)
-      {
-        pkgCache::VerIterator av = (*apt_cache_file)[a.first].CandidateVerIter(*apt_cache_file);
-        pkgCache::VerIterator bv = (*apt_cache_file)[b.first].CandidateVerIter(*apt_cache_file);
-
-        return s->compare(a.first, av, b.first, bv)<0;
-      }
-    };
+      std::vector<pkg_sort_item> items;
+      items.reserve(results.size());
+      for(typename std::vector<std::pair<pkgCache::PkgIterator, T> >::const_iterator
+            it = results.begin(); it != results.end(); ++it)
+        items.push_back(pkg_sort_item(it->first,
+                                      (*apt_cache_file)[it->first].CandidateVerIter(*apt_cache_file)));
+
+      const std::vector<std::size_t> order(pkg_sort_keys(s, items).get_order());
+
+      std::vector<std::pair<pkgCache::PkgIterator, T> > sorted;
+      sorted.reserve(results.size());
+      for(std::vector<std::size_t>::const_iterator it = order.begin();
+          it != order.end(); ++it)
+        sorted.push_back(results[*it]);
+
+      results.swap(sorted);
+    }
 
     /** \brief Compare pairs whose first elements are package
      *  iterators for equality.
@@ -350,24 +356,32 @@ namespace aptitude
       }
     };
 
-    /** \brief less-than over version match results. */
-    class version_results_lt
+    /** \brief Sort version match results (pairs whose first element
+     *  is a version) according to a sorting policy.
+     *
+     *  The sort keys of each version are computed once (see
+     *  pkg_sort_keys), and the sort is stable.
+     */
+    template<typename T>
+    void sort_version_results(std::vector<std::pair<pkgCache::VerIterator, T> > &results,
+                              const pkg_sortpolicy *sortpolicy)
     {
-      compare_version_results3 comparer;
+      std::vector<pkg_sort_item> items;
+      items.reserve(results.size());
+      for(typename std::vector<std::pair<pkgCache::VerIterator, T> >::const_iterator
+            it = results.begin(); it != results.end(); ++it)
+        items.push_back(pkg_sort_item(it->first.ParentPkg(), it->first));
 
-    public:
-      version_results_lt(pkg_sortpolicy *sortpolicy)
-        : comparer(sortpolicy)
-      {
-      }
+      const std::vector<std::size_t> order(pkg_sort_keys(sortpolicy, items).get_order());
 
-      template<typename T, typename U>
-      bool operator()(const std::pair<pkgCache::VerIterator, T> &a,
-                      const std::pair<pkgCache::VerIterator, U> &b)
-      {
-        return comparer(a, b) < 0;
-      }
-    };
+      std::vector<std::pair<pkgCache::VerIterator, T> > sorted;
+      sorted.reserve(results.size());
+      for(std::vector<std::size_t>::const_iterator it = order.begin();
+          it != order.end(); ++it)
+        sorted.push_back(results[*it]);
+
+      results.swap(sorted);
+    }
 
     /** \brief equality over version match results.
      *
@@ -60,14 +60,13 @@ using aptitude::cmdline::create_progress_display;
 using aptitude::cmdline::create_search_progress;
 using aptitude::cmdline::create_terminal;
 using aptitude::cmdline::lessthan_1st;
-using aptitude::cmdline::package_results_lt;
 using aptitude::cmdline::search_result_column_parameters;
+using aptitude::cmdline::sort_version_results;
 using aptitude::cmdline::terminal_io;
 using aptitude::cmdline::terminal_locale;
 using aptitude::cmdline::terminal_metrics;
 using aptitude::cmdline::terminal_output;
 using aptitude::cmdline::version_results_eq;
-using aptitude::cmdline::version_results_lt;
 using aptitude::matching::serialize_pattern;
 using aptitude::util::create_throttle;
 using aptitude::util::progress_info;
@@ -417,7 +416,7 @@ namespace
     // don't have to sort lots of little lists later.  The code below
     // very carefully builds a list of the versions of each package in
     // a stable way, so the versions will continue to be in order.
-    std::sort(output.begin(), output.end(), version_results_lt(sort_policy));
+    sort_version_results(output, sort_policy);
     output.erase(std::unique(output.begin(), output.end(), version_results_eq(sort_policy)),
                  output.end());
 
@@ -474,9 +474,6 @@ void apt_load_cache(OpProgress *progress_bar, bool do_initselections,
   // Um, good time to clear our undo info.
   apt_undos->clear_items();
 
-  LOG_TRACE(logger, "Loading tags.");
-  aptitude::apt::load_tags(progress_bar);
-
   LOG_TRACE(logger, "Initializing global dependency resolver manager.");
   resman = new resolver_manager(new_file, imm::map<aptitude_resolver_package, aptitude_resolver_version>());
 
@@ -485,6 +482,81 @@ void apt_load_cache(OpProgress *progress_bar, bool do_initselections,
   LOG_TRACE(logger, "Done emitting cache_reloaded().");
 }
 
+std::string get_cache_dir()
+{
+  // get xdg_cache_home directory to use
+  const char* env_XDG_CACHE_HOME = getenv("XDG_CACHE_HOME");
+  string xdg_cache_home;
+  if ( ! strempty(env_XDG_CACHE_HOME))
+    {
+      xdg_cache_home = string(env_XDG_CACHE_HOME);
+    }
+  else
+    {
+      const char* env_HOME = getenv("HOME");
+      string home = (! strempty(env_HOME)) ? string(env_HOME) : get_homedir();
+      if (home.empty())
+	{
+	  _error->Error(_("Could not establish home directory (username: '%s')"), get_username().c_str());
+	}
+      else if ( ! fs::is_directory(home) )
+	{
+	  _error->Error(_("Home directory does not exist or is not a directory: '%s')"), home.c_str());
+	}
+      else
+	{
+	  xdg_cache_home = home + "/.cache";
+	}
+    }
+
+  // if directory to be used could be gathered, create the path if needed
+  std::string cache_dir;
+  if (!xdg_cache_home.empty())
+    {
+      // if dir does not exist, create default $XDG_CACHE_HOME with the right
+      // permisisons (0700) according to the spec -- see
+      // http://standards.freedesktop.org/basedir-spec/latest/ar01s03.html and
+      // http://standards.freedesktop.org/basedir-spec/latest/ar01s04.html
+      if ( ! fs::is_directory(xdg_cache_home) )
+	{
+	  mode_t previous_umask = umask(0077);
+
+	  try
+	    {
+	      fs::create_directory(xdg_cache_home);
+	    }
+	  catch (const fs::filesystem_error& e)
+	    {
+	      _error->Error(_("Could not create directory: %s: %s"), xdg_cache_home.c_str(), e.what());
+	    }
+
+	  umask(previous_umask);
+	}
+
+      // if the directory exist, continue to the next step
+      if ( fs::is_directory(xdg_cache_home) )
+	{
+	  cache_dir = xdg_cache_home + "/aptitude";
+	}
+    }
+
+  // if directory to be used could be gathered, create full path if needed
+  if (!cache_dir.empty())
+    {
+      try
+	{
+	  fs::create_directories(cache_dir);
+	}
+      catch (const fs::filesystem_error& e)
+	{
+	  _error->Error(_("Could not create directories: %s: %s"), cache_dir.c_str(), e.what());
+	  cache_dir.clear();
+	}
+    }
+
+  return cache_dir;
+}
+
 std::shared_ptr<aptitude::util::file_cache> get_download_cache()
 {
   // return if already initialised
@@ -516,77 +588,11 @@ std::shared_ptr<aptitude::util::file_cache> get_download_cache()
 	// it doesn't matter
       }
 
-    // get xdg_cache_home directory to use
-    const char* env_XDG_CACHE_HOME = getenv("XDG_CACHE_HOME");
-    string xdg_cache_home;
-    if ( ! strempty(env_XDG_CACHE_HOME))
-      {
-	xdg_cache_home = string(env_XDG_CACHE_HOME);
-      }
-    else
-      {
-	const char* env_HOME = getenv("HOME");
-	string home = (! strempty(env_HOME)) ? string(env_HOME) : get_homedir();
-	if (home.empty())
-	  {
-	    _error->Error(_("Could not establish home directory (username: '%s')"), get_username().c_str());
-	  }
-	else if ( ! fs::is_directory(home) )
-	  {
-	    _error->Error(_("Home directory does not exist or is not a directory: '%s')"), home.c_str());
-	  }
-	else
-	  {
-	    xdg_cache_home = home + "/.cache";
-	  }
-      }
-
-    // if directory to be used could be gathered, create the path if needed
-    std::string download_cache_dir;
-    if (!xdg_cache_home.empty())
-      {
-	// if dir does not exist, create default $XDG_CACHE_HOME with the right
-	// permisisons (0700) according to the spec -- see
-	// http://standards.freedesktop.org/basedir-spec/latest/ar01s03.html and
-	// http://standards.freedesktop.org/basedir-spec/latest/ar01s04.html
-	if ( ! fs::is_directory(xdg_cache_home) )
-	  {
-	    mode_t previous_umask = umask(0077);
-
-	    try
-	      {
-		fs::create_directory(xdg_cache_home);
-	      }
-	    catch (const fs::filesystem_error& e)
-	      {
-		_error->Error(_("Could not create directory: %s: %s"), xdg_cache_home.c_str(), e.what());
-	      }
-
-	    umask(previous_umask);
-	  }
-
-	// if the directory exist, continue to the next step
-	if ( fs::is_directory(xdg_cache_home) )
-	  {
-	    download_cache_dir = xdg_cache_home + "/aptitude";
-	  }
-      }
-
-    // if directory to be used could be gathered, create full path if needed,
-    // then assign filename
+    // if directory to be used could be gathered, assign filename
     std::string download_cache_file_name;
+    const std::string download_cache_dir = get_cache_dir();
     if (!download_cache_dir.empty())
-      {
-	try
-	  {
-	    fs::create_directories(download_cache_dir);
-	    download_cache_file_name = download_cache_dir + "/metadata-download";
-	  }
-	catch (const fs::filesystem_error& e)
-	  {
-	    _error->Error(_("Could not create directories: %s: %s"), download_cache_dir.c_str(), e.what());
-	  }
-      }
+      download_cache_file_name = download_cache_dir + "/metadata-download";
 
     // do create the cache file
     if (!download_cache_file_name.empty())
@@ -595,11 +601,30 @@ std::shared_ptr<aptitude::util::file_cache> get_download_cache()
 	  aptcfg->FindI(PACKAGE "::UI::DownloadCache::MemorySize", 512 * 1024);
 	const int download_cache_disk_size   =
 	  aptcfg->FindI(PACKAGE "::UI::DownloadCache::DiskSize", 10 * 1024 * 1024);
+	const std::string download_cache_compression_name =
+	  aptcfg->Find(PACKAGE "::UI::DownloadCache::Compression", "zstd");
+	int download_cache_compression_level =
+	  aptcfg->FindI(PACKAGE "::UI::DownloadCache::CompressionLevel", 0);
+
+	aptitude::util::file_cache::compression_method download_cache_compression;
+	if (!aptitude::util::file_cache::parse_compression_method(download_cache_compression_name,
+								 download_cache_compression))
+	  {
+	    LOG_WARN(logger,
+		     "Unknown download cache compression method \""
+		     << download_cache_compression_name
+		     << "\"; using zlib.");
+	    download_cache_compression = aptitude::util::file_cache::compress_zlib;
+	    download_cache_compression_level = 0;
+	  }
+
 	try
 	  {
-	    download_cache = aptitude::util::file_cache::create(download_cache_file_name,
-								download_cache_memory_size,
-								download_cache_disk_size);
+	    download_cache = aptitude::util::file_cache::create_compressed(download_cache_file_name,
+									   download_cache_memory_size,
+									   download_cache_disk_size,
+									   download_cache_compression,
+									   download_cache_compression_level);
 	  }
 	catch(cwidget::util::Exception &ex)
 	  {
@@ -666,7 +691,11 @@ pkg_action_state find_pkg_state(pkgCache::PkgIterator pkg,
                                 bool ignore_broken)
 {
   aptitudeDepCache::StateCache &state = cache[pkg];
-  aptitudeDepCache::aptitude_state &extstate = cache.get_ext_state(pkg);
+  // Only read the extended state, so that the package isn't recorded
+  // as touched (this is called by searches, possibly from several
+  // threads).
+  const aptitudeDepCache::aptitude_state &extstate =
+    static_cast<const aptitudeDepCache &>(cache).get_ext_state(pkg);
 
   if(state.InstBroken() && !ignore_broken)
     return pkg_broken;
@@ -1571,6 +1600,95 @@ namespace aptitude
 	}
     }
 
+    namespace
+    {
+      inline void add_to_generation(uint64_t &hash, uint64_t n)
+      {
+	// 64-bit FNV-1a, a byte at a time.
+	for(int shift = 0; shift < 64; shift += 8)
+	  hash = (hash ^ ((n >> shift) & 0xff)) * 1099511628211ULL;
+      }
+
+      inline void add_to_generation(uint64_t &hash, const char *s)
+      {
+	if(s == NULL)
+	  s = "";
+
+	// Include the terminating NUL to separate the strings.
+	do
+	  hash = (hash ^ (unsigned char)*s) * 1099511628211ULL;
+	while(*s++ != '\0');
+      }
+
+      /** \brief Combine the hash of one object and its ID into the
+       *  hash of a whole cache.
+       *
+       *  The cache iterators don't visit objects in ID order, so
+       *  this doesn't depend on the order in which it is called.
+       */
+      inline void add_object_to_generation(uint64_t &hash, uint64_t object_hash,
+					   uint32_t id)
+      {
+	add_to_generation(object_hash, id);
+	hash += object_hash * 1099511628211ULL;
+      }
+    }
+
+    uint64_t get_cache_generation(pkgCache &cache)
+    {
+      uint64_t hash = 14695981039346656037ULL;
+
+      add_to_generation(hash, cache.Head().GroupCount);
+      add_to_generation(hash, cache.Head().PackageCount);
+      add_to_generation(hash, cache.Head().VersionCount);
+      add_to_generation(hash, cache.Head().PackageFileCount);
+
+      for(pkgCache::PkgFileIterator f = cache.FileBegin(); !f.end(); ++f)
+	{
+	  // The dpkg status file changes whenever packages are
+	  // installed or removed; that alone doesn't change which
+	  // packages and versions the cache knows about.
+	  if((f->Flags & pkgCache::Flag::NotSource) != 0)
+	    continue;
+
+	  add_to_generation(hash, f.FileName());
+	  add_to_generation(hash, f->mtime);
+	  add_to_generation(hash, f->Size);
+	}
+
+      // The counts above can stay the same while IDs move around
+      // (for instance, if one package that is only known from the
+      // status file is installed and another one removed), so
+      // include what each ID stands for.
+      uint64_t ids_hash = 0;
+      for(pkgCache::GrpIterator grp = cache.GrpBegin(); !grp.end(); ++grp)
+	{
+	  uint64_t grp_hash = 14695981039346656037ULL;
+	  add_to_generation(grp_hash, grp.Name());
+	  add_object_to_generation(ids_hash, grp_hash, grp->ID);
+
+	  for(pkgCache::PkgIterator pkg = grp.PackageList(); !pkg.end(); pkg = grp.NextPkg(pkg))
+	    {
+	      uint64_t pkg_hash = 14695981039346656037ULL;
+	      add_to_generation(pkg_hash, pkg.Arch());
+	      add_to_generation(pkg_hash, grp->ID);
+	      add_object_to_generation(ids_hash, pkg_hash, pkg->ID);
+
+	      for(pkgCache::VerIterator ver = pkg.VersionList(); !ver.end(); ++ver)
+		{
+		  uint64_t ver_hash = 14695981039346656037ULL;
+		  add_to_generation(ver_hash, ver.VerStr());
+		  add_to_generation(ver_hash, ver.Arch());
+		  add_to_generation(ver_hash, pkg->ID);
+		  add_object_to_generation(ids_hash, ver_hash, ver->ID);
+		}
+	    }
+	}
+
+      add_to_generation(hash, ids_hash);
+
+      return hash;
+    }
 
     bool is_full_replacement(const pkgCache::DepIterator &dep)
     {
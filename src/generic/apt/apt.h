@@ -25,6 +25,7 @@
 
 #include "aptcache.h"
 
+#include <stdint.h>
 #include <string.h>
 
 #include <memory>
@@ -144,6 +145,13 @@ extern sigc::signal0<void> cache_reload_failed;
  */
 extern sigc::signal0<void> consume_errors;
 
+/** \brief Return aptitude's per-user cache directory
+ *  (~/.cache/aptitude by default), creating it if necessary.
+ *
+ *  \return the directory, or an empty string if it can't be used.
+ */
+std::string get_cache_dir();
+
 /** \brief Used to cache downloaded data, to avoid multiple
  *  downloads of items such as changelogs and screenshots.
  */
@@ -564,6 +572,26 @@ namespace aptitude
      */
     bool is_full_replacement(const pkgCache::DepIterator &dep);
 
+    /** \brief Identify the package lists that a cache was built from
+     *  and the IDs it assigned.
+     *
+     *  The generation is a hash of the name, size and modification
+     *  time of each package list (files that are not sources, such
+     *  as the dpkg status file and the translation lists, are left
+     *  out) and of the name of every group, package and version together
+     *  with its ID.  So installing or removing packages that are in
+     *  the lists normally leaves it unchanged, while updating the
+     *  package lists, or installing or removing a package that is
+     *  only known from the status file, changes it.
+     *
+     *  Unless two different caches happen to have the same hash,
+     *  caches with the same generation give each group, package and
+     *  version the same ID, and data that was derived only from the
+     *  package lists (such as the tags of each package) can be
+     *  carried over from one to the other.
+     */
+    uint64_t get_cache_generation(pkgCache &cache);
+
     /** \return an ordered vector of the Top Sections
      *
      *  From the configuration item Aptitude::Sections::Top-Sections
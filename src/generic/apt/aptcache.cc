@@ -45,10 +45,12 @@
 #include <apt-pkg/policy.h>
 #include <apt-pkg/version.h>
 
+#include <algorithm>
 #include <vector>
 
 #include <unistd.h>
 #include <stdio.h>
+#include <string.h>
 #include <errno.h>
 #include <sys/stat.h>
 
@@ -122,8 +124,8 @@ public:
 
     // make sure that everything is really set.
     owner->MarkAuto(pkg, (prev_flags & Flag::Auto));
-    owner->get_ext_state(pkg).remove_reason=prev_removereason;
-    owner->get_ext_state(pkg).forbidver=prev_forbidver;
+    owner->modify_ext_state(pkg).remove_reason=prev_removereason;
+    owner->modify_ext_state(pkg).forbidver=prev_forbidver;
   }
 };
 
@@ -197,9 +199,18 @@ aptitudeDepCache::action_group::~action_group()
 
 aptitudeDepCache::aptitudeDepCache(pkgCache *Cache, Policy *Plcy)
   :pkgDepCache(Cache, Plcy), dirty(false), read_only(true),
+   state_generation(0),
    package_states(NULL), lock(-1), group_level(0),
-   new_package_count(0), records(NULL)
+   new_package_count(0),
+   touched_package_flags(Cache->Head().PackageCount, false),
+   expanded_touched_count(0), all_packages_touched(true),
+   unsaved_package_flags(Cache->Head().PackageCount, false),
+   all_packages_unsaved(true),
+   records(NULL)
 {
+  package_state_changed.connect(sigc::mem_fun(*this, &aptitudeDepCache::increment_state_generation));
+  package_category_changed.connect(sigc::mem_fun(*this, &aptitudeDepCache::increment_state_generation));
+
   // When the "install recommended packages" flag changes, collect garbage.
 #if 0
   aptcfg->connect("APT::Install-Recommends",
@@ -239,6 +250,289 @@ void aptitudeDepCache::set_read_only(bool new_read_only)
   read_only = new_read_only;
 }
 
+namespace
+{
+  /** \brief Read one stanza of the textual pkgstates file. */
+  void parse_state_section(pkgTagSection &section,
+			   aptitude::apt::package_state_record &record)
+  {
+    record.name = section.FindS("Package");
+    record.arch = section.FindS("Architecture");
+
+    unsigned long tmp = 0;
+    section.FindFlag("Unseen", tmp, 1);
+    record.unseen = (tmp == 1);
+
+    tmp = 0;
+    section.FindFlag("Upgrade", tmp, 1);
+    record.upgrade = (tmp == 1);
+
+    tmp = 0;
+    section.FindFlag("Reinstall", tmp, 1);
+    record.reinstall = (tmp == 1);
+
+    tmp = 0;
+    section.FindFlag("Auto-New-Install", tmp, 1);
+    record.auto_new_install = (tmp != 0);
+
+    // The install reason is much more important to preserve from
+    // previous versions, so support the outdated name for it.
+    record.install_reason =
+      section.FindI("Install-Reason",
+		    section.FindI("Last-Change", aptitudeDepCache::manual));
+    record.remove_reason = section.FindI("Remove-Reason", aptitudeDepCache::manual);
+    record.selection_state = section.FindI("State", pkgCache::State::Unknown);
+
+    const char *start, *end;
+    record.has_dselect_state = section.Find("Dselect-State", start, end);
+    record.dselect_state = section.FindI("Dselect-State", 0);
+
+    record.candver = section.FindS("Version");
+    record.forbidver = section.FindS("ForbidVer");
+
+    if (section.Find("User-Tags", start, end))
+      record.user_tags.assign(start, end);
+    else
+      record.user_tags.clear();
+  }
+
+  /** \brief Write one stanza of the textual pkgstates file. */
+  void append_state_section(std::ostream &out,
+			    const aptitude::apt::package_state_record &record)
+  {
+    using cw::util::ssprintf;
+    out << ssprintf("Package: %s\nArchitecture: %s\nUnseen: %s\nState: %i\nDselect-State: %i\nRemove-Reason: %i\n",
+		    record.name.c_str(),
+		    record.arch.c_str(),
+		    record.unseen ? "yes" : "no",
+		    record.selection_state,
+		    record.dselect_state,
+		    record.remove_reason);
+
+    if (record.upgrade)
+      out << "Upgrade: yes\n";
+    if (record.reinstall)
+      out << "Reinstall: yes\n";
+    if (record.auto_new_install)
+      out << "Auto-New-Install: yes\n";
+    if (!record.forbidver.empty())
+      out << "ForbidVer: " << record.forbidver << "\n";
+    if (!record.user_tags.empty())
+      out << "User-Tags: " << record.user_tags << "\n";
+    if (!record.candver.empty())
+      out << "Version: " << record.candver << "\n";
+
+    out << "\n";
+  }
+}
+
+pkgCache::PkgIterator
+aptitudeDepCache::load_saved_state(const aptitude::apt::package_state_record &record,
+				   bool reset_reinstall,
+				   bool do_dselect,
+				   bool do_initselections)
+{
+  PkgIterator pkg;
+  // TODO: Wheezy+n can assume that all sections will have the
+  // Architecture tag (probably ;-).
+  if(record.arch.empty())
+    pkg=FindPkg(record.name);
+  else
+    pkg=FindPkg(record.name, record.arch);
+
+  if(pkg.end() || pkg.VersionList().end())
+    // Silently ignore unknown packages and packages with no actual
+    // version.
+    return PkgIterator();
+
+  aptitude_state &pkg_state=modify_ext_state(pkg);
+
+  pkg_state.new_package=record.unseen;
+  pkg_state.upgrade=record.upgrade;
+
+  if (record.reinstall)
+    {
+      if (!pkg.CurrentVer().end() && is_version_available(pkg, pkg.CurrentVer().VerStr()))
+	{
+	  pkg_state.reinstall = true;
+	}
+      else
+	{
+	  // warning, not an error, it's not that severe and also
+	  // otherwise the algorithm to read from saved state stops
+	  _error->Warning(_("Package %s had been marked to reinstall, but the file for the current installed version %s is not available"),
+			  pkg.FullName(true).c_str(), (pkg.CurVersion() ? pkg.CurVersion() : "<none>"));
+	}
+    }
+
+  // if the last installation was successful reset_reinstall==true,
+  // to unmark .reinstall property of the package, otherwise there
+  // is no way to control that this is not repeated forever.
+  //
+  // doing the more expensive test "(reset_reinstall &&
+  // pkg_state.reinstall)" rather than blindly marking as false,
+  // because of "dirty" (so we only mark as dirty and pending to
+  // save when we really changed the state.
+  if (reset_reinstall && pkg_state.reinstall)
+    {
+      pkg_state.reinstall = false;
+      dirty = true;
+    }
+
+  if(record.auto_new_install)
+    pkg_state.previously_auto_package = true;
+
+  if((changed_reason) record.install_reason != manual)
+    pkg_state.previously_auto_package = true;
+
+  pkg_state.remove_reason=(changed_reason) record.remove_reason;
+
+  // marked as auto-installed from apt? -- bug #841347
+  //
+  // using PkgState[pkg->ID] because passing "pkg" needs
+  // apt_cache_file initialised
+  if (is_auto_installed(PkgState[pkg->ID]))
+    pkg_state.previously_auto_package = true;
+
+  pkg_state.selection_state=(pkgCache::State::PkgSelectedState) record.selection_state;
+  pkg_state.original_selection_state = static_cast<pkgCache::State::PkgSelectedState>(pkg->SelectedState);
+  pkgCache::State::PkgSelectedState last_dselect_state
+    = (pkgCache::State::PkgSelectedState)
+        (record.has_dselect_state ? record.dselect_state : pkg->SelectedState);
+  pkg_state.candver=record.candver;
+  pkg_state.forbidver=record.forbidver;
+
+  if (!record.user_tags.empty())
+    {
+      const char *start = record.user_tags.data();
+      const char *end = start + record.user_tags.size();
+      bool parse_ok = user_tags.parse(pkg_state.user_tags, start, end,
+				      record.name);
+      if (!parse_ok)
+	{
+	  _error->Error(_("Cannot parse user-tags for package: %s: '%s'"), pkg.FullName(true).c_str(), record.user_tags.c_str());
+	  // do not return now, loading would hang
+	}
+    }
+
+  if(do_dselect && pkg->SelectedState != last_dselect_state)
+    {
+      MarkFromDselect(pkg);
+      // dirty should be set to "true" so that we update
+      // the on-disk dselect state ASAP, even if no
+      // package states change as a result.
+      dirty=true;
+
+      // We need to update the package state from the
+      // dselect state regardless of whether we're doing
+      // initselections.  This is so that, e.g., if the
+      // user installed a package outside aptitude (so the
+      // dselect state says to install it), our internal
+      // state isn't left at "remove".  But if we aren't
+      // supposed to set up stored installs/removals, we
+      // should cancel this at the apt-get level (so the
+      // package doesn't get changed if dselect said to
+      // install it, but this isn't stored in our database
+      // for future runs).
+      //
+      // In the past, we skipped doing MarkFromDselect in
+      // this case.  BAD.
+      if(!do_initselections)
+	MarkKeep(pkg, false);
+    }
+
+  // if the package is already in the version that we wanted to
+  // target, but pkgstates still lists as "upgrade" with a candidate
+  // version (downgrades always do, upgrades not always), mark as
+  // dirty to update pkgstates, and reset "pkg_state".  otherwise:
+  //
+  // - if pkgstates is not written at most at the end of the current
+  // session, the packages downgraded do not show up as "upgradable"
+  // until there is an update forced for other reasons (see #787658
+  // and #714429), even in subsequent invokations of aptitude
+  //
+  // - without resetting "pkg_state" it's marked for "upgrade" (or
+  // "downgrade") again down in this function, and while for
+  // "upgrades" it is not a problem, with "downgrades" it will not
+  // show as upgradable in the current interactive session.
+  //
+  //
+  // also unmark as upgrade as soon as already upgraded, even if no
+  // candidate version required in pkgstates -- see #721426
+  std::string installed_ver = pkg.CurVersion() ? pkg.CurVersion() : "";
+  if (pkg_state.upgrade)
+    {
+      bool version_as_in_pkgstates = (!pkg_state.candver.empty() && (installed_ver == pkg_state.candver));
+      bool version_as_candidate = (!GetCandidateVersion(pkg).end() && !pkg.CurrentVer().end() && (GetCandidateVersion(pkg) == pkg.CurrentVer()));
+      if (version_as_in_pkgstates || (pkg_state.candver.empty() && version_as_candidate))
+	{
+	  pkg_state.upgrade = false;
+	  pkg_state.candver = "";
+	  dirty = true;
+	}
+    }
+
+  return pkg;
+}
+
+void aptitudeDepCache::get_saved_state(const PkgIterator &pkg,
+				       aptitude::apt::package_state_record &record)
+{
+  StateCache &state=(*this)[pkg];
+  const aptitude_state &estate=get_ext_state(pkg);
+
+  record.name = pkg.Name();
+  record.arch = pkg.Arch();
+  record.unseen = estate.new_package;
+  record.selection_state = estate.selection_state;
+  record.has_dselect_state = true;
+  record.dselect_state = pkg->SelectedState;
+  record.install_reason = manual;
+  record.remove_reason = estate.remove_reason;
+  record.upgrade = (!pkg.CurrentVer().end()) && state.Install();
+  record.reinstall = estate.reinstall;
+
+  // packages that are auto and not yet installed are marked in this
+  // way in aptitude's DB, to set the flag accordingly when installing
+  // for the first time.  apt does not save auto state on uninstalled
+  // packages.
+  //
+  // it comes originally from fix to #435079; and then to fix problem
+  // when install-auto scheduled from previous sessions (but were not
+  // installed at that point) were losing the auto flag (#563877).
+  //
+  // the flag is removed if the package is already installed, to fix
+  // having this flag and preventing code handling auto in different
+  // parts from working normally (#816497)
+  bool is_or_was_auto = ((state.Flags & Flag::Auto) != 0) || estate.previously_auto_package;
+  record.auto_new_install = (pkg.CurrentVer().end() &&
+			     state.Install() &&
+			     is_or_was_auto);
+
+  record.forbidver = estate.forbidver;
+
+  if(state.Install() &&
+     !estate.candver.empty() &&
+     (GetCandidateVersion(pkg).end() ||
+      GetCandidateVersion(pkg).VerStr() != estate.candver))
+    record.candver = estate.candver;
+  else
+    record.candver.clear();
+
+  // Build the list of usertags for this package; sort them so we
+  // get predictable outputs.
+  record.user_tags.clear();
+  if (!estate.user_tags.empty())
+    {
+      for (const auto& tag : get_user_tags(pkg))
+	{
+	  if (!record.user_tags.empty())
+	    record.user_tags.push_back(' ');
+	  record.user_tags += tag;
+	}
+    }
+}
+
 bool aptitudeDepCache::build_selection_list(OpProgress* Prog,
 					    bool WithLock,
 					    bool do_initselections,
@@ -263,6 +557,12 @@ bool aptitudeDepCache::build_selection_list(OpProgress* Prog,
 
   delete package_states;
   package_states=new aptitude_state[Head().PackageCount];
+  touched_packages.clear();
+  touched_package_flags.assign(Head().PackageCount, false);
+  expanded_touched_count = 0;
+  touch_all_packages();
+  unsaved_package_flags.assign(Head().PackageCount, false);
+  all_packages_unsaved = true;
   user_tags.clear();
   for(unsigned int i=0; i<Head().PackageCount; i++)
     {
@@ -288,244 +588,139 @@ bool aptitudeDepCache::build_selection_list(OpProgress* Prog,
 	  return false;
 	}
     }
+  packages_by_id.assign(Head().PackageCount, NULL);
+  for(pkgCache::PkgIterator i = PkgBegin(); !i.end(); ++i)
+    packages_by_id[i->ID] = i;
+
   // Errrrr, I think we need to do this first in case the stuff below
   // manages to trigger a mark operation.
-  duplicate_cache(&backup_state);
+  refresh_backup_state();
 
   // Should this not go under Dir:: ?  I'm not sure..
   string statedir = aptcfg->FindDir("Dir::Aptitude::state", STATEDIR);
   string statefilepath = (status_fname) ? status_fname : (statedir + "/" + "pkgstates");
 
-  FileFd state_file;
-
-  // Read in the states that we saved
-  state_file.Open(statefilepath, FileFd::ReadOnly);
+  bool do_dselect=aptcfg->FindB(PACKAGE "::Track-Dselect-State", true);
 
   // Have to make the file NOT read-only to set up the initial state.
   read_only = false;
 
-  if(!state_file.IsOpen())
+  saved_state_checksums.assign(Head().PackageCount, 0);
+  state_journal.reset();
+
+  // The binary state files are read whenever they exist, even if
+  // Binary-Pkgstates is off: turning it off only takes effect when
+  // the states are next saved, so until then they are the newest
+  // copy of the states.
+  std::vector<aptitude::apt::pkgstates_journal::stored_record> stored_states;
+  bool read_binary_states = false;
+  if(!status_fname)
     {
-      _error->Discard();
-      if(errno!=ENOENT)
-	_error->Warning(_("Can't open Aptitude extended state file"));
-      else
+      state_journal.reset(new aptitude::apt::pkgstates_journal(statedir + "pkgstates.bin"));
+      read_binary_states = state_journal->read(stored_states);
+
+      // The text file isn't updated while the binary files are in
+      // use, so it may hold old selections, holds and forbidden
+      // versions: don't fall back to it behind the user's back.
+      if(!read_binary_states && state_journal->exists())
 	{
-	  initial_open=true;
-	  // Mark the cache as dirty so that we'll create the
-	  // pkgstates file later.  We need to do this even if the
-	  // user doesn't change anything because otherwise we won't
-	  // know which packages are new until we save the cache (#429732).
-	  dirty = true;
+	  _error->Error(_("Can't read %s; remove it to use the older states in %s instead"),
+			state_journal->get_base_filename().c_str(),
+			statefilepath.c_str());
+	  return false;
 	}
     }
-  else
+
+  if(read_binary_states)
     {
-      // last percent shown in progress -- do not update on every cycle
-      int last_pct_shown = 0;
-      int amt = 0;
-      int file_size = state_file.Size();
       if (Prog)
+	Prog->OverallProgress(0, stored_states.size(), 1, _("Reading extended state information"));
+
+      for(std::vector<aptitude::apt::pkgstates_journal::stored_record>::const_iterator
+	    it = stored_states.begin(); it != stored_states.end(); ++it)
 	{
-	  Prog->OverallProgress(0, file_size, 1, _("Reading extended state information"));
+	  const PkgIterator pkg = load_saved_state(it->state, reset_reinstall,
+						   do_dselect, do_initselections);
+	  if(!pkg.end())
+	    saved_state_checksums[pkg->ID] = it->checksum;
 	}
 
-      pkgTagFile tagfile(&state_file);
-      pkgTagSection section;
-
-      bool do_dselect=aptcfg->FindB(PACKAGE "::Track-Dselect-State", true);
-      while(tagfile.Step(section))
+      if (Prog)
 	{
-	  std::string package_name(section.FindS("Package"));
-          std::string arch(section.FindS("Architecture"));
-	  PkgIterator pkg;
-          // TODO: Wheezy+n can assume that all sections will have the
-          // Architecture tag (probably ;-).
-          if(arch.empty())
-            pkg=FindPkg(package_name);
-          else
-            pkg=FindPkg(package_name, arch);
-	  if(!pkg.end() && !pkg.VersionList().end())
-	    // Silently ignore unknown packages and packages with no actual
-	    // version.
-	    {
-	      unsigned long tmp=0;
-	      string candver;
+	  Prog->OverallProgress(stored_states.size(), stored_states.size(), 1, _("Reading extended state information"));
+	  Prog->Done();
+	}
+    }
+  else
+    {
+      FileFd state_file;
 
-	      aptitude_state &pkg_state=get_ext_state(pkg);
+      // Read in the states that we saved
+      state_file.Open(statefilepath, FileFd::ReadOnly);
 
-	      section.FindFlag("Unseen", tmp, 1);
+      if(!state_file.IsOpen())
+	{
+	  _error->Discard();
+	  if(errno!=ENOENT)
+	    _error->Warning(_("Can't open Aptitude extended state file"));
+	  else
+	    {
+	      initial_open=true;
+	      // Mark the cache as dirty so that we'll create the
+	      // pkgstates file later.  We need to do this even if the
+	      // user doesn't change anything because otherwise we won't
+	      // know which packages are new until we save the cache (#429732).
+	      dirty = true;
+	    }
+	}
+      else
+	{
+	  // last percent shown in progress -- do not update on every cycle
+	  int last_pct_shown = 0;
+	  int amt = 0;
+	  int file_size = state_file.Size();
+	  if (Prog)
+	    {
+	      Prog->OverallProgress(0, file_size, 1, _("Reading extended state information"));
+	    }
 
-	      pkg_state.new_package=(tmp==1);
+	  pkgTagFile tagfile(&state_file);
+	  pkgTagSection section;
+	  aptitude::apt::package_state_record record;
 
-	      tmp=0;
-	      section.FindFlag("Upgrade", tmp, 1);
-	      pkg_state.upgrade=(tmp==1);
+	  while(tagfile.Step(section))
+	    {
+	      parse_state_section(section, record);
+	      load_saved_state(record, reset_reinstall,
+			       do_dselect, do_initselections);
 
-	      tmp=0;
-	      section.FindFlag("Reinstall", tmp, 1);
-	      if (tmp == 1)
+	      if (Prog)
 		{
-		  if (!pkg.CurrentVer().end() && is_version_available(pkg, pkg.CurrentVer().VerStr()))
-		    {
-		      pkg_state.reinstall = true;
-		    }
-		  else
+		  // update progress, but not every time -- very expensive
+		  amt += section.size();
+		  int pct = (file_size > 0) ? (100*amt) / file_size : 0;
+		  if ((pct % 10 == 1) && last_pct_shown != pct)
 		    {
-		      // warning, not an error, it's not that severe and also
-		      // otherwise the algorithm to read from saved state stops
-		      _error->Warning(_("Package %s had been marked to reinstall, but the file for the current installed version %s is not available"),
-				      pkg.FullName(true).c_str(), (pkg.CurVersion() ? pkg.CurVersion() : "<none>"));
+		      last_pct_shown = pct;
+		      Prog->OverallProgress(amt, file_size, 1, _("Reading extended state information"));
 		    }
 		}
+	    }
 
-	      // if the last installation was successful reset_reinstall==true,
-	      // to unmark .reinstall property of the package, otherwise there
-	      // is no way to control that this is not repeated forever.
-	      //
-	      // doing the more expensive test "(reset_reinstall &&
-	      // pkg_state.reinstall)" rather than blindly marking as false,
-	      // because of "dirty" (so we only mark as dirty and pending to
-	      // save when we really changed the state.
-	      if (reset_reinstall && pkg_state.reinstall)
-		{
-		  pkg_state.reinstall = false;
-		  dirty = true;
-		}
-
-	      unsigned long auto_new_install = 0;
-	      section.FindFlag("Auto-New-Install", auto_new_install, 1);
-	      if(auto_new_install)
-		pkg_state.previously_auto_package = true;
-
-	      // The install reason is much more important to preserve
-	      // from previous versions, so support the outdated name
-	      // for it.
-	      changed_reason install_reason=(changed_reason)
-		section.FindI("Install-Reason",
-			      section.FindI("Last-Change", manual));
-
-	      if(install_reason != manual)
-		pkg_state.previously_auto_package = true;
-
-	      pkg_state.remove_reason=(changed_reason)
-		section.FindI("Remove-Reason", manual);
-
-	      // marked as auto-installed from apt? -- bug #841347
-	      //
-	      // using PkgState[pkg->ID] because passing "pkg" needs
-	      // apt_cache_file initialised
-	      if (is_auto_installed(PkgState[pkg->ID]))
-		pkg_state.previously_auto_package = true;
-
-	      candver=section.FindS("Version");
-
-	      pkg_state.selection_state=(pkgCache::State::PkgSelectedState) section.FindI("State", pkgCache::State::Unknown);
-	      pkg_state.original_selection_state = static_cast<pkgCache::State::PkgSelectedState>(pkg->SelectedState);
-	      pkgCache::State::PkgSelectedState last_dselect_state
-		= (pkgCache::State::PkgSelectedState)
-		    section.FindI("Dselect-State", pkg->SelectedState);
-	      pkg_state.candver=candver;
-	      pkg_state.forbidver=section.FindS("ForbidVer");
-
-	      {
-		const char *start, *end;
-		if (section.Find("User-Tags", start, end))
-		  {
-		    bool parse_ok = user_tags.parse(pkg_state.user_tags, start, end,
-						    package_name);
-		    if (!parse_ok)
-		      {
-			_error->Error(_("Cannot parse user-tags for package: %s: '%s'"), pkg.FullName(true).c_str(), string(start, end).c_str());
-			// do not return now, loading would hang
-		      }
-		  }
-	      }
-
-	      if(do_dselect && pkg->SelectedState != last_dselect_state)
-		{
-		  MarkFromDselect(pkg);
-		  // dirty should be set to "true" so that we update
-		  // the on-disk dselect state ASAP, even if no
-		  // package states change as a result.
-		  dirty=true;
-
-		  // We need to update the package state from the
-		  // dselect state regardless of whether we're doing
-		  // initselections.  This is so that, e.g., if the
-		  // user installed a package outside aptitude (so the
-		  // dselect state says to install it), our internal
-		  // state isn't left at "remove".  But if we aren't
-		  // supposed to set up stored installs/removals, we
-		  // should cancel this at the apt-get level (so the
-		  // package doesn't get changed if dselect said to
-		  // install it, but this isn't stored in our database
-		  // for future runs).
-		  //
-		  // In the past, we skipped doing MarkFromDselect in
-		  // this case.  BAD.
-		  if(!do_initselections)
-		    MarkKeep(pkg, false);
-		}
-
-	      // if the package is already in the version that we wanted to
-	      // target, but pkgstates still lists as "upgrade" with a candidate
-	      // version (downgrades always do, upgrades not always), mark as
-	      // dirty to update pkgstates, and reset "pkg_state".  otherwise:
-	      //
-	      // - if pkgstates is not written at most at the end of the current
-	      // session, the packages downgraded do not show up as "upgradable"
-	      // until there is an update forced for other reasons (see #787658
-	      // and #714429), even in subsequent invokations of aptitude
-	      //
-	      // - without resetting "pkg_state" it's marked for "upgrade" (or
-	      // "downgrade") again down in this function, and while for
-	      // "upgrades" it is not a problem, with "downgrades" it will not
-	      // show as upgradable in the current interactive session.
-	      //
-	      //
-	      // also unmark as upgrade as soon as already upgraded, even if no
-	      // candidate version required in pkgstates -- see #721426
-	      std::string installed_ver = pkg.CurVersion() ? pkg.CurVersion() : "";
-	      if (pkg_state.upgrade)
-		{
-		  bool version_as_in_pkgstates = (!pkg_state.candver.empty() && (installed_ver == pkg_state.candver));
-		  bool version_as_candidate = (!GetCandidateVersion(pkg).end() && !pkg.CurrentVer().end() && (GetCandidateVersion(pkg) == pkg.CurrentVer()));
-		  if (version_as_in_pkgstates || (pkg_state.candver.empty() && version_as_candidate))
-		    {
-		      pkg_state.upgrade = false;
-		      pkg_state.candver = "";
-		      dirty = true;
-		    }
-		}
+	  // if pkgTagFile.Step() throws errors, file likely corrupt -- see #405506
+	  if (_error->PendingError())
+	    {
+	      _error->Error(_("Problem parsing '%s', is it corrupt or malformed? You can try to recover from '%s.old'."),
+			    statefilepath.c_str(), statefilepath.c_str());
+	      return false;
 	    }
 
 	  if (Prog)
 	    {
-	      // update progress, but not every time -- very expensive
-	      amt += section.size();
-	      int pct = (file_size > 0) ? (100*amt) / file_size : 0;
-	      if ((pct % 10 == 1) && last_pct_shown != pct)
-		{
-		  last_pct_shown = pct;
-		  Prog->OverallProgress(amt, file_size, 1, _("Reading extended state information"));
-		}
+	      Prog->OverallProgress(file_size, file_size, 1, _("Reading extended state information"));
+	      Prog->Done();
 	    }
 	}
-
-      // if pkgTagFile.Step() throws errors, file likely corrupt -- see #405506
-      if (_error->PendingError())
-	{
-	  _error->Error(_("Problem parsing '%s', is it corrupt or malformed? You can try to recover from '%s.old'."),
-			statefilepath.c_str(), statefilepath.c_str());
-	  return false;
-	}
-
-      if (Prog)
-	{
-	  Prog->OverallProgress(file_size, file_size, 1, _("Reading extended state information"));
-	  Prog->Done();
-	}
     }
 
   int progress_num = 0;
@@ -546,7 +741,7 @@ bool aptitudeDepCache::build_selection_list(OpProgress* Prog,
   for(pkgCache::PkgIterator i=PkgBegin(); !i.end(); i++)
     {
       StateCache &state=(*this)[i];
-      aptitude_state &estate=get_ext_state(i);
+      aptitude_state &estate=modify_ext_state(i);
 
       if(initial_open) // Don't make everything "new".
 	estate.new_package=false;
@@ -632,7 +827,7 @@ bool aptitudeDepCache::build_selection_list(OpProgress* Prog,
   if (Prog)
     Prog->OverallProgress(progress_total, progress_total, 1, _("Initializing package states"));
 
-  duplicate_cache(&backup_state);
+  refresh_backup_state();
 
   if(aptcfg->FindB(PACKAGE "::Auto-Upgrade", false) && do_initselections)
     mark_all_upgradable(aptcfg->FindB(PACKAGE "::Auto-Install", true),
@@ -786,18 +981,25 @@ bool aptitudeDepCache::save_selection_list(OpProgress* Prog,
 
   string statefile=_config->FindDir("Dir::Aptitude::state", STATEDIR)+"pkgstates";
 
+  // Custom state files are always written as text.
+  const bool binary_states = !status_fname &&
+    aptcfg->FindB(PACKAGE "::Binary-Pkgstates", false);
+
   FileFd newstate;
 
-  if(!status_fname)
-    newstate.Open(statefile+".new", FileFd::WriteEmpty, 0644);
-  else
-    newstate.Open(status_fname, FileFd::WriteEmpty, 0644);
+  if(!binary_states)
+    {
+      if(!status_fname)
+	newstate.Open(statefile+".new", FileFd::WriteEmpty, 0644);
+      else
+	newstate.Open(status_fname, FileFd::WriteEmpty, 0644);
 
-  // The user might have a restrictive umask -- make sure we get a
-  // mode 644 file.
-  fchmod(newstate.Fd(), 0644);
+      // The user might have a restrictive umask -- make sure we get a
+      // mode 644 file.
+      fchmod(newstate.Fd(), 0644);
+    }
 
-  if(!newstate.IsOpen())
+  if(!binary_states && !newstate.IsOpen())
     {
       _error->Error(_("Cannot open Aptitude state file"));
       if (Prog)
@@ -818,94 +1020,42 @@ bool aptitudeDepCache::save_selection_list(OpProgress* Prog,
 
       // save some allocations in the loop and other optimisations -- see #312920
       std::stringstream newstate_tmpbuffer;
-      string line;
-      string forbidstr;
-      string upgradestr;
-      string reinstall_str;
-      string autostr;
-      string tailstr;
-      string user_tags;
+      aptitude::apt::package_state_record record;
       string select_arch;
 
+      // The encoded records of the packages that changed since they
+      // were read or last saved, and their IDs, for the binary state
+      // files.  Packages that weren't touched since then are skipped:
+      // their records and dselect states can't have changed.
+      std::vector<std::string> changed_states;
+      std::vector<std::pair<unsigned long, uint64_t> > changed_checksums;
+
       for(PkgIterator i=PkgBegin(); !i.end(); i++)
-	if (i.VersionList().end())
+	if (i.VersionList().end() || (binary_states && !is_unsaved(i->ID)))
 	  {
 	    ++progress_num;
 	  }
 	else
 	  {
 	    StateCache &state=(*this)[i];
+	    // Only original_selection_state is changed below, and change
+	    // detection ignores it, so the package isn't touched.
 	    aptitude_state &estate=get_ext_state(i);
 
-	    forbidstr = (!estate.forbidver.empty()) ? ("ForbidVer: " + estate.forbidver + "\n") : "";
-
-	    upgradestr = ((!i.CurrentVer().end()) && state.Install()) ? "Upgrade: yes\n" : "";
-
-	    reinstall_str = (estate.reinstall) ? ("Reinstall: yes\n") : "";
-
-	    // packages that are auto and not yet installed are marked in this
-	    // way in aptitude's DB, to set the flag accordingly when installing
-	    // for the first time.  apt does not save auto state on uninstalled
-	    // packages.
-	    //
-	    // it comes originally from fix to #435079; and then to fix problem
-	    // when install-auto scheduled from previous sessions (but were not
-	    // installed at that point) were losing the auto flag (#563877).
-	    //
-	    // the flag is removed if the package is already installed, to fix
-	    // having this flag and preventing code handling auto in different
-	    // parts from working normally (#816497)
-	    bool is_or_was_auto = ((state.Flags & Flag::Auto) != 0) || estate.previously_auto_package;
-	    bool auto_new_install = (i.CurrentVer().end() &&
-				     state.Install() &&
-				     is_or_was_auto);
-	    autostr = (auto_new_install) ? "Auto-New-Install: yes\n" : "";
-
-
-	    if(state.Install() &&
-	       !estate.candver.empty() &&
-	       (GetCandidateVersion(i).end() ||
-		GetCandidateVersion(i).VerStr() != estate.candver))
-	      tailstr = "Version: " + estate.candver + "\n";
-	    else
-	      tailstr = "";
-
-	    // Build the list of usertags for this package.
-	    if (!estate.user_tags.empty())
+	    get_saved_state(i, record);
+	    if(binary_states)
 	      {
-		user_tags = "User-Tags:";
-
-		// get sorted usertags so we get predictable outputs
-		std::vector<std::string> sorted_pkg_user_tags = get_user_tags(i);
-
-		// append user tags to the field
-		for (const auto& tag : sorted_pkg_user_tags)
+		std::string encoded(aptitude::apt::encode_package_state(record));
+		const uint64_t checksum =
+		  aptitude::apt::package_state_checksum(encoded);
+		if(checksum != saved_state_checksums[i->ID])
 		  {
-		    user_tags.push_back(' ');
-		    user_tags += tag;
+		    changed_states.push_back(std::move(encoded));
+		    changed_checksums.push_back(std::make_pair(i->ID, checksum));
 		  }
-
-		user_tags.push_back('\n');
 	      }
 	    else
-	      user_tags = "";
-
-	    // write section for this package
-	    using cw::util::ssprintf;
-	    line = ssprintf("Package: %s\nArchitecture: %s\nUnseen: %s\nState: %i\nDselect-State: %i\nRemove-Reason: %i\n%s%s%s%s%s%s\n",
-				      i.Name(),
-                                      i.Arch(),
-				      estate.new_package?"yes":"no",
-				      estate.selection_state,
-				      i->SelectedState,
-				      estate.remove_reason,
-				      upgradestr.c_str(),
-				      reinstall_str.c_str(),
-				      autostr.c_str(),
-				      forbidstr.c_str(),
-				      user_tags.c_str(),
-				      tailstr.c_str());
-	    newstate_tmpbuffer << line;
+	      append_state_section(newstate_tmpbuffer, record);
 
 	    // dpkg-dselect state
 	    if (estate.original_selection_state != estate.selection_state
@@ -946,8 +1096,51 @@ bool aptitudeDepCache::save_selection_list(OpProgress* Prog,
       if (Prog)
 	Prog->OverallProgress(progress_total, progress_total, 1, _("Writing extended state information"));
 
-      if (newstate.Failed() ||
-	  !newstate.Write(newstate_tmpbuffer.str().c_str(), newstate_tmpbuffer.str().size()))
+      if(binary_states)
+	{
+	  if(state_journal.get() == NULL)
+	    state_journal.reset(new aptitude::apt::pkgstates_journal(statefile + ".bin"));
+
+	  bool ok;
+	  if(state_journal->needs_compaction(changed_states.size()))
+	    {
+	      // Only a rewrite needs the records of every package.
+	      std::vector<std::string> all_states;
+	      std::vector<uint64_t> new_state_checksums(Head().PackageCount, 0);
+	      for(PkgIterator i=PkgBegin(); !i.end(); i++)
+		if (!i.VersionList().end())
+		  {
+		    get_saved_state(i, record);
+		    all_states.push_back(aptitude::apt::encode_package_state(record));
+		    new_state_checksums[i->ID] =
+		      aptitude::apt::package_state_checksum(all_states.back());
+		  }
+
+	      ok = state_journal->rewrite(all_states);
+	      if(ok)
+		saved_state_checksums.swap(new_state_checksums);
+	    }
+	  else
+	    {
+	      ok = changed_states.empty() || state_journal->append(changed_states);
+	      if(ok)
+		for(std::vector<std::pair<unsigned long, uint64_t> >::const_iterator
+		      it = changed_checksums.begin(); it != changed_checksums.end(); ++it)
+		  saved_state_checksums[it->first] = it->second;
+	    }
+
+	  if(!ok)
+	    {
+	      if (Prog)
+		Prog->Done();
+	      return false;
+	    }
+
+	  unsaved_package_flags.assign(Head().PackageCount, false);
+	  all_packages_unsaved = false;
+	}
+      else if (newstate.Failed() ||
+	       !newstate.Write(newstate_tmpbuffer.str().c_str(), newstate_tmpbuffer.str().size()))
 	{
 	  _error->Error(_("Couldn't write state file"));
 	  newstate.Close();
@@ -959,11 +1152,12 @@ bool aptitudeDepCache::save_selection_list(OpProgress* Prog,
 	    Prog->Done();
 	  return false;
 	}
-      newstate.Close();
+      else
+	newstate.Close();
 
       // FIXME!  This potentially breaks badly on NFS.. (?) -- actually, it
       //       wouldn't be harmful; you'd just get gratuitous errors..
-      if(!status_fname)
+      if(!binary_states && !status_fname)
 	{
 	  string oldstr(statefile + ".old"), newstr(statefile + ".new");
 
@@ -991,6 +1185,13 @@ bool aptitudeDepCache::save_selection_list(OpProgress* Prog,
 		Prog->Done();
 	      return false;
 	    }
+
+	  // The text file is the newest copy of the states now, so
+	  // drop the binary ones (which would be read in preference).
+	  state_journal.reset();
+	  saved_state_checksums.assign(Head().PackageCount, 0);
+	  all_packages_unsaved = true;
+	  aptitude::apt::pkgstates_journal(statefile + ".bin").remove();
 	}
 
       // save selection state to dpkg database
@@ -1031,7 +1232,7 @@ void aptitudeDepCache::set_new_flag(const pkgCache::PkgIterator& pkg,
       return;
     }
 
-  aptitude_state& estate = get_ext_state(pkg);
+  aptitude_state& estate = modify_ext_state(pkg);
 
   if (estate.new_package && !is_new)
     {
@@ -1075,6 +1276,7 @@ void aptitudeDepCache::forget_new(undoable **undoer, const std::vector<pkgCache:
 	    --new_package_count;
 
 	  dirty = true;
+	  touch_package(i->ID);
 	  package_states[i->ID].new_package = false;
 	  if (undo)
 	    undo->add_item(i);
@@ -1086,7 +1288,7 @@ void aptitudeDepCache::forget_new(undoable **undoer, const std::vector<pkgCache:
   else
     delete undo;
 
-  duplicate_cache(&backup_state);
+  refresh_backup_state();
 
   // Umm, is this a hack? dunno.
   cache_reloaded();
@@ -1113,12 +1315,17 @@ void aptitudeDepCache::cleanup_after_change(undo_group *undo,
   // build a collection of undoers to return to it or find out which
   // packages changed relative to it.
   if(backup_state.PkgState == NULL ||
-     backup_state.DepState == NULL ||
      backup_state.AptitudeState == NULL)
     return;
 
-  for(pkgCache::PkgIterator pkg=PkgBegin(); !pkg.end(); pkg++)
+  std::vector<unsigned long> candidates;
+  find_changed_packages(candidates);
+
+  for(std::vector<unsigned long>::const_iterator it = candidates.begin();
+      it != candidates.end(); ++it)
     {
+      pkgCache::PkgIterator pkg(GetCache(), packages_by_id[*it]);
+
       // Set to true if we should signal that this package's visible
       // state changed.
       bool visibly_changed = false;
@@ -1148,6 +1355,8 @@ void aptitudeDepCache::cleanup_after_change(undo_group *undo,
 	    // Catch packages which switched without altering their Aptitude
 	    // selection mode
 	    {
+	      touch_package(pkg->ID);
+
 	      switch(PkgState[pkg->ID].Mode)
 		{
 		case ModeDelete:
@@ -1250,10 +1459,11 @@ void aptitudeDepCache::internal_mark_install(const PkgIterator &Pkg,
 
   MarkAuto(Pkg, final_auto);
 
-  get_ext_state(Pkg).selection_state=pkgCache::State::Install;
-  get_ext_state(Pkg).reinstall=ReInstall;
-  get_ext_state(Pkg).forbidver="";
-  get_ext_state(Pkg).previously_auto_package = final_auto;
+  aptitude_state &estate = modify_ext_state(Pkg);
+  estate.selection_state=pkgCache::State::Install;
+  estate.reinstall=ReInstall;
+  estate.forbidver="";
+  estate.previously_auto_package = final_auto;
 }
 
 void aptitudeDepCache::mark_delete(const PkgIterator &Pkg,
@@ -1322,15 +1532,15 @@ void aptitudeDepCache::internal_mark_delete(const PkgIterator &Pkg,
   pkgDepCache::MarkDelete(Pkg, Purge);
   pkgDepCache::SetReInstall(Pkg, false);
 
-  get_ext_state(Pkg).selection_state=(Purge?pkgCache::State::Purge:pkgCache::State::DeInstall);
-  get_ext_state(Pkg).reinstall=false;
+  modify_ext_state(Pkg).selection_state=(Purge?pkgCache::State::Purge:pkgCache::State::DeInstall);
+  modify_ext_state(Pkg).reinstall=false;
 
   if(!previously_to_delete)
     {
       if(unused_delete)
-	get_ext_state(Pkg).remove_reason=unused;
+	modify_ext_state(Pkg).remove_reason=unused;
       else
-	get_ext_state(Pkg).remove_reason=manual;
+	modify_ext_state(Pkg).remove_reason=manual;
     }
 
   // after marking a package for delete, check all the dependencies to see if
@@ -1493,8 +1703,9 @@ void aptitudeDepCache::internal_mark_keep(const PkgIterator &Pkg, bool Automatic
 
   pkgDepCache::MarkKeep(Pkg, false, !Automatic);
   pkgDepCache::SetReInstall(Pkg, false);
-  get_ext_state(Pkg).reinstall=false;
-  get_ext_state(Pkg).forbidver="";
+  aptitude_state &estate = modify_ext_state(Pkg);
+  estate.reinstall=false;
+  estate.forbidver="";
 
   // explicitly mark auto-installed, sometimes apt does not apply it properly in
   // some cases -- see #508428
@@ -1503,14 +1714,14 @@ void aptitudeDepCache::internal_mark_keep(const PkgIterator &Pkg, bool Automatic
   if(Pkg.CurrentVer().end())
     {
       if((*this)[Pkg].iFlags&Purge)
-	get_ext_state(Pkg).selection_state=pkgCache::State::Purge;
+	estate.selection_state=pkgCache::State::Purge;
       else
-	get_ext_state(Pkg).selection_state=pkgCache::State::DeInstall;
+	estate.selection_state=pkgCache::State::DeInstall;
     }
   else if(SetHold)
-    get_ext_state(Pkg).selection_state=pkgCache::State::Hold;
+    estate.selection_state=pkgCache::State::Hold;
   else
-    get_ext_state(Pkg).selection_state=pkgCache::State::Install;
+    estate.selection_state=pkgCache::State::Install;
 }
 
 void aptitudeDepCache::set_candidate_version(const VerIterator &ver,
@@ -1546,7 +1757,7 @@ void aptitudeDepCache::set_candidate_version(const VerIterator &ver,
 
       VerIterator prev=(*this)[(ver.ParentPkg())].CandidateVerIter(GetCache());
 
-      aptitude_state &estate = get_ext_state(ver.ParentPkg());
+      aptitude_state &estate = modify_ext_state(ver.ParentPkg());
 
       if(ver!=GetCandidateVersion(ver.ParentPkg()))
 	estate.candver=ver.VerStr();
@@ -1585,7 +1796,7 @@ void aptitudeDepCache::forbid_upgrade(const PkgIterator &pkg,
       return;
     }
 
-  aptitude_state &estate=get_ext_state(pkg);
+  const aptitude_state &estate=get_ext_state(pkg);
 
   if(verstr!=estate.forbidver)
     {
@@ -1597,7 +1808,7 @@ void aptitudeDepCache::forbid_upgrade(const PkgIterator &pkg,
 
       dirty=true;
 
-      estate.forbidver=verstr;
+      modify_ext_state(pkg).forbidver=verstr;
       if(!candver.end() && candver.VerStr()==verstr && (*this)[pkg].Install())
 	MarkKeep(pkg, false);
     }
@@ -1617,6 +1828,7 @@ void aptitudeDepCache::mark_single_install(const PkgIterator &Pkg, undo_group *u
   pre_package_state_changed();
   dirty=true;
 
+  touch_all_packages();
   for(PkgIterator i=PkgBegin(); !i.end(); i++)
     pkgDepCache::MarkKeep(i, true);
 
@@ -1651,6 +1863,7 @@ void aptitudeDepCache::mark_auto_installed(const PkgIterator &Pkg,
       pre_package_state_changed();
       dirty=true;
 
+      touch_package(Pkg->ID);
       MarkAuto(Pkg, set_auto);
     }
 }
@@ -1735,6 +1948,7 @@ bool aptitudeDepCache::attach_user_tag(const PkgIterator &pkg,
       if (insert_result.second)
 	{
 	  dirty = true;
+	  touch_package(pkg->ID);
 	  if (undo != NULL)
 	    undo->add_item(new attach_user_tag_undoer(this, pkg, tag));
 
@@ -1777,6 +1991,7 @@ bool aptitudeDepCache::detach_user_tag(const PkgIterator &pkg,
       if (num_erased > 0)
 	{
 	  dirty = true;
+	  touch_package(pkg->ID);
 	  if(undo != NULL)
 	    undo->add_item(new detach_user_tag_undoer(this, pkg, tag));
 
@@ -1829,6 +2044,8 @@ bool aptitudeDepCache::all_upgrade(bool with_autoinst, undo_group *undo)
   if(BrokenCount()!=0)
     return false;
 
+  touch_all_packages();
+
   for(pkgCache::PkgIterator pkg=PkgBegin(); !pkg.end(); ++pkg)
     {
       if((*this)[pkg].Install())
@@ -1857,6 +2074,8 @@ bool aptitudeDepCache::try_fix_broken(pkgProblemResolver &fixer, undo_group *und
 
   pre_package_state_changed();
   dirty=true;
+  // The problem resolver doesn't report which packages it changed.
+  touch_all_packages();
   bool founderr=false;
   if(!fixer.Resolve(true))
     founderr=true;
@@ -1911,7 +2130,7 @@ void aptitudeDepCache::MarkFromDselect(const PkgIterator &Pkg)
       return;
     }
 
-  aptitude_state &state=get_ext_state(Pkg);
+  aptitude_state &state=modify_ext_state(Pkg);
 
   state.original_selection_state = static_cast<pkgCache::State::PkgSelectedState>(Pkg->SelectedState);
 
@@ -1960,13 +2179,10 @@ void aptitudeDepCache::duplicate_cache(apt_state_snapshot *target)
 {
   if(!target->PkgState)
     target->PkgState=new StateCache[Head().PackageCount];
-  if(!target->DepState)
-    target->DepState=new unsigned char[Head().DependsCount];
   if(!target->AptitudeState)
     target->AptitudeState=new aptitude_state[Head().PackageCount];
 
   memcpy(target->PkgState, PkgState, sizeof(StateCache)*Head().PackageCount);
-  memcpy(target->DepState, DepState, sizeof(char)*Head().DependsCount);
   // memcpy doesn't work here because the aptitude_state structure
   // contains a std::string.  (would it be worthwhile/possible to
   // change things so that it doesn't?)
@@ -1982,6 +2198,105 @@ void aptitudeDepCache::duplicate_cache(apt_state_snapshot *target)
   target->iBadCount=iBadCount;
 }
 
+void aptitudeDepCache::touch_reverse_dependencies()
+{
+  if(all_packages_touched)
+    return;
+
+  // This mirrors pkgDepCache::Update(Pkg), which recomputes the
+  // dependency flags of exactly these packages.
+  const std::vector<unsigned long>::size_type end = touched_packages.size();
+  for(std::vector<unsigned long>::size_type i = expanded_touched_count;
+      i < end; ++i)
+    {
+      const pkgCache::PkgIterator pkg(GetCache(), packages_by_id[touched_packages[i]]);
+
+      for(pkgCache::DepIterator dep = pkg.RevDependsList(); !dep.end(); ++dep)
+	touch_package(dep.ParentPkg()->ID);
+
+      for(pkgCache::VerIterator ver = pkg.VersionList(); !ver.end(); ++ver)
+	for(pkgCache::PrvIterator prv = ver.ProvidesList(); !prv.end(); ++prv)
+	  for(pkgCache::DepIterator dep = prv.ParentPkg().RevDependsList();
+	      !dep.end(); ++dep)
+	    touch_package(dep.ParentPkg()->ID);
+    }
+
+  // The reverse dependencies only had their flags recomputed, so
+  // there's no need to expand them in turn.
+  expanded_touched_count = touched_packages.size();
+}
+
+void aptitudeDepCache::touch_swept_packages()
+{
+  if(all_packages_touched || backup_state.PkgState == NULL)
+    return;
+
+  // libapt runs a mark-and-sweep pass over every package at the end of
+  // each of its action groups, so this doesn't add to the asymptotic
+  // cost of an action.
+  for(unsigned long id = 0; id < Head().PackageCount; ++id)
+    if(PkgState[id].Garbage != backup_state.PkgState[id].Garbage ||
+       PkgState[id].Marked != backup_state.PkgState[id].Marked)
+      touch_package(id);
+}
+
+void aptitudeDepCache::refresh_backup_state()
+{
+  if(backup_state.PkgState == NULL ||
+     backup_state.AptitudeState == NULL ||
+     all_packages_touched)
+    duplicate_cache(&backup_state);
+  else
+    {
+      touch_reverse_dependencies();
+
+      for(std::vector<unsigned long>::const_iterator it = touched_packages.begin();
+	  it != touched_packages.end(); ++it)
+	{
+	  backup_state.PkgState[*it] = PkgState[*it];
+	  backup_state.AptitudeState[*it] = package_states[*it];
+	}
+
+      backup_state.iUsrSize=iUsrSize;
+      backup_state.iDownloadSize=iDownloadSize;
+      backup_state.iInstCount=iInstCount;
+      backup_state.iDelCount=iDelCount;
+      backup_state.iKeepCount=iKeepCount;
+      backup_state.iBrokenCount=iBrokenCount;
+      backup_state.iBadCount=iBadCount;
+    }
+
+  if(all_packages_touched)
+    all_packages_unsaved = true;
+
+  for(std::vector<unsigned long>::const_iterator it = touched_packages.begin();
+      it != touched_packages.end(); ++it)
+    {
+      touched_package_flags[*it] = false;
+      unsaved_package_flags[*it] = true;
+    }
+  touched_packages.clear();
+  expanded_touched_count = 0;
+  all_packages_touched = false;
+}
+
+void aptitudeDepCache::find_changed_packages(std::vector<unsigned long> &out)
+{
+  const std::vector<unsigned long>::size_type first = out.size();
+
+  if(all_packages_touched)
+    {
+      for(unsigned long id = 0; id < Head().PackageCount; ++id)
+	out.push_back(id);
+      return;
+    }
+
+  touch_reverse_dependencies();
+
+  out.insert(out.end(), touched_packages.begin(), touched_packages.end());
+  std::sort(out.begin() + first, out.end());
+}
+
 // Helpers for aptitudeDepCache::sweep().
 namespace
 {
@@ -2253,6 +2568,7 @@ void aptitudeDepCache::sweep()
 
 		  pre_package_state_changed();
 		  MarkDelete(pkg, purge_unused);
+		  touch_package(pkg->ID);
 		  package_states[pkg->ID].selection_state =
 		    (purge_unused ? pkgCache::State::Purge : pkgCache::State::DeInstall);
 		  package_states[pkg->ID].remove_reason = unused;
@@ -2260,6 +2576,7 @@ void aptitudeDepCache::sweep()
 	    }
 	  else
 	    {
+	      touch_package(pkg->ID);
 	      if(pkg.CurrentVer().end())
 		{
 		  if((*this)[pkg].iFlags & Purge)
@@ -2321,6 +2638,7 @@ void aptitudeDepCache::sweep()
       pkgCache::PkgIterator pkg(*it);
       LOG_INFO(logger, "aptitudeDepCache::sweep(): reinstating "
 	       << pkg.FullName(false));
+      touch_package(pkg->ID);
       MarkKeep(pkg, false, false);
     }
 }
@@ -2349,9 +2667,10 @@ void aptitudeDepCache::end_action_group(undo_group *undo)
 
       sweep();
 
+      touch_swept_packages();
       cleanup_after_change(undo, &changed_packages);
 
-      duplicate_cache(&backup_state);
+      refresh_backup_state();
 
       package_state_changed();
       package_states_changed(&changed_packages);
@@ -2360,40 +2679,6 @@ void aptitudeDepCache::end_action_group(undo_group *undo)
   group_level--;
 }
 
-const aptitudeDepCache::apt_state_snapshot *aptitudeDepCache::snapshot_apt_state()
-{
-  apt_state_snapshot *rval=new apt_state_snapshot;
-  duplicate_cache(rval);
-
-  return rval;
-}
-
-void aptitudeDepCache::restore_apt_state(const apt_state_snapshot *snapshot)
-{
-  if(read_only && !read_only_permission())
-    {
-      if(group_level == 0)
-	read_only_fail();
-      return;
-    }
-
-  memcpy(PkgState, snapshot->PkgState, sizeof(StateCache)*Head().PackageCount);
-  memcpy(DepState, snapshot->DepState, sizeof(char)*Head().DependsCount);
-  // memcpy doesn't work here because the aptitude_state structure
-  // contains a std::string.  (would it be worthwhile/possible to
-  // change things so that it doesn't?)
-  for(unsigned int i=0; i<Head().PackageCount; ++i)
-    package_states[i]=snapshot->AptitudeState[i];
-
-  iUsrSize=snapshot->iUsrSize;
-  iDownloadSize=snapshot->iDownloadSize;
-  iInstCount=snapshot->iInstCount;
-  iDelCount=snapshot->iDelCount;
-  iKeepCount=snapshot->iKeepCount;
-  iBrokenCount=snapshot->iBrokenCount;
-  iBadCount=snapshot->iBadCount;
-}
-
 void aptitudeDepCache::apply_solution(const generic_solution<aptitude_universe> &realSol,
 				      undo_group *undo)
 {
@@ -2477,7 +2762,7 @@ void aptitudeDepCache::apply_solution(const generic_solution<aptitude_universe>
 	  // removal.
 	  internal_mark_delete(pkg, false, false);
 	  if(is_auto && !curver.end())
-	    get_ext_state(pkg).remove_reason = from_resolver;
+	    modify_ext_state(pkg).remove_reason = from_resolver;
 	}
       else if(actionver == curver)
 	{
@@ -2685,7 +2970,7 @@ public:
   bool InRootSet(const pkgCache::PkgIterator &pkg)
   {
     pkgRecords &records(cache.get_records());
-    if(p.valid() && aptitude::matching::get_match(p, pkg, search_info, cache, records).valid())
+    if(p.valid() && aptitude::matching::matches(p, pkg, search_info, cache, records))
       return true;
     else
       return chain != NULL && chain->InRootSet(pkg);
@@ -2717,6 +3002,10 @@ bool aptitudeDepCache::IsInstallOk(const pkgCache::PkgIterator &pkg,
 				   unsigned long Depth,
 				   bool FromUser)
 {
+  // libapt calls this for every package that it is about to install,
+  // including the dependencies that it installs on its own.
+  touch_package(pkg->ID);
+
   if(Depth == 0)
     // This is a straight-up MarkInstall() call, not a dependency
     // resolution; allow it.
@@ -2756,6 +3045,8 @@ bool aptitudeDepCache::IsDeleteOk(const pkgCache::PkgIterator &pkg,
 				  unsigned long Depth,
 				  bool FromUser)
 {
+  touch_package(pkg->ID);
+
   if(Depth == 0)
     // This is a straight-up MarkDelete() call, not a dependency
     // resolution; allow it.
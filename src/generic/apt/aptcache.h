@@ -23,6 +23,7 @@
 
 #include <config.h>
 
+#include "pkgstates_journal.h"
 #include "usertags.h"
 
 #include <cwidget/generic/util/bool_accumulate.h>
@@ -35,6 +36,7 @@
 
 #include <iostream>
 #include <map>
+#include <memory>
 #include <set>
 #include <vector>
 
@@ -186,6 +188,15 @@ public:
    */
   bool read_only;
 
+  /** Incremented after package states or categories might have
+   *  changed.  It is bumped by package_state_changed rather than
+   *  pre_package_state_changed, so that anything computed while a
+   *  change is still in progress is discarded once it completes.
+   */
+  unsigned long state_generation;
+
+  void increment_state_generation() { ++state_generation; }
+
   /** Collection of all user tags */
   user_tag_collection user_tags;
 
@@ -205,7 +216,6 @@ public:
   class apt_state_snapshot
   {
     StateCache *PkgState;
-    unsigned char *DepState;
     aptitude_state *AptitudeState;
     signed long long iUsrSize;
     unsigned long long iDownloadSize;
@@ -216,13 +226,12 @@ public:
     unsigned long iBadCount;
 
   private:
-    apt_state_snapshot():PkgState(NULL), DepState(NULL), AptitudeState(NULL) {}
+    apt_state_snapshot():PkgState(NULL), AptitudeState(NULL) {}
 
   public:
     ~apt_state_snapshot()
     {
       delete[] PkgState;
-      delete[] DepState;
       delete[] AptitudeState;
     }
 
@@ -244,6 +253,119 @@ private:
   apt_state_snapshot backup_state;
   // Stores what the cache was like just before an action was performed
 
+  /** \brief The IDs of the packages whose state might differ from
+   *  backup_state, in the order in which they were first touched.
+   *
+   *  Every routine that changes a package records it here (see
+   *  touch_package()), as do the IsInstallOk() and IsDeleteOk() hooks
+   *  for the packages that libapt changes on its own.  This lets
+   *  backup_state be compared and refreshed without visiting every
+   *  package.
+   */
+  std::vector<unsigned long> touched_packages;
+
+  /** \brief touched_package_flags[id] is \b true if and only if id
+   *  is in touched_packages.
+   */
+  std::vector<bool> touched_package_flags;
+
+  /** \brief The number of entries at the start of touched_packages
+   *  whose reverse dependencies have been touched.
+   */
+  std::vector<unsigned long>::size_type expanded_touched_count;
+
+  /** \brief If \b true, an operation that doesn't report which
+   *  packages it changed (such as the problem resolver of libapt) ran
+   *  since backup_state was taken, so every package must be compared.
+   */
+  bool all_packages_touched;
+
+  /** \brief The package structure corresponding to each package ID. */
+  std::vector<pkgCache::Package *> packages_by_id;
+
+  /** \brief The binary package state files, if they are in use. */
+  std::unique_ptr<aptitude::apt::pkgstates_journal> state_journal;
+
+  /** \brief The checksum of the stored binary state record of each
+   *  package, indexed by package ID, or 0 if it wasn't read from the
+   *  binary state files.
+   *
+   *  Only the packages whose records no longer match are written to
+   *  the journal when the states are saved.
+   */
+  std::vector<uint64_t> saved_state_checksums;
+
+  /** \brief unsaved_package_flags[id] is \b true if the package was
+   *  touched since the states were last saved to the binary state
+   *  files.
+   */
+  std::vector<bool> unsaved_package_flags;
+
+  /** \brief If \b true, every package might have changed since the
+   *  states were last saved to the binary state files.
+   */
+  bool all_packages_unsaved;
+
+  /** \brief Return \b true if the saved state of the package might
+   *  be out of date.
+   */
+  bool is_unsaved(unsigned long id) const
+  {
+    return all_packages_unsaved || all_packages_touched ||
+      unsaved_package_flags[id] || touched_package_flags[id];
+  }
+
+  /** \brief Apply the stored state of a package that was read from
+   *  the state file.
+   *
+   *  \return the package that the record describes, or an end
+   *  iterator if it is unknown.
+   */
+  PkgIterator load_saved_state(const aptitude::apt::package_state_record &record,
+			       bool reset_reinstall,
+			       bool do_dselect,
+			       bool do_initselections);
+
+  /** \brief Fill in the record that is stored in the state file for
+   *  the given package.
+   */
+  void get_saved_state(const PkgIterator &pkg,
+		       aptitude::apt::package_state_record &record);
+
+  /** \brief Remember that every package might have changed since
+   *  backup_state was taken.
+   */
+  void touch_all_packages()
+  {
+    all_packages_touched = true;
+  }
+
+  /** \brief Touch the packages whose broken flags might have changed
+   *  along with the touched packages: the packages that depend on
+   *  them or on something that they provide.
+   */
+  void touch_reverse_dependencies();
+
+  /** \brief Touch the packages whose Garbage or Marked flags were
+   *  changed by the last mark-and-sweep pass of libapt.
+   */
+  void touch_swept_packages();
+
+  /** \brief Bring backup_state up to date with the current state.
+   *
+   *  Only the states of the touched packages are copied, unless
+   *  every package was touched.
+   */
+  void refresh_backup_state();
+
+  /** \brief Find the packages whose state might differ from
+   *  backup_state.
+   *
+   *  \param out  A vector to which the IDs of the touched packages
+   *              are appended, in increasing order.
+   */
+  void find_changed_packages(std::vector<unsigned long> &out);
+
   pkgRecords *records;
 
   undoable *state_restorer(PkgIterator pkg, StateCache &state, aptitude_state &ext_state);
@@ -313,6 +435,14 @@ public:
 
   bool is_dirty() const { return dirty; }
 
+  /** \brief Get a number that changes whenever package states or
+   *  categories might have changed.
+   *
+   *  Information derived from the package states can be kept for as
+   *  long as this returns the same value.
+   */
+  unsigned long get_state_generation() const { return state_generation; }
+
   pkgRecords &get_records() { return *records; }
 
   // If do_initselections is "false", the "sticky states" will not be used
@@ -344,6 +474,33 @@ public:
   inline aptitude_state &get_ext_state(const PkgIterator &Pkg)
   {return package_states[Pkg->ID];}
 
+  /** \brief Get the extended state of a package in order to modify
+   *  it.
+   *
+   *  Unlike get_ext_state(), this records that the package changed,
+   *  so that the change is noticed at the end of the current action
+   *  group.
+   */
+  inline aptitude_state &modify_ext_state(const PkgIterator &Pkg)
+  {touch_package(Pkg->ID); return package_states[Pkg->ID];}
+
+  /** \brief Remember that the state of the given package might have
+   *  changed since the end of the last action group.
+   */
+  void touch_package(unsigned long id)
+  {
+    if(id >= touched_package_flags.size())
+      touch_all_packages();
+    else if(!touched_package_flags[id])
+      {
+	touched_package_flags[id] = true;
+	touched_packages.push_back(id);
+      }
+  }
+
+  inline const aptitude_state &get_ext_state(const PkgIterator &Pkg) const
+  {return package_states[Pkg->ID];}
+
   bool save_selection_list(OpProgress* Prog, const char* status_fname = nullptr);
   // If the list isn't locked (or an fd isn't provided), is a NOP.
 
@@ -489,13 +646,6 @@ public:
   // Just runs the resolver given and catches automatic changes.
   // (this lets callers customize the information given to the resolver)
 
-  const apt_state_snapshot *snapshot_apt_state();
-  // Returns the current state of the *APT* cache (no information about
-  // Aptitude states is included); this is meant to be used to implement undo,
-  // detection of "wtf happened??" after the problem resolver runs, etc.
-  void restore_apt_state(const apt_state_snapshot *snapshot);
-  // Restores the *APT* cache to the given state.
-
   /** This signal is emitted *before* any package's install state is
    *  changed.  It may be emitted more than once per state change; if
    *  no states actually change, it might not be emitted at all.
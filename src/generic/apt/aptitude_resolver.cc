@@ -20,6 +20,8 @@
 
 #include "aptitude_resolver.h"
 
+#include "apt.h"
+#include "aptitude_resolver_compiled_universe.h"
 #include "config_signal.h"
 
 #include <apt-pkg/algorithms.h>
@@ -29,6 +31,7 @@
 
 #include <aptitude.h>
 #include <generic/apt/matching/compare_patterns.h>
+#include <generic/apt/matching/compile_pattern.h>
 #include <generic/apt/matching/match.h>
 #include <generic/apt/matching/parse.h>
 #include <generic/apt/matching/pattern.h>
@@ -36,10 +39,13 @@
 
 #include <generic/problemresolver/cost.h>
 
+#include <cwidget/generic/threads/threads.h>
 #include <cwidget/generic/util/ssprintf.h>
 
 #include <loggers.h>
 
+#include <sys/time.h>
+
 using cwidget::util::ssprintf;
 
 namespace
@@ -52,12 +58,19 @@ namespace
   logging::LoggerPtr loggerScores(aptitude::Loggers::getAptitudeResolverScores());
   logging::LoggerPtr loggerCosts(aptitude::Loggers::getAptitudeResolverCosts());
 
+  double now()
+  {
+    timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+  }
+
   /** \brief If the given version is valid, find its maximum priority
    *  and return a raise-cost operation for that priority.
    */
   cost raise_priority_op(aptitude_resolver_cost_settings &settings,
                          const aptitude_resolver_version &ver,
-                         pkgPolicy *policy,
+                         const aptitude_resolver_base &base,
                          aptitude_resolver_cost_settings::component &priority_component)
   {
     if(!settings.is_component_relevant(priority_component))
@@ -67,13 +80,7 @@ namespace
 
     if(!apt_ver.end())
       {
-	int apt_priority = INT_MIN;
-	for(pkgCache::VerFileIterator vf = apt_ver.FileList();
-	    !vf.end(); ++vf)
-	  {
-	    int pin = policy->GetPriority(vf.File());
-	    apt_priority = std::max(apt_priority, pin);
-	  }
+	const int apt_priority = base.get_pin_priority(apt_ver);
 
         if(apt_priority > INT_MIN)
           return settings.raise_cost(priority_component,
@@ -726,7 +733,7 @@ aptitude_resolver::aptitude_resolver(int step_score,
                                                unfixed_soft_cost,
 					       future_horizon,
 					       initial_installations,
-					       aptitude_universe(cache)),
+					       aptitude_universe(cache, get_compiled_universe(cache))),
    policy(_policy),
    cost_settings(_cost_settings)
 {
@@ -1159,6 +1166,146 @@ void aptitude_resolver::add_default_resolution_score(const pkgCache::DepIterator
     }
 }
 
+bool aptitude_resolver::apply_hint(const hint &h,
+				   const aptitude_resolver_cost_settings::component &component,
+				   const version &v)
+{
+  if(!h.get_version_selection().matches(v))
+    return false;
+
+  switch(h.get_type())
+    {
+    case hint::add_to_cost_component:
+      LOG_DEBUG(loggerScores, "** Adding " << h.get_amt() << " to the cost component \"" << h.get_component_name() << "\" for " << v);
+      modify_version_cost(v, cost_settings.add_to_cost(component, h.get_amt()));
+      break;
+
+    case hint::discard:
+      LOG_DEBUG(loggerScores, "** Discarding " << v);
+      modify_version_cost(v, cost_limits::conflict_cost);
+      break;
+
+    case hint::raise_cost_component:
+      LOG_DEBUG(loggerScores, "** Raising the cost component \"" << h.get_component_name() << "\" to " << h.get_amt() << " for " << v);
+      modify_version_cost(v, cost_settings.raise_cost(component, h.get_amt()));
+      break;
+
+    case hint::reject:
+      LOG_DEBUG(loggerScores, "** Rejecting " << v << " due to the hint " << h);
+      reject_version(v);
+      break;
+
+    case hint::mandate:
+      LOG_DEBUG(loggerScores, "** Mandating " << v << " due to the hint " << h);
+      mandate_version(v);
+      break;
+
+    case hint::tweak_score:
+      LOG_DEBUG(loggerScores, "** Score: " << std::showpos << h.get_amt() << std::noshowpos << " for " << v << " due to the hint " << h);
+      add_version_score(v, h.get_amt());
+      break;
+
+    default:
+      LOG_ERROR(loggerScores, "Bad resolver hint type " << h.get_type());
+      _error->Error("Bad resolver hint type %d.", h.get_type());
+      break;
+    }
+
+  return true;
+}
+
+void aptitude_resolver::apply_hints(const aptitude_resolver_base &base)
+{
+  using aptitude::matching::match_all_packages;
+  using aptitude::matching::match_all_versions;
+
+  const std::vector<hint> &hints(base.get_hints());
+  if(hints.empty())
+    return;
+
+  const double start_time = now();
+
+  aptitudeDepCache *cache(get_universe().get_cache());
+  cwidget::util::ref_ptr<aptitude::matching::search_cache>
+    search_info(aptitude::matching::search_cache::create());
+  // Only needed to match the targets of hints that depend on the
+  // package states; opening the records is expensive.
+  std::unique_ptr<pkgRecords> records;
+
+  for(std::vector<hint>::size_type i = 0; i < hints.size(); ++i)
+    {
+      const hint &h(hints[i]);
+
+      // Resolve the component of the hint here (since hints are
+      // supposed to be purely syntactic, it would be wrong to store
+      // the component there when we can look it up here with little
+      // cost), and bypass hints that are irrelevant.
+      aptitude_resolver_cost_settings::component component;
+      switch(h.get_type())
+        {
+        case hint::add_to_cost_component:
+          component = cost_settings.get_or_create_component(h.get_component_name(), aptitude_resolver_cost_settings::additive);
+          if(!cost_settings.is_component_relevant(component))
+            continue;
+          break;
+
+        case hint::raise_cost_component:
+          component = cost_settings.get_or_create_component(h.get_component_name(), aptitude_resolver_cost_settings::maximized);
+          if(!cost_settings.is_component_relevant(component))
+            continue;
+          break;
+
+        default:
+          break;
+        }
+
+      // Find every version and removal that the target matches,
+      // unless the base already knows.
+      const double match_start_time = now();
+      boost::dynamic_bitset<> local_version_matches, local_removal_matches;
+      const boost::dynamic_bitset<> *version_matches, *removal_matches;
+      if(base.is_hint_precomputed(i))
+	{
+	  version_matches = &base.get_hint_version_matches(i);
+	  removal_matches = &base.get_hint_removal_matches(i);
+	}
+      else
+	{
+	  if(records.get() == NULL)
+	    records.reset(new pkgRecords(*cache));
+
+	  match_all_versions(h.get_target(), search_info,
+			     local_version_matches, *cache, *records);
+	  match_all_packages(h.get_target(), search_info,
+			     local_removal_matches, *cache, *records);
+	  version_matches = &local_version_matches;
+	  removal_matches = &local_removal_matches;
+	}
+      const double apply_start_time = now();
+
+      std::size_t num_applied = 0;
+      for(boost::dynamic_bitset<>::size_type id = version_matches->find_first();
+	  id != boost::dynamic_bitset<>::npos; id = version_matches->find_next(id))
+	if(apply_hint(h, component, version::make_install(base.get_version(id), cache)))
+	  ++num_applied;
+
+      for(boost::dynamic_bitset<>::size_type id = removal_matches->find_first();
+	  id != boost::dynamic_bitset<>::npos; id = removal_matches->find_next(id))
+	if(apply_hint(h, component, version::make_removal(base.get_package(id), cache)))
+	  ++num_applied;
+
+      LOG_DEBUG(loggerHints,
+		"Applied the hint " << h << " to " << num_applied << " versions in "
+		<< (now() - apply_start_time) << "s ("
+		<< (base.is_hint_precomputed(i) ? "precomputed" : "matched")
+		<< " the target in " << (apply_start_time - match_start_time) << "s).");
+    }
+
+  LOG_DEBUG(loggerHints,
+	    "Applied " << hints.size() << " hints in "
+	    << (now() - start_time) << "s.");
+}
+
 void aptitude_resolver::add_action_scores(int preserve_score, int auto_score,
 					  int remove_score, int remove_obsolete_score,
 					  int cancel_removal_score,
@@ -1171,7 +1318,7 @@ void aptitude_resolver::add_action_scores(int preserve_score, int auto_score,
 					  bool allow_break_holds_and_forbids,
 					  int default_resolution_score,
 					  const std::map<package, bool> &initial_state_manual_flags,
-					  const std::vector<hint> &hints)
+					  const aptitude_resolver_base &base)
 {
   cfg_level safe_level(aptitude_universe::get_safe_level());
   cfg_level keep_all_level(aptitude_universe::get_keep_all_level());
@@ -1197,10 +1344,7 @@ void aptitude_resolver::add_action_scores(int preserve_score, int auto_score,
 	    << ", break_hold_level = " << break_hold_level << ", non_default_level = "
 	    << non_default_level << ", remove_essential_level = " << remove_essential_level << ".");
 
-  cwidget::util::ref_ptr<aptitude::matching::search_cache>
-    search_info(aptitude::matching::search_cache::create());
   aptitudeDepCache *cache(get_universe().get_cache());
-  pkgRecords records(*cache);
   const resolver_initial_state<aptitude_universe> &initial_state(get_initial_state());
 
   aptitude_resolver_cost_settings::component
@@ -1215,28 +1359,7 @@ void aptitude_resolver::add_action_scores(int preserve_score, int auto_score,
     broken_holds_component = cost_settings.get_or_create_component("broken-holds", aptitude_resolver_cost_settings::additive),
     canceled_actions_component = cost_settings.get_or_create_component("canceled-actions", aptitude_resolver_cost_settings::additive);
 
-  // Resolve the component of each hint into a side table (since hints
-  // are supposed to be purely syntactic, it would be wrong to store
-  // the component there when we can look it up here with little
-  // cost).
-  std::vector<aptitude_resolver_cost_settings::component> hint_components;
-  for(std::vector<hint>::const_iterator it = hints.begin(); it != hints.end(); ++it)
-    {
-      switch(it->get_type())
-        {
-        case hint::add_to_cost_component:
-          hint_components.push_back(cost_settings.get_or_create_component(it->get_component_name(), aptitude_resolver_cost_settings::additive));
-          break;
-
-        case hint::raise_cost_component:
-          hint_components.push_back(cost_settings.get_or_create_component(it->get_component_name(), aptitude_resolver_cost_settings::maximized));
-          break;
-
-        default:
-          hint_components.push_back(aptitude_resolver_cost_settings::component());
-          break;
-        }
-    }
+  apply_hints(base);
 
   // Should I stick with APT iterators instead?  This is a bit more
   // convenient, though..
@@ -1304,90 +1427,6 @@ void aptitude_resolver::add_action_scores(int preserve_score, int auto_score,
 
 	  pkgCache::VerIterator apt_ver(v.get_ver());
 
-	  // Apply resolver hints.
-	  for(std::vector<hint>::const_iterator it = hints.begin();
-	      it != hints.end(); ++it)
-	    {
-	      const hint &h(*it);
-              const aptitude_resolver_cost_settings::component
-                &component = hint_components[it - hints.begin()];
-
-              // Bypass hints that are irrelevant.
-              switch(h.get_type())
-                {
-                case hint::add_to_cost_component:
-                case hint::raise_cost_component:
-                  if(!cost_settings.is_component_relevant(component))
-                    continue;
-                  break;
-
-                default:
-                  break;
-                }
-
-	      using aptitude::matching::get_match;
-
-	      // Check the version selection.  This is quicker than
-	      // the target test, so we do it first.
-	      if(!h.get_version_selection().matches(v))
-		continue;
-
-	      // Now check the target.
-	      if(apt_ver.end())
-		{
-		  if(!get_match(h.get_target(), p.get_pkg(),
-				search_info, *cache,
-				records).valid())
-		    continue;
-		}
-	      else
-		{
-		  if(!get_match(h.get_target(), p.get_pkg(), v.get_ver(),
-				search_info, *cache,
-				records).valid())
-		    continue;
-		}
-
-	      // OK, apply the hint.
-	      switch(h.get_type())
-		{
-		case hint::add_to_cost_component:
-                  LOG_DEBUG(loggerScores, "** Adding " << h.get_amt() << " to the cost component \"" << h.get_component_name() << "\" for " << v);
-                  modify_version_cost(v, cost_settings.add_to_cost(component, h.get_amt()));
-                  break;
-
-                case hint::discard:
-                  LOG_DEBUG(loggerScores, "** Discarding " << v);
-                  modify_version_cost(v, cost_limits::conflict_cost);
-                  break;
-
-		case hint::raise_cost_component:
-                  LOG_DEBUG(loggerScores, "** Raising the cost component \"" << h.get_component_name() << "\" to " << h.get_amt() << " for " << v);
-                  modify_version_cost(v, cost_settings.raise_cost(component, h.get_amt()));
-		  break;
-
-		case hint::reject:
-		  LOG_DEBUG(loggerScores, "** Rejecting " << v << " due to the hint " << h);
-		  reject_version(v);
-		  break;
-
-		case hint::mandate:
-		  LOG_DEBUG(loggerScores, "** Mandating " << v << " due to the hint " << h);
-		  mandate_version(v);
-		  break;
-
-		case hint::tweak_score:
-		  LOG_DEBUG(loggerScores, "** Score: " << std::showpos << h.get_amt() << std::noshowpos << " for " << v << " due to the hint " << h);
-		  add_version_score(v, h.get_amt());
-		  break;
-
-		default:
-		  LOG_ERROR(loggerScores, "Bad resolver hint type " << h.get_type());
-		  _error->Error("Bad resolver hint type %d.", h.get_type());
-		  break;
-		}
-	    }
-
           // We only raise the priority component if v is not the
           // initial version of p, for two reasons: first and
           // foremost, this was the old behavior, and I don't want to
@@ -1398,7 +1437,7 @@ void aptitude_resolver::add_action_scores(int preserve_score, int auto_score,
           // version of a package).
           if(v != initial_state.version_of(p))
             modify_version_cost(v, raise_priority_op(cost_settings,
-                                                     v, policy,
+                                                     v, base,
                                                      priority_component));
 
 	  if (v == initial_state.version_of(p))
@@ -1779,3 +1818,169 @@ void aptitude_resolver::add_priority_scores(int important,
 	add_version_score(*vi, score_tweak);
       }
 }
+
+aptitude_resolver_base::aptitude_resolver_base(const std::vector<std::string> &_hint_definitions,
+					       aptitudeDepCache *cache,
+					       pkgPolicy *policy)
+  : hint_definitions(_hint_definitions),
+    generation(aptitude::apt::get_cache_generation(cache->GetCache()))
+{
+  using aptitude::matching::match_all_packages;
+  using aptitude::matching::match_all_versions;
+  using aptitude::matching::pattern_depends_on_state;
+  using aptitude::matching::search_cache;
+
+  for(std::vector<std::string>::const_iterator it = hint_definitions.begin();
+      it != hint_definitions.end(); ++it)
+    {
+      aptitude_resolver::hint h;
+      if(aptitude_resolver::hint::parse(*it, h))
+	hints.push_back(h);
+    }
+
+  hint_precomputed.resize(hints.size(), false);
+  hint_version_matches.resize(hints.size());
+  hint_removal_matches.resize(hints.size());
+
+  if(!hints.empty())
+    {
+      cwidget::util::ref_ptr<search_cache> search_info(search_cache::create());
+      pkgRecords records(*cache);
+
+      for(std::vector<aptitude_resolver::hint>::size_type i = 0;
+	  i < hints.size(); ++i)
+	{
+	  const aptitude_resolver::hint &h(hints[i]);
+
+	  if(pattern_depends_on_state(h.get_target()))
+	    {
+	      LOG_DEBUG(loggerHintsMatch,
+			"Not precomputing the targets of the hint " << h
+			<< ": they depend on the package states.");
+	      continue;
+	    }
+
+	  match_all_versions(h.get_target(), search_info,
+			     hint_version_matches[i], *cache, records);
+	  match_all_packages(h.get_target(), search_info,
+			     hint_removal_matches[i], *cache, records);
+	  hint_precomputed[i] = true;
+
+	  LOG_TRACE(loggerHintsMatch,
+		    "Precomputed the targets of the hint " << h << ": "
+		    << hint_version_matches[i].count() << " versions, "
+		    << hint_removal_matches[i].count() << " removals.");
+	}
+    }
+
+  index_cache(cache, policy);
+}
+
+aptitude_resolver_base::aptitude_resolver_base(const aptitude_resolver_base &other,
+					       aptitudeDepCache *cache,
+					       pkgPolicy *policy)
+  : hint_definitions(other.hint_definitions),
+    hints(other.hints),
+    hint_precomputed(other.hint_precomputed),
+    hint_version_matches(other.hint_version_matches),
+    hint_removal_matches(other.hint_removal_matches),
+    generation(other.generation)
+{
+  index_cache(cache, policy);
+}
+
+void aptitude_resolver_base::index_cache(aptitudeDepCache *cache,
+					 pkgPolicy *policy)
+{
+  packages.resize(cache->Head().PackageCount);
+  versions.resize(cache->Head().VersionCount);
+  pin_priorities.resize(cache->Head().VersionCount, INT_MIN);
+  for(pkgCache::PkgIterator pkg = cache->PkgBegin(); !pkg.end(); ++pkg)
+    {
+      packages[pkg->ID] = pkg;
+      for(pkgCache::VerIterator ver = pkg.VersionList(); !ver.end(); ++ver)
+	{
+	  versions[ver->ID] = ver;
+
+	  int &apt_priority = pin_priorities[ver->ID];
+	  for(pkgCache::VerFileIterator vf = ver.FileList();
+	      !vf.end(); ++vf)
+	    apt_priority = std::max(apt_priority, policy->GetPriority(vf.File()));
+	}
+    }
+}
+
+namespace
+{
+  cwidget::threads::mutex resolver_base_mutex;
+  std::shared_ptr<const aptitude_resolver_base> global_resolver_base;
+  // The cache that global_resolver_base was built for.
+  const aptitudeDepCache *resolver_base_cache = NULL;
+  bool resolver_base_reset_connected = false;
+
+  void reset_resolver_base()
+  {
+    cwidget::threads::mutex::lock l(resolver_base_mutex);
+
+    global_resolver_base.reset();
+    resolver_base_cache = NULL;
+  }
+
+  // Keep the base of a closed cache around, so that its hint matches
+  // can be carried over if the cache is reopened with the same
+  // generation.  It points into the closed cache, so it isn't handed
+  // out again as it is.
+  void retire_resolver_base()
+  {
+    cwidget::threads::mutex::lock l(resolver_base_mutex);
+
+    resolver_base_cache = NULL;
+  }
+}
+
+std::shared_ptr<const aptitude_resolver_base>
+get_resolver_base(aptitudeDepCache *cache, pkgPolicy *policy)
+{
+  cwidget::threads::mutex::lock l(resolver_base_mutex);
+
+  if(!resolver_base_reset_connected)
+    {
+      cache_closed.connect(sigc::ptr_fun(retire_resolver_base));
+      cache_reload_failed.connect(sigc::ptr_fun(reset_resolver_base));
+      resolver_base_reset_connected = true;
+    }
+
+  std::vector<std::string> hint_definitions;
+  const Configuration::Item * const root =
+    aptcfg->Tree(PACKAGE "::ProblemResolver::Hints");
+  if(root != NULL)
+    for(const Configuration::Item *itm = root->Child;
+	itm != NULL; itm = itm -> Next)
+      hint_definitions.push_back(itm->Value);
+
+  if(global_resolver_base.get() != NULL &&
+     resolver_base_cache != cache &&
+     global_resolver_base->get_hint_definitions() == hint_definitions &&
+     global_resolver_base->get_generation() == aptitude::apt::get_cache_generation(cache->GetCache()))
+    {
+      LOG_TRACE(loggerScores, "Carrying the shared resolver base over to the reopened cache.");
+
+      global_resolver_base =
+	std::make_shared<aptitude_resolver_base>(*global_resolver_base,
+						 cache, policy);
+      resolver_base_cache = cache;
+    }
+  else if(global_resolver_base.get() == NULL ||
+	  resolver_base_cache != cache ||
+	  global_resolver_base->get_hint_definitions() != hint_definitions)
+    {
+      LOG_TRACE(loggerScores, "Building the shared resolver base.");
+
+      global_resolver_base =
+	std::make_shared<aptitude_resolver_base>(hint_definitions,
+						 cache, policy);
+      resolver_base_cache = cache;
+    }
+
+  return global_resolver_base;
+}
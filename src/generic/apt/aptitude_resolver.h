@@ -34,7 +34,10 @@
 
 #include <generic/util/immset.h>
 
+#include <boost/dynamic_bitset.hpp>
+
 #include <iosfwd>
+#include <memory>
 
 class pkgPolicy;
 
@@ -61,6 +64,8 @@ namespace aptitude
   }
 }
 
+class aptitude_resolver_base;
+
 class aptitude_resolver:public generic_problem_resolver<aptitude_universe>
 {
   choice_set keep_all_solution;
@@ -80,6 +85,15 @@ class aptitude_resolver:public generic_problem_resolver<aptitude_universe>
    */
   void add_default_resolution_score(const pkgCache::DepIterator &dep,
 				    int default_resolution_score);
+
+  /** \brief Apply the hints of the given base to every version that
+   *  they select.
+   *
+   *  Each hint's target is matched against the whole cache at once
+   *  (or taken from the base, if it was precomputed), and the hint
+   *  is then applied to the versions that were found.
+   */
+  void apply_hints(const aptitude_resolver_base &base);
 public:
   class hint
   {
@@ -440,6 +454,16 @@ public:
     const version_selection &get_version_selection() const { return selection; }
   };
 
+private:
+  /** \brief Apply a hint to a version that its target matches.
+   *
+   *  \return \b true if the hint selects the version.
+   */
+  bool apply_hint(const hint &h,
+		  const aptitude_resolver_cost_settings::component &component,
+		  const version &v);
+
+public:
   aptitude_resolver(int step_score, int broken_score,
 		    int unfixed_soft_score,
 		    int infinity,
@@ -462,10 +486,8 @@ public:
    *  to its arguments.  All scores are assigned with add_score, so
    *  this can be easily combined with other policies.
    *
-   *  Note: hints are folded into this routine for efficiency
-   *  (minimizing the number of passes over the cache.  We should
-   *  probably fold everything into one enormous monster "set all the
-   *  aptitude scores up" routine.
+   *  Note: hints are also applied by this routine, before the
+   *  scores; see apply_hints().
    *
    * \param preserve_score the score to assign to the version that the
    * user selected.
@@ -526,6 +548,9 @@ public:
    * whether they should be considered to have a manually chosen
    * state.  The manual states of overridden packages default to
    * "true" if they do not have a mapping in this collection.
+   *
+   * \param base the hints to apply and the precomputed matches of
+   * their targets.
    */
   void add_action_scores(int preserve_score, int auto_score,
 			 int remove_score, int remove_obsolete_score,
@@ -539,7 +564,7 @@ public:
 			 bool allow_break_holds_and_forbids,
 			 int default_resolution_score,
 			 const std::map<package, bool> &initial_state_manual_flags,
-			 const std::vector<hint> &hints);
+			 const aptitude_resolver_base &base);
 
   /** Score packages/versions according to their priorities.  Normally
    *  you want important>=required>=standard>=optional>=extra.
@@ -559,6 +584,154 @@ public:
   choice_set get_keep_all_solution() const;
 };
 
+/** \brief The parts of the resolver setup that only depend on the
+ *  package cache and the configuration.
+ *
+ *  Testing the targets of the resolver hints against every version
+ *  in the cache is the most expensive part of setting up a resolver,
+ *  and unless a target tests the package states (see
+ *  aptitude::matching::pattern_depends_on_state()), its results are
+ *  the same for every resolver created while the cache is open.  The
+ *  base holds the parsed hints, their precomputed matches and the
+ *  pin priority of each version.  It is immutable once built, so it
+ *  can be shared by any number of resolvers; see get_resolver_base().
+ */
+class aptitude_resolver_base
+{
+  std::vector<std::string> hint_definitions;
+  std::vector<aptitude_resolver::hint> hints;
+
+  // Whether the target of each hint was matched when the base was
+  // built.  If so, the corresponding entries of hint_version_matches
+  // (indexed by version ID) and hint_removal_matches (indexed by
+  // package ID, for the removal of each package) hold the result.
+  std::vector<bool> hint_precomputed;
+  std::vector<boost::dynamic_bitset<> > hint_version_matches;
+  std::vector<boost::dynamic_bitset<> > hint_removal_matches;
+
+  // The packages and versions of the cache, indexed by ID.
+  std::vector<const pkgCache::Package *> packages;
+  std::vector<const pkgCache::Version *> versions;
+
+  // The highest pin priority of the files containing each version,
+  // indexed by version ID, or INT_MIN if it isn't in any file.
+  std::vector<int> pin_priorities;
+
+  // The generation of the cache that the hints were matched against.
+  uint64_t generation;
+
+  /** \brief Fill in the packages, versions and pin priorities of
+   *  the given cache.
+   */
+  void index_cache(aptitudeDepCache *cache, pkgPolicy *policy);
+
+public:
+  /** \brief Build the base for the given cache.
+   *
+   *  \param _hint_definitions  The hints to parse, as they appear in
+   *                            Aptitude::ProblemResolver::Hints.
+   *                            Hints that fail to parse are dropped.
+   *  \param cache    The package cache.
+   *  \param policy   The policy used to look up pin priorities.
+   */
+  aptitude_resolver_base(const std::vector<std::string> &_hint_definitions,
+			 aptitudeDepCache *cache,
+			 pkgPolicy *policy);
+
+  /** \brief Carry a base over to a cache that was reopened with the
+   *  same generation (see aptitude::apt::get_cache_generation()).
+   *
+   *  The hints and their precomputed matches only depend on the IDs
+   *  and on the package lists, so they are copied from other; the
+   *  packages, versions and pin priorities are looked up again in
+   *  the new cache.
+   */
+  aptitude_resolver_base(const aptitude_resolver_base &other,
+			 aptitudeDepCache *cache,
+			 pkgPolicy *policy);
+
+  /** \brief Get the generation of the cache that this base was
+   *  built for.
+   */
+  uint64_t get_generation() const
+  {
+    return generation;
+  }
+
+  /** \brief Get the hint definitions that this base was built from. */
+  const std::vector<std::string> &get_hint_definitions() const
+  {
+    return hint_definitions;
+  }
+
+  /** \brief Get the hints that were parsed successfully. */
+  const std::vector<aptitude_resolver::hint> &get_hints() const
+  {
+    return hints;
+  }
+
+  /** \brief Return \b true if the target of the ith hint was
+   *  matched against the whole cache when the base was built.
+   */
+  bool is_hint_precomputed(std::size_t i) const
+  {
+    return hint_precomputed[i];
+  }
+
+  /** \brief Get the versions, indexed by version ID, that the
+   *  target of the ith hint matches.
+   *
+   *  Only valid if is_hint_precomputed(i) returns \b true.
+   */
+  const boost::dynamic_bitset<> &get_hint_version_matches(std::size_t i) const
+  {
+    eassert(hint_precomputed[i]);
+    return hint_version_matches[i];
+  }
+
+  /** \brief Get the packages, indexed by package ID, whose removals
+   *  the target of the ith hint matches.
+   *
+   *  Only valid if is_hint_precomputed(i) returns \b true.
+   */
+  const boost::dynamic_bitset<> &get_hint_removal_matches(std::size_t i) const
+  {
+    eassert(hint_precomputed[i]);
+    return hint_removal_matches[i];
+  }
+
+  /** \brief Get the package with the given ID. */
+  const pkgCache::Package *get_package(std::size_t id) const
+  {
+    return packages[id];
+  }
+
+  /** \brief Get the version with the given ID. */
+  const pkgCache::Version *get_version(std::size_t id) const
+  {
+    return versions[id];
+  }
+
+  /** \brief Get the highest pin priority of the files containing a
+   *  version, or INT_MIN if it isn't in any file.
+   */
+  int get_pin_priority(const pkgCache::VerIterator &ver) const
+  {
+    return pin_priorities[ver->ID];
+  }
+};
+
+/** \brief Return the resolver base of the current configuration and
+ *  the given cache, building it if necessary.
+ *
+ *  The base is rebuilt if the resolver hints in the configuration
+ *  change.  When the cache is reopened (for instance, after running
+ *  dpkg) with the same generation, the hint matches of the old base
+ *  are carried over to it; otherwise the base is rebuilt.
+ */
+std::shared_ptr<const aptitude_resolver_base>
+get_resolver_base(aptitudeDepCache *cache, pkgPolicy *policy);
+
 std::ostream &operator<<(std::ostream &out, const aptitude_resolver::hint &hint);
 
 #endif
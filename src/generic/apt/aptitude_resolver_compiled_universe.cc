@@ -0,0 +1,219 @@
+// aptitude_resolver_compiled_universe.cc                   -*-c++-*-
+//
+//   This program is free software; you can redistribute it and/or
+//   modify it under the terms of the GNU General Public License as
+//   published by the Free Software Foundation; either version 2 of
+//   the License, or (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//   General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program; see the file COPYING.  If not, write to
+//   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+//   Boston, MA 02110-1301, USA.
+
+#include "aptitude_resolver_compiled_universe.h"
+
+#include "apt.h"
+#include "config_signal.h"
+
+#include <aptitude.h>
+#include <loggers.h>
+
+#include <cwidget/generic/threads/threads.h>
+
+#include <sigc++/functors/ptr_fun.h>
+
+#include <sys/time.h>
+
+#include <atomic>
+
+using aptitude::Loggers;
+
+namespace
+{
+  cwidget::threads::mutex compiled_universe_mutex;
+  std::shared_ptr<const aptitude_compiled_universe> global_compiled_universe;
+  // The compiled universe that the adapter reads; always either
+  // NULL or global_compiled_universe.get().
+  std::atomic<const aptitude_compiled_universe *> active_compiled_universe(NULL);
+  bool compiled_universe_reset_connected = false;
+
+  void reset_compiled_universe()
+  {
+    cwidget::threads::mutex::lock l(compiled_universe_mutex);
+
+    active_compiled_universe.store(NULL);
+    global_compiled_universe.reset();
+  }
+}
+
+aptitude_compiled_universe::aptitude_compiled_universe(aptitudeDepCache *_cache)
+  : cache(_cache),
+    apt_dep_ids(_cache->Head().DependsCount, no_dep)
+{
+}
+
+unsigned int aptitude_compiled_universe::find_dep(const aptitude_resolver_dep &d) const
+{
+  const pkgCache::DepIterator apt_dep(d.get_dep());
+
+  if(d.prv == NULL || !is_conflict(apt_dep->Type))
+    return apt_dep_ids[apt_dep->ID];
+
+  const unsigned int prv_index = d.prv - cache->GetCache().ProvideP;
+  boost::unordered_map<std::pair<unsigned int, unsigned int>, unsigned int>::const_iterator
+    found = provides_conflict_ids.find(std::make_pair(static_cast<unsigned int>(apt_dep->ID),
+						      prv_index));
+  if(found == provides_conflict_ids.end())
+    return no_dep;
+  else
+    return found->second;
+}
+
+unsigned int aptitude_compiled_universe::intern_dep(const aptitude_resolver_dep &d)
+{
+  const unsigned int found = find_dep(d);
+  if(found != no_dep)
+    return found;
+
+  const unsigned int id = deps.size();
+  const pkgCache::DepIterator apt_dep(d.get_dep());
+  const bool conflict = is_conflict(apt_dep->Type);
+
+  if(d.prv == NULL || !conflict)
+    apt_dep_ids[apt_dep->ID] = id;
+  else
+    provides_conflict_ids[std::make_pair(static_cast<unsigned int>(apt_dep->ID),
+					 static_cast<unsigned int>(d.prv - cache->GetCache().ProvideP))] = id;
+  deps.push_back(d);
+
+  // Walk the cache explicitly: solvers_begin() would look the
+  // dependency up in the compiled universe that is being built.
+  aptitude_resolver_dep::solver_iterator si =
+    conflict
+    ? aptitude_resolver_dep::solver_iterator(d.start, d.prv, cache)
+    : aptitude_resolver_dep::solver_iterator(d.start, cache);
+  for( ; !si.end(); ++si)
+    {
+      const aptitude_resolver_version v(*si);
+      const unsigned int version_id = v.get_id();
+
+      versions[version_id] = v;
+      dep_solver_targets.push_back(version_id);
+    }
+  dep_solver_offsets.push_back(dep_solver_targets.size());
+
+  return id;
+}
+
+std::shared_ptr<const aptitude_compiled_universe>
+aptitude_compiled_universe::compile(aptitudeDepCache *cache)
+{
+  std::shared_ptr<aptitude_compiled_universe> rval(new aptitude_compiled_universe(cache));
+
+  const unsigned long version_count = cache->Head().VersionCount;
+  const unsigned long package_count = cache->Head().PackageCount;
+
+  // Versions are laid out in ID order; removals follow the real
+  // versions, as in aptitude_resolver_version::get_id().
+  std::vector<const pkgCache::Version *> apt_versions(version_count);
+  rval->versions.resize(version_count + package_count);
+  for(pkgCache::PkgIterator pkg = cache->PkgBegin(); !pkg.end(); ++pkg)
+    {
+      rval->versions[version_count + pkg->ID] =
+	aptitude_resolver_version::make_removal(pkg, cache);
+
+      for(pkgCache::VerIterator ver = pkg.VersionList(); !ver.end(); ++ver)
+	{
+	  apt_versions[ver->ID] = ver;
+	  rval->versions[ver->ID] = aptitude_resolver_version::make_install(ver, cache);
+	}
+    }
+
+  rval->version_dep_offsets.reserve(version_count + 1);
+  rval->version_dep_offsets.push_back(0);
+  rval->version_revdep_offsets.reserve(version_count + 1);
+  rval->version_revdep_offsets.push_back(0);
+  rval->dep_solver_offsets.push_back(0);
+
+  for(unsigned long id = 0; id < version_count; ++id)
+    {
+      const pkgCache::VerIterator ver(cache->GetCache(),
+				      const_cast<pkgCache::Version *>(apt_versions[id]));
+
+      for(aptitude_resolver_version::dep_iterator di(ver, cache);
+	  !di.end(); ++di)
+	rval->version_dep_targets.push_back(rval->intern_dep(*di));
+      rval->version_dep_offsets.push_back(rval->version_dep_targets.size());
+
+      for(aptitude_resolver_version::revdep_iterator rdi(ver, cache);
+	  !rdi.end(); ++rdi)
+	rval->version_revdep_targets.push_back(rval->intern_dep(*rdi));
+      rval->version_revdep_offsets.push_back(rval->version_revdep_targets.size());
+    }
+
+  return rval;
+}
+
+const aptitude_compiled_universe *
+aptitude_compiled_universe::find(const pkgDepCache *cache)
+{
+  const aptitude_compiled_universe *rval =
+    active_compiled_universe.load(std::memory_order_acquire);
+
+  if(rval != NULL && rval->cache == cache)
+    return rval;
+  else
+    return NULL;
+}
+
+std::shared_ptr<const aptitude_compiled_universe>
+get_compiled_universe(aptitudeDepCache *cache)
+{
+  logging::LoggerPtr logger(Loggers::getAptitudeResolver());
+
+  cwidget::threads::mutex::lock l(compiled_universe_mutex);
+
+  if(!compiled_universe_reset_connected)
+    {
+      cache_closed.connect(sigc::ptr_fun(reset_compiled_universe));
+      cache_reload_failed.connect(sigc::ptr_fun(reset_compiled_universe));
+      compiled_universe_reset_connected = true;
+    }
+
+  if(!aptcfg->FindB(PACKAGE "::ProblemResolver::Compile-Universe", true))
+    {
+      active_compiled_universe.store(NULL);
+      global_compiled_universe.reset();
+      return global_compiled_universe;
+    }
+
+  if(global_compiled_universe.get() == NULL ||
+     global_compiled_universe->get_cache() != cache)
+    {
+      // Stop the adapter from reading the old universe before it
+      // goes away.
+      active_compiled_universe.store(NULL);
+
+      timeval start, end;
+      gettimeofday(&start, 0);
+
+      global_compiled_universe = aptitude_compiled_universe::compile(cache);
+
+      gettimeofday(&end, 0);
+      LOG_INFO(logger, "Compiled the resolver universe in "
+	       << ((end.tv_sec - start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) / 1000)
+	       << "ms: " << global_compiled_universe->get_version_count() << " versions, "
+	       << global_compiled_universe->get_dep_count() << " dependencies, "
+	       << global_compiled_universe->get_solver_count() << " solver links.");
+
+      active_compiled_universe.store(global_compiled_universe.get(),
+				     std::memory_order_release);
+    }
+
+  return global_compiled_universe;
+}
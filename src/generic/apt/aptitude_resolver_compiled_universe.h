@@ -0,0 +1,180 @@
+// aptitude_resolver_compiled_universe.h              -*-c++-*-
+//
+//   This program is free software; you can redistribute it and/or
+//   modify it under the terms of the GNU General Public License as
+//   published by the Free Software Foundation; either version 2 of
+//   the License, or (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//   General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program; see the file COPYING.  If not, write to
+//   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+//   Boston, MA 02110-1301, USA.
+
+#ifndef APTITUDE_RESOLVER_COMPILED_UNIVERSE_H
+#define APTITUDE_RESOLVER_COMPILED_UNIVERSE_H
+
+#include "aptitude_resolver_universe.h"
+
+#include <boost/unordered_map.hpp>
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+/** \file aptitude_resolver_compiled_universe.h
+ *
+ *  A flattened copy of the dependency graph of an aptitude_universe.
+ *
+ *  Walking the aptitude_universe adapter recomputes the graph from
+ *  the APT cache every time: each call to solvers_begin(),
+ *  deps_begin() or revdeps_begin() re-runs the version comparisons
+ *  needed to decide which dependencies apply and which versions
+ *  satisfy them.  The compiled universe performs that work exactly
+ *  once, storing each relation as compressed sparse rows (an offsets
+ *  array and a targets array).
+ *
+ *  The adapter's iterators read the compiled universe of their cache
+ *  whenever one is available (see aptitude_compiled_universe::find()),
+ *  so the resolver and the code that inspects its results keep using
+ *  aptitude_resolver_version and aptitude_resolver_dep.  The graph
+ *  only depends on the contents of the package cache, so one compiled
+ *  universe is shared by every resolver until the cache is closed.
+ */
+
+/** \brief The dependency graph of a package cache, stored as flat
+ *  arrays indexed by integer identifiers.
+ *
+ *  Every relation "X has a list of Y" is stored as a pair of vectors
+ *  X_offsets and X_targets: the Ys of the X with identifier i are
+ *  X_targets[X_offsets[i]] through X_targets[X_offsets[i + 1] - 1].
+ *
+ *  Versions are identified by aptitude_resolver_version::get_id(),
+ *  so looking up the dependencies of a version is an array access.
+ *  Dependencies are numbered in the order in which they are
+ *  discovered; a dependency is found from its APT dependency ID, or
+ *  for a Conflicts/Breaks projected through a Provides, from that
+ *  pair of IDs.
+ */
+class aptitude_compiled_universe
+{
+  aptitudeDepCache *cache;
+
+  /** \brief The version corresponding to each version ID. */
+  std::vector<aptitude_resolver_version> versions;
+  /** \brief The forward dependencies of each real version. */
+  std::vector<unsigned int> version_dep_offsets;
+  std::vector<unsigned int> version_dep_targets;
+  /** \brief The reverse dependencies of each real version. */
+  std::vector<unsigned int> version_revdep_offsets;
+  std::vector<unsigned int> version_revdep_targets;
+
+  /** \brief The dependency corresponding to each dependency ID. */
+  std::vector<aptitude_resolver_dep> deps;
+  /** \brief The solvers of each dependency, in the order that the
+   *  adapter's solver_iterator produces them.
+   */
+  std::vector<unsigned int> dep_solver_offsets;
+  std::vector<unsigned int> dep_solver_targets;
+
+  /** \brief The ID of the dependency that starts with each APT
+   *  dependency, or no_dep.
+   *
+   *  For a Conflicts/Breaks, this is the ID of its direct part.
+   */
+  std::vector<unsigned int> apt_dep_ids;
+  /** \brief The IDs of Conflicts/Breaks projected through Provides,
+   *  keyed by the APT dependency ID and the index of the Provides.
+   */
+  boost::unordered_map<std::pair<unsigned int, unsigned int>, unsigned int> provides_conflict_ids;
+
+  static const unsigned int no_dep = static_cast<unsigned int>(-1);
+
+  explicit aptitude_compiled_universe(aptitudeDepCache *_cache);
+
+  /** \brief Find the ID of a dependency, or return no_dep. */
+  unsigned int find_dep(const aptitude_resolver_dep &d) const;
+
+  /** \brief Find the ID of a dependency, compiling it if it hasn't
+   *  been seen yet.
+   */
+  unsigned int intern_dep(const aptitude_resolver_dep &d);
+
+public:
+  /** \brief Compile the dependency graph of the given cache.
+   *
+   *  This walks every version and dependency in the cache exactly
+   *  once.  The cache must outlive the returned object.
+   */
+  static std::shared_ptr<const aptitude_compiled_universe>
+  compile(aptitudeDepCache *cache);
+
+  /** \brief Return the compiled universe that the adapter currently
+   *  uses for the given cache, or NULL if it walks the cache.
+   *
+   *  This is safe to call from any thread.
+   */
+  static const aptitude_compiled_universe *find(const pkgDepCache *cache);
+
+  aptitudeDepCache *get_cache() const { return cache; }
+
+  std::size_t get_version_count() const { return versions.size(); }
+  std::size_t get_dep_count() const { return deps.size(); }
+  std::size_t get_solver_count() const { return dep_solver_targets.size(); }
+
+  /** \brief Get the forward dependencies of the version with the
+   *  given ID, which must not be a removal.
+   */
+  aptitude_compiled_rows<aptitude_resolver_dep> get_deps(unsigned int version_id) const
+  {
+    eassert(version_id + 1 < version_dep_offsets.size());
+    return aptitude_compiled_rows<aptitude_resolver_dep>(deps.data(),
+							 version_dep_targets.data() + version_dep_offsets[version_id],
+							 version_dep_targets.data() + version_dep_offsets[version_id + 1]);
+  }
+
+  /** \brief Get the reverse dependencies of the version with the
+   *  given ID, which must not be a removal.
+   */
+  aptitude_compiled_rows<aptitude_resolver_dep> get_revdeps(unsigned int version_id) const
+  {
+    eassert(version_id + 1 < version_revdep_offsets.size());
+    return aptitude_compiled_rows<aptitude_resolver_dep>(deps.data(),
+							 version_revdep_targets.data() + version_revdep_offsets[version_id],
+							 version_revdep_targets.data() + version_revdep_offsets[version_id + 1]);
+  }
+
+  /** \brief Look up the solvers of a dependency.
+   *
+   *  \return \b true and set out if d is part of the compiled graph;
+   *  otherwise return \b false.
+   */
+  bool find_solvers(const aptitude_resolver_dep &d,
+		    aptitude_compiled_rows<aptitude_resolver_version> &out) const
+  {
+    const unsigned int id = find_dep(d);
+    if(id == no_dep)
+      return false;
+
+    out = aptitude_compiled_rows<aptitude_resolver_version>(versions.data(),
+							    dep_solver_targets.data() + dep_solver_offsets[id],
+							    dep_solver_targets.data() + dep_solver_offsets[id + 1]);
+    return true;
+  }
+};
+
+/** \brief Return the compiled universe of the given cache, compiling
+ *  it if necessary, and make the adapter use it.
+ *
+ *  The compiled universe is dropped when the cache is closed.  If
+ *  Aptitude::ProblemResolver::Compile-Universe is \b false, nothing is
+ *  compiled and this returns an empty pointer.
+ */
+std::shared_ptr<const aptitude_compiled_universe>
+get_compiled_universe(aptitudeDepCache *cache);
+
+#endif // APTITUDE_RESOLVER_COMPILED_UNIVERSE_H
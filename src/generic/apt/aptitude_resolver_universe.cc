@@ -5,6 +5,7 @@
 
 #include "aptitude_resolver_universe.h"
 
+#include "aptitude_resolver_compiled_universe.h"
 #include "config_signal.h"
 
 #include <generic/problemresolver/problemresolver.h>
@@ -503,6 +504,13 @@ aptitude_resolver_dep::solver_iterator &aptitude_resolver_dep::solver_iterator::
 {
   eassert(!end());
 
+  if(compiled.is_compiled())
+    {
+      ++compiled.curr;
+      finished = (compiled.curr == compiled.last);
+      return *this;
+    }
+
   // Advance whatever needs to be advanced next in the
   // sub-list.
 
@@ -523,10 +531,15 @@ aptitude_resolver_dep::solver_iterator &aptitude_resolver_dep::solver_iterator::
 
 aptitude_resolver_version::dep_iterator &aptitude_resolver_version::dep_iterator::operator++()
 {
-  eassert(!dep.end());
+  eassert(!end());
 
-  advance();
-  normalize();
+  if(compiled.is_compiled())
+    ++compiled.curr;
+  else
+    {
+      advance();
+      normalize();
+    }
 
   return *this;
 }
@@ -535,6 +548,9 @@ aptitude_resolver_version aptitude_resolver_dep::solver_iterator::operator*() co
 {
   eassert(!end());
 
+  if(compiled.is_compiled())
+    return compiled.table[*compiled.curr];
+
   if(!ver_lst.end())
     return aptitude_resolver_version::make_install(ver_lst, cache);
   else // In this case we're trying to remove some package or other.
@@ -553,6 +569,42 @@ aptitude_resolver_version aptitude_resolver_dep::solver_iterator::operator*() co
     }
 }
 
+aptitude_resolver_version::revdep_iterator aptitude_resolver_version::revdeps_begin() const
+{
+  const aptitude_compiled_universe *compiled =
+    aptitude_compiled_universe::find(cache);
+  if(compiled != NULL && is_version)
+    return revdep_iterator(compiled->get_revdeps(get_id()), cache);
+  else
+    return revdep_iterator(get_ver(), cache);
+}
+
+aptitude_resolver_version::dep_iterator aptitude_resolver_version::deps_begin() const
+{
+  if(!is_version)
+    return dep_iterator(cache);
+
+  const aptitude_compiled_universe *compiled =
+    aptitude_compiled_universe::find(cache);
+  if(compiled != NULL)
+    return dep_iterator(compiled->get_deps(get_id()), cache);
+  else
+    return dep_iterator(get_ver(), cache);
+}
+
+aptitude_resolver_dep::solver_iterator aptitude_resolver_dep::solvers_begin() const
+{
+  const aptitude_compiled_universe *compiled =
+    aptitude_compiled_universe::find(cache);
+  aptitude_compiled_rows<aptitude_resolver_version> solvers;
+  if(compiled != NULL && compiled->find_solvers(*this, solvers))
+    return solver_iterator(solvers, cache);
+  else if(!is_conflict(get_dep(start)->Type))
+    return solver_iterator(start, cache);
+  else
+    return solver_iterator(start, prv, cache);
+}
+
 void aptitude_universe::dep_iterator::normalize()
 {
   while(dep.end() && !pkg.end())
@@ -36,11 +36,44 @@
 
 #include <limits.h>
 
+#include <memory>
+
 /** \file aptitude_resolver_universe.h
  */
 
+class aptitude_compiled_universe;
 class aptitude_resolver_version;
 
+/** \brief A run of entries of one of the tables of an
+ *  aptitude_compiled_universe.
+ *
+ *  The entries are the identifiers curr through last - 1, each of
+ *  which indexes table.  A default-constructed object has no table;
+ *  iterators use that to tell whether they are reading a compiled
+ *  universe or walking the APT cache.
+ */
+template<typename T>
+struct aptitude_compiled_rows
+{
+  const T *table;
+  const unsigned int *curr;
+  const unsigned int *last;
+
+  aptitude_compiled_rows()
+    : table(NULL), curr(NULL), last(NULL)
+  {
+  }
+
+  aptitude_compiled_rows(const T *_table,
+			 const unsigned int *_curr,
+			 const unsigned int *_last)
+    : table(_table), curr(_curr), last(_last)
+  {
+  }
+
+  bool is_compiled() const { return table != NULL; }
+};
+
 /** \brief Translates an APT package into the abstract realm.
  *
  *  This class is a model of the \ref universe_package "Package concept".
@@ -389,6 +422,8 @@ class aptitude_resolver_dep
    *  is broken and/or when finding its solvers.
    */
   const pkgCache::Provides *prv;
+
+  friend class aptitude_compiled_universe;
 public:
   /** \brief Generate an invalid dependency object.
    */
@@ -652,6 +687,10 @@ class aptitude_resolver_version::revdep_iterator
   pkgCache::VerIterator ver;
   /** Whether we've started looking at provides yet. */
   bool provides_open;
+  /** If compiled, the reverse dependencies that remain to be
+   *  returned; the members above are unused in that case.
+   */
+  aptitude_compiled_rows<aptitude_resolver_dep> compiled;
 
   /** Advance to the next valid iterator. */
   void normalize();
@@ -696,6 +735,21 @@ public:
     normalize();
   }
 
+  /** \brief Generate a revdep_iterator that returns reverse
+   *  dependencies recorded by a compiled universe.
+   *
+   *  \param _compiled The reverse dependencies to return.
+   *
+   *  \param _cache The cache in which to operate.
+   */
+  revdep_iterator(const aptitude_compiled_rows<aptitude_resolver_dep> &_compiled,
+		  pkgDepCache *_cache)
+    :cache(_cache),
+     prv_lst(*_cache, 0, (pkgCache::Package *) 0),
+     provides_open(true), compiled(_compiled)
+  {
+  }
+
 //   bool operator==(const revdep_iterator &other) const
 //   {
 //     return dep == other.dep && ver == other.ver;
@@ -709,7 +763,10 @@ public:
   /** \brief Test whether this is an end iterator. */
   bool end() const
   {
-    return dep_lst.end();
+    if(compiled.is_compiled())
+      return compiled.curr == compiled.last;
+    else
+      return dep_lst.end();
   }
 
   /** \return The dependency at which this iterator currently
@@ -717,7 +774,10 @@ public:
    */
   aptitude_resolver_dep operator*() const
   {
-    return aptitude_resolver_dep(dep_lst, prv_lst, cache);
+    if(compiled.is_compiled())
+      return compiled.table[*compiled.curr];
+    else
+      return aptitude_resolver_dep(dep_lst, prv_lst, cache);
   }
 
   /** \brief Advance to the next entry in the list.
@@ -726,8 +786,13 @@ public:
    */
   revdep_iterator &operator++()
   {
-    ++dep_lst;
-    normalize();
+    if(compiled.is_compiled())
+      ++compiled.curr;
+    else
+      {
+	++dep_lst;
+	normalize();
+      }
 
     return *this;
   }
@@ -746,6 +811,10 @@ class aptitude_resolver_version::dep_iterator
    *  the packages providing its target.
    */
   bool prv_open;
+  /** If compiled, the dependencies that remain to be returned; the
+   *  members above are unused in that case.
+   */
+  aptitude_compiled_rows<aptitude_resolver_dep> compiled;
 
   /** \brief Walk forward on the full dependency graph (including
    *  things that we filter out at the high level, like self-depends)
@@ -796,6 +865,22 @@ public:
     normalize();
   }
 
+  /** \brief Create an iterator that returns dependencies recorded by
+   *  a compiled universe.
+   *
+   *  \param _compiled The dependencies to return.
+   *
+   *  \param _cache The cache in which to operate.
+   */
+  dep_iterator(const aptitude_compiled_rows<aptitude_resolver_dep> &_compiled,
+	       pkgDepCache *_cache)
+    :cache(_cache),
+     prv(*_cache, 0, (pkgCache::Package *) 0),
+     prv_open(false),
+     compiled(_compiled)
+  {
+  }
+
   /** \brief Assignment operator. */
   dep_iterator &operator=(const dep_iterator &other)
   {
@@ -803,6 +888,7 @@ public:
     dep=other.dep;
     prv=other.prv;
     prv_open=other.prv_open;
+    compiled=other.compiled;
 
     return *this;
   }
@@ -810,13 +896,19 @@ public:
   /** \return The dependency at which this iterator currently points. */
   aptitude_resolver_dep operator*() const
   {
-    return aptitude_resolver_dep(dep, prv, cache);
+    if(compiled.is_compiled())
+      return compiled.table[*compiled.curr];
+    else
+      return aptitude_resolver_dep(dep, prv, cache);
   }
 
   /** \brief Test whether this is an end iterator. */
   bool end() const
   {
-    return dep.end();
+    if(compiled.is_compiled())
+      return compiled.curr == compiled.last;
+    else
+      return dep.end();
   }
 
   /** \brief Advance to the next dependency of this version.
@@ -826,19 +918,6 @@ public:
   dep_iterator &operator++();
 };
 
-inline aptitude_resolver_version::revdep_iterator aptitude_resolver_version::revdeps_begin() const
-{
-  return revdep_iterator(get_ver(), cache);
-}
-
-inline aptitude_resolver_version::dep_iterator aptitude_resolver_version::deps_begin() const
-{
-  if(!is_version)
-    return dep_iterator(cache);
-  else
-    return dep_iterator(get_ver(), cache);
-}
-
 /** \brief Iterates over the targets of a dependency.
  *
  *  \sa aptitude_resolver_dep
@@ -855,6 +934,10 @@ class aptitude_resolver_dep::solver_iterator
    *          move to the next OR group)
    */
   bool finished;
+  /** If compiled, the solvers that remain to be returned; the members
+   *  above are unused in that case.
+   */
+  aptitude_compiled_rows<aptitude_resolver_version> compiled;
 
   /** Advance to the next interesting version/provides -- i.e., skip
    *  uninteresting ones.
@@ -920,6 +1003,22 @@ public:
     normalize();
   }
 
+  /** \brief Initialize a solution iterator that returns the solvers
+   *  recorded by a compiled universe.
+   *
+   *  \param _compiled The solvers to return.
+   *
+   *  \param _cache The package cache in which to work.
+   */
+  solver_iterator(const aptitude_compiled_rows<aptitude_resolver_version> &_compiled,
+		  pkgDepCache *_cache)
+    :cache(_cache),
+     prv_lst(*_cache, 0, (pkgCache::Package *) 0),
+     finished(_compiled.curr == _compiled.last),
+     compiled(_compiled)
+  {
+  }
+
 #if 0
   solver_iterator()
     :cache(0),
@@ -935,6 +1034,7 @@ public:
     return dep_lst == other.dep_lst &&
       ver_lst == other.ver_lst &&
       prv_lst == other.prv_lst &&
+      compiled.curr == other.compiled.curr &&
       finished == other.finished;
   }
 
@@ -944,6 +1044,7 @@ public:
     return dep_lst != other.dep_lst ||
       ver_lst != other.ver_lst ||
       prv_lst != other.prv_lst ||
+      compiled.curr != other.compiled.curr ||
       finished != other.finished;
   }
 
@@ -963,14 +1064,6 @@ public:
   }
 };
 
-inline aptitude_resolver_dep::solver_iterator aptitude_resolver_dep::solvers_begin() const
-{
-  if(!is_conflict(get_dep(start)->Type))
-    return solver_iterator(start, cache);
-  else
-    return solver_iterator(start, prv, cache);
-}
-
 template<typename InstallationType>
 bool aptitude_resolver_dep::broken_under(const InstallationType &I) const
 {
@@ -1111,11 +1204,17 @@ std::ostream &operator<<(std::ostream &out, const cfg_level &level);
 /** \brief This class translates an APT package system into the
  *  abstract package system as described in \ref abstract_universe.
  *
+ *  If the universe holds a compiled copy of the dependency graph,
+ *  the iterators of its versions and dependencies read that copy
+ *  instead of walking the cache; see
+ *  aptitude_resolver_compiled_universe.h.
+ *
  *  \sa \ref universe_universe
  */
 class aptitude_universe
 {
   aptitudeDepCache *cache;
+  std::shared_ptr<const aptitude_compiled_universe> compiled;
 
   aptitude_universe();
 public:
@@ -1128,6 +1227,19 @@ public:
   {
   }
 
+  /** \brief Create a universe that keeps the given compiled
+   *  dependency graph alive while it is in use.
+   *
+   *  \param _cache The package cache.
+   *  \param _compiled The compiled graph of _cache, as returned by
+   *  get_compiled_universe(); may be empty.
+   */
+  aptitude_universe(aptitudeDepCache *_cache,
+		    const std::shared_ptr<const aptitude_compiled_universe> &_compiled)
+    :cache(_cache), compiled(_compiled)
+  {
+  }
+
   aptitudeDepCache *get_cache() const {return cache;}
 
   /** \brief Iterate over all the packages in the universe. */
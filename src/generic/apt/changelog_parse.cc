@@ -18,15 +18,14 @@
 //   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
 //   Boston, MA 02110-1301, USA.
 //
-// At the moment this code uses parsechangelog to convert changelogs
-// into something easier to read.
+// Changelogs are parsed here directly, following the format that
+// dpkg-parsechangelog accepts.
 
 #include "changelog_parse.h"
 
 #include "apt.h"
 #include "desc_render.h"
 
-#include <generic/util/file_cache.h>
 #include <generic/util/job_queue_thread.h>
 #include <generic/util/temp.h>
 #include <generic/util/util.h>
@@ -36,12 +35,13 @@
 #include <cwidget/generic/util/transcode.h>
 
 #include <apt-pkg/fileutl.h>
-#include <apt-pkg/tagfile.h>
+#include <apt-pkg/pkgsystem.h>
 #include <apt-pkg/strutl.h>
+#include <apt-pkg/version.h>
 
 #include <memory>
 
-#include <cstdlib>
+#include <cstring>
 
 namespace cw = cwidget;
 
@@ -268,91 +268,325 @@ namespace aptitude
       return changelog_element_list::create(elements);
     }
 
-    changelog::changelog(FileFd &digest)
+    namespace
     {
-      if(digest.IsOpen())
-	{
-	  pkgTagFile tagfile(&digest);
+      /** \brief Read one line of a changelog, without its trailing
+       *  newline.
+       *
+       *  \return \b false if the end of the file was reached before
+       *  any text was read.
+       */
+      bool read_changelog_line(FileFd &file, std::string &line)
+      {
+	line.clear();
+
+	char buf[1024];
+	while(file.ReadLine(buf, sizeof(buf)) != NULL)
+	  {
+	    const std::string::size_type len = strlen(buf);
+	    if(len == 0)
+	      break;
+	    else if(buf[len - 1] == '\n')
+	      {
+		line.append(buf, len - 1);
+		return true;
+	      }
+	    else
+	      line.append(buf, len);
+	  }
+
+	return !line.empty();
+      }
+
+      /** \brief Return \b true if the given line contains only
+       *  whitespace.
+       */
+      bool is_blank_line(const std::string &line)
+      {
+	for(std::string::const_iterator it = line.begin(); it != line.end(); ++it)
+	  if(!isspace(*it))
+	    return false;
+
+	return true;
+      }
 
-	  pkgTagSection sec;
+      std::string trim_whitespace(const std::string &s,
+				  std::string::size_type start,
+				  std::string::size_type end)
+      {
+	while(start < end && isspace(s[start]))
+	  ++start;
+	while(end > start && isspace(s[end - 1]))
+	  --end;
 
-	  std::vector<cw::fragment *> fragments;
+	return std::string(s, start, end - start);
+      }
 
-	  while(tagfile.Step(sec))
+      /** \brief The parts of a changelog entry that have been read so
+       *  far.
+       */
+      struct pending_changelog_entry
+      {
+	std::string source;
+	std::string version;
+	std::string distribution;
+	std::string urgency;
+	std::string header;
+	std::string maintainer;
+	std::string date;
+	// The lines of the entry's body, excluding any blank lines
+	// before the first line of text.
+	std::vector<std::string> lines;
+      };
+
+      /** \brief Parse an entry header, which looks like
+       *
+       *  source (version) distribution...; urgency=value, ...
+       *
+       *  \return \b false if the line isn't an entry header.
+       */
+      bool parse_changelog_header(const std::string &line,
+				  pending_changelog_entry &entry)
+      {
+	if(line.empty() || !isalnum(line[0]))
+	  return false;
+
+	const std::string::size_type source_end = line.find(' ');
+	if(source_end == std::string::npos ||
+	   source_end + 1 >= line.size() || line[source_end + 1] != '(')
+	  return false;
+
+	const std::string::size_type version_start = source_end + 2;
+	const std::string::size_type version_end = line.find(')', version_start);
+	if(version_end == std::string::npos || version_end == version_start)
+	  return false;
+
+	const std::string::size_type semicolon = line.find(';', version_end);
+	if(semicolon == std::string::npos)
+	  return false;
+
+	entry.source.assign(line, 0, source_end);
+	entry.version.assign(line, version_start, version_end - version_start);
+	if(entry.version.find_first_of(" \t(") != std::string::npos)
+	  return false;
+
+	// Collapse the whitespace between distributions.
+	entry.distribution.clear();
+	{
+	  std::string::size_type i = version_end + 1;
+	  while(i < semicolon)
 	    {
-	      std::string source(sec.FindS("Source"));
-	      std::string version(sec.FindS("Version"));
-	      std::string distribution(sec.FindS("Distribution"));
-	      std::string urgency(sec.FindS("Urgency"));
-	      std::string changes(sec.FindS("Changes"));
-	      std::string maintainer(sec.FindS("Maintainer"));
-	      std::string date(sec.FindS("Date"));
-
-	      cw::util::ref_ptr<changelog_element_list> changelog_elements =
-		parse_changes(changes);
-
-	      entries.push_back(changelog_entry::create(source,
-							version,
-							distribution,
-							urgency,
-							changes,
-							changelog_elements,
-							maintainer,
-							date));
+	      while(i < semicolon && isspace(line[i]))
+		++i;
+
+	      const std::string::size_type word_start = i;
+	      while(i < semicolon && !isspace(line[i]))
+		++i;
+
+	      if(i > word_start)
+		{
+		  if(!entry.distribution.empty())
+		    entry.distribution += ' ';
+		  entry.distribution.append(line, word_start, i - word_start);
+		}
 	    }
-
-	  filename = digest.Name();
 	}
-    }
 
-    cw::util::ref_ptr<changelog> parse_digested_changelog(const temp::name &digested)
-    {
-      if(!digested.valid())
-	return NULL;
-      else
+	if(entry.distribution.empty())
+	  return false;
+
+	// Find the urgency among the comma-separated keywords.
+	entry.urgency.clear();
 	{
-	  FileFd digestedfd(digested.get_name(),
-			    FileFd::ReadOnly);
-	  if(!digestedfd.IsOpen())
-	    return NULL;
-	  else
-	    return changelog::create(digestedfd);
+	  std::string::size_type i = semicolon + 1;
+	  while(i < line.size())
+	    {
+	      std::string::size_type keyword_end = line.find(',', i);
+	      if(keyword_end == std::string::npos)
+		keyword_end = line.size();
+
+	      const std::string::size_type equals = line.find('=', i);
+	      if(equals < keyword_end &&
+		 strcasecmp(trim_whitespace(line, i, equals).c_str(), "urgency") == 0)
+		{
+		  std::string urgency(trim_whitespace(line, equals + 1, keyword_end));
+		  // Drop any comment after the urgency itself.
+		  const std::string::size_type space = urgency.find_first_of(" \t");
+		  if(space != std::string::npos)
+		    urgency.erase(space);
+
+		  for(std::string::iterator it = urgency.begin(); it != urgency.end(); ++it)
+		    *it = tolower(*it);
+
+		  entry.urgency = urgency;
+		}
+
+	      i = keyword_end + 1;
+	    }
 	}
+
+	entry.header = trim_whitespace(line, 0, line.size());
+	entry.maintainer.clear();
+	entry.date.clear();
+	entry.lines.clear();
+
+	return true;
+      }
+
+      /** \brief Parse an entry trailer, which looks like
+       *
+       *   -- Maintainer <email>  date
+       *
+       *  \return \b false if the line isn't an entry trailer.
+       */
+      bool parse_changelog_trailer(const std::string &line,
+				   pending_changelog_entry &entry)
+      {
+	if(line.compare(0, 4, " -- ") != 0)
+	  return false;
+
+	const std::string::size_type email_end = line.find('>', 4);
+	if(email_end == std::string::npos)
+	  {
+	    entry.maintainer = trim_whitespace(line, 4, line.size());
+	    entry.date.clear();
+	  }
+	else
+	  {
+	    entry.maintainer = trim_whitespace(line, 4, email_end + 1);
+	    entry.date = trim_whitespace(line, email_end + 1, line.size());
+	  }
+
+	return true;
+      }
+
+      /** \brief Return \b true if the line starts the free-form text
+       *  that may follow the entries of a changelog.
+       */
+      bool is_changelog_end(const std::string &line)
+      {
+	return
+	  strncasecmp(line.c_str(), "local variables:", 16) == 0 ||
+	  strncasecmp(line.c_str(), "old changelog:", 14) == 0;
+      }
+
+      /** \brief Build a changelog_entry from the parts that were read.
+       *
+       *  The text of the entry is laid out the way it used to be in
+       *  the output of parsechangelog, which is what parse_changes()
+       *  and the changelog renderers expect: the header line, then
+       *  each line of the body indented by one space, with blank
+       *  lines replaced by " .".
+       */
+      cw::util::ref_ptr<changelog_entry>
+      make_changelog_entry(const pending_changelog_entry &entry)
+      {
+	std::vector<std::string>::size_type num_lines = entry.lines.size();
+	while(num_lines > 0 && is_blank_line(entry.lines[num_lines - 1]))
+	  --num_lines;
+
+	std::string changes(entry.header);
+	if(num_lines > 0)
+	  changes += "\n .";
+	for(std::vector<std::string>::size_type i = 0; i < num_lines; ++i)
+	  {
+	    if(is_blank_line(entry.lines[i]))
+	      changes += "\n .";
+	    else
+	      {
+		changes += "\n ";
+		changes += entry.lines[i];
+	      }
+	  }
+
+	return changelog_entry::create(entry.source,
+				       entry.version,
+				       entry.distribution,
+				       entry.urgency,
+				       changes,
+				       parse_changes(changes),
+				       entry.maintainer,
+				       entry.date);
+      }
     }
 
-    temp::name digest_changelog(const std::string& filename,
-				const std::string &from)
+    cw::util::ref_ptr<changelog> parse_changelog(FileFd &file,
+						 const std::string &from)
     {
-      temp::name rval("parsedchangelog");
+      if(!file.IsOpen())
+	return NULL;
 
-      std::string version_fragment;
-      if(from.empty())
-	version_fragment = "--all";
-      else
+      std::vector<cw::util::ref_ptr<changelog_entry> > entries;
+      pending_changelog_entry entry;
+      bool in_entry = false;
+      bool found_header = false;
+      // Set when the entry being read is the last one to return.
+      bool last_entry = false;
+
+      std::string line;
+      while(read_changelog_line(file, line))
 	{
-	  version_fragment = "-f ";
-	  // Note that escaping the version is *critical*, because
-	  // it is untrusted data.
-	  version_fragment += backslash_escape_nonalnum(from);
+	  if(!line.empty() && !isspace(line[0]))
+	    {
+	      if(is_changelog_end(line))
+		break;
+
+	      pending_changelog_entry next;
+	      if(!parse_changelog_header(line, next))
+		continue;
+
+	      // An entry without a trailer; keep it anyway.
+	      if(in_entry)
+		entries.push_back(make_changelog_entry(entry));
+	      in_entry = false;
+	      found_header = true;
+
+	      if(last_entry)
+		break;
+
+	      if(!from.empty())
+		{
+		  const int cmp = _system->VS->CmpVersion(next.version, from);
+		  if(cmp < 0)
+		    break;
+		  else if(cmp == 0)
+		    last_entry = true;
+		}
+
+	      entry = next;
+	      in_entry = true;
+	    }
+	  else if(!in_entry)
+	    continue;
+	  else if(parse_changelog_trailer(line, entry))
+	    {
+	      entries.push_back(make_changelog_entry(entry));
+	      in_entry = false;
+
+	      if(last_entry)
+		break;
+	    }
+	  else if(!entry.lines.empty() || !is_blank_line(line))
+	    entry.lines.push_back(line);
 	}
 
-      std::string cmd =
-	cw::util::ssprintf("/usr/bin/parsechangelog --format rfc822 %s -l %s > %s 2> /dev/null",
-			   version_fragment.c_str(),
-			   filename.c_str(),
-			   rval.get_name().c_str());
+      if(in_entry)
+	entries.push_back(make_changelog_entry(entry));
 
-      if(system(cmd.c_str()) == 0)
-	return rval;
+      if(!found_header || file.Failed())
+	return NULL;
       else
-	return temp::name();
+	return changelog::create(entries, file.Name());
     }
 
     cw::util::ref_ptr<changelog> parse_changelog(const std::string& filename,
 						 const std::string &from)
     {
-      temp::name digested = digest_changelog(filename, from);
-      return parse_digested_changelog(digested);
+      FileFd file;
+      if(!file.Open(filename, FileFd::ReadOnly, FileFd::Auto))
+	return NULL;
+      else
+	return parse_changelog(file, from);
     }
 
 
@@ -374,7 +608,6 @@ namespace aptitude
 	const std::string to;
 	const std::string source_package;
 	post_thunk_f post_thunk;
-	bool digested;
 
       public:
 	parse_changelog_job(const temp::name &_name,
@@ -382,12 +615,10 @@ namespace aptitude
 			    const std::string &_from,
 			    const std::string &_to,
 			    const std::string &_source_package,
-			    bool _digested,
 			    post_thunk_f _post_thunk)
 	  : name(_name), slot(_slot), from(_from),
 	    to(_to), source_package(_source_package),
-	    post_thunk(_post_thunk),
-	    digested(_digested)
+	    post_thunk(_post_thunk)
 	{
 	}
 
@@ -401,13 +632,6 @@ namespace aptitude
 	const std::string &get_to() const { return to; }
 	/** \brief Return the source package whose changelog is being parsed. */
 	const std::string &get_source_package() const { return source_package; }
-	/** \brief Return \b true if the input file has already been
-	 *  passed through digest_changelog().
-	 *
-	 *  This is true, for instance, when retrieving a digested
-	 *  changelog from the cache.
-	 */
-	bool get_digested() const { return digested; }
 	/** \brief Get the function used to post thunks to the main
 	 *  thread.
 	 */
@@ -423,7 +647,6 @@ namespace aptitude
 	  << ", from=" << job->get_from()
 	  << ", to=" << job->get_to()
 	  << ", source_package=" << job->get_source_package()
-	  << ", digested=" << (job->get_digested() ? "true" : "false")
 	  << ")";
       }
 
@@ -431,8 +654,7 @@ namespace aptitude
        *
        *  The purpose of the queue is to ensure that aptitude only
        *  parses one changelog at a time and doesn't waste a ton of time
-       *  starting new changelog parse threads and spawning copies of
-       *  parsechangelog.
+       *  starting new changelog parse threads.
        *
        *  This is a self-terminating singleton thread.
        */
@@ -461,38 +683,13 @@ namespace aptitude
 
 	void process_job(const std::shared_ptr<parse_changelog_job> &job)
 	{
-	  std::string changelog_uri;
-	  if(job->get_from().empty())
-	    changelog_uri = ssprintf("changelog://%s/%s",
-				     job->get_source_package().c_str(),
-				     job->get_to().c_str());
-	  else
-	    changelog_uri = ssprintf("delta-changelog://%s/%s/%s",
-				     job->get_source_package().c_str(),
-				     job->get_from().c_str(),
-				     job->get_to().c_str());
-
-	  temp::name digested;
-	  if(job->get_digested())
-	    digested = job->get_name();
-	  else
-	    digested = aptitude::apt::digest_changelog(job->get_name().get_name(), job->get_from());
-
-	  // Note that we don't re-cache the digested
-	  // changelog if it was retrieved from the cache
-	  // earlier (i.e., if job->get_digested() is true).
-	  if(digested.valid() && !job->get_digested())
-	    {
-	      LOG_TRACE(get_log_category(),
-			"Caching digested changelog as " << changelog_uri);
-
-	      auto download_cache = get_download_cache();
-	      if (download_cache)
-		download_cache->putItem(changelog_uri, digested.get_name());
-	    }
+	  // The raw changelog is already in the download cache, and
+	  // parsing it again is cheap, so nothing is cached here.
+	  cw::util::ref_ptr<aptitude::apt::changelog> parsed;
+	  if(job->get_name().valid())
+	    parsed = aptitude::apt::parse_changelog(job->get_name().get_name(),
+						    job->get_from());
 
-	  cw::util::ref_ptr<aptitude::apt::changelog> parsed =
-	    aptitude::apt::parse_digested_changelog(digested);
 	  job->get_post_thunk()(sigc::bind(sigc::ptr_fun(&invoke_safe_slot),
 					   safe_bind(job->get_slot(), parsed)));
 	}
@@ -505,7 +702,6 @@ namespace aptitude
 				    const std::string &from,
 				    const std::string &to,
 				    const std::string &source_package,
-				    bool digested,
 				    post_thunk_f post_thunk)
     {
       std::shared_ptr<parse_changelog_job> job =
@@ -514,7 +710,6 @@ namespace aptitude
 					      from,
 					      to,
 					      source_package,
-					      digested,
 					      post_thunk);
 
       parse_changelog_thread::add_job(job);
@@ -29,6 +29,7 @@
 
 #include <cwidget/generic/util/ref_ptr.h>
 
+#include <string>
 #include <vector>
 
 #include <ctime>
@@ -210,12 +211,22 @@ namespace aptitude
 
       std::string filename;
 
-      changelog(FileFd &file);
+
+      changelog(const std::vector<cwidget::util::ref_ptr<changelog_entry> > &_entries,
+		const std::string &_filename)
+	: entries(_entries), filename(_filename)
+      {
+      }
 
     public:
-      static cwidget::util::ref_ptr<changelog> create(FileFd &file)
+      /** \brief Create a changelog from entries that were already
+       *  parsed.
+       */
+      static cwidget::util::ref_ptr<changelog>
+      create(const std::vector<cwidget::util::ref_ptr<changelog_entry> > &entries,
+	     const std::string &filename)
       {
-	return new changelog(file);
+	return new changelog(entries, filename);
       }
 
       /** \brief The type of an iterator over this changelog. */
@@ -229,24 +240,32 @@ namespace aptitude
       std::string get_filename() const { return filename; }
     };
 
-    /** \brief Given a Debian changelog, parse it and generate a new
-     *  file containing the changelog in an RFC822-style format.
-     */
-    temp::name digest_changelog(const std::string& filename,
-				const std::string &from);
-
-    /** \brief Given a digested changelog as produced by
-     *  digest_changelog, parse it into a changelog structure.
+    /** \brief Parse a Debian changelog from an open file.
+     *
+     *  The changelog is read one line at a time, and reading stops as
+     *  soon as \b from has been reached, so only the part of the file
+     *  that is returned is read.
+     *
+     *  \param file  the file containing the changelog.  If it was
+     *               opened with FileFd::Auto, it may be compressed.
+     *
+     *  \param from  a string giving the earliest version that is to
+     *               be included in the changelog.  If non-empty,
+     *               parsing stops after the first entry for this
+     *               version, or before the first entry for an earlier
+     *               version.
+     *
+     *  \return the parsed changelog, or \b NULL if the file doesn't
+     *  look like a Debian changelog.
      */
-    cwidget::util::ref_ptr<changelog> parse_digested_changelog(const temp::name &digested);
+    cwidget::util::ref_ptr<changelog> parse_changelog(FileFd &file,
+						      const std::string &from = "");
 
     /** Parse the contents of the given file as a Debian changelog.
-     *  for some reason the file cannot be parsed, returns \b NULL.
+     *  If for some reason the file cannot be parsed, returns \b NULL.
      *
-     *  \param file a temporary file object containing the changelog.  A
-     *         second temporary file will be created in the parent
-     *         directory of this file, in which an intermediate form of
-     *         the changelog will be stored.
+     *  \param filename  the name of the file containing the changelog;
+     *                   it may be compressed.
      *
      *  \param from   a string giving the earliest version
      *                that is to be included in the changelog.
@@ -270,8 +289,6 @@ namespace aptitude
      *              to parse until the end of the changelog.
      *  \param source_package The name of the source package whose
      *                        changelog is being parsed.
-     *  \param digested       True if the changelog was already
-     *                        digested.
      *  \param post_thunk     A function that should be used to post
      *                        thunks to the main thread.
      */
@@ -280,7 +297,6 @@ namespace aptitude
 				    const std::string &from,
 				    const std::string &to,
 				    const std::string &source_package,
-				    bool digested,
 				    post_thunk_f post_thunk);
   }
 }
@@ -265,6 +265,12 @@ void download_install_manager::finish_post_dpkg(pkgPackageManager::OrderResult d
       // world.
       //
       // This implicitly updates the package state file on disk.
+      //
+      // It's cheaper than a first load: unless the package lists
+      // changed, apt only re-reads the dpkg status file on top of its
+      // saved source cache, and data derived from the lists alone
+      // (such as the tag database) is kept if the new cache has the
+      // same generation as the old one.
       if(!download_only)
 	{
 	  bool operation_needs_lock = true;
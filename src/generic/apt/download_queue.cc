@@ -391,21 +391,32 @@ namespace aptitude
     {
       std::shared_ptr<download_job> job;
       sigc::slot<void> destroy;
+      bool store_in_cache;
 
     public:
       active_download_info(const std::shared_ptr<download_job> &_job,
 			   const sigc::slot<void> &_destroy)
 	: job(_job),
-	  destroy(_destroy)
+	  destroy(_destroy),
+	  store_in_cache(false)
       {
       }
 
-      active_download_info(const std::shared_ptr<download_job> &_job)
-	: job(_job)
+      /** \brief Track a download that has no item of our own.
+       *
+       *  \param _store_in_cache  If \b true, the downloaded file is
+       *                          added to the download cache when it
+       *                          has been fetched.
+       */
+      active_download_info(const std::shared_ptr<download_job> &_job,
+			   bool _store_in_cache)
+	: job(_job),
+	  store_in_cache(_store_in_cache)
       {
       }
 
       const std::shared_ptr<download_job> &get_job() const { return job; }
+      bool get_store_in_cache() const { return store_in_cache; }
       void destroy_item() {
 	if (!destroy.empty()) {
 	  destroy();
@@ -713,6 +724,20 @@ namespace aptitude
 
 		      job->invoke_success(new_filename);
 		      job->mark_finished();
+
+		      // Items that we queued ourselves store themselves
+		      // in the cache, along with their modification
+		      // time.  Write to the cache without holding the
+		      // lock, since it can take a while.
+		      if (it.second->get_store_in_cache())
+			{
+			  const std::string uri = job->get_uri();
+			  l.release();
+
+			  auto download_cache = get_download_cache();
+			  if (download_cache)
+			    download_cache->putItem(uri, itemdesc.Owner->DestFile);
+			}
 		    }
 		  else
 		    {
@@ -882,8 +907,10 @@ namespace aptitude
 	    new pkgAcqChangelog(&acquireQueue, req.get_uri(), pkg_name.c_str(), pkg_version.c_str(),
 				"", req.get_filename());
 
+	    // Changelogs are fetched by name and version, so the
+	    // cached copy never needs to be refreshed.
 	    std::shared_ptr<active_download_info> download =
-	      std::make_shared<active_download_info>(job);
+	      std::make_shared<active_download_info>(job, true);
 
 	    active_downloads[req.get_uri()] = download;
 
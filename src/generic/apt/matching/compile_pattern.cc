@@ -0,0 +1,498 @@
+// compile_pattern.cc    -*-c++-*-
+//
+//   This program is free software; you can redistribute it and/or
+//   modify it under the terms of the GNU General Public License as
+//   published by the Free Software Foundation; either version 2 of
+//   the License, or (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//   General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program; see the file COPYING.  If not, write to
+//   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+//   Boston, MA 02110-1301, USA.
+
+#include "compile_pattern.h"
+
+#include "pattern.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+using cwidget::util::ref_ptr;
+
+namespace aptitude
+{
+  namespace matching
+  {
+    namespace
+    {
+      /** \brief Terms that only test flags or pointers in the
+       *  package cache.
+       */
+      const int flag_cost = 1;
+
+      /** \brief Terms that test a string stored in the package
+       *  cache.
+       */
+      const int string_cost = 4;
+
+      /** \brief Terms that look up the package records, the debtags
+       *  or the Xapian index.
+       */
+      const int record_cost = 32;
+
+      /** \brief Terms that follow dependencies or Provides and run a
+       *  sub-search on what they find.
+       */
+      const int traversal_cost = 128;
+
+      int sum_pattern_costs(const std::vector<ref_ptr<pattern> > &patterns)
+      {
+	int rval = 0;
+
+	for(std::vector<ref_ptr<pattern> >::const_iterator it =
+	      patterns.begin(); it != patterns.end(); ++it)
+	  rval += estimate_pattern_cost(*it);
+
+	return rval;
+      }
+
+      struct compare_by_cost
+      {
+	bool operator()(const std::pair<int, ref_ptr<pattern> > &p1,
+			const std::pair<int, ref_ptr<pattern> > &p2) const
+	{
+	  return p1.first < p2.first;
+	}
+      };
+
+      /** \brief Compile each of the given patterns and, unless one
+       *  of them contains a ?for, sort them by increasing cost.
+       */
+      std::vector<ref_ptr<pattern> >
+      compile_commutative_patterns(const std::vector<ref_ptr<pattern> > &patterns)
+      {
+	std::vector<std::pair<int, ref_ptr<pattern> > > costs;
+	bool reorder = true;
+
+	for(std::vector<ref_ptr<pattern> >::const_iterator it =
+	      patterns.begin(); it != patterns.end(); ++it)
+	  {
+	    if(pattern_contains_for(*it))
+	      reorder = false;
+
+	    const ref_ptr<pattern> compiled(compile_pattern(*it));
+	    costs.push_back(std::make_pair(estimate_pattern_cost(compiled), compiled));
+	  }
+
+	// Stable, so that terms of equal cost keep the order that the
+	// user wrote them in.
+	if(reorder)
+	  std::stable_sort(costs.begin(), costs.end(), compare_by_cost());
+
+	std::vector<ref_ptr<pattern> > rval;
+	rval.reserve(costs.size());
+	for(std::vector<std::pair<int, ref_ptr<pattern> > >::const_iterator it =
+	      costs.begin(); it != costs.end(); ++it)
+	  rval.push_back(it->second);
+
+	return rval;
+      }
+    }
+
+    bool pattern_contains_for(const ref_ptr<pattern> &p)
+    {
+      switch(p->get_type())
+	{
+	case pattern::for_tp:
+	  return true;
+
+	case pattern::all_versions:
+	  return pattern_contains_for(p->get_all_versions_pattern());
+
+	case pattern::and_tp:
+	  {
+	    const std::vector<ref_ptr<pattern> > &sub_patterns(p->get_and_patterns());
+	    return std::find_if(sub_patterns.begin(), sub_patterns.end(),
+				pattern_contains_for) != sub_patterns.end();
+	  }
+
+	case pattern::any_version:
+	  return pattern_contains_for(p->get_any_version_pattern());
+
+	case pattern::bind:
+	  return pattern_contains_for(p->get_bind_pattern());
+
+	case pattern::depends:
+	  return pattern_contains_for(p->get_depends_pattern());
+
+	case pattern::narrow:
+	  return
+	    pattern_contains_for(p->get_narrow_filter()) ||
+	    pattern_contains_for(p->get_narrow_pattern());
+
+	case pattern::not_tp:
+	  return pattern_contains_for(p->get_not_pattern());
+
+	case pattern::or_tp:
+	  {
+	    const std::vector<ref_ptr<pattern> > &sub_patterns(p->get_or_patterns());
+	    return std::find_if(sub_patterns.begin(), sub_patterns.end(),
+				pattern_contains_for) != sub_patterns.end();
+	  }
+
+	case pattern::provides:
+	  return pattern_contains_for(p->get_provides_pattern());
+
+	case pattern::reverse_depends:
+	  return pattern_contains_for(p->get_reverse_depends_pattern());
+
+	case pattern::reverse_provides:
+	  return pattern_contains_for(p->get_reverse_provides_pattern());
+
+	case pattern::widen:
+	  return pattern_contains_for(p->get_widen_pattern());
+
+	default:
+	  return false;
+	}
+    }
+
+    bool pattern_uses_stack(const ref_ptr<pattern> &p)
+    {
+      switch(p->get_type())
+	{
+	case pattern::bind:
+	case pattern::equal:
+	case pattern::for_tp:
+	  return true;
+
+	case pattern::all_versions:
+	  return pattern_uses_stack(p->get_all_versions_pattern());
+
+	case pattern::and_tp:
+	  {
+	    const std::vector<ref_ptr<pattern> > &sub_patterns(p->get_and_patterns());
+	    return std::find_if(sub_patterns.begin(), sub_patterns.end(),
+				pattern_uses_stack) != sub_patterns.end();
+	  }
+
+	case pattern::any_version:
+	  return pattern_uses_stack(p->get_any_version_pattern());
+
+	case pattern::depends:
+	  return pattern_uses_stack(p->get_depends_pattern());
+
+	case pattern::narrow:
+	  return
+	    pattern_uses_stack(p->get_narrow_filter()) ||
+	    pattern_uses_stack(p->get_narrow_pattern());
+
+	case pattern::not_tp:
+	  return pattern_uses_stack(p->get_not_pattern());
+
+	case pattern::or_tp:
+	  {
+	    const std::vector<ref_ptr<pattern> > &sub_patterns(p->get_or_patterns());
+	    return std::find_if(sub_patterns.begin(), sub_patterns.end(),
+				pattern_uses_stack) != sub_patterns.end();
+	  }
+
+	case pattern::provides:
+	  return pattern_uses_stack(p->get_provides_pattern());
+
+	case pattern::reverse_depends:
+	  return pattern_uses_stack(p->get_reverse_depends_pattern());
+
+	case pattern::reverse_provides:
+	  return pattern_uses_stack(p->get_reverse_provides_pattern());
+
+	case pattern::widen:
+	  return pattern_uses_stack(p->get_widen_pattern());
+
+	default:
+	  return false;
+	}
+    }
+
+    bool pattern_depends_on_state(const ref_ptr<pattern> &p)
+    {
+      switch(p->get_type())
+	{
+	  // Terms that read the state of the depcache or aptitude's
+	  // extended state, which changes without reloading the cache.
+
+	case pattern::action:
+	case pattern::automatic:
+	case pattern::broken:
+	case pattern::broken_type:
+	case pattern::candidate_version:
+	case pattern::garbage:
+	case pattern::install_version:
+	case pattern::new_tp:
+	case pattern::upgradable:
+	case pattern::user_tag:
+	  return true;
+
+	case pattern::all_versions:
+	  return pattern_depends_on_state(p->get_all_versions_pattern());
+
+	case pattern::and_tp:
+	  {
+	    const std::vector<ref_ptr<pattern> > &sub_patterns(p->get_and_patterns());
+	    return std::find_if(sub_patterns.begin(), sub_patterns.end(),
+				pattern_depends_on_state) != sub_patterns.end();
+	  }
+
+	case pattern::any_version:
+	  return pattern_depends_on_state(p->get_any_version_pattern());
+
+	case pattern::bind:
+	  return pattern_depends_on_state(p->get_bind_pattern());
+
+	case pattern::depends:
+	  return
+	    p->get_depends_broken() ||
+	    pattern_depends_on_state(p->get_depends_pattern());
+
+	case pattern::for_tp:
+	  return pattern_depends_on_state(p->get_for_pattern());
+
+	case pattern::narrow:
+	  return
+	    pattern_depends_on_state(p->get_narrow_filter()) ||
+	    pattern_depends_on_state(p->get_narrow_pattern());
+
+	case pattern::not_tp:
+	  return pattern_depends_on_state(p->get_not_pattern());
+
+	case pattern::or_tp:
+	  {
+	    const std::vector<ref_ptr<pattern> > &sub_patterns(p->get_or_patterns());
+	    return std::find_if(sub_patterns.begin(), sub_patterns.end(),
+				pattern_depends_on_state) != sub_patterns.end();
+	  }
+
+	case pattern::provides:
+	  return pattern_depends_on_state(p->get_provides_pattern());
+
+	case pattern::reverse_depends:
+	  return
+	    p->get_reverse_depends_broken() ||
+	    pattern_depends_on_state(p->get_reverse_depends_pattern());
+
+	case pattern::reverse_provides:
+	  return pattern_depends_on_state(p->get_reverse_provides_pattern());
+
+	case pattern::widen:
+	  return pattern_depends_on_state(p->get_widen_pattern());
+
+	default:
+	  return false;
+	}
+    }
+
+    bool pattern_depends_on_other_packages(const ref_ptr<pattern> &p)
+    {
+      switch(p->get_type())
+	{
+	case pattern::broken:
+	case pattern::broken_type:
+	case pattern::depends:
+	case pattern::garbage:
+	case pattern::provides:
+	case pattern::reverse_depends:
+	case pattern::reverse_provides:
+	case pattern::widen:
+	  return true;
+
+	case pattern::all_versions:
+	  return pattern_depends_on_other_packages(p->get_all_versions_pattern());
+
+	case pattern::and_tp:
+	  {
+	    const std::vector<ref_ptr<pattern> > &sub_patterns(p->get_and_patterns());
+	    return std::find_if(sub_patterns.begin(), sub_patterns.end(),
+				pattern_depends_on_other_packages) != sub_patterns.end();
+	  }
+
+	case pattern::any_version:
+	  return pattern_depends_on_other_packages(p->get_any_version_pattern());
+
+	case pattern::bind:
+	  return pattern_depends_on_other_packages(p->get_bind_pattern());
+
+	case pattern::for_tp:
+	  return pattern_depends_on_other_packages(p->get_for_pattern());
+
+	case pattern::narrow:
+	  return
+	    pattern_depends_on_other_packages(p->get_narrow_filter()) ||
+	    pattern_depends_on_other_packages(p->get_narrow_pattern());
+
+	case pattern::not_tp:
+	  return pattern_depends_on_other_packages(p->get_not_pattern());
+
+	case pattern::or_tp:
+	  {
+	    const std::vector<ref_ptr<pattern> > &sub_patterns(p->get_or_patterns());
+	    return std::find_if(sub_patterns.begin(), sub_patterns.end(),
+				pattern_depends_on_other_packages) != sub_patterns.end();
+	  }
+
+	default:
+	  return false;
+	}
+    }
+
+    int estimate_pattern_cost(const ref_ptr<pattern> &p)
+    {
+      switch(p->get_type())
+	{
+	  // Structural terms cost what their sub-patterns cost.
+
+	case pattern::all_versions:
+	  return estimate_pattern_cost(p->get_all_versions_pattern());
+
+	case pattern::and_tp:
+	  return sum_pattern_costs(p->get_and_patterns());
+
+	case pattern::any_version:
+	  return estimate_pattern_cost(p->get_any_version_pattern());
+
+	case pattern::for_tp:
+	  return estimate_pattern_cost(p->get_for_pattern());
+
+	case pattern::narrow:
+	  return
+	    estimate_pattern_cost(p->get_narrow_filter()) +
+	    estimate_pattern_cost(p->get_narrow_pattern());
+
+	case pattern::not_tp:
+	  return estimate_pattern_cost(p->get_not_pattern());
+
+	case pattern::or_tp:
+	  return sum_pattern_costs(p->get_or_patterns());
+
+	case pattern::widen:
+	  return estimate_pattern_cost(p->get_widen_pattern());
+
+	case pattern::bind:
+	  return estimate_pattern_cost(p->get_bind_pattern());
+
+	  // Terms that only read the package cache or the state of
+	  // the depcache.
+
+	case pattern::action:
+	case pattern::automatic:
+	case pattern::broken:
+	case pattern::broken_type:
+	case pattern::candidate_version:
+	case pattern::config_files:
+	case pattern::current_version:
+	case pattern::equal:
+	case pattern::essential:
+	case pattern::false_tp:
+	case pattern::foreign_architecture:
+	case pattern::garbage:
+	case pattern::install_version:
+	case pattern::installed:
+	case pattern::multiarch:
+	case pattern::native_architecture:
+	case pattern::new_tp:
+	case pattern::obsolete:
+	case pattern::priority:
+	case pattern::true_tp:
+	case pattern::upgradable:
+	case pattern::virtual_tp:
+	  return flag_cost;
+
+	  // Terms that test strings stored in the package cache.
+
+	case pattern::archive:
+	case pattern::architecture:
+	case pattern::exact_name:
+	case pattern::name:
+	case pattern::origin:
+	case pattern::section:
+	case pattern::user_tag:
+	case pattern::version:
+	  return string_cost;
+
+	  // Terms that have to parse the package records or consult
+	  // an external database.
+
+	case pattern::description:
+	case pattern::maintainer:
+	case pattern::source_package:
+	case pattern::source_version:
+	case pattern::tag:
+	case pattern::task:
+	case pattern::term:
+	case pattern::term_prefix:
+	  return record_cost;
+
+	  // Terms that run a new search on the other end of each
+	  // dependency or Provides.
+
+	case pattern::depends:
+	  return traversal_cost + estimate_pattern_cost(p->get_depends_pattern());
+
+	case pattern::provides:
+	  return traversal_cost + estimate_pattern_cost(p->get_provides_pattern());
+
+	case pattern::reverse_depends:
+	  return traversal_cost + estimate_pattern_cost(p->get_reverse_depends_pattern());
+
+	case pattern::reverse_provides:
+	  return traversal_cost + estimate_pattern_cost(p->get_reverse_provides_pattern());
+
+	default:
+	  return traversal_cost;
+	}
+    }
+
+    ref_ptr<pattern> compile_pattern(const ref_ptr<pattern> &p)
+    {
+      switch(p->get_type())
+	{
+	case pattern::all_versions:
+	  return pattern::make_all_versions(compile_pattern(p->get_all_versions_pattern()));
+
+	case pattern::and_tp:
+	  return pattern::make_and(compile_commutative_patterns(p->get_and_patterns()));
+
+	case pattern::any_version:
+	  return pattern::make_any_version(compile_pattern(p->get_any_version_pattern()));
+
+	case pattern::for_tp:
+	  return pattern::make_for(p->get_for_variable_name(),
+				   compile_pattern(p->get_for_pattern()));
+
+	case pattern::narrow:
+	  return pattern::make_narrow(compile_pattern(p->get_narrow_filter()),
+				      compile_pattern(p->get_narrow_pattern()));
+
+	case pattern::not_tp:
+	  return pattern::make_not(compile_pattern(p->get_not_pattern()));
+
+	case pattern::or_tp:
+	  return pattern::make_or(compile_commutative_patterns(p->get_or_patterns()));
+
+	case pattern::widen:
+	  return pattern::make_widen(compile_pattern(p->get_widen_pattern()));
+
+	  // Terms that start a new search are evaluated structurally
+	  // by their parent, so there's nothing to gain by rewriting
+	  // their sub-patterns.
+	default:
+	  return p;
+	}
+    }
+  }
+}
@@ -0,0 +1,105 @@
+// compile_pattern.h       -*-c++-*-
+//
+//   This program is free software; you can redistribute it and/or
+//   modify it under the terms of the GNU General Public License as
+//   published by the Free Software Foundation; either version 2 of
+//   the License, or (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//   General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program; see the file COPYING.  If not, write to
+//   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+//   Boston, MA 02110-1301, USA.
+
+#ifndef COMPILE_PATTERN_H
+#define COMPILE_PATTERN_H
+
+/** \file compile_pattern.h */
+
+#include <cwidget/generic/util/ref_ptr.h>
+
+namespace aptitude
+{
+  namespace matching
+  {
+    class pattern;
+
+    /** \brief Return \b true if p contains a ?for term.
+     *
+     *  ?for pushes its pool onto the evaluation stack and leaves it
+     *  there, so the results of terms evaluated after it can depend
+     *  on how often it was evaluated.  Such patterns can't be
+     *  reordered or short-circuited.
+     */
+    bool pattern_contains_for(const cwidget::util::ref_ptr<pattern> &p);
+
+    /** \brief Return \b true if matching p might read or modify the
+     *  variable stack.
+     *
+     *  Patterns that don't contain ?bind, ?= or ?for match the same
+     *  way whatever the stack holds, so their results only depend on
+     *  the pool they are matched against.
+     */
+    bool pattern_uses_stack(const cwidget::util::ref_ptr<pattern> &p);
+
+    /** \brief Return \b true if the packages that p matches can
+     *  change while the package cache stays open.
+     *
+     *  This is the case if p tests the planned actions, the
+     *  candidate versions or any other part of the package states
+     *  that the user can modify (e.g., ?action, ?broken or
+     *  ?upgradable).  Patterns that only test the contents of the
+     *  cache and the installed versions match the same packages
+     *  until the cache is reloaded.
+     */
+    bool pattern_depends_on_state(const cwidget::util::ref_ptr<pattern> &p);
+
+    /** \brief Return \b true if whether p matches a package can
+     *  depend on other packages.
+     *
+     *  This is the case for terms that follow dependencies or
+     *  provides (e.g., ?depends or ?reverse-provides), that test
+     *  whether the dependencies of a package are satisfied (?broken
+     *  and ?garbage), and for ?widen.  When the state of some
+     *  packages changes, the result of such a pattern can change
+     *  for packages whose own state didn't.
+     */
+    bool pattern_depends_on_other_packages(const cwidget::util::ref_ptr<pattern> &p);
+
+    /** \brief Estimate how expensive it is to test one package or
+     *  version against a pattern.
+     *
+     *  The estimate is a rough relative weight, not a measurement:
+     *  terms that only read flags out of the package cache are the
+     *  cheapest, followed by terms that test a string stored in the
+     *  cache (e.g., the package name), terms that have to look up
+     *  the package records or an external database (e.g.,
+     *  ?description), and finally terms that follow dependencies and
+     *  start a new search on the other end.  Terms with
+     *  sub-patterns cost at least as much as their sub-patterns.
+     */
+    int estimate_pattern_cost(const cwidget::util::ref_ptr<pattern> &p);
+
+    /** \brief Build an evaluation plan for a pattern.
+     *
+     *  The returned pattern matches exactly the same packages and
+     *  versions as p, but the sub-patterns of each ?and and ?or term
+     *  are sorted by their estimated cost, so that an evaluator that
+     *  short-circuits tests the cheap terms first.  Terms that
+     *  contain a ?for are never moved.
+     *
+     *  The plan is only suitable for testing \e whether something
+     *  matches: the structural match produced by evaluating it
+     *  reflects the reordered pattern rather than the one that the
+     *  user typed.
+     */
+    cwidget::util::ref_ptr<pattern>
+    compile_pattern(const cwidget::util::ref_ptr<pattern> &p);
+  }
+}
+
+#endif // COMPILE_PATTERN_H
@@ -25,6 +25,7 @@
 #include <generic/apt/apt.h>
 #include <generic/apt/tags.h>
 #include <generic/apt/tasks.h>
+#include <generic/apt/term_index.h>
 #include <generic/apt/usertags.h>
 #include <generic/util/progress_info.h>
 #include <generic/util/util.h>
@@ -34,15 +35,19 @@
 #include <apt-pkg/pkgsystem.h>
 #include <apt-pkg/version.h>
 
+#include <cwidget/generic/threads/threads.h>
 #include <cwidget/generic/util/transcode.h>
 
 #include <xapian.h>
 
+#include "compile_pattern.h"
 #include "serialize.h"
 #include "../config_signal.h"
 
 #include <algorithm>
+#include <atomic>
 #include <memory>
+#include <thread>
 #include <unordered_map>
 
 
@@ -77,6 +82,19 @@ namespace aptitude
         return db;
       }
 
+      /** \brief Read the extended state of a package.
+       *
+       *  Matching never modifies the cache and may run in several
+       *  threads at once, so it must not use the non-const accessor,
+       *  which records the package as touched.
+       */
+      const aptitudeDepCache::aptitude_state &
+      read_ext_state(const aptitudeDepCache &cache,
+		     const pkgCache::PkgIterator &pkg)
+      {
+	return cache.get_ext_state(pkg);
+      }
+
       /** \brief Evaluate any regular expression-based pattern.
        *
        *  \param p      The pattern to evaluate.
@@ -315,6 +333,37 @@ namespace aptitude
       // top-level term is filled in the first time it's encountered.
       std::map<ref_ptr<pattern>, xapian_info> toplevel_xapian_info;
 
+      // Maps patterns that were tested with matches() to their
+      // evaluation plans.
+      std::map<ref_ptr<pattern>, ref_ptr<pattern> > compiled_patterns;
+
+      // Maps text-search terms to the packages that the term index
+      // says they might match, indexed by package ID.  An empty list
+      // means that any package might match.
+      std::map<ref_ptr<pattern>, std::vector<bool> > index_candidates;
+
+      // Maps the sub-patterns of ?depends and ?reverse-depends that
+      // don't use the variable stack to the result of matching them
+      // against each pool of related versions.  Nested dependency
+      // searches reach the same versions over and over, so this
+      // turns them from quadratic into linear.
+      std::map<std::pair<ref_ptr<pattern>, std::vector<matchable> >,
+	       ref_ptr<structural_match> > dependency_matches;
+
+      // The state generation of the cache when dependency_matches
+      // was filled in; the results are dropped when it changes.
+      unsigned long dependency_matches_generation;
+
+      // The most results that dependency_matches holds.  Each entry
+      // keeps its pool and match tree alive, so a search that walks
+      // the whole archive would otherwise pin them all until the
+      // next state change; when the limit is reached the memo is
+      // emptied and refilled from scratch.
+      static const std::size_t max_dependency_matches = 16384;
+
+      // Stores whether each dependency sub-pattern uses the stack.
+      std::map<ref_ptr<pattern>, bool> dependency_patterns_use_stack;
+
       // Maps each term that has been looked up to a sorted list of
       // the packages it matches.
       std::map<std::string, std::vector<Xapian::docid> > matched_terms;
@@ -379,6 +428,7 @@ namespace aptitude
 
     public:
       implementation()
+	: dependency_matches_generation(0)
       {
 	try
 	  {
@@ -640,6 +690,169 @@ namespace aptitude
 	else
 	  return found->second;
       }
+
+      /** \brief Get the evaluation plan of the given pattern.
+       *
+       *  Memoizes its return value in compiled_patterns.
+       *
+       *  \return the plan, or an invalid pointer if the pattern
+       *  contains a ?for and has to be evaluated structurally.
+       */
+      ref_ptr<pattern> get_compiled_pattern(const ref_ptr<pattern> &p)
+      {
+	std::map<ref_ptr<pattern>, ref_ptr<pattern> >::const_iterator found =
+	  compiled_patterns.find(p);
+
+	if(found != compiled_patterns.end())
+	  return found->second;
+
+	ref_ptr<pattern> result;
+	if(!pattern_contains_for(p))
+	  result = compile_pattern(p);
+
+	compiled_patterns[p] = result;
+	return result;
+      }
+
+      /** \brief Test whether the result of matching a dependency
+       *  sub-pattern can be memoized.
+       *
+       *  \sa pattern_uses_stack()
+       */
+      bool can_memoize_dependency_pattern(const ref_ptr<pattern> &p)
+      {
+	std::map<ref_ptr<pattern>, bool>::const_iterator found =
+	  dependency_patterns_use_stack.find(p);
+
+	if(found == dependency_patterns_use_stack.end())
+	  found = dependency_patterns_use_stack.insert(std::make_pair(p, pattern_uses_stack(p))).first;
+
+	return !found->second;
+      }
+
+      /** \brief Look up the memoized result of matching a dependency
+       *  sub-pattern against a pool.
+       *
+       *  \return \b true if the result was found; it is stored in
+       *  result (and is invalid if the pattern didn't match).
+       */
+      bool find_dependency_match(const ref_ptr<pattern> &p,
+				 const std::vector<matchable> &pool,
+				 const aptitudeDepCache &cache,
+				 ref_ptr<structural_match> &result)
+      {
+	if(dependency_matches_generation != cache.get_state_generation())
+	  {
+	    dependency_matches.clear();
+	    dependency_matches_generation = cache.get_state_generation();
+	  }
+
+	std::map<std::pair<ref_ptr<pattern>, std::vector<matchable> >,
+		 ref_ptr<structural_match> >::const_iterator found =
+	  dependency_matches.find(std::make_pair(p, pool));
+
+	if(found == dependency_matches.end())
+	  return false;
+
+	result = found->second;
+	return true;
+      }
+
+      /** \brief Memoize the result of matching a dependency
+       *  sub-pattern against a pool.
+       */
+      void add_dependency_match(const ref_ptr<pattern> &p,
+				const std::vector<matchable> &pool,
+				const ref_ptr<structural_match> &result)
+      {
+	if(dependency_matches.size() >= max_dependency_matches)
+	  dependency_matches.clear();
+
+	dependency_matches[std::make_pair(p, pool)] = result;
+      }
+
+      /** \brief Test whether a text-search term might match a
+       *  package, according to the term index.
+       *
+       *  Memoizes the candidates of each term in index_candidates.
+       *
+       *  \return \b false if p is a ?name, ?description, ?maintainer,
+       *  ?term or ?term-prefix term that can't match any version of
+       *  pkg; \b true otherwise.
+       */
+      bool may_match(const ref_ptr<pattern> &p,
+		     const pkgCache::PkgIterator &pkg,
+		     aptitudeDepCache &cache,
+		     pkgRecords &records)
+      {
+	std::map<ref_ptr<pattern>, std::vector<bool> >::iterator found =
+	  index_candidates.find(p);
+
+	if(found == index_candidates.end())
+	  {
+	    found = index_candidates.insert(std::make_pair(p, std::vector<bool>())).first;
+
+	    unsigned int field_mask = 0;
+	    std::vector<std::string> runs;
+	    bool have_runs = false;
+
+	    switch(p->get_type())
+	      {
+	      case pattern::name:
+		field_mask = 1 << aptitude::apt::term_index::name_field;
+		have_runs = aptitude::apt::get_regex_literals(p->get_name_regex_info().get_regex_string(), runs);
+		break;
+
+	      case pattern::description:
+		field_mask = 1 << aptitude::apt::term_index::description_field;
+		have_runs = aptitude::apt::get_regex_literals(p->get_description_regex_info().get_regex_string(), runs);
+		break;
+
+	      case pattern::maintainer:
+		field_mask = 1 << aptitude::apt::term_index::maintainer_field;
+		have_runs = aptitude::apt::get_regex_literals(p->get_maintainer_regex_info().get_regex_string(), runs);
+		break;
+
+		// Without Xapian, terms are matched against the name
+		// and description (see term_matches()).
+	      case pattern::term:
+		if(db.get() == NULL)
+		  {
+		    field_mask =
+		      (1 << aptitude::apt::term_index::name_field) |
+		      (1 << aptitude::apt::term_index::description_field);
+		    have_runs = aptitude::apt::get_regex_literals(backslash_escape_nonalnum(p->get_term_term()), runs);
+		  }
+		break;
+
+	      case pattern::term_prefix:
+		if(db.get() == NULL)
+		  {
+		    field_mask =
+		      (1 << aptitude::apt::term_index::name_field) |
+		      (1 << aptitude::apt::term_index::description_field);
+		    have_runs = aptitude::apt::get_regex_literals(backslash_escape_nonalnum(p->get_term_prefix_term()), runs);
+		  }
+		break;
+
+	      default:
+		break;
+	      }
+
+	    if(have_runs)
+	      {
+		const std::shared_ptr<const aptitude::apt::term_index>
+		  index(aptitude::apt::get_term_index(cache.GetCache(), records));
+
+		if(index.get() != NULL)
+		  index->find_candidates(field_mask, runs, found->second);
+	      }
+	  }
+
+	const std::vector<bool> &candidates(found->second);
+	const unsigned long id = pkg->ID;
+	return id >= candidates.size() || candidates[id];
+      }
     };
  
     search_cache::search_cache()
@@ -741,6 +954,43 @@ namespace aptitude
 						  pkgRecords &records,
 						  bool debug);
 
+      /** \brief Match the sub-pattern of a ?depends or
+       *  ?reverse-depends term against a pool of related versions,
+       *  reusing the result of an earlier match against the same pool
+       *  if possible.
+       */
+      ref_ptr<structural_match> evaluate_dependency_pattern(const ref_ptr<pattern> &p,
+							    stack &the_stack,
+							    const ref_ptr<search_cache::implementation> &search_info,
+							    const std::vector<matchable> &pool,
+							    aptitudeDepCache &cache,
+							    pkgRecords &records,
+							    bool debug)
+      {
+	if(!search_info->can_memoize_dependency_pattern(p))
+	  return evaluate_toplevel(structural_eval_any, p, the_stack,
+				   search_info, pool, cache, records, debug);
+
+	ref_ptr<structural_match> result;
+	if(search_info->find_dependency_match(p, pool, cache, result))
+	  {
+	    if(debug)
+	      {
+		std::cout << "Reusing the result of matching "
+			  << serialize_pattern(p) << " against the pool ";
+		print_pool(std::cout, pool, cache);
+		std::cout << std::endl;
+	      }
+
+	    return result;
+	  }
+
+	result = evaluate_toplevel(structural_eval_any, p, the_stack,
+				   search_info, pool, cache, records, debug);
+	search_info->add_dependency_match(p, pool, result);
+	return result;
+      }
+
       // Match an atomic expression against one matchable.
       ref_ptr<match> evaluate_atomic(const ref_ptr<pattern> &p,
 				     const matchable &target,
@@ -760,6 +1010,22 @@ namespace aptitude
 	    std::cout << std::endl;
 	  }
 
+	// Rule out packages that don't contain the text being searched
+	// for before parsing their records.
+	const pattern::type tp = p->get_type();
+	if((tp == pattern::description ||
+	    tp == pattern::maintainer ||
+	    tp == pattern::name ||
+	    tp == pattern::term ||
+	    tp == pattern::term_prefix) &&
+	   !search_info->may_match(p, target.get_package_iterator(cache), cache, records))
+	  {
+	    if(debug)
+	      std::cout << "Ruled out by the search index." << std::endl;
+
+	    return NULL;
+	  }
+
 	switch(p->get_type())
 	  {
 	    // Structural matchers:
@@ -840,7 +1106,7 @@ namespace aptitude
 		  break;
 
 		case pattern::action_hold:
-		  matches = !pkg.CurrentVer().end() && cache.get_ext_state(pkg).selection_state == pkgCache::State::Hold;
+		  matches = !pkg.CurrentVer().end() && read_ext_state(cache, pkg).selection_state == pkgCache::State::Hold;
 		  break;
 
 		  // The rest correspond directly to find_pkg_state() return values.
@@ -1058,14 +1324,13 @@ namespace aptitude
 			    std::sort(new_pool.begin(), new_pool.end());
 
 			    ref_ptr<structural_match> m =
-			      evaluate_toplevel(structural_eval_any,
-						p->get_depends_pattern(),
-						the_stack,
-						search_info,
-						new_pool,
-						cache,
-						records,
-						debug);
+			      evaluate_dependency_pattern(p->get_depends_pattern(),
+							  the_stack,
+							  search_info,
+							  new_pool,
+							  cache,
+							  records,
+							  debug);
 
 			    // Note: the dependency that we return is
 			    // just the head of the OR group.
@@ -1240,7 +1505,7 @@ namespace aptitude
 	  case pattern::new_tp:
 	    if(!target.get_has_version())
 	      return NULL;
-	    else if(!cache.get_ext_state(target.get_package_iterator(cache)).new_package)
+	    else if(!read_ext_state(cache, target.get_package_iterator(cache)).new_package)
 	      return NULL;
 	    else
 	      return match::make_atomic(p);
@@ -1375,14 +1640,13 @@ namespace aptitude
 
 
 		      ref_ptr<structural_match>
-			rval(evaluate_toplevel(structural_eval_any,
-					       p->get_reverse_depends_pattern(),
-					       the_stack,
-					       search_info,
-					       revdep_pool,
-					       cache,
-					       records,
-					       debug));
+			rval(evaluate_dependency_pattern(p->get_reverse_depends_pattern(),
+							 the_stack,
+							 search_info,
+							 revdep_pool,
+							 cache,
+							 records,
+							 debug));
 
 		      if(rval.valid())
 			return match::make_dependency(p, rval, d);
@@ -1420,14 +1684,13 @@ namespace aptitude
 
 
 			      ref_ptr<structural_match>
-				rval(evaluate_toplevel(structural_eval_any,
-						       p->get_reverse_depends_pattern(),
-						       the_stack,
-						       search_info,
-						       revdep_pool,
-						       cache,
-						       records,
-						       debug));
+				rval(evaluate_dependency_pattern(p->get_reverse_depends_pattern(),
+								 the_stack,
+								 search_info,
+								 revdep_pool,
+								 cache,
+								 records,
+								 debug));
 
 			      if(rval.valid())
 				return match::make_dependency(p, rval, d);
@@ -1735,7 +1998,7 @@ namespace aptitude
 		target.get_package_iterator(cache);
 
 	      const std::set<user_tag> &user_tags =
-		cache.get_ext_state(pkg).user_tags;
+		read_ext_state(cache, pkg).user_tags;
 
 	      for(std::set<user_tag>::const_iterator it =
 		    user_tags.begin(); it != user_tags.end(); ++it)
@@ -1780,6 +2043,53 @@ namespace aptitude
 	  }
       }
 
+      /** \brief Expand a pool to include all the versions of each
+       *  package that it includes, as ?widen does.
+       *
+       *  \param pool      The pool to widen; must be sorted.
+       *  \param cache     The cache that the pool was drawn from.
+       *  \param new_pool  Where to store the widened pool.
+       */
+      void widen_pool(const std::vector<matchable> &pool,
+		      aptitudeDepCache &cache,
+		      std::vector<matchable> &new_pool)
+      {
+	// NB: to make this fast I rely on the sort order of
+	// matchables.
+	for(std::vector<matchable>::const_iterator it
+	      = pool.begin(); it != pool.end(); ++it)
+	  {
+	    // If we've already seen this package it'll be at the back
+	    // of the new pool (due to processing inputs in the pool in
+	    // sort order).
+	    if(!new_pool.empty() &&
+	       new_pool.back().get_pkg() == it->get_pkg())
+	      continue;
+
+	    // Virtual packages aren't touched by ?widen.
+	    if(!it->get_has_version())
+	      {
+		new_pool.push_back(*it);
+		continue;
+	      }
+
+	    pkgCache::PkgIterator pkg =
+	      it->get_package_iterator(cache);
+	    if(pkg.VersionList().end())
+	      new_pool.push_back(*it);
+	    else
+	      {
+		for(pkgCache::VerIterator ver = pkg.VersionList();
+		    !ver.end(); ++ver)
+		  {
+		    new_pool.push_back(matchable(pkg, ver));
+		  }
+	      }
+	  }
+
+	std::sort(new_pool.begin(), new_pool.end());
+      }
+
       ref_ptr<structural_match> evaluate_structural(structural_eval_mode mode,
 						    const ref_ptr<pattern> &p,
 						    stack &the_stack,
@@ -2018,48 +2328,14 @@ namespace aptitude
 	    break;
 
 	  case pattern::widen:
-	    // NB: to make this fast I rely on the sort order of
-	    // matchables.
-	    //
 	    // \todo Perhaps this pattern should be redefined to allow
 	    // us to inject arbitrary stuff into the pool?  Right now
 	    // it just expands the pool to include all the versions of
 	    // each package that it includes.
 	    {
 	      std::vector<matchable> new_pool;
+	      widen_pool(pool, cache, new_pool);
 
-	      for(std::vector<matchable>::const_iterator it
-		    = pool.begin(); it != pool.end(); ++it)
-		{
-		  // If we've already seen this package it'll be at
-		  // the back of the new pool (due to processing
-		  // inputs in the pool in sort order).
-		  if(!new_pool.empty() &&
-		     new_pool.back().get_pkg() == it->get_pkg())
-		    continue;
-
-		  // Virtual packages aren't touched by ?widen.
-		  if(!it->get_has_version())
-		    {
-		      new_pool.push_back(*it);
-		      continue;
-		    }
-
-		  pkgCache::PkgIterator pkg =
-		    it->get_package_iterator(cache);
-		  if(pkg.VersionList().end())
-		    new_pool.push_back(*it);
-		  else
-		    {
-		      for(pkgCache::VerIterator ver = pkg.VersionList();
-			  !ver.end(); ++ver)
-			{
-			  new_pool.push_back(matchable(pkg, ver));
-			}
-		    }
-		}
-
-	      std::sort(new_pool.begin(), new_pool.end());
 	      ref_ptr<structural_match>
 		m(evaluate_structural(mode,
 				      p->get_widen_pattern(),
@@ -2189,6 +2465,173 @@ namespace aptitude
 	  }
       }
 
+      /** \brief Like evaluate_structural, but only computes whether
+       *  the pattern matches.
+       *
+       *  Since no match tree is built, ?and, ?or and the pool loops
+       *  stop as soon as their result is known; p should be an
+       *  evaluation plan produced by compile_pattern(), so that the
+       *  cheapest sub-patterns are tested first.
+       */
+      bool evaluate_boolean(structural_eval_mode mode,
+			    const ref_ptr<pattern> &p,
+			    stack &the_stack,
+			    const ref_ptr<search_cache::implementation> &search_info,
+			    const std::vector<matchable> &pool,
+			    aptitudeDepCache &cache,
+			    pkgRecords &records,
+			    bool debug)
+      {
+	if(debug)
+	  {
+	    std::cout << "Testing " << serialize_pattern(p)
+		      << " against the pool ";
+	    print_pool(std::cout, pool, cache);
+	    std::cout << " with stack ";
+	    print_stack(std::cout, the_stack, cache);
+	    std::cout << std::endl;
+	  }
+
+	switch(p->get_type())
+	  {
+	  case pattern::all_versions:
+	    return evaluate_boolean(structural_eval_all,
+				    p->get_all_versions_pattern(),
+				    the_stack, search_info, pool,
+				    cache, records, debug);
+
+	  case pattern::and_tp:
+	    {
+	      const std::vector<ref_ptr<pattern> > &sub_patterns(p->get_and_patterns());
+
+	      for(std::vector<ref_ptr<pattern> >::const_iterator it =
+		    sub_patterns.begin(); it != sub_patterns.end(); ++it)
+		{
+		  if(!evaluate_boolean(mode, *it, the_stack, search_info,
+				       pool, cache, records, debug))
+		    return false;
+		}
+
+	      return true;
+	    }
+
+	  case pattern::any_version:
+	    {
+	      std::vector<matchable> new_pool;
+	      new_pool.push_back(matchable());
+
+	      for(std::vector<matchable>::const_iterator it =
+		    pool.begin(); it != pool.end(); ++it)
+		{
+		  new_pool[0] = *it;
+
+		  if(evaluate_boolean(mode, p->get_any_version_pattern(),
+				      the_stack, search_info, new_pool,
+				      cache, records, debug))
+		    return true;
+		}
+
+	      return false;
+	    }
+
+	  case pattern::for_tp:
+	    // Patterns containing ?for are normally evaluated
+	    // structurally; mirror evaluate_structural(), which leaves
+	    // the pool on the stack.
+	    the_stack.push_back(&pool);
+
+	    return evaluate_boolean(mode, p->get_for_pattern(),
+				    the_stack, search_info, pool,
+				    cache, records, debug);
+
+	  case pattern::narrow:
+	    {
+	      std::vector<matchable> singleton_pool;
+	      std::vector<matchable> new_pool;
+	      singleton_pool.push_back(matchable());
+
+	      for(std::vector<matchable>::const_iterator it =
+		    pool.begin(); it != pool.end(); ++it)
+		{
+		  singleton_pool[0] = *it;
+
+		  if(evaluate_boolean(mode, p->get_narrow_filter(),
+				      the_stack, search_info, singleton_pool,
+				      cache, records, debug))
+		    new_pool.push_back(*it);
+		}
+
+	      return
+		!new_pool.empty() &&
+		evaluate_boolean(mode, p->get_narrow_pattern(),
+				 the_stack, search_info, new_pool,
+				 cache, records, debug);
+	    }
+
+	  case pattern::not_tp:
+	    return !evaluate_boolean(mode, p->get_not_pattern(),
+				     the_stack, search_info, pool,
+				     cache, records, debug);
+
+	  case pattern::or_tp:
+	    {
+	      const std::vector<ref_ptr<pattern> > &sub_patterns(p->get_or_patterns());
+
+	      for(std::vector<ref_ptr<pattern> >::const_iterator it =
+		    sub_patterns.begin(); it != sub_patterns.end(); ++it)
+		{
+		  if(evaluate_boolean(mode, *it, the_stack, search_info,
+				      pool, cache, records, debug))
+		    return true;
+		}
+
+	      return false;
+	    }
+
+	  case pattern::widen:
+	    {
+	      std::vector<matchable> new_pool;
+	      widen_pool(pool, cache, new_pool);
+
+	      return evaluate_boolean(mode, p->get_widen_pattern(),
+				      the_stack, search_info, new_pool,
+				      cache, records, debug);
+	    }
+
+	    // Atomic matchers; evaluate_atomic() rejects anything that
+	    // it doesn't know about.
+	  default:
+	    switch(mode)
+	      {
+	      case structural_eval_all:
+		if(pool.empty())
+		  return false;
+
+		for(std::vector<matchable>::const_iterator it =
+		      pool.begin(); it != pool.end(); ++it)
+		  {
+		    if(!evaluate_atomic(p, *it, the_stack, search_info, cache, records, debug).valid())
+		      return false;
+		  }
+
+		return true;
+
+	      case structural_eval_any:
+		for(std::vector<matchable>::const_iterator it =
+		      pool.begin(); it != pool.end(); ++it)
+		  {
+		    if(evaluate_atomic(p, *it, the_stack, search_info, cache, records, debug).valid())
+		      return true;
+		  }
+
+		return false;
+
+	      default:
+		throw MatchingException("Internal error: unhandled structural match mode.");
+	      }
+	  }
+      }
+
       ref_ptr<structural_match> evaluate_toplevel(structural_eval_mode mode,
 						  const ref_ptr<pattern> &p,
 						  stack &the_stack,
@@ -2956,6 +3399,36 @@ namespace aptitude
       }
     }
 
+    namespace
+    {
+      /** \brief Build the pool that a top-level match of a package
+       *  or version starts from.
+       */
+      void make_initial_pool(const pkgCache::PkgIterator &pkg,
+			     const pkgCache::VerIterator &ver,
+			     std::vector<matchable> &initial_pool)
+      {
+	if(pkg.VersionList().end())
+	  initial_pool.push_back(matchable(pkg));
+	else if(ver.end())
+	  {
+	    for(pkgCache::VerIterator ver2 = pkg.VersionList();
+		!ver2.end(); ++ver2)
+	      {
+		initial_pool.push_back(matchable(pkg, ver2));
+	      }
+	  }
+	else
+	  {
+	    eassert(ver.ParentPkg() == pkg);
+
+	    initial_pool.push_back(matchable(pkg, ver));
+	  }
+
+	std::sort(initial_pool.begin(), initial_pool.end());
+      }
+    }
+
     ref_ptr<structural_match>
     get_match(const ref_ptr<pattern> &p,
 	      const pkgCache::PkgIterator &pkg,
@@ -2969,28 +3442,10 @@ namespace aptitude
       eassert(search_info.valid());
 
       std::vector<matchable> initial_pool;
+      make_initial_pool(pkg, ver, initial_pool);
 
-      if(pkg.VersionList().end())
-	initial_pool.push_back(matchable(pkg));
-      else if(ver.end())
-	{
-	  for(pkgCache::VerIterator ver2 = pkg.VersionList();
-	      !ver2.end(); ++ver2)
-	    {
-	      initial_pool.push_back(matchable(pkg, ver2));
-	    }
-	}
-      else
-	{
-	  eassert(ver.ParentPkg() == pkg);
-
-	  initial_pool.push_back(matchable(pkg, ver));
-	}
-
-      std::sort(initial_pool.begin(), initial_pool.end());
-
-      stack st;
-      st.push_back(&initial_pool);
+      stack st;
+      st.push_back(&initial_pool);
 
       ref_ptr<search_cache::implementation> search_info_imp =
 	search_info.dyn_downcast<search_cache::implementation>();
@@ -3019,6 +3474,53 @@ namespace aptitude
 		       search_info, cache, records, debug);
     }
 
+    bool matches(const ref_ptr<pattern> &p,
+		 const pkgCache::PkgIterator &pkg,
+		 const pkgCache::VerIterator &ver,
+		 const cwidget::util::ref_ptr<search_cache> &search_info,
+		 aptitudeDepCache &cache,
+		 pkgRecords &records,
+		 bool debug)
+    {
+      eassert(p.valid());
+      eassert(search_info.valid());
+
+      ref_ptr<search_cache::implementation> search_info_imp =
+	search_info.dyn_downcast<search_cache::implementation>();
+      eassert(search_info_imp.valid());
+
+      const ref_ptr<pattern> plan(search_info_imp->get_compiled_pattern(p));
+      if(!plan.valid())
+	return get_match(p, pkg, ver, search_info, cache, records, debug).valid();
+
+      std::vector<matchable> initial_pool;
+      make_initial_pool(pkg, ver, initial_pool);
+
+      stack st;
+      st.push_back(&initial_pool);
+
+      return evaluate_boolean(structural_eval_any,
+			      plan,
+			      st,
+			      search_info_imp,
+			      initial_pool,
+			      cache,
+			      records,
+			      debug);
+    }
+
+    bool matches(const ref_ptr<pattern> &p,
+		 const pkgCache::PkgIterator &pkg,
+		 const cwidget::util::ref_ptr<search_cache> &search_info,
+		 aptitudeDepCache &cache,
+		 pkgRecords &records,
+		 bool debug)
+    {
+      return matches(p, pkg,
+		     pkgCache::VerIterator(cache),
+		     search_info, cache, records, debug);
+    }
+
     void xapian_info::setup(const Xapian::Database &db,
 			    const ref_ptr<pattern> &p,
 			    bool debug)
@@ -3070,115 +3572,438 @@ namespace aptitude
 	}
     }
 
-    void search(const ref_ptr<pattern> &p,
-		const ref_ptr<search_cache> &search_info,
-		std::vector<std::pair<pkgCache::PkgIterator, ref_ptr<structural_match> > > &matches,
-		aptitudeDepCache &cache,
-		pkgRecords &records,
-                bool debug,
-                const sigc::slot<void, progress_info> &progress_slot)
+    namespace
     {
-      try
-	{
-          progress_slot(progress_info::pulse(_("Accessing index")));
+      /** \brief How many packages a search thread claims at once. */
+      const std::size_t search_chunk_size = 256;
 
-	  eassert(p.valid());
-	  eassert(search_info.valid());
+      /** \brief Tests a package against a pattern as a package. */
+      struct match_packages
+      {
+	typedef std::pair<pkgCache::PkgIterator, ref_ptr<structural_match> > result;
+
+	void operator()(const ref_ptr<pattern> &p,
+			const pkgCache::PkgIterator &pkg,
+			const ref_ptr<search_cache> &info,
+			aptitudeDepCache &cache,
+			pkgRecords &records,
+			bool debug,
+			std::vector<result> &out) const
+	{
+	  ref_ptr<structural_match> m(get_match(p, pkg,
+						info,
+						cache,
+						records,
+						debug));
 
-	  const ref_ptr<search_cache::implementation> info = search_info.dyn_downcast<search_cache::implementation>();
-	  eassert(info.valid());
+	  if(m.valid())
+	    out.push_back(std::make_pair(pkg, m));
+	}
+      };
 
-	  const xapian_info &xapian_results(info->get_toplevel_xapian_info(p, debug));
+      /** \brief Tests a package against a pattern as a package,
+       *  without building a structural match.
+       */
+      struct match_packages_boolean
+      {
+	typedef pkgCache::PkgIterator result;
+
+	void operator()(const ref_ptr<pattern> &p,
+			const pkgCache::PkgIterator &pkg,
+			const ref_ptr<search_cache> &info,
+			aptitudeDepCache &cache,
+			pkgRecords &records,
+			bool debug,
+			std::vector<result> &out) const
+	{
+	  if(matches(p, pkg, info, cache, records, debug))
+	    out.push_back(pkg);
+	}
+      };
 
-          const std::string filter_msg = _("Filtering packages");
-	  if(!xapian_results.get_matched_packages_valid())
+      /** \brief Tests each version of a package against a pattern. */
+      struct match_versions
+      {
+	typedef std::pair<pkgCache::VerIterator, ref_ptr<structural_match> > result;
+
+	void operator()(const ref_ptr<pattern> &p,
+			const pkgCache::PkgIterator &pkg,
+			const ref_ptr<search_cache> &info,
+			aptitudeDepCache &cache,
+			pkgRecords &records,
+			bool debug,
+			std::vector<result> &out) const
+	{
+	  for(pkgCache::VerIterator ver = pkg.VersionList();
+	      !ver.end(); ++ver)
 	    {
-	      if(debug)
-		std::cout << "Failed to build a Xapian query for this search." << std::endl
-			  << "Falling back to testing each package." << std::endl;
+	      ref_ptr<structural_match> m(get_match(p,
+						    pkg, ver,
+						    info,
+						    cache,
+						    records,
+						    debug));
 
-              progress_info progress = progress_info::bar(0, filter_msg);
-              progress_slot(progress);
+	      if(m.valid())
+		out.push_back(std::make_pair(ver, m));
+	    }
+	}
+      };
 
-              int i = 0;
-	      for(pkgCache::PkgIterator pkg = cache.PkgBegin();
-		  !pkg.end(); ++pkg)
-		{
-		  if(pkg.VersionList().end() && pkg.ProvidesList().end())
-		    continue;
-
-		  // TODO: how do I make sure the sub-patterns are
-		  // searched using the right xapian_info?  I could thread
-		  // the current top-level or the current xapian_info
-		  // through, I suppose.  Or I could use a global list of
-		  // term postings and only store match sets on a
-		  // per-toplevel basis (that might work, actually?).
-
-		  ref_ptr<structural_match> m(get_match(p, pkg,
-							info,
-							cache,
-							records,
-							debug));
+      /** \brief Records the first error reported by the threads of a
+       *  scan, so that the caller can throw it once they have all
+       *  finished.
+       */
+      class scan_errors
+      {
+	std::atomic<bool> failed;
 
-		  if(m.valid())
-		    matches.push_back(std::make_pair(pkg, m));
+	cwidget::threads::mutex error_mutex;
+	std::string error;
 
-                  ++i;
-                  progress.set_progress_fraction(((double)i) / ((double)cache.Head().PackageCount));
-                  progress_slot(progress);
-		}
-	    }
-	  else
+      public:
+	scan_errors()
+	  : failed(false)
+	{
+	}
+
+	bool has_failed() const { return failed; }
+
+	void fail(const std::string &msg)
+	{
+	  cwidget::threads::mutex::lock l(error_mutex);
+	  if(!failed)
 	    {
-              // Xapian doesn't allow us to present meaningful
-              // progress information.
-              progress_slot(progress_info::pulse(filter_msg));
+	      error = msg;
+	      failed = true;
+	    }
+	}
 
-	      Xapian::MSet mset(xapian_results.get_xapian_match());
-	      for(Xapian::MSetIterator it = mset.begin();
-		  it != mset.end(); ++it)
+	/** \brief Throw the first error reported by any thread, if any. */
+	void check() const
+	{
+	  if(failed)
+	    throw MatchingException(error);
+	}
+      };
+
+      /** \brief The state shared by the threads of a package scan.
+       *
+       *  Packages are handed out in chunks of search_chunk_size, and
+       *  the matches of each chunk are stored separately so that they
+       *  can be merged in the order of the input list.
+       */
+      template<typename Matcher>
+      class package_scan
+      {
+	typedef typename Matcher::result result;
+
+	const ref_ptr<pattern> &p;
+	const std::vector<pkgCache::PkgIterator> &packages;
+	aptitudeDepCache &cache;
+	bool debug;
+
+	std::vector<std::vector<result> > chunk_results;
+	std::atomic<std::size_t> next_chunk;
+	std::atomic<std::size_t> packages_done;
+	scan_errors errors;
+
+      public:
+	package_scan(const ref_ptr<pattern> &_p,
+		     const std::vector<pkgCache::PkgIterator> &_packages,
+		     aptitudeDepCache &_cache,
+		     bool _debug)
+	  : p(_p), packages(_packages), cache(_cache), debug(_debug),
+	    chunk_results((_packages.size() + search_chunk_size - 1) / search_chunk_size),
+	    next_chunk(0), packages_done(0)
+	{
+	}
+
+	std::size_t get_num_chunks() const { return chunk_results.size(); }
+
+	/** \brief Test chunks of packages until none are left.
+	 *
+	 *  \param info      The search cache of the calling thread.
+	 *  \param records   The package records of the calling thread.
+	 *  \param progress  If not NULL, updated with the progress of
+	 *                   all threads after each chunk and passed to
+	 *                   progress_slot.
+	 */
+	void run(const ref_ptr<search_cache> &info,
+		 pkgRecords &records,
+		 progress_info *progress,
+		 const sigc::slot<void, progress_info> *progress_slot)
+	{
+	  const Matcher matcher;
+
+	  try
+	    {
+	      std::size_t chunk;
+	      while(!errors.has_failed() &&
+		    (chunk = next_chunk++) < chunk_results.size())
 		{
-		  std::string name(it.get_document().get_data());
+		  const std::size_t begin = chunk * search_chunk_size;
+		  const std::size_t end = std::min(begin + search_chunk_size, packages.size());
 
-		  if(debug)
-		    std::cout << "HIT: " << name
-			      << " (score " << it.get_weight() << ")" << std::endl;
+		  for(std::size_t i = begin; i < end; ++i)
+		    matcher(p, packages[i], info, cache, records, debug,
+			    chunk_results[chunk]);
 
-		  pkgCache::PkgIterator pkg(cache.FindPkg(name));
-		  if(pkg.end())
+		  const std::size_t done = packages_done += end - begin;
+		  if(progress != NULL)
 		    {
-		      if(debug)
-			std::cout << "W: unable to find the package " << name
-				  << std::endl;
-		    }
-		  else if(!(pkg.VersionList().end() && pkg.ProvidesList().end()))
-		    {
-		      ref_ptr<structural_match> m(get_match(p, pkg,
-							    info,
-							    cache,
-							    records,
-							    debug));
-
-		      if(m.valid())
-			matches.push_back(std::make_pair(pkg, m));
+		      progress->set_progress_fraction(((double)done) / ((double)packages.size()));
+		      (*progress_slot)(*progress);
 		    }
 		}
 	    }
+	  catch(cwidget::util::Exception &e)
+	    {
+	      errors.fail(e.errmsg());
+	    }
+	  catch(std::exception &e)
+	    {
+	      errors.fail(e.what());
+	    }
+	  catch(Xapian::Error &e)
+	    {
+	      errors.fail(e.get_msg());
+	    }
+	}
 
-          progress_slot(progress_info::none());
+	/** \brief Throw the first error reported by any thread, if any. */
+	void check_failed() const
+	{
+	  errors.check();
 	}
-      catch(cwidget::util::Exception &e)
+
+	/** \brief Append the matches to out in the order of the input
+	 *  packages.
+	 */
+	void get_results(std::vector<result> &out) const
 	{
-	  _error->Error("%s", e.errmsg().c_str());
+	  for(typename std::vector<std::vector<result> >::const_iterator it =
+		chunk_results.begin(); it != chunk_results.end(); ++it)
+	    out.insert(out.end(), it->begin(), it->end());
 	}
-      catch(std::exception &e)
+      };
+
+      /** \brief The body of a search thread other than the caller. */
+      template<typename Matcher>
+      class package_scan_thread
+      {
+	package_scan<Matcher> &scan;
+	ref_ptr<search_cache> info;
+	std::shared_ptr<pkgRecords> records;
+
+      public:
+	package_scan_thread(package_scan<Matcher> &_scan,
+			    const ref_ptr<search_cache> &_info,
+			    const std::shared_ptr<pkgRecords> &_records)
+	  : scan(_scan), info(_info), records(_records)
 	{
-	  _error->Error("%s", e.what());
 	}
-      catch(Xapian::Error &e)
+
+	void operator()() const
 	{
-	  _error->Error("%s", e.get_msg().c_str());
+	  scan.run(info, *records, NULL, NULL);
 	}
+      };
+
+      /** \brief Return the number of threads to use for a scan of
+       *  num_chunks chunks of packages.
+       */
+      unsigned int get_search_threads(std::size_t num_chunks, bool debug)
+      {
+	// Debugging output from several threads would be interleaved.
+	if(debug)
+	  return 1;
+
+	const int configured = aptcfg->FindI(PACKAGE "::Search-Threads", 0);
+	unsigned int rval = configured > 0
+	  ? configured
+	  : std::thread::hardware_concurrency();
+
+	if(rval > num_chunks)
+	  rval = num_chunks;
+
+	return std::max(rval, 1U);
+      }
+
+      /** \brief Test each of the given packages against a pattern,
+       *  using several threads if that's likely to help.
+       *
+       *  Pattern evaluation only reads from the cache.  Each extra
+       *  thread gets its own search cache and package records, since
+       *  neither of those can be shared; the caller's thread uses the
+       *  ones that were passed in and is the only one that reports
+       *  progress.  Matches are returned in the order of packages, no
+       *  matter how many threads were used.
+       */
+      template<typename Matcher>
+      void scan_packages(const ref_ptr<pattern> &p,
+			 const std::vector<pkgCache::PkgIterator> &packages,
+			 const ref_ptr<search_cache> &info,
+			 std::vector<typename Matcher::result> &matches,
+			 aptitudeDepCache &cache,
+			 pkgRecords &records,
+			 bool debug,
+			 progress_info &progress,
+			 const sigc::slot<void, progress_info> &progress_slot)
+      {
+	package_scan<Matcher> scan(p, packages, cache, debug);
+
+	const unsigned int num_threads = get_search_threads(scan.get_num_chunks(), debug);
+
+	std::vector<std::shared_ptr<cwidget::threads::thread> > threads;
+	if(num_threads > 1)
+	  {
+	    // ?task and ?tag load their data the first time they're
+	    // used; make sure that threads don't race to do that.
+	    aptitude::apt::load_tasks_lazy();
+	    aptitude::apt::load_tags_lazy();
+
+	    for(unsigned int i = 1; i < num_threads; ++i)
+	      {
+		const std::shared_ptr<pkgRecords> thread_records =
+		  std::make_shared<pkgRecords>(cache);
+		threads.push_back(std::make_shared<cwidget::threads::thread>(package_scan_thread<Matcher>(scan, search_cache::create(), thread_records)));
+	      }
+	  }
+
+	scan.run(info, records, &progress, &progress_slot);
+
+	for(std::vector<std::shared_ptr<cwidget::threads::thread> >::const_iterator
+	      it = threads.begin(); it != threads.end(); ++it)
+	  (*it)->join();
+
+	scan.check_failed();
+	scan.get_results(matches);
+      }
+    }
+
+    namespace
+    {
+      /** \brief The body of search() and search_packages(). */
+      template<typename Matcher>
+      void search_with(const ref_ptr<pattern> &p,
+		       const ref_ptr<search_cache> &search_info,
+		       std::vector<typename Matcher::result> &matches,
+		       aptitudeDepCache &cache,
+		       pkgRecords &records,
+		       bool debug,
+		       const sigc::slot<void, progress_info> &progress_slot)
+      {
+	try
+	  {
+	    progress_slot(progress_info::pulse(_("Accessing index")));
+
+	    eassert(p.valid());
+	    eassert(search_info.valid());
+
+	    const ref_ptr<search_cache::implementation> info = search_info.dyn_downcast<search_cache::implementation>();
+	    eassert(info.valid());
+
+	    const xapian_info &xapian_results(info->get_toplevel_xapian_info(p, debug));
+
+	    const std::string filter_msg = _("Filtering packages");
+	    if(!xapian_results.get_matched_packages_valid())
+	      {
+		if(debug)
+		  std::cout << "Failed to build a Xapian query for this search." << std::endl
+			    << "Falling back to testing each package." << std::endl;
+
+		progress_info progress = progress_info::bar(0, filter_msg);
+		progress_slot(progress);
+
+		std::vector<pkgCache::PkgIterator> packages;
+		for(pkgCache::PkgIterator pkg = cache.PkgBegin();
+		    !pkg.end(); ++pkg)
+		  {
+		    if(pkg.VersionList().end() && pkg.ProvidesList().end())
+		      continue;
+
+		    packages.push_back(pkg);
+		  }
+
+		// TODO: how do I make sure the sub-patterns are
+		// searched using the right xapian_info?  I could thread
+		// the current top-level or the current xapian_info
+		// through, I suppose.  Or I could use a global list of
+		// term postings and only store match sets on a
+		// per-toplevel basis (that might work, actually?).
+		scan_packages<Matcher>(p, packages, info, matches,
+				       cache, records, debug,
+				       progress, progress_slot);
+	      }
+	    else
+	      {
+		// Xapian doesn't allow us to present meaningful
+		// progress information.
+		progress_slot(progress_info::pulse(filter_msg));
+
+		const Matcher matcher;
+		Xapian::MSet mset(xapian_results.get_xapian_match());
+		for(Xapian::MSetIterator it = mset.begin();
+		    it != mset.end(); ++it)
+		  {
+		    std::string name(it.get_document().get_data());
+
+		    if(debug)
+		      std::cout << "HIT: " << name
+				<< " (score " << it.get_weight() << ")" << std::endl;
+
+		    pkgCache::PkgIterator pkg(cache.FindPkg(name));
+		    if(pkg.end())
+		      {
+			if(debug)
+			  std::cout << "W: unable to find the package " << name
+				    << std::endl;
+		      }
+		    else if(!(pkg.VersionList().end() && pkg.ProvidesList().end()))
+		      matcher(p, pkg, info, cache, records, debug, matches);
+		  }
+	      }
+
+	    progress_slot(progress_info::none());
+	  }
+	catch(cwidget::util::Exception &e)
+	  {
+	    _error->Error("%s", e.errmsg().c_str());
+	  }
+	catch(std::exception &e)
+	  {
+	    _error->Error("%s", e.what());
+	  }
+	catch(Xapian::Error &e)
+	  {
+	    _error->Error("%s", e.get_msg().c_str());
+	  }
+      }
+    }
+
+    void search(const ref_ptr<pattern> &p,
+		const ref_ptr<search_cache> &search_info,
+		std::vector<std::pair<pkgCache::PkgIterator, ref_ptr<structural_match> > > &matches,
+		aptitudeDepCache &cache,
+		pkgRecords &records,
+                bool debug,
+                const sigc::slot<void, progress_info> &progress_slot)
+    {
+      search_with<match_packages>(p, search_info, matches,
+				  cache, records, debug, progress_slot);
+    }
+
+    void search_packages(const ref_ptr<pattern> &p,
+			 const ref_ptr<search_cache> &search_info,
+			 std::vector<pkgCache::PkgIterator> &matches,
+			 aptitudeDepCache &cache,
+			 pkgRecords &records,
+			 bool debug,
+			 const sigc::slot<void, progress_info> &progress_slot)
+    {
+      search_with<match_packages_boolean>(p, search_info, matches,
+					  cache, records, debug, progress_slot);
     }
 
     void search_versions(const ref_ptr<pattern> &p,
@@ -3215,29 +4040,14 @@ namespace aptitude
               progress_info progress = progress_info::bar(0, filter_msg);
               progress_slot(progress);
 
-
-              int i = 0;
+	      std::vector<pkgCache::PkgIterator> packages;
 	      for(pkgCache::PkgIterator pkg = cache.PkgBegin();
 		  !pkg.end(); ++pkg)
-                {
-                  for(pkgCache::VerIterator ver = pkg.VersionList();
-                      !ver.end(); ++ver)
-                    {
-                      ref_ptr<structural_match> m(get_match(p,
-                                                            pkg, ver,
-                                                            info,
-                                                            cache,
-                                                            records,
-                                                            debug));
-
-                      if(m.valid())
-                        matches.push_back(std::make_pair(ver, m));
-                    }
-
-                  ++i;
-                  progress.set_progress_fraction(((double)i) / ((double)cache.Head().PackageCount));
-                  progress_slot(progress);
-                }
+		packages.push_back(pkg);
+
+	      scan_packages<match_versions>(p, packages, info, matches,
+					    cache, records, debug,
+					    progress, progress_slot);
 	    }
 	  else
 	    {
@@ -3294,6 +4104,400 @@ namespace aptitude
 	  _error->Error("%s", e.get_msg().c_str());
 	}
     }
+
+    namespace
+    {
+      // Each thread of a term test sets bits in its own words of the
+      // result.
+      static_assert(search_chunk_size % boost::dynamic_bitset<>::bits_per_block == 0,
+		    "search chunks must cover whole words of a bitset");
+
+      /** \brief A package or a version tested by match_all_packages()
+       *  or match_all_versions().
+       *
+       *  The version is an end iterator when the package itself is
+       *  tested.
+       */
+      typedef std::pair<pkgCache::PkgIterator, pkgCache::VerIterator> match_target;
+
+      /** \brief Tests a term of a pattern against a set of targets,
+       *  a chunk of targets at a time.
+       */
+      class term_scan
+      {
+	const ref_ptr<pattern> &p;
+	bool structural;
+	const std::vector<match_target> &targets;
+	const boost::dynamic_bitset<> &candidates;
+	boost::dynamic_bitset<> &result;
+	aptitudeDepCache &cache;
+	bool debug;
+
+	const std::size_t num_chunks;
+	std::atomic<std::size_t> next_chunk;
+	scan_errors errors;
+
+      public:
+	/** \brief Create a term scan.
+	 *
+	 *  \param _p           The term to test.
+	 *  \param _structural  If \b true, _p is a whole pattern that
+	 *                      has no evaluation plan and is tested with
+	 *                      evaluate_structural().
+	 *  \param _targets     The targets, indexed by ID.
+	 *  \param _candidates  The targets to test.
+	 *  \param _result      The bit of each candidate that matches
+	 *                      _p is set; it must already be cleared.
+	 */
+	term_scan(const ref_ptr<pattern> &_p,
+		  bool _structural,
+		  const std::vector<match_target> &_targets,
+		  const boost::dynamic_bitset<> &_candidates,
+		  boost::dynamic_bitset<> &_result,
+		  aptitudeDepCache &_cache,
+		  bool _debug)
+	  : p(_p), structural(_structural), targets(_targets),
+	    candidates(_candidates), result(_result),
+	    cache(_cache), debug(_debug),
+	    num_chunks((_targets.size() + search_chunk_size - 1) / search_chunk_size),
+	    next_chunk(0)
+	{
+	}
+
+	/** \brief Test chunks of targets until none are left.
+	 *
+	 *  \param info     The search cache of the calling thread.
+	 *  \param records  The package records of the calling thread.
+	 */
+	void run(const ref_ptr<search_cache::implementation> &info,
+		 pkgRecords &records)
+	{
+	  std::vector<matchable> initial_pool;
+
+	  try
+	    {
+	      std::size_t chunk;
+	      while(!errors.has_failed() &&
+		    (chunk = next_chunk++) < num_chunks)
+		{
+		  const std::size_t begin = chunk * search_chunk_size;
+		  const std::size_t end = std::min(begin + search_chunk_size, targets.size());
+
+		  for(std::size_t i = begin; i < end; ++i)
+		    {
+		      if(!candidates[i])
+			continue;
+
+		      initial_pool.clear();
+		      make_initial_pool(targets[i].first, targets[i].second,
+					initial_pool);
+
+		      stack st;
+		      st.push_back(&initial_pool);
+
+		      const bool matched = structural
+			? evaluate_structural(structural_eval_any, p, st, info,
+					      initial_pool, cache, records,
+					      debug).valid()
+			: evaluate_boolean(structural_eval_any, p, st, info,
+					   initial_pool, cache, records,
+					   debug);
+
+		      if(matched)
+			result.set(i);
+		    }
+		}
+	    }
+	  catch(cwidget::util::Exception &e)
+	    {
+	      errors.fail(e.errmsg());
+	    }
+	  catch(std::exception &e)
+	    {
+	      errors.fail(e.what());
+	    }
+	  catch(Xapian::Error &e)
+	    {
+	      errors.fail(e.get_msg());
+	    }
+	}
+
+	/** \brief Throw the first error reported by any thread, if any. */
+	void check_failed() const
+	{
+	  errors.check();
+	}
+      };
+
+      /** \brief The body of a term scan thread other than the caller. */
+      class term_scan_thread
+      {
+	term_scan &scan;
+	ref_ptr<search_cache::implementation> info;
+	std::shared_ptr<pkgRecords> records;
+
+      public:
+	term_scan_thread(term_scan &_scan,
+			 const ref_ptr<search_cache::implementation> &_info,
+			 const std::shared_ptr<pkgRecords> &_records)
+	  : scan(_scan), info(_info), records(_records)
+	{
+	}
+
+	void operator()() const
+	{
+	  scan.run(info, *records);
+	}
+      };
+
+      /** \brief Evaluates a pattern against every target at once.
+       *
+       *  Sets of targets are bitsets indexed by target ID.  The ?and,
+       *  ?or and ?not nodes of the evaluation plan are computed from
+       *  the sets matched by their children with bitwise operations;
+       *  every other node is a term that is tested against each
+       *  target that is still a candidate.  ?and only passes the
+       *  targets that matched its earlier children to the later ones
+       *  and ?or only the targets that didn't, as the plan's
+       *  short-circuit evaluation would.
+       */
+      class set_evaluator
+      {
+	const std::vector<match_target> &targets;
+	const ref_ptr<search_cache::implementation> &info;
+	aptitudeDepCache &cache;
+	pkgRecords &records;
+	bool debug;
+
+	// The search caches and package records of the threads other
+	// than the caller; they're created the first time a term is
+	// tested by several threads, and reused for the other terms so
+	// that their memoized results carry over.
+	std::vector<ref_ptr<search_cache::implementation> > thread_infos;
+	std::vector<std::shared_ptr<pkgRecords> > thread_records;
+
+      public:
+	set_evaluator(const std::vector<match_target> &_targets,
+		      const ref_ptr<search_cache::implementation> &_info,
+		      aptitudeDepCache &_cache,
+		      pkgRecords &_records,
+		      bool _debug)
+	  : targets(_targets), info(_info),
+	    cache(_cache), records(_records), debug(_debug)
+	{
+	}
+
+	/** \brief Test a term against each candidate.
+	 *
+	 *  \param p           The term to test.
+	 *  \param structural  If \b true, p is a pattern with no
+	 *                     evaluation plan.
+	 *  \param candidates  The targets to test.
+	 *  \param result      Set to the candidates that match p.
+	 */
+	void test_term(const ref_ptr<pattern> &p,
+		       bool structural,
+		       const boost::dynamic_bitset<> &candidates,
+		       boost::dynamic_bitset<> &result)
+	{
+	  result.resize(targets.size());
+	  result.reset();
+
+	  const std::size_t num_candidates = candidates.count();
+	  if(num_candidates == 0)
+	    return;
+
+	  term_scan scan(p, structural, targets, candidates, result,
+			 cache, debug);
+
+	  const unsigned int num_threads =
+	    get_search_threads((num_candidates + search_chunk_size - 1) / search_chunk_size,
+			       debug);
+
+	  if(num_threads > 1 && thread_infos.empty())
+	    {
+	      // ?task and ?tag load their data the first time they're
+	      // used; make sure that threads don't race to do that.
+	      aptitude::apt::load_tasks_lazy();
+	      aptitude::apt::load_tags_lazy();
+	    }
+
+	  while(thread_infos.size() + 1 < num_threads)
+	    {
+	      thread_infos.push_back(search_cache::create().dyn_downcast<search_cache::implementation>());
+	      thread_records.push_back(std::make_shared<pkgRecords>(cache));
+	    }
+
+	  std::vector<std::shared_ptr<cwidget::threads::thread> > threads;
+	  for(unsigned int i = 1; i < num_threads; ++i)
+	    threads.push_back(std::make_shared<cwidget::threads::thread>(term_scan_thread(scan, thread_infos[i - 1], thread_records[i - 1])));
+
+	  scan.run(info, records);
+
+	  for(std::vector<std::shared_ptr<cwidget::threads::thread> >::const_iterator
+		it = threads.begin(); it != threads.end(); ++it)
+	    (*it)->join();
+
+	  scan.check_failed();
+	}
+
+	/** \brief Find the candidates that match a node of an
+	 *  evaluation plan.
+	 *
+	 *  \param p           The node to evaluate.
+	 *  \param candidates  The targets to test.
+	 *  \param result      Set to the candidates that match p.
+	 */
+	void evaluate(const ref_ptr<pattern> &p,
+		      const boost::dynamic_bitset<> &candidates,
+		      boost::dynamic_bitset<> &result)
+	{
+	  switch(p->get_type())
+	    {
+	    case pattern::and_tp:
+	      {
+		const std::vector<ref_ptr<pattern> > &sub_patterns(p->get_and_patterns());
+
+		result = candidates;
+		boost::dynamic_bitset<> sub_result;
+		for(std::vector<ref_ptr<pattern> >::const_iterator it =
+		      sub_patterns.begin();
+		    it != sub_patterns.end() && result.any(); ++it)
+		  {
+		    evaluate(*it, result, sub_result);
+		    result &= sub_result;
+		  }
+	      }
+	      break;
+
+	    case pattern::or_tp:
+	      {
+		const std::vector<ref_ptr<pattern> > &sub_patterns(p->get_or_patterns());
+
+		result.resize(targets.size());
+		result.reset();
+		boost::dynamic_bitset<> remaining(candidates);
+		boost::dynamic_bitset<> sub_result;
+		for(std::vector<ref_ptr<pattern> >::const_iterator it =
+		      sub_patterns.begin();
+		    it != sub_patterns.end() && remaining.any(); ++it)
+		  {
+		    evaluate(*it, remaining, sub_result);
+		    result |= sub_result;
+		    remaining -= sub_result;
+		  }
+	      }
+	      break;
+
+	    case pattern::not_tp:
+	      {
+		boost::dynamic_bitset<> sub_result;
+		evaluate(p->get_not_pattern(), candidates, sub_result);
+		result = candidates - sub_result;
+	      }
+	      break;
+
+	    default:
+	      test_term(p, false, candidates, result);
+	      break;
+	    }
+	}
+      };
+
+      /** \brief The body of match_all_packages() and
+       *  match_all_versions().
+       *
+       *  \param targets  The targets, indexed by ID.
+       */
+      void match_all(const ref_ptr<pattern> &p,
+		     const ref_ptr<search_cache> &search_info,
+		     const std::vector<match_target> &targets,
+		     boost::dynamic_bitset<> &matches,
+		     aptitudeDepCache &cache,
+		     pkgRecords &records,
+		     bool debug)
+      {
+	matches.resize(targets.size());
+	matches.reset();
+
+	try
+	  {
+	    eassert(p.valid());
+	    eassert(search_info.valid());
+
+	    const ref_ptr<search_cache::implementation> info = search_info.dyn_downcast<search_cache::implementation>();
+	    eassert(info.valid());
+
+	    // Targets that Xapian rules out can't match.
+	    const xapian_info &xapian_results(info->get_toplevel_xapian_info(p, debug));
+
+	    boost::dynamic_bitset<> candidates(targets.size());
+	    for(std::size_t i = 0; i < targets.size(); ++i)
+	      {
+		const pkgCache::PkgIterator &pkg(targets[i].first);
+		if(!pkg.end() &&
+		   xapian_results.maybe_contains_package(pkg, info->get_db()))
+		  candidates.set(i);
+	      }
+
+	    if(debug)
+	      std::cout << "Testing " << candidates.count() << " of "
+			<< targets.size() << " targets." << std::endl;
+
+	    set_evaluator evaluator(targets, info, cache, records, debug);
+
+	    const ref_ptr<pattern> plan(info->get_compiled_pattern(p));
+	    if(plan.valid())
+	      evaluator.evaluate(plan, candidates, matches);
+	    else
+	      evaluator.test_term(p, true, candidates, matches);
+	  }
+	catch(cwidget::util::Exception &e)
+	  {
+	    matches.reset();
+	    _error->Error("%s", e.errmsg().c_str());
+	  }
+	catch(std::exception &e)
+	  {
+	    matches.reset();
+	    _error->Error("%s", e.what());
+	  }
+	catch(Xapian::Error &e)
+	  {
+	    matches.reset();
+	    _error->Error("%s", e.get_msg().c_str());
+	  }
+      }
+    }
+
+    void match_all_packages(const ref_ptr<pattern> &p,
+			    const ref_ptr<search_cache> &search_info,
+			    boost::dynamic_bitset<> &matches,
+			    aptitudeDepCache &cache,
+			    pkgRecords &records,
+			    bool debug)
+    {
+      std::vector<match_target> targets(cache.Head().PackageCount);
+      for(pkgCache::PkgIterator pkg = cache.PkgBegin(); !pkg.end(); ++pkg)
+	targets[pkg->ID] = match_target(pkg, pkgCache::VerIterator(cache));
+
+      match_all(p, search_info, targets, matches, cache, records, debug);
+    }
+
+    void match_all_versions(const ref_ptr<pattern> &p,
+			    const ref_ptr<search_cache> &search_info,
+			    boost::dynamic_bitset<> &matches,
+			    aptitudeDepCache &cache,
+			    pkgRecords &records,
+			    bool debug)
+    {
+      std::vector<match_target> targets(cache.Head().VersionCount);
+      for(pkgCache::PkgIterator pkg = cache.PkgBegin(); !pkg.end(); ++pkg)
+	for(pkgCache::VerIterator ver = pkg.VersionList(); !ver.end(); ++ver)
+	  targets[ver->ID] = match_target(pkg, ver);
+
+      match_all(p, search_info, targets, matches, cache, records, debug);
+    }
   }
 }
 
@@ -29,6 +29,8 @@
 
 #include <sigc++/slot.h>
 
+#include <boost/dynamic_bitset.hpp>
+
 #include <vector>
 
 #include <regex.h>
@@ -687,6 +689,46 @@ namespace aptitude
 	      pkgRecords &records,
 	      bool debug = false);
 
+    /** \brief Test whether a version of a package matches a pattern.
+     *
+     *  This is equivalent to testing whether get_match() returns a
+     *  valid match, but it doesn't build the match tree: the pattern
+     *  is compiled into an evaluation plan (see compile_pattern())
+     *  that tests the cheapest terms first and stops as soon as the
+     *  result is known.  Use it when only the result matters.
+     *
+     *  \param p   The pattern to execute.
+     *  \param pkg The package to compare.
+     *  \param ver The version of pkg to compare, or an end iterator to match the
+     *             package itself.
+     *  \param search_info  Where to store "side information"
+     *                      associated with this search; the
+     *                      evaluation plan of p is cached here.
+     *  \param cache   The cache in which to search.
+     *  \param records The package records with which to perform the match.
+     *  \param debug   If \b true, information about the search process
+     *                 will be printed to standard output.
+     */
+    bool matches(const cwidget::util::ref_ptr<pattern> &p,
+		 const pkgCache::PkgIterator &pkg,
+		 const pkgCache::VerIterator &ver,
+		 const cwidget::util::ref_ptr<search_cache> &search_info,
+		 aptitudeDepCache &cache,
+		 pkgRecords &records,
+		 bool debug = false);
+
+    /** \brief Test whether a package matches a pattern.
+     *
+     *  This tests the package as a package, not as a version; see
+     *  the other overload for details.
+     */
+    bool matches(const cwidget::util::ref_ptr<pattern> &p,
+		 const pkgCache::PkgIterator &pkg,
+		 const cwidget::util::ref_ptr<search_cache> &search_info,
+		 aptitudeDepCache &cache,
+		 pkgRecords &records,
+		 bool debug = false);
+
     /** \brief Retrieve all the packages matching the given pattern.
      *
      *  This may use Xapian or other indices to accelerate the search
@@ -711,6 +753,31 @@ namespace aptitude
                 const sigc::slot<void, aptitude::util::progress_info> &progress_slot
                   = sigc::slot<void, aptitude::util::progress_info>());
 
+    /** \brief Retrieve all the packages matching the given pattern,
+     *  without computing how they matched.
+     *
+     *  This is like search(), but tests each package with matches()
+     *  instead of get_match().
+     *
+     *  \param p            The pattern to match against.
+     *  \param search_info  Where to store "side information"
+     *                      associated with this search.
+     *  \param matches      Where to store the matching packages.
+     *  \param cache        The package cache in which to search.
+     *  \param records      The package records in which to perform the match.
+     *  \param debug        If \b true, information about the search
+     *                      process will be printed to standard output.
+     *  \param progress_slot A slot used to report the progress of the search.
+     */
+    void search_packages(const cwidget::util::ref_ptr<pattern> &p,
+			 const cwidget::util::ref_ptr<search_cache> &search_info,
+			 std::vector<pkgCache::PkgIterator> &matches,
+			 aptitudeDepCache &cache,
+			 pkgRecords &records,
+			 bool debug = false,
+			 const sigc::slot<void, aptitude::util::progress_info> &progress_slot =
+			   sigc::slot<void, aptitude::util::progress_info>());
+
     /** \brief Retrieve all the package versions matching the given pattern.
      *
      *  This may use Xapian or other indices to accelerate the search
@@ -734,6 +801,53 @@ namespace aptitude
                          bool debug = false,
                          const sigc::slot<void, aptitude::util::progress_info> &progress_slot =
                            sigc::slot<void, aptitude::util::progress_info>());
+
+    /** \brief Test every package in the cache against a pattern.
+     *
+     *  This gives the same results as calling matches() on each
+     *  package, but the pattern is evaluated a set of packages at a
+     *  time: ?and, ?or and ?not at the top of the evaluation plan
+     *  are computed as bitwise operations on the sets matched by
+     *  their terms, and each term is only tested against the
+     *  packages whose result still depends on it.  Use it to filter
+     *  a large part of the cache, e.g. to limit a package view.
+     *
+     *  Errors are reported through _error, in which case no package
+     *  is matched.
+     *
+     *  \param p            The pattern to match against.
+     *  \param search_info  Where to store "side information"
+     *                      associated with this search.
+     *  \param matches      Set to a bitset indexed by package ID; the
+     *                      bit of each matching package is set.
+     *  \param cache        The package cache in which to search.
+     *  \param records      The package records in which to perform the match.
+     *  \param debug        If \b true, information about the search
+     *                      process will be printed to standard output.
+     */
+    void match_all_packages(const cwidget::util::ref_ptr<pattern> &p,
+			    const cwidget::util::ref_ptr<search_cache> &search_info,
+			    boost::dynamic_bitset<> &matches,
+			    aptitudeDepCache &cache,
+			    pkgRecords &records,
+			    bool debug = false);
+
+    /** \brief Test every version in the cache against a pattern.
+     *
+     *  This is the counterpart of match_all_packages() for versions:
+     *  the result is the same as calling matches() on each version.
+     *
+     *  \param matches  Set to a bitset indexed by version ID; the bit
+     *                  of each matching version is set.
+     *
+     *  \sa match_all_packages()
+     */
+    void match_all_versions(const cwidget::util::ref_ptr<pattern> &p,
+			    const cwidget::util::ref_ptr<search_cache> &search_info,
+			    boost::dynamic_bitset<> &matches,
+			    aptitudeDepCache &cache,
+			    pkgRecords &records,
+			    bool debug = false);
   }
 }
 
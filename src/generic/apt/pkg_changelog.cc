@@ -24,7 +24,9 @@
 #include "config_signal.h"
 #include "download_queue.h"
 
+#include <generic/util/file_cache.h>
 #include <generic/util/job_queue_thread.h>
+#include <generic/util/temp.h>
 
 #include <aptitude.h>
 #include <config.h>
@@ -46,7 +48,9 @@
 #include <loggers.h>
 
 #include <deque>
+#include <map>
 #include <memory>
+#include <vector>
 
 using namespace std;
 namespace cw = cwidget;
@@ -81,6 +85,57 @@ namespace aptitude
 
 	return false;
       }
+
+      /** \brief Return the URI from which the changelog can be
+       *  downloaded from the archive.
+       *
+       *  Since the URI names the source version, whatever is stored
+       *  under it in the download cache never goes out of date.
+       */
+      std::string get_remote_uri(const changelog_info &info)
+      {
+	if (!info.get_uri().empty())
+	  return info.get_uri();
+
+	const string &source_package(info.get_source_package());
+	const string &source_version(info.get_source_version());
+	const string &section(info.get_section());
+
+	string realsection;
+
+	if (section.find('/') != section.npos)
+	  realsection.assign(section, 0, section.find('/'));
+	else
+	  realsection.assign("main");
+
+	string prefix;
+
+	if(source_package.size() > 3 &&
+	   source_package[0] == 'l' && source_package[1] == 'i' && source_package[2] == 'b')
+	  prefix = std::string("lib") + source_package[3];
+	else
+	  prefix = source_package[0];
+
+	string realver;
+
+	if(source_version.find(':') != source_version.npos)
+	  realver.assign(source_version, source_version.find(':') + 1, source_version.npos);
+	else
+	  realver = source_version;
+
+	// WATCH: apt/cmdline/apt-get.cc(DownloadChangelog)
+	string server = aptcfg->Find("APT::Changelogs::Server",
+				     "http://metadata.ftp-master.debian.org/changelogs");
+	string path = cw::util::ssprintf("%s/%s/%s/%s_%s",
+					 realsection.c_str(),
+					 prefix.c_str(),
+					 source_package.c_str(),
+					 source_package.c_str(),
+					 realver.c_str());
+	return cw::util::ssprintf("%s/%s_changelog",
+				  server.c_str(),
+				  path.c_str());
+      }
     }
 
     std::shared_ptr<changelog_info>
@@ -458,7 +513,6 @@ namespace aptitude
 
 	  const string source_package(info.get_source_package());
 	  const string source_version(info.get_source_version());
-	  const string section(info.get_section());
 	  const string name(info.get_display_name());
 	  const string short_description = cw::util::ssprintf(_("Changelog of %s"), name.c_str());
 
@@ -553,45 +607,7 @@ namespace aptitude
 		      }
 		}
 
-	      std::string uri = info.get_uri();
-	      if (uri.empty())
-		{
-		  string realsection;
-
-		  if (section.find('/') != section.npos)
-		    realsection.assign(section, 0, section.find('/'));
-		  else
-		    realsection.assign("main");
-
-		  string prefix;
-
-		  if(source_package.size() > 3 &&
-		     source_package[0] == 'l' && source_package[1] == 'i' && source_package[2] == 'b')
-		    prefix = std::string("lib") + source_package[3];
-		  else
-		    prefix = source_package[0];
-
-		  string realver;
-
-		  if(source_version.find(':') != source_version.npos)
-		    realver.assign(source_version, source_version.find(':') + 1, source_version.npos);
-		  else
-		    realver = source_version;
-
-		  // WATCH: apt/cmdline/apt-get.cc(DownloadChangelog)
-		  string server = aptcfg->Find("APT::Changelogs::Server",
-					       "http://metadata.ftp-master.debian.org/changelogs");
-		  string path = cw::util::ssprintf("%s/%s/%s/%s_%s",
-						   realsection.c_str(),
-						   prefix.c_str(),
-						   source_package.c_str(),
-						   source_package.c_str(),
-						   realver.c_str());
-		  uri = cw::util::ssprintf("%s/%s_changelog",
-					   server.c_str(),
-					   path.c_str());
-		}
-
+	      const std::string uri = get_remote_uri(info);
 	      if (!uri.empty())
 		{
 		  LOG_TRACE(logger,
@@ -680,6 +696,282 @@ get_changelog(const pkgCache::VerIterator &ver,
 		       post_thunk);
 }
 
+namespace
+{
+  /** \brief Collects the results of a batch of changelog downloads
+   *  and passes them on in the order in which the changelogs were
+   *  requested.
+   */
+  class changelog_batch : public std::enable_shared_from_this<changelog_batch>,
+			  public download_request
+  {
+    struct result
+    {
+      bool finished;
+      bool succeeded;
+      // The file name if the changelog was fetched, or the error
+      // message if it wasn't.
+      std::string text;
+
+      result()
+	: finished(false), succeeded(false)
+      {
+      }
+    };
+
+    // The callbacks of each changelog.  Read-only, so they can be
+    // used without holding the lock.
+    const std::vector<std::shared_ptr<download_callbacks> > callbacks;
+
+    std::vector<result> results;
+
+    // The changelogs that were found in the download cache; they're
+    // removed along with the batch.
+    std::vector<temp::name> cached_files;
+
+    // The downloads started for this batch.  Each download holds a
+    // strong reference to the batch, so we can't hold strong
+    // references to them.
+    std::vector<std::weak_ptr<download_request> > downloads;
+
+    // The first changelog whose result hasn't been passed on yet.
+    std::size_t next_to_report;
+
+    bool canceled;
+
+    cw::threads::mutex state_mutex;
+
+  public:
+    explicit changelog_batch(const std::vector<std::shared_ptr<download_callbacks> > &_callbacks)
+      : callbacks(_callbacks),
+	results(_callbacks.size()),
+	next_to_report(0),
+	canceled(false)
+    {
+    }
+
+    void add_download(const std::shared_ptr<download_request> &download)
+    {
+      cw::threads::mutex::lock l(state_mutex);
+
+      downloads.push_back(download);
+    }
+
+    void add_cached_file(const temp::name &name)
+    {
+      cw::threads::mutex::lock l(state_mutex);
+
+      cached_files.push_back(name);
+    }
+
+    /** \brief Store the result of fetching the changelogs with the
+     *  given indices.
+     */
+    void set_result(const std::vector<std::size_t> &indices,
+		    bool succeeded,
+		    const std::string &text)
+    {
+      cw::threads::mutex::lock l(state_mutex);
+
+      for(std::vector<std::size_t>::const_iterator it = indices.begin();
+	  it != indices.end(); ++it)
+	{
+	  result &r(results[*it]);
+	  r.finished = true;
+	  r.succeeded = succeeded;
+	  r.text = text;
+	}
+    }
+
+    /** \brief Pass on the results that are available, stopping at
+     *  the first changelog that hasn't been fetched yet.
+     *
+     *  Must be invoked in the main thread.
+     */
+    void report_finished()
+    {
+      while(true)
+	{
+	  std::shared_ptr<download_callbacks> cb;
+	  result r;
+
+	  {
+	    cw::threads::mutex::lock l(state_mutex);
+
+	    if(canceled ||
+	       next_to_report == results.size() ||
+	       !results[next_to_report].finished)
+	      return;
+
+	    cb = callbacks[next_to_report];
+	    r = results[next_to_report];
+	    ++next_to_report;
+	  }
+
+	  // The lock is released first, in case the callback wants to
+	  // cancel the batch.
+	  if(r.succeeded)
+	    cb->success(r.text);
+	  else
+	    cb->failure(r.text);
+	}
+    }
+
+    void partial_download(const std::vector<std::size_t> &indices,
+			  const std::string &filename,
+			  unsigned long long currentSize,
+			  unsigned long long totalSize)
+    {
+      for(std::vector<std::size_t>::const_iterator it = indices.begin();
+	  it != indices.end(); ++it)
+	callbacks[*it]->partial_download(filename, currentSize, totalSize);
+    }
+
+    void cancel()
+    {
+      std::vector<std::weak_ptr<download_request> > to_cancel;
+
+      {
+	cw::threads::mutex::lock l(state_mutex);
+
+	if(canceled)
+	  return;
+
+	canceled = true;
+	to_cancel.swap(downloads);
+      }
+
+      for(std::vector<std::weak_ptr<download_request> >::const_iterator
+	    it = to_cancel.begin(); it != to_cancel.end(); ++it)
+	{
+	  std::shared_ptr<download_request> download(it->lock());
+	  if(download.get() != NULL)
+	    download->cancel();
+	}
+    }
+  };
+
+  /** \brief Passes the events of one download in a batch on to the
+   *  batch.
+   *
+   *  Requests for the same changelog share a download, so a download
+   *  can stand for several entries of the batch.
+   */
+  class changelog_batch_item : public download_callbacks
+  {
+    std::shared_ptr<changelog_batch> batch;
+    std::vector<std::size_t> indices;
+
+  public:
+    changelog_batch_item(const std::shared_ptr<changelog_batch> &_batch,
+			 const std::vector<std::size_t> &_indices)
+      : batch(_batch),
+	indices(_indices)
+    {
+    }
+
+    void success(const std::string& filename)
+    {
+      batch->set_result(indices, true, filename);
+      batch->report_finished();
+    }
+
+    void failure(const std::string &msg)
+    {
+      batch->set_result(indices, false, msg);
+      batch->report_finished();
+    }
+
+    void partial_download(const std::string& filename,
+			  unsigned long long currentSize,
+			  unsigned long long totalSize)
+    {
+      batch->partial_download(indices, filename, currentSize, totalSize);
+    }
+  };
+}
+
+std::shared_ptr<download_request>
+get_changelogs(const std::vector<std::shared_ptr<changelog_info> > &infos,
+	       const std::vector<std::shared_ptr<download_callbacks> > &callbacks,
+	       post_thunk_f post_thunk)
+{
+  logging::LoggerPtr logger(Loggers::getAptitudeChangelog());
+
+  std::shared_ptr<changelog_batch> batch =
+    std::make_shared<changelog_batch>(callbacks);
+
+  // Find out which requests are for the same changelog, keeping the
+  // order in which each changelog was first requested.
+  std::vector<std::string> uris;
+  std::vector<std::vector<std::size_t> > groups;
+  {
+    std::map<std::string, std::size_t> group_by_key;
+    for(std::size_t i = 0; i < infos.size(); ++i)
+      {
+	const changelog_info &info(*infos[i]);
+	const std::string uri = get_remote_uri(info);
+	const std::string key = info.get_source_package() + " " +
+	  info.get_source_version() + " " + uri;
+
+	std::map<std::string, std::size_t>::const_iterator found =
+	  group_by_key.find(key);
+	if(found != group_by_key.end())
+	  groups[found->second].push_back(i);
+	else
+	  {
+	    group_by_key[key] = groups.size();
+	    uris.push_back(uri);
+	    groups.push_back(std::vector<std::size_t>(1, i));
+	  }
+      }
+  }
+
+  // Look up every changelog in the download cache before starting any
+  // downloads; the ones that are found don't need to go through the
+  // download queue at all.
+  auto download_cache = get_download_cache();
+  std::size_t num_cached = 0;
+  for(std::size_t g = 0; g < groups.size(); ++g)
+    {
+      const std::shared_ptr<changelog_info> &info(infos[groups[g].front()]);
+
+      temp::name cached;
+      if(download_cache)
+	cached = download_cache->getItem(uris[g]);
+
+      struct stat buf;
+      if(cached.valid() && stat(cached.get_name().c_str(), &buf) == 0)
+	{
+	  LOG_TRACE(logger,
+		    "Using the cached changelog of "
+		    << info->get_source_package() << " "
+		    << info->get_source_version() << " from " << uris[g]);
+
+	  batch->add_cached_file(cached);
+	  batch->set_result(groups[g], true, cached.get_name());
+	  ++num_cached;
+	}
+      else
+	batch->add_download(get_changelog(info,
+					  std::make_shared<changelog_batch_item>(batch, groups[g]),
+					  post_thunk));
+    }
+
+  LOG_DEBUG(logger,
+	    "Fetching " << infos.size() << " changelogs ("
+	    << groups.size() << " distinct, "
+	    << num_cached << " found in the cache)");
+
+  if(num_cached > 0)
+    {
+      sigc::slot<void> report_slot(sigc::mem_fun(*batch, &changelog_batch::report_finished));
+      post_thunk(make_keepalive_slot(report_slot, batch));
+    }
+
+  return batch;
+}
+
 bool check_valid_origin(const pkgCache::VerIterator& ver)
 {
   for (pkgCache::VerFileIterator vf = ver.FileList(); !vf.end(); ++vf)
@@ -33,6 +33,7 @@
 #include <map>
 #include <memory>
 #include <string>
+#include <vector>
 
 
 /** \brief Routines to download a Debian changelog for a given package.
@@ -138,6 +139,31 @@ namespace aptitude
 		  const sigc::slot<void, std::string> &success,
 		  const sigc::slot<void, std::string> &failure);
 
+    /** \brief Start fetching several changelogs at once.
+     *
+     *  The download cache is checked for every changelog first, and
+     *  the ones that aren't there are all queued for downloading
+     *  together, so they are fetched by a single run of the
+     *  background download queue instead of one after another.
+     *  Requests for the same changelog share one download.
+     *
+     *  \param infos      The changelogs that are to be fetched.
+     *  \param callbacks  The callbacks to invoke for each changelog;
+     *                    must be as long as \b infos.
+     *  \param post_thunk How to post thunks to the foreground thread.
+     *
+     *  The success or failure callback of each changelog is invoked
+     *  in the main thread once it and every changelog before it in
+     *  \b infos have been fetched, so results are reported in order
+     *  as they become available.  Partial download callbacks are
+     *  invoked as soon as they happen.  Files taken from the cache
+     *  are kept at least as long as the returned object.
+     */
+    std::shared_ptr<download_request>
+    get_changelogs(const std::vector<std::shared_ptr<changelog_info> > &infos,
+		   const std::vector<std::shared_ptr<download_callbacks> > &callbacks,
+		   post_thunk_f post_thunk);
+
     /** Check whether it's a valid Origin (otherwise the URL is not known)
      *
      * It also emits _error->Error() that can be shown by the caller
@@ -0,0 +1,551 @@
+// pkgstates_journal.cc
+//
+//   This program is free software; you can redistribute it and/or
+//   modify it under the terms of the GNU General Public License as
+//   published by the Free Software Foundation; either version 2 of
+//   the License, or (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//   General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program; see the file COPYING.  If not, write to
+//   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+//   Boston, MA 02110-1301, USA.
+
+#include "pkgstates_journal.h"
+
+#include <aptitude.h>
+#include <loggers.h>
+
+#include <apt-pkg/error.h>
+#include <apt-pkg/fileutl.h>
+#include <apt-pkg/mmap.h>
+
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+using aptitude::Loggers;
+
+namespace aptitude
+{
+  namespace apt
+  {
+    namespace
+    {
+      /** \brief The start of the base file and of the journal.
+       *
+       *  The header is followed by the records, each of which is a
+       *  record_header, the encoded record and padding up to a
+       *  multiple of eight bytes.  The base file stores its number of
+       *  records in the header; the journal stores 0 and is read up
+       *  to the end of the file.
+       */
+      struct file_header
+      {
+	char magic[8];
+	uint32_t format_version;
+	uint32_t num_records;
+	uint64_t generation;
+      };
+
+      struct record_header
+      {
+	uint32_t length;
+	uint32_t reserved;
+	uint64_t checksum;
+      };
+
+      const char base_magic[8] = { 'A', 'P', 'T', 'S', 'T', 'A', 'T', 'E' };
+      const char journal_magic[8] = { 'A', 'P', 'T', 'S', 'J', 'R', 'N', 'L' };
+      const uint32_t format_version = 1;
+
+      // The journal is compacted when it holds more records than
+      // this, or than a quarter of the base file.
+      const std::size_t min_journal_limit = 1024;
+
+      // Bits of the flags byte of an encoded record.
+      const unsigned char flag_unseen = 1 << 0;
+      const unsigned char flag_upgrade = 1 << 1;
+      const unsigned char flag_reinstall = 1 << 2;
+      const unsigned char flag_auto_new_install = 1 << 3;
+
+      // The key hash, the flags, the selection state, the dselect
+      // state and the removal reason.
+      const std::size_t fixed_payload_size = 8 + 4;
+
+      inline std::size_t pad8(std::size_t n)
+      {
+	return (n + 7) & ~std::size_t(7);
+      }
+
+      // 64-bit FNV-1a.
+      uint64_t fnv1a(const char *data, std::size_t size,
+		     uint64_t hash = 14695981039346656037ULL)
+      {
+	for(std::size_t i = 0; i < size; ++i)
+	  hash = (hash ^ (unsigned char)data[i]) * 1099511628211ULL;
+	return hash;
+      }
+
+      uint64_t get_key_hash(const std::string &name, const std::string &arch)
+      {
+	const uint64_t name_hash = fnv1a(name.c_str(), name.size() + 1);
+	return fnv1a(arch.data(), arch.size(), name_hash);
+      }
+
+      void append_string(std::string &out, const std::string &s)
+      {
+	out += s;
+	out.push_back('\0');
+      }
+
+      /** \brief Read a NUL-terminated string, advancing data. */
+      bool read_string(const char *&data, const char *end, std::string &out)
+      {
+	const char *nul = static_cast<const char *>(memchr(data, '\0', end - data));
+	if(nul == NULL)
+	  return false;
+
+	out.assign(data, nul);
+	data = nul + 1;
+	return true;
+      }
+
+      /** \brief Check the header of a file and the record after it.
+       *
+       *  \return the size of the record (header, payload and padding)
+       *  that starts at data, or 0 if it is invalid or incomplete.
+       */
+      std::size_t check_record(const char *data, const char *end)
+      {
+	if((std::size_t)(end - data) < sizeof(record_header))
+	  return 0;
+
+	record_header header;
+	memcpy(&header, data, sizeof(header));
+
+	const std::size_t size = pad8(sizeof(header) + header.length);
+	if(header.length < fixed_payload_size ||
+	   (std::size_t)(end - data) < size ||
+	   fnv1a(data + sizeof(header), header.length) != header.checksum)
+	  return 0;
+
+	return size;
+      }
+
+      /** \brief The records that were read, with the latest record of
+       *  each package.
+       */
+      class record_merger
+      {
+	std::vector<pkgstates_journal::stored_record> &records;
+	std::unordered_multimap<uint64_t, std::size_t> by_key;
+
+      public:
+	explicit record_merger(std::vector<pkgstates_journal::stored_record> &_records)
+	  : records(_records)
+	{
+	}
+
+	/** \brief Decode and add the record starting at data, which
+	 *  must have passed check_record().
+	 */
+	bool add(const char *data)
+	{
+	  record_header header;
+	  memcpy(&header, data, sizeof(header));
+
+	  pkgstates_journal::stored_record record;
+	  if(!decode_package_state(data + sizeof(header), header.length,
+				   record.state))
+	    return false;
+	  record.checksum = header.checksum;
+
+	  uint64_t key;
+	  memcpy(&key, data + sizeof(header), sizeof(key));
+
+	  typedef std::unordered_multimap<uint64_t, std::size_t>::const_iterator iterator;
+	  const std::pair<iterator, iterator> found = by_key.equal_range(key);
+	  for(iterator it = found.first; it != found.second; ++it)
+	    {
+	      pkgstates_journal::stored_record &existing(records[it->second]);
+	      if(existing.state.name == record.state.name &&
+		 existing.state.arch == record.state.arch)
+		{
+		  existing = record;
+		  return true;
+		}
+	    }
+
+	  by_key.insert(std::make_pair(key, records.size()));
+	  records.push_back(record);
+	  return true;
+	}
+      };
+
+      /** \brief Map a whole file, or return NULL if it's empty or
+       *  can't be read.
+       */
+      std::unique_ptr<MMap> map_file(FileFd &file, const std::string &filename)
+      {
+	if(!file.Open(filename, FileFd::ReadOnly) || file.Size() == 0)
+	  return std::unique_ptr<MMap>();
+
+	std::unique_ptr<MMap> rval(new MMap(file, MMap::ReadOnly));
+	if(rval->Data() == NULL)
+	  return std::unique_ptr<MMap>();
+
+	return rval;
+      }
+
+      bool read_header(const char *data, std::size_t size,
+		       const char (&magic)[8], file_header &out)
+      {
+	if(size < sizeof(out))
+	  return false;
+
+	memcpy(&out, data, sizeof(out));
+	return
+	  memcmp(out.magic, magic, sizeof(out.magic)) == 0 &&
+	  out.format_version == format_version;
+      }
+
+      void append_header(std::string &out, const char (&magic)[8],
+			 uint32_t num_records, uint64_t generation)
+      {
+	file_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, magic, sizeof(header.magic));
+	header.format_version = format_version;
+	header.num_records = num_records;
+	header.generation = generation;
+	out.append(reinterpret_cast<const char *>(&header), sizeof(header));
+      }
+
+      void append_record(std::string &out, const std::string &payload)
+      {
+	record_header header;
+	header.length = payload.size();
+	header.reserved = 0;
+	header.checksum = package_state_checksum(payload);
+	out.append(reinterpret_cast<const char *>(&header), sizeof(header));
+	out += payload;
+	out.resize(pad8(out.size()), '\0');
+      }
+    }
+
+    std::string encode_package_state(const package_state_record &record)
+    {
+      std::string rval;
+      rval.reserve(fixed_payload_size + record.name.size() + record.arch.size() + 8);
+
+      const uint64_t key = get_key_hash(record.name, record.arch);
+      rval.append(reinterpret_cast<const char *>(&key), sizeof(key));
+
+      unsigned char flags = 0;
+      if(record.unseen)
+	flags |= flag_unseen;
+      if(record.upgrade)
+	flags |= flag_upgrade;
+      if(record.reinstall)
+	flags |= flag_reinstall;
+      if(record.auto_new_install)
+	flags |= flag_auto_new_install;
+
+      rval.push_back(flags);
+      rval.push_back(static_cast<char>(record.selection_state));
+      rval.push_back(static_cast<char>(record.dselect_state));
+      rval.push_back(static_cast<char>(record.remove_reason));
+
+      append_string(rval, record.name);
+      append_string(rval, record.arch);
+      append_string(rval, record.candver);
+      append_string(rval, record.forbidver);
+      append_string(rval, record.user_tags);
+
+      return rval;
+    }
+
+    bool decode_package_state(const char *data, std::size_t size,
+			      package_state_record &out)
+    {
+      if(size < fixed_payload_size)
+	return false;
+
+      const char *end = data + size;
+      data += sizeof(uint64_t);
+
+      const unsigned char flags = data[0];
+      out.unseen = (flags & flag_unseen) != 0;
+      out.upgrade = (flags & flag_upgrade) != 0;
+      out.reinstall = (flags & flag_reinstall) != 0;
+      out.auto_new_install = (flags & flag_auto_new_install) != 0;
+      out.selection_state = (unsigned char)data[1];
+      out.has_dselect_state = true;
+      out.dselect_state = (unsigned char)data[2];
+      out.remove_reason = (unsigned char)data[3];
+      out.install_reason = 0;
+      data += 4;
+
+      return
+	read_string(data, end, out.name) &&
+	read_string(data, end, out.arch) &&
+	read_string(data, end, out.candver) &&
+	read_string(data, end, out.forbidver) &&
+	read_string(data, end, out.user_tags) &&
+	data == end;
+    }
+
+    uint64_t package_state_checksum(const std::string &payload)
+    {
+      return fnv1a(payload.data(), payload.size());
+    }
+
+    pkgstates_journal::pkgstates_journal(const std::string &_base_filename)
+      : base_filename(_base_filename),
+	journal_filename(_base_filename + ".journal"),
+	generation(0), base_records(0), journal_records(0),
+	journal_end(0), journal_valid(false)
+    {
+    }
+
+    bool pkgstates_journal::exists() const
+    {
+      struct stat buf;
+      return stat(base_filename.c_str(), &buf) == 0;
+    }
+
+    bool pkgstates_journal::read(std::vector<stored_record> &out)
+    {
+      logging::LoggerPtr logger(Loggers::getAptitudeAptCache());
+
+      out.clear();
+      generation = 0;
+      base_records = 0;
+      journal_records = 0;
+      journal_end = 0;
+      journal_valid = false;
+
+      // A missing file is reported by the return value, not as an
+      // error.
+      _error->PushToStack();
+
+      record_merger merger(out);
+
+      {
+	FileFd file;
+	std::unique_ptr<MMap> map(map_file(file, base_filename));
+	if(map.get() == NULL)
+	  {
+	    _error->RevertToStack();
+	    return false;
+	  }
+
+	const char *data = static_cast<const char *>(map->Data());
+	const char * const end = data + map->Size();
+
+	file_header header;
+	if(!read_header(data, end - data, base_magic, header) ||
+	   header.generation == 0)
+	  {
+	    LOG_WARN(logger, "Invalid header in " << base_filename);
+	    _error->RevertToStack();
+	    return false;
+	  }
+
+	data += sizeof(header);
+	for(uint32_t i = 0; i < header.num_records; ++i)
+	  {
+	    const std::size_t size = check_record(data, end);
+	    if(size == 0 || !merger.add(data))
+	      {
+		LOG_WARN(logger, "Invalid record " << i << " in " << base_filename);
+		out.clear();
+		_error->RevertToStack();
+		return false;
+	      }
+
+	    data += size;
+	  }
+
+	generation = header.generation;
+	base_records = header.num_records;
+      }
+
+      {
+	FileFd file;
+	std::unique_ptr<MMap> map(map_file(file, journal_filename));
+	if(map.get() != NULL)
+	  {
+	    const char * const begin = static_cast<const char *>(map->Data());
+	    const char * const end = begin + map->Size();
+	    const char *data = begin;
+
+	    file_header header;
+	    if(read_header(data, end - data, journal_magic, header) &&
+	       header.generation == generation)
+	      {
+		journal_valid = true;
+		data += sizeof(header);
+
+		while(data != end)
+		  {
+		    const std::size_t size = check_record(data, end);
+		    if(size == 0 || !merger.add(data))
+		      {
+			// Most likely the program was interrupted while
+			// appending to the journal; the next append
+			// overwrites the damaged record.
+			LOG_WARN(logger, "Ignoring " << (end - data) << " bytes at the end of " << journal_filename);
+			break;
+		      }
+
+		    data += size;
+		    ++journal_records;
+		  }
+
+		journal_end = data - begin;
+	      }
+	    else
+	      LOG_INFO(logger, "Ignoring " << journal_filename << ", which doesn't belong to " << base_filename);
+	  }
+      }
+
+      _error->RevertToStack();
+
+      LOG_DEBUG(logger, "Read " << base_records << " package states from " << base_filename
+		<< " and " << journal_records << " from " << journal_filename);
+
+      return true;
+    }
+
+    bool pkgstates_journal::needs_compaction(std::size_t num_new_records) const
+    {
+      if(generation == 0 || !journal_valid)
+	return true;
+
+      const std::size_t limit = std::max(min_journal_limit, base_records / 4);
+      return journal_records + num_new_records > limit;
+    }
+
+    bool pkgstates_journal::save(const std::vector<std::string> &changed,
+				 const std::vector<std::string> &all)
+    {
+      if(needs_compaction(changed.size()))
+	return rewrite(all);
+      else if(changed.empty())
+	return true;
+      else
+	return append(changed);
+    }
+
+    bool pkgstates_journal::append(const std::vector<std::string> &payloads)
+    {
+      if(generation == 0 || !journal_valid)
+	return false;
+
+      std::string data;
+      for(std::vector<std::string>::const_iterator it = payloads.begin();
+	  it != payloads.end(); ++it)
+	append_record(data, *it);
+
+      FileFd file;
+      const bool ok =
+	file.Open(journal_filename, FileFd::WriteExists) &&
+	file.Truncate(journal_end) &&
+	file.Seek(journal_end) &&
+	file.Write(data.data(), data.size()) &&
+	file.Close();
+
+      if(!ok)
+	return _error->Error(_("Couldn't write state file"));
+
+      journal_end += data.size();
+      journal_records += payloads.size();
+      return true;
+    }
+
+    bool pkgstates_journal::write_file(const std::string &filename,
+				       bool is_base,
+				       const std::vector<std::string> &payloads) const
+    {
+      std::string data;
+      if(is_base)
+	append_header(data, base_magic, payloads.size(), generation);
+      else
+	append_header(data, journal_magic, 0, generation);
+      for(std::vector<std::string>::const_iterator it = payloads.begin();
+	  it != payloads.end(); ++it)
+	append_record(data, *it);
+
+      const std::string newname = filename + ".new";
+
+      FileFd out;
+      bool ok =
+	out.Open(newname, FileFd::WriteEmpty, 0644) &&
+	out.Write(data.data(), data.size());
+      ok = out.Close() && ok;
+
+      if(!ok)
+	{
+	  unlink(newname.c_str());
+	  return _error->Error(_("Couldn't write state file"));
+	}
+
+      if(rename(newname.c_str(), filename.c_str()) != 0)
+	{
+	  unlink(newname.c_str());
+	  return _error->Errno("rename", _("couldn't replace %s with %s"),
+			       filename.c_str(), newname.c_str());
+	}
+
+      return true;
+    }
+
+    bool pkgstates_journal::rewrite(const std::vector<std::string> &payloads)
+    {
+      logging::LoggerPtr logger(Loggers::getAptitudeAptCache());
+
+      // Use a generation that the old journal can't have, so that
+      // it's ignored if we're interrupted before replacing it.
+      const uint64_t old_generation = generation;
+      generation = old_generation != 0 ? old_generation + 1 : (uint64_t)time(NULL) << 16;
+      journal_valid = false;
+
+      if(!write_file(base_filename, true, payloads) ||
+	 !write_file(journal_filename, false, std::vector<std::string>()))
+	return false;
+
+      base_records = payloads.size();
+      journal_records = 0;
+      journal_end = sizeof(file_header);
+      journal_valid = true;
+
+      LOG_DEBUG(logger, "Wrote " << base_records << " package states to " << base_filename);
+
+      return true;
+    }
+
+    void pkgstates_journal::remove()
+    {
+      unlink(base_filename.c_str());
+      unlink(journal_filename.c_str());
+
+      generation = 0;
+      base_records = 0;
+      journal_records = 0;
+      journal_end = 0;
+      journal_valid = false;
+    }
+  }
+}
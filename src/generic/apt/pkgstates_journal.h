@@ -0,0 +1,199 @@
+// pkgstates_journal.h                               -*-c++-*-
+//
+//   This program is free software; you can redistribute it and/or
+//   modify it under the terms of the GNU General Public License as
+//   published by the Free Software Foundation; either version 2 of
+//   the License, or (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//   General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program; see the file COPYING.  If not, write to
+//   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+//   Boston, MA 02110-1301, USA.
+
+#ifndef PKGSTATES_JOURNAL_H
+#define PKGSTATES_JOURNAL_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+/** \brief A binary store for aptitude's extended package states.
+ *
+ *  \file pkgstates_journal.h
+ */
+
+namespace aptitude
+{
+  namespace apt
+  {
+    /** \brief The stored extended state of one package.
+     *
+     *  This holds the same fields as a stanza of the textual pkgstates
+     *  file, and is what both the text and the binary formats are
+     *  converted to and from.
+     */
+    struct package_state_record
+    {
+      std::string name;
+      std::string arch;
+
+      bool unseen;
+      bool upgrade;
+      bool reinstall;
+      bool auto_new_install;
+
+      /** \brief The obsolete Install-Reason field; only found in old
+       *  text files.
+       */
+      int install_reason;
+      int remove_reason;
+      int selection_state;
+
+      /** \brief \b false if the record doesn't say what the dselect
+       *  state was (only possible in text files).
+       */
+      bool has_dselect_state;
+      int dselect_state;
+
+      /** \brief The version the user selected, if it isn't the
+       *  candidate version.
+       */
+      std::string candver;
+      std::string forbidver;
+      /** \brief The user tags of the package, separated by spaces. */
+      std::string user_tags;
+
+      package_state_record()
+	: unseen(false), upgrade(false), reinstall(false),
+	  auto_new_install(false), install_reason(0), remove_reason(0),
+	  selection_state(0), has_dselect_state(false), dselect_state(0)
+      {
+      }
+    };
+
+    /** \brief Reads and writes the binary package state files.
+     *
+     *  The states are kept in two files.  The base file holds one
+     *  record for each package, as of the last compaction; the
+     *  journal holds a record for each package whose state changed
+     *  since then, appended in the order the changes were saved.  So
+     *  saving the state after changing a few packages only appends a
+     *  few records to the journal, and loading it maps the base file
+     *  and reads a flat sequence of records, with no text parsing.
+     *  When the journal gets long compared to the base file, both are
+     *  rewritten.
+     *
+     *  Each record is stored with the length and a checksum of its
+     *  contents.  A record that was only partly written (because the
+     *  program was interrupted while appending to the journal) fails
+     *  the check, and it and everything after it are ignored.  The
+     *  two files carry the same generation number, so a journal that
+     *  was left over from before a compaction is never applied to the
+     *  new base file.
+     */
+    class pkgstates_journal
+    {
+      std::string base_filename;
+      std::string journal_filename;
+
+      // The generation of the files that were read or written last,
+      // or 0 if there are none.
+      uint64_t generation;
+      std::size_t base_records;
+      std::size_t journal_records;
+      // The offset just after the last valid record of the journal.
+      uint64_t journal_end;
+      // \b false if the journal is missing, or was written for
+      // another base file.
+      bool journal_valid;
+
+      /** \brief Replace the base file or the journal with one that
+       *  holds the given records.
+       */
+      bool write_file(const std::string &filename,
+		      bool is_base,
+		      const std::vector<std::string> &payloads) const;
+
+    public:
+      /** \brief A record that was read from disk. */
+      struct stored_record
+      {
+	package_state_record state;
+	/** \brief The checksum of the encoded record. */
+	uint64_t checksum;
+      };
+
+      /** \brief Create a journal that uses the given base file.
+       *
+       *  The journal is stored next to the base file, with
+       *  ".journal" appended to its name.
+       */
+      explicit pkgstates_journal(const std::string &_base_filename);
+
+      const std::string &get_base_filename() const { return base_filename; }
+      const std::string &get_journal_filename() const { return journal_filename; }
+
+      /** \brief Return \b true if the base file exists. */
+      bool exists() const;
+
+      /** \brief Read the current state of every package.
+       *
+       *  \param out  Set to the latest record of each package, in the
+       *              order the packages first appear in the files.
+       *
+       *  \return \b false if the base file is missing or invalid.
+       */
+      bool read(std::vector<stored_record> &out);
+
+      /** \brief Save the states of some packages.
+       *
+       *  \param changed  The encoded records of the packages whose
+       *                  states changed since they were last saved.
+       *  \param all      The encoded records of every package, used
+       *                  if the files need to be rewritten.
+       *
+       *  \return \b true if the states were saved.
+       */
+      bool save(const std::vector<std::string> &changed,
+		const std::vector<std::string> &all);
+
+      /** \brief Return \b true if appending the given number of
+       *  records would make the journal too long.
+       */
+      bool needs_compaction(std::size_t num_new_records) const;
+
+      /** \brief Append records to the journal. */
+      bool append(const std::vector<std::string> &payloads);
+
+      /** \brief Replace both files with a base file holding the given
+       *  records and an empty journal.
+       */
+      bool rewrite(const std::vector<std::string> &payloads);
+
+      /** \brief Delete both files. */
+      void remove();
+    };
+
+    /** \brief Encode a record in the binary format. */
+    std::string encode_package_state(const package_state_record &record);
+
+    /** \brief Decode a record written by encode_package_state.
+     *
+     *  \return \b false if the data isn't a valid record.
+     */
+    bool decode_package_state(const char *data, std::size_t size,
+			      package_state_record &out);
+
+    /** \brief Compute the checksum of an encoded record. */
+    uint64_t package_state_checksum(const std::string &payload);
+  }
+}
+
+#endif // PKGSTATES_JOURNAL_H
@@ -40,13 +40,18 @@
 #include <apt-pkg/error.h>
 #include <apt-pkg/strutl.h>
 
+#include <cwidget/generic/util/ssprintf.h>
+
 #include <sigc++/bind.h>
 #include <sigc++/functors/mem_fun.h>
 
+#include <cerrno>
+#include <cstdio>
 #include <fstream>
 
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <unistd.h>
 
 using aptitude::Loggers;
 
@@ -881,24 +886,11 @@ void resolver_manager::create_resolver()
   cwidget::threads::mutex::lock l(mutex);
   eassert(resolver == NULL);
 
-  // \todo We should parse these once on startup to avoid duplicate
-  // error messages, support modifying the list dynamically (for the
-  // sake of GUI users), etc.
-  std::vector<aptitude_resolver::hint> hints;
-
-  const Configuration::Item * const root =
-    aptcfg->Tree(PACKAGE "::ProblemResolver::Hints");
-
-  if(root != NULL)
-    {
-      for(const Configuration::Item *itm = root->Child;
-	  itm != NULL; itm = itm -> Next)
-	{
-	  aptitude_resolver::hint hint;
-	  if(aptitude_resolver::hint::parse(itm->Value, hint))
-	    hints.push_back(hint);
-	}
-    }
+  // The hints and everything else that doesn't depend on the
+  // package states are shared by all the resolvers created for this
+  // cache.
+  const std::shared_ptr<const aptitude_resolver_base>
+    base(get_resolver_base(*cache_file, cache_file->Policy));
 
   // NOTE: the performance of the resolver is highly sensitive to
   // these settings; choosing bad ones can result in hitting
@@ -967,6 +959,8 @@ void resolver_manager::create_resolver()
 				 (*cache_file),
 				 cache_file->Policy);
 
+  resolver->set_threads(aptcfg->FindI(PACKAGE "::ProblemResolver::Threads", 1));
+
   // Set auto flags for initial installations as if the installs were
   // done by the user.  i.e., if the package is currently installed,
   // we use the current value of the Auto flag; otherwise we treat it
@@ -1016,7 +1010,7 @@ void resolver_manager::create_resolver()
 			      aptcfg->FindB(PACKAGE "::ProblemResolver::Allow-Break-Holds", false),
 			      aptcfg->FindI(PACKAGE "::ProblemResolver::DefaultResolutionScore", 400),
 			      manual_flags,
-			      hints);
+			      *base);
 
   resolver->add_priority_scores(aptcfg->FindI(PACKAGE "::ProblemResolver::RequiredScore", 8),
 				aptcfg->FindI(PACKAGE "::ProblemResolver::ImportantScore", 4),
@@ -1024,6 +1018,8 @@ void resolver_manager::create_resolver()
 				aptcfg->FindI(PACKAGE "::ProblemResolver::OptionalScore", 1),
 				aptcfg->FindI(PACKAGE "::ProblemResolver::ExtraScore", 0));
 
+  load_resolver_checkpoint();
+
   {
     cwidget::threads::mutex::lock l2(background_control_mutex);
     resolver_null = false;
@@ -1146,6 +1142,63 @@ resolver_manager::state resolver_manager::state_snapshot()
   return rval;
 }
 
+void resolver_manager::load_resolver_checkpoint()
+{
+  const std::string filename =
+    aptcfg->Find(PACKAGE "::ProblemResolver::Checkpoint-File", "");
+  if(filename.empty())
+    return;
+
+  std::ifstream in(filename.c_str(), std::ios::in | std::ios::binary);
+  if(!in)
+    {
+      LOG_DEBUG(Loggers::getAptitudeResolver(),
+		"No resolver checkpoint in " << filename);
+      return;
+    }
+
+  if(resolver->load_checkpoint(in))
+    LOG_INFO(Loggers::getAptitudeResolver(),
+	     "Resumed the dependency search saved in " << filename);
+}
+
+void resolver_manager::save_resolver_checkpoint()
+{
+  const std::string filename =
+    aptcfg->Find(PACKAGE "::ProblemResolver::Checkpoint-File", "");
+  if(filename.empty())
+    return;
+
+  // Write to a temporary file and rename it, so that an interrupted
+  // write doesn't leave a truncated checkpoint behind.
+  const std::string tmp_filename = filename + ".new";
+  {
+    std::ofstream out(tmp_filename.c_str(),
+		      std::ios::out | std::ios::binary | std::ios::trunc);
+    if(out)
+      {
+	resolver->save_checkpoint(out);
+	out.close();
+      }
+
+    if(!out)
+      {
+	LOG_WARN(Loggers::getAptitudeResolver(),
+		 "Unable to write the resolver checkpoint " << tmp_filename);
+	unlink(tmp_filename.c_str());
+	return;
+      }
+  }
+
+  if(rename(tmp_filename.c_str(), filename.c_str()) != 0)
+    {
+      LOG_WARN(Loggers::getAptitudeResolver(),
+	       "Unable to rename " << tmp_filename << " to " << filename
+	       << ": " << cwidget::util::sstrerror(errno));
+      unlink(tmp_filename.c_str());
+    }
+}
+
 const aptitude_resolver::solution *
 resolver_manager::do_get_solution(int max_steps, unsigned int solution_num,
 				  std::set<aptitude_resolver_package> &visited_packages)
@@ -1182,6 +1235,7 @@ resolver_manager::do_get_solution(int max_steps, unsigned int solution_num,
       catch(NoMoreTime)
 	{
 	  ticks_since_last_solution += max_steps;
+	  save_resolver_checkpoint();
 	  throw NoMoreTime();
 	}
       catch(NoMoreSolutions)
@@ -424,6 +424,23 @@ private:
   void dump_visited_packages(const std::set<aptitude_resolver_package> &visited_packages,
 			     int solution_number);
 
+  /** \brief Resume the search saved in the file named by
+   *  Aptitude::ProblemResolver::Checkpoint-File, if there is one and
+   *  it was saved for the current problem.
+   *
+   *  Must be called from create_resolver(), after the resolver's
+   *  scores are set up.
+   */
+  void load_resolver_checkpoint();
+
+  /** \brief Save the state of the search to the file named by
+   *  Aptitude::ProblemResolver::Checkpoint-File, if any.
+   *
+   *  Must be called from the thread running the resolver, while it
+   *  is not searching.
+   */
+  void save_resolver_checkpoint();
+
   /** Low-level code to get a solution; it does not take the global
    *  lock, does not stop a background thread, and must run in the
    *  background.  It is called by background_thread_execution.
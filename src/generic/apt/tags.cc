@@ -29,22 +29,31 @@
 
 #include <algorithm>
 #include <map>
+#include <memory>
 #include <utility>
+#include <vector>
 
 #include <ctype.h>
+#include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <sigc++/functors/mem_fun.h>
 
 #include <apt-pkg/error.h>
+#include <apt-pkg/fileutl.h>
+#include <apt-pkg/mmap.h>
 #include <apt-pkg/pkgrecords.h>
 #include <apt-pkg/tagfile.h>
 
 #include <cwidget/generic/util/eassert.h>
+#include <cwidget/generic/util/ssprintf.h>
 
 using namespace std;
 using aptitude::apt::tag;
 using aptitude::apt::tag_set;
+using cwidget::util::ssprintf;
 
 class tag_list
 {
@@ -145,22 +154,402 @@ public:
   }
 };
 
-// The database is built eagerly, since the common use case is
-// to scan everything in sight right away and this makes it easy
-// to provide a progress bar to the user.
-tag_set *tagDB;
+namespace
+{
+  /** \brief The start of a tag cache file.
+   *
+   *  The header is followed by the cache key, padded to four bytes,
+   *  and then by:
+   *
+   *   - the offsets of the tag names (num_tags + 1 entries);
+   *   - the tag names (tag_bytes bytes, padded);
+   *   - the offsets of the package names (num_packages + 1 entries);
+   *   - the package names (name_bytes bytes, padded);
+   *   - the offsets of the tag IDs of each package (num_packages + 1
+   *     entries);
+   *   - the sorted tag IDs of each package (num_ids entries).
+   *
+   *  Tag IDs are indices into the alphabetically sorted list of tag
+   *  names, and the packages are also sorted by name.
+   */
+  struct tag_cache_header
+  {
+    char magic[8];
+    uint32_t format_version;
+    uint32_t num_tags;
+    uint32_t tag_bytes;
+    uint32_t num_packages;
+    uint32_t name_bytes;
+    uint32_t num_ids;
+    uint32_t key_length;
+  };
+
+  const char tag_cache_magic[8] = { 'A', 'P', 'T', 'T', 'A', 'G', 'S', '\0' };
+  const uint32_t tag_cache_format_version = 1;
+
+  inline std::size_t pad4(std::size_t n)
+  {
+    return (n + 3) & ~std::size_t(3);
+  }
+
+  /** \brief Compare two strings that aren't NUL-terminated, in the
+   *  order of std::string.
+   */
+  int compare_names(const char *a, std::size_t a_len,
+		    const char *b, std::size_t b_len)
+  {
+    const int rval = memcmp(a, b, std::min(a_len, b_len));
+    if(rval != 0)
+      return rval;
+    else if(a_len < b_len)
+      return -1;
+    else if(a_len > b_len)
+      return 1;
+    else
+      return 0;
+  }
+
+  template<typename T>
+  void append(std::vector<char> &out, const T *data, std::size_t n)
+  {
+    const char *bytes = reinterpret_cast<const char *>(data);
+    out.insert(out.end(), bytes, bytes + n * sizeof(T));
+  }
+
+  void append_padded(std::vector<char> &out, const std::string &s)
+  {
+    out.insert(out.end(), s.begin(), s.end());
+    out.resize(pad4(out.size()), '\0');
+  }
+
+  /** \brief The tags of each package group.
+   *
+   *  Tag names are stored once, and each group refers to a sorted
+   *  span of tag IDs.  The IDs live either in a memory-mapped cache
+   *  file or in a buffer that was built in memory.
+   */
+  class tag_db
+  {
+    // The cache file and its memory map, if the tags were loaded
+    // from disk.  The map is declared last so it's destroyed first.
+    std::unique_ptr<FileFd> file;
+    std::unique_ptr<MMap> map;
+    // The tag data, if it was built in memory.
+    std::vector<char> buffer;
+
+    std::vector<tag> vocabulary;
+    const uint32_t *ids;
+    // The range of ids holding the tags of each group, indexed by
+    // group ID.
+    std::vector<std::pair<uint32_t, uint32_t> > group_spans;
+
+    bool attach(const char *data, std::size_t size,
+		const std::string &key, pkgCache &cache);
+
+  public:
+    explicit tag_db(pkgCache &cache)
+      : ids(NULL),
+	group_spans(cache.Head().GroupCount, std::make_pair(0, 0))
+    {
+    }
+
+    /** \brief Use the tags stored in the given file, if it exists
+     *  and has the given key.
+     */
+    bool load_file(const std::string &filename,
+		   const std::string &key,
+		   pkgCache &cache);
+
+    /** \brief Use the tags stored in the given data.
+     *
+     *  The contents of data are moved into the database.
+     */
+    bool load_data(std::vector<char> &data,
+		   const std::string &key,
+		   pkgCache &cache);
+
+    tag_set get_tags(const pkgCache::GrpIterator &grp) const
+    {
+      const std::pair<uint32_t, uint32_t> &span(group_spans[grp->ID]);
+      return tag_set(&vocabulary, ids + span.first, ids + span.second);
+    }
+  };
+
+  bool tag_db::attach(const char *data, std::size_t size,
+		      const std::string &key, pkgCache &cache)
+  {
+    const char * const end = data + size;
+
+    if(size < sizeof(tag_cache_header))
+      return false;
+
+    tag_cache_header header;
+    memcpy(&header, data, sizeof(header));
+
+    if(memcmp(header.magic, tag_cache_magic, sizeof(header.magic)) != 0 ||
+       header.format_version != tag_cache_format_version ||
+       header.key_length != key.size())
+      return false;
 
-static void insert_tags(const pkgCache::VerIterator &ver,
+    data += sizeof(header);
+
+    const std::size_t tag_offsets_bytes = (header.num_tags + 1) * sizeof(uint32_t);
+    const std::size_t package_offsets_bytes = (header.num_packages + 1) * sizeof(uint32_t);
+    if((std::size_t)(end - data) <
+       pad4(key.size()) +
+       tag_offsets_bytes + header.tag_bytes +
+       2 * package_offsets_bytes + header.name_bytes +
+       header.num_ids * sizeof(uint32_t))
+      return false;
+
+    if(key.compare(0, std::string::npos, data, key.size()) != 0)
+      return false;
+    data += pad4(key.size());
+
+    const uint32_t *tag_offsets = reinterpret_cast<const uint32_t *>(data);
+    data += tag_offsets_bytes;
+    const char *tag_names = data;
+    data += header.tag_bytes;
+    const uint32_t *name_offsets = reinterpret_cast<const uint32_t *>(data);
+    data += package_offsets_bytes;
+    const char *names = data;
+    data += header.name_bytes;
+    const uint32_t *id_offsets = reinterpret_cast<const uint32_t *>(data);
+    data += package_offsets_bytes;
+    const uint32_t *stored_ids = reinterpret_cast<const uint32_t *>(data);
+
+    // Check every offset and ID once, so that get_tags() doesn't
+    // have to.
+    for(uint32_t i = 0; i < header.num_tags; ++i)
+      if(tag_offsets[i] > tag_offsets[i + 1] ||
+	 tag_offsets[i + 1] > header.tag_bytes)
+	return false;
+
+    for(uint32_t i = 0; i < header.num_packages; ++i)
+      if(name_offsets[i] > name_offsets[i + 1] ||
+	 name_offsets[i + 1] > header.name_bytes ||
+	 id_offsets[i] > id_offsets[i + 1] ||
+	 id_offsets[i + 1] > header.num_ids)
+	return false;
+
+    for(uint32_t i = 0; i < header.num_ids; ++i)
+      if(stored_ids[i] >= header.num_tags)
+	return false;
+
+    vocabulary.clear();
+    vocabulary.reserve(header.num_tags);
+    for(uint32_t i = 0; i < header.num_tags; ++i)
+      vocabulary.push_back(tag(tag_names + tag_offsets[i],
+			       tag_names + tag_offsets[i + 1]));
+
+    // The stored names are sorted, so each group of the cache is
+    // found with a binary search.  Packages that aren't in the cache
+    // are skipped, just as they would be if the tag file was read
+    // directly.
+    for(pkgCache::GrpIterator grp = cache.GrpBegin(); !grp.end(); ++grp)
+      {
+	const char * const name = grp.Name();
+	const std::size_t name_len = strlen(name);
+
+	uint32_t first = 0, last = header.num_packages;
+	while(first < last)
+	  {
+	    const uint32_t mid = first + (last - first) / 2;
+	    const int cmp = compare_names(names + name_offsets[mid],
+					  name_offsets[mid + 1] - name_offsets[mid],
+					  name, name_len);
+
+	    if(cmp < 0)
+	      first = mid + 1;
+	    else if(cmp > 0)
+	      last = mid;
+	    else
+	      {
+		group_spans[grp->ID] = std::make_pair(id_offsets[mid], id_offsets[mid + 1]);
+		break;
+	      }
+	  }
+      }
+
+    ids = stored_ids;
+    return true;
+  }
+
+  bool tag_db::load_file(const std::string &filename,
+			 const std::string &key,
+			 pkgCache &cache)
+  {
+    // A missing or unreadable cache file is simply rebuilt.
+    _error->PushToStack();
+
+    std::unique_ptr<FileFd> new_file(new FileFd);
+    if(new_file->Open(filename, FileFd::ReadOnly) && new_file->Size() > 0)
+      {
+	std::unique_ptr<MMap> new_map(new MMap(*new_file, MMap::ReadOnly));
+
+	if(new_map->Data() != NULL &&
+	   attach(static_cast<const char *>(new_map->Data()), new_map->Size(),
+		  key, cache))
+	  {
+	    file = std::move(new_file);
+	    map = std::move(new_map);
+	    _error->RevertToStack();
+	    return true;
+	  }
+      }
+
+    _error->RevertToStack();
+    return false;
+  }
+
+  bool tag_db::load_data(std::vector<char> &data,
+			 const std::string &key,
+			 pkgCache &cache)
+  {
+    buffer.swap(data);
+    return attach(&buffer.front(), buffer.size(), key, cache);
+  }
+
+  /** \brief Collects the tags of each package before they are
+   *  written out in the format of a tag cache file.
+   *
+   *  Tag names are interned as they are added, so each one is only
+   *  stored once however many packages it's attached to.
+   */
+  class tag_db_builder
+  {
+    std::map<tag, uint32_t> tag_ids;
+    std::vector<tag> tag_names;
+    std::map<std::string, std::vector<uint32_t> > package_tags;
+
+  public:
+    void add(const std::string &package, const tag_list &tags)
+    {
+      std::vector<uint32_t> &pkg_tags(package_tags[package]);
+
+      for(tag_list::const_iterator t = tags.begin(); t != tags.end(); ++t)
+	{
+	  const tag name(*t);
+	  std::map<tag, uint32_t>::const_iterator found = tag_ids.find(name);
+
+	  if(found != tag_ids.end())
+	    pkg_tags.push_back(found->second);
+	  else
+	    {
+	      const uint32_t id = tag_names.size();
+	      tag_ids[name] = id;
+	      tag_names.push_back(name);
+	      pkg_tags.push_back(id);
+	    }
+	}
+    }
+
+    /** \brief Serialize the tags to the end of out. */
+    void write(const std::string &key, std::vector<char> &out) const
+    {
+      // tag_ids is sorted by name; renumber the tags to match.
+      std::vector<uint32_t> final_ids(tag_names.size());
+      std::vector<uint32_t> tag_offsets;
+      std::string tag_strings;
+      uint32_t next_id = 0;
+      for(std::map<tag, uint32_t>::const_iterator it = tag_ids.begin();
+	  it != tag_ids.end(); ++it)
+	{
+	  final_ids[it->second] = next_id++;
+	  tag_offsets.push_back(tag_strings.size());
+	  tag_strings += it->first;
+	}
+      tag_offsets.push_back(tag_strings.size());
+
+      std::vector<uint32_t> name_offsets;
+      std::string names;
+      std::vector<uint32_t> id_offsets;
+      std::vector<uint32_t> ids;
+      for(std::map<std::string, std::vector<uint32_t> >::const_iterator it =
+	    package_tags.begin(); it != package_tags.end(); ++it)
+	{
+	  name_offsets.push_back(names.size());
+	  names += it->first;
+
+	  std::vector<uint32_t> pkg_ids;
+	  for(std::vector<uint32_t>::const_iterator id = it->second.begin();
+	      id != it->second.end(); ++id)
+	    pkg_ids.push_back(final_ids[*id]);
+	  std::sort(pkg_ids.begin(), pkg_ids.end());
+	  pkg_ids.erase(std::unique(pkg_ids.begin(), pkg_ids.end()), pkg_ids.end());
+
+	  id_offsets.push_back(ids.size());
+	  ids.insert(ids.end(), pkg_ids.begin(), pkg_ids.end());
+	}
+      name_offsets.push_back(names.size());
+      id_offsets.push_back(ids.size());
+
+      tag_cache_header header;
+      memcpy(header.magic, tag_cache_magic, sizeof(header.magic));
+      header.format_version = tag_cache_format_version;
+      header.num_tags = tag_names.size();
+      header.tag_bytes = pad4(tag_strings.size());
+      header.num_packages = package_tags.size();
+      header.name_bytes = pad4(names.size());
+      header.num_ids = ids.size();
+      header.key_length = key.size();
+
+      append(out, &header, 1);
+      append_padded(out, key);
+      append(out, &tag_offsets.front(), tag_offsets.size());
+      append_padded(out, tag_strings);
+      append(out, &name_offsets.front(), name_offsets.size());
+      append_padded(out, names);
+      append(out, &id_offsets.front(), id_offsets.size());
+      append(out, ids.empty() ? NULL : &ids.front(), ids.size());
+    }
+  };
+
+  /** \brief Write a tag cache file, replacing it atomically. */
+  void save_tag_cache(const std::string &filename,
+		      const std::vector<char> &data)
+  {
+    const std::string newname = filename + ".new";
+
+    _error->PushToStack();
+    FileFd out;
+    bool ok =
+      out.Open(newname, FileFd::WriteEmpty, 0644) &&
+      out.Write(&data.front(), data.size());
+    ok = out.Close() && ok;
+    _error->RevertToStack();
+
+    if(!ok || rename(newname.c_str(), filename.c_str()) != 0)
+      unlink(newname.c_str());
+  }
+}
+
+// The tag database of the current cache, or NULL if it hasn't been
+// loaded yet.  It is loaded the first time a package's tags are
+// needed, rather than whenever the cache is loaded.
+static tag_db *tagDB;
+
+// Set when the cache that tagDB was loaded for is closed.  The tags
+// only depend on the package lists and on the debtags file, so if the
+// next cache has the same generation (for instance, because it was
+// reopened after running dpkg) and the debtags file is unchanged, the
+// database is reused rather than rebuilt.
+static bool tagDB_retired;
+// The generation of the cache that tagDB was loaded for.
+static uint64_t tagDB_generation;
+// The key of the debtags file that tagDB was loaded from, or an empty
+// string if it was built from the package records.
+static std::string tagDB_debtags_key;
+
+static void insert_tags(tag_db_builder &builder,
+			const pkgCache::VerIterator &ver,
 			const pkgCache::VerFileIterator &vf)
 {
-  tag_set *tags = tagDB + ver.ParentPkg().Group()->ID;
-
   const char *recstart=0, *recend=0;
   const char *tagstart, *tagend;
   pkgTagSection sec;
 
   eassert(apt_package_records);
-  eassert(tagDB);
 
   apt_package_records->Lookup(vf).GetRec(recstart, recend);
   if(!recstart || !recend)
@@ -171,30 +560,77 @@ static void insert_tags(const pkgCache::VerIterator &ver,
   if(!sec.Find("Tag", tagstart, tagend))
     return;
 
-  tag_list lst(tagstart, tagend);
-
-  for(tag_list::const_iterator t=lst.begin(); t!=lst.end(); ++t)
-    tags->insert(*t);
+  builder.add(ver.ParentPkg().Group().Name(), tag_list(tagstart, tagend));
 }
 
 static void reset_tags()
 {
-  delete[] tagDB;
+  delete tagDB;
   tagDB = NULL;
+  tagDB_retired = false;
 }
 
-const tag_set aptitude::apt::get_tags(const pkgCache::PkgIterator &pkg)
+static void retire_tags()
 {
-  if(!apt_cache_file || !tagDB)
+  if(tagDB != NULL)
+    tagDB_retired = true;
+}
+
+static string get_debtags_filename()
+{
+  return aptcfg->FindFile("Debtags::Package-Tags",
+			  "/var/lib/debtags/package-tags");
+}
+
+/** \brief Return a string identifying the current contents of the
+ *  debtags file, or an empty string if it doesn't exist.
+ */
+static string get_debtags_key(const string &filename)
+{
+  struct stat buf_stat;
+  if(stat(filename.c_str(), &buf_stat) != 0)
+    return string();
+
+  return ssprintf("%s %lld %lld",
+		  filename.c_str(),
+		  (long long)buf_stat.st_mtime,
+		  (long long)buf_stat.st_size);
+}
+
+tag_set aptitude::apt::get_tags(const pkgCache::PkgIterator &pkg)
+{
+  if(!apt_cache_file)
     return tag_set();
 
-  return tagDB[pkg.Group()->ID];
+  load_tags_lazy();
+
+  if(!tagDB || tagDB_retired)
+    return tag_set();
+
+  return tagDB->get_tags(pkg.Group());
 }
 
-static bool load_tags_from_debtags(OpProgress *progress)
+static bool load_tags_from_debtags(tag_db &db, OpProgress *progress,
+				   const string &filename,
+				   const string &key)
 {
-  const string filename(aptcfg->FindFile("Debtags::Package-Tags",
-                                         "/var/lib/debtags/package-tags"));
+  if(key.empty())
+    {
+      // Fail silently; debtags need not be installed.
+      return false;
+    }
+
+  // The cache file is only valid for this exact tag file, which the
+  // key identifies.
+  const string cache_dir(get_cache_dir());
+  const string cache_filename(cache_dir.empty()
+			      ? string()
+			      : cache_dir + "/debtags-cache");
+
+  if(!cache_filename.empty() &&
+     db.load_file(cache_filename, key, (*apt_cache_file)->GetCache()))
+    return true;
+
   _error->PushToStack(); // Ignore no-such-file errors.
   FileFd F(filename, FileFd::ReadOnly);
   _error->RevertToStack();
@@ -213,6 +649,8 @@ static bool load_tags_from_debtags(OpProgress *progress)
     progress->OverallProgress(0, file_size, 1,
                               _("Building tag database"));
 
+  tag_db_builder builder;
+
   const unsigned long long buf_size = 4096;
   char buf[buf_size];
   while(F.ReadLine(buf, buf_size) != NULL)
@@ -233,11 +671,6 @@ static bool load_tags_from_debtags(OpProgress *progress)
         continue;
 
       const string pkg_name(buf, sep - buf);
-      const pkgCache::GrpIterator grp((*apt_cache_file)->FindGrp(pkg_name));
-      if(grp.end() == true)
-        continue;
-
-      tag_set *tags = tagDB + grp->ID;
 
       const char *tagstart = sep + 2;
       const char *tagend = tagstart;
@@ -248,13 +681,17 @@ static bool load_tags_from_debtags(OpProgress *progress)
       if (tagend > tagstart)
 	--tagend;
 
-      tag_list ts(tagstart, tagend);
-      for(tag_list::const_iterator t = ts.begin();
-          t != ts.end();
-          ++t)
-        tags->insert(*t);
+      builder.add(pkg_name, tag_list(tagstart, tagend));
     }
 
+  std::vector<char> data;
+  builder.write(key, data);
+
+  if(!cache_filename.empty())
+    save_tag_cache(cache_filename, data);
+
+  const bool rval = db.load_data(data, key, (*apt_cache_file)->GetCache());
+
   if (progress)
     {
       progress->OverallProgress(file_size, file_size, 1,
@@ -262,10 +699,10 @@ static bool load_tags_from_debtags(OpProgress *progress)
       progress->Done();
     }
 
-  return true;
+  return rval;
 }
 
-static bool load_tags_from_verfiles(OpProgress *progress)
+static bool load_tags_from_verfiles(tag_db &db, OpProgress *progress)
 {
   std::vector<loc_pair> verfiles;
 
@@ -286,10 +723,12 @@ static bool load_tags_from_verfiles(OpProgress *progress)
   if (progress)
     progress->OverallProgress(0, progress_total, 1, _("Building tag database"));
 
+  tag_db_builder builder;
+
   for(std::vector<loc_pair>::iterator i=verfiles.begin();
       i!=verfiles.end(); ++i)
     {
-      insert_tags(i->first, i->second);
+      insert_tags(builder, i->first, i->second);
 
       if (progress)
 	{
@@ -302,6 +741,12 @@ static bool load_tags_from_verfiles(OpProgress *progress)
 	}
     }
 
+  // The package records are part of the package cache, so there's
+  // no point in saving these tags separately.
+  std::vector<char> data;
+  builder.write(string(), data);
+  const bool rval = db.load_data(data, string(), (*apt_cache_file)->GetCache());
+
   if (progress)
     {
       progress->OverallProgress(progress_total, progress_total, 1,
@@ -309,7 +754,7 @@ static bool load_tags_from_verfiles(OpProgress *progress)
       progress->Done();
     }
 
-  return true;
+  return rval;
 }
 
 bool initialized_reset_signal;
@@ -317,19 +762,52 @@ void aptitude::apt::load_tags(OpProgress *progress)
 {
   eassert(apt_cache_file && apt_package_records);
 
+  if(tagDB != NULL && !tagDB_retired)
+    return;
+
   if(!initialized_reset_signal)
     {
-      cache_closed.connect(sigc::ptr_fun(reset_tags));
+      cache_closed.connect(sigc::ptr_fun(retire_tags));
       cache_reload_failed.connect(sigc::ptr_fun(reset_tags));
       initialized_reset_signal = true;
     }
 
-  tagDB = new tag_set[(*apt_cache_file)->Head().GroupCount];
+  pkgCache &cache((*apt_cache_file)->GetCache());
+  const uint64_t generation = get_cache_generation(cache);
+  const string debtags_filename(get_debtags_filename());
+  const string debtags_key(get_debtags_key(debtags_filename));
 
-  if(load_tags_from_debtags(progress) == true)
-    return;
+  if(tagDB != NULL)
+    {
+      if(tagDB_generation == generation && tagDB_debtags_key == debtags_key)
+	{
+	  tagDB_retired = false;
+	  return;
+	}
+
+      reset_tags();
+    }
 
-  load_tags_from_verfiles(progress);
+  tag_db *db = new tag_db(cache);
+
+  string loaded_debtags_key(debtags_key);
+  if(!load_tags_from_debtags(*db, progress, debtags_filename, debtags_key))
+    {
+      load_tags_from_verfiles(*db, progress);
+      loaded_debtags_key.clear();
+    }
+
+  // Even if no tags were found, don't look for them again until the
+  // cache is reloaded.
+  tagDB = db;
+  tagDB_generation = generation;
+  tagDB_debtags_key = loaded_debtags_key;
+}
+
+void aptitude::apt::load_tags_lazy()
+{
+  if((tagDB == NULL || tagDB_retired) && apt_cache_file && apt_package_records)
+    load_tags(NULL);
 }
 
 // TAG VOCABULARY FILE
@@ -27,8 +27,11 @@
 #include <config.h>
 #endif
 
-#include <set>
+#include <cstddef>
 #include <string>
+#include <vector>
+
+#include <stdint.h>
 
 #include <apt-pkg/pkgcache.h>
 
@@ -44,18 +47,107 @@ namespace aptitude
   namespace apt
   {
     typedef std::string tag;
-    typedef std::set<tag> tag_set;
+
+    /** \brief The tags of a package, in alphabetical order.
+     *
+     *  This is a view into the tag database: it is cheap to copy, but
+     *  it is only valid until the package cache is closed.
+     */
+    class tag_set
+    {
+      const std::vector<tag> *vocabulary;
+      const uint32_t *first;
+      const uint32_t *last;
+
+    public:
+      /** \brief Iterates over the tags of a package. */
+      class const_iterator
+      {
+	const std::vector<tag> *vocabulary;
+	const uint32_t *id;
+
+      public:
+	const_iterator(const std::vector<tag> *_vocabulary,
+		       const uint32_t *_id)
+	  : vocabulary(_vocabulary), id(_id)
+	{
+	}
+
+	const tag &operator*() const
+	{
+	  return (*vocabulary)[*id];
+	}
+
+	const tag *operator->() const
+	{
+	  return &(*vocabulary)[*id];
+	}
+
+	const_iterator &operator++()
+	{
+	  ++id;
+	  return *this;
+	}
+
+	bool operator==(const const_iterator &other) const
+	{
+	  return id == other.id;
+	}
+
+	bool operator!=(const const_iterator &other) const
+	{
+	  return id != other.id;
+	}
+      };
+
+      /** \brief Create an empty tag set. */
+      tag_set()
+	: vocabulary(NULL), first(NULL), last(NULL)
+      {
+      }
+
+      /** \brief Create a tag set.
+       *
+       *  \param _vocabulary  The names of all tags, indexed by ID.
+       *  \param _first       The beginning of a sorted array of tag IDs.
+       *  \param _last        The end of the array.
+       */
+      tag_set(const std::vector<tag> *_vocabulary,
+	      const uint32_t *_first,
+	      const uint32_t *_last)
+	: vocabulary(_vocabulary), first(_first), last(_last)
+      {
+      }
+
+      bool empty() const { return first == last; }
+      std::size_t size() const { return last - first; }
+
+      const_iterator begin() const { return const_iterator(vocabulary, first); }
+      const_iterator end() const { return const_iterator(vocabulary, last); }
+    };
 
     inline std::string get_fullname(const tag &t)
     {
       return static_cast<std::string>(t);
     }
 
-    /** \brief Initialize the cache of debtags information. */
+    /** \brief Load the debtags information, unless it was already
+     *  loaded for the current package cache.
+     *
+     *  This is done automatically the first time get_tags() is
+     *  called; it only needs to be called directly to show progress,
+     *  or before calling get_tags() from several threads.
+     */
     void load_tags(OpProgress *progress);
 
+    /** \brief Load the debtags information with no progress display.
+     *
+     *  \sa load_tags()
+     */
+    void load_tags_lazy();
+
     /** \brief Get the tags for the given package. */
-    const tag_set get_tags(const pkgCache::PkgIterator &pkg);
+    tag_set get_tags(const pkgCache::PkgIterator &pkg);
 
     /** \brief Get the name of the facet corresponding to a tag. */
     std::string get_facet_name(const tag &t);
@@ -95,6 +95,13 @@ bool is_task_package(const pkgCache::PkgIterator &pkg);
 // cache reload, for obvious reasons.  apt_reload_cache will call this.
 void load_tasks(OpProgress &progress);
 
+/** \brief Load the list of tasks if it hasn't been loaded yet.
+ *
+ *  Callers that are about to look up tasks from several threads at
+ *  once should call this first.
+ */
+void load_tasks_lazy();
+
 // Discards the current task list and readies a new one to be loaded.
 // Since the task list contains package iterators, we have to do something
 // in case they're still hanging around.
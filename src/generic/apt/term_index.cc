@@ -0,0 +1,625 @@
+// term_index.cc
+//
+//   This program is free software; you can redistribute it and/or
+//   modify it under the terms of the GNU General Public License as
+//   published by the Free Software Foundation; either version 2 of
+//   the License, or (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//   General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program; see the file COPYING.  If not, write to
+//   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+//   Boston, MA 02110-1301, USA.
+
+#include "term_index.h"
+
+#include "apt.h"
+#include "config_signal.h"
+
+#include <aptitude.h>
+#include <loggers.h>
+
+#include <apt-pkg/error.h>
+#include <apt-pkg/fileutl.h>
+#include <apt-pkg/mmap.h>
+#include <apt-pkg/pkgcache.h>
+#include <apt-pkg/pkgrecords.h>
+
+#include <cwidget/generic/threads/threads.h>
+#include <cwidget/generic/util/ssprintf.h>
+
+#include <sigc++/functors/ptr_fun.h>
+
+#include <algorithm>
+#include <map>
+#include <utility>
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+using aptitude::Loggers;
+using cwidget::util::ssprintf;
+
+namespace aptitude
+{
+  namespace apt
+  {
+    namespace
+    {
+      /** \brief The start of an index file. */
+      struct file_header
+      {
+	char magic[8];
+	uint32_t format_version;
+	uint32_t num_fields;
+	uint32_t num_packages;
+	/** \brief The length of the cache key that follows the
+	 *  header (before padding).
+	 */
+	uint32_t key_length;
+      };
+
+      const char index_magic[8] = { 'A', 'P', 'T', 'I', 'T', 'U', 'D', 'E' };
+      const uint32_t index_format_version = 1;
+
+      inline std::size_t pad4(std::size_t n)
+      {
+	return (n + 3) & ~std::size_t(3);
+      }
+
+      inline bool is_word_char(unsigned char c)
+      {
+	return (c >= 'a' && c <= 'z') ||
+	  (c >= 'A' && c <= 'Z') ||
+	  (c >= '0' && c <= '9') ||
+	  c >= 0x80;
+      }
+
+      inline bool is_ascii_alnum(unsigned char c)
+      {
+	return c < 0x80 && is_word_char(c);
+      }
+
+      inline char fold_case(char c)
+      {
+	return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+      }
+
+      typedef std::map<std::string, std::vector<uint32_t> > word_map;
+
+      /** \brief Record that the package with the given ID contains
+       *  each word of a string.
+       */
+      void add_words(word_map &words, const std::string &text, uint32_t id)
+      {
+	std::string word;
+
+	for(std::string::size_type i = 0; i <= text.size(); ++i)
+	  {
+	    if(i < text.size() && is_word_char(text[i]))
+	      word.push_back(fold_case(text[i]));
+	    else if(!word.empty())
+	      {
+		std::vector<uint32_t> &postings = words[word];
+		if(postings.empty() || postings.back() != id)
+		  postings.push_back(id);
+		word.clear();
+	      }
+	  }
+      }
+
+      template<typename T>
+      void append(std::vector<char> &out, const T *data, std::size_t n)
+      {
+	const char *bytes = reinterpret_cast<const char *>(data);
+	out.insert(out.end(), bytes, bytes + n * sizeof(T));
+      }
+
+      void append_padding(std::vector<char> &out)
+      {
+	out.resize(pad4(out.size()), '\0');
+      }
+
+      /** \brief Serialize a field's words to the end of out. */
+      void write_section(word_map &words, std::vector<char> &out)
+      {
+	std::vector<uint32_t> word_offsets;
+	std::vector<uint32_t> posting_offsets;
+	std::string strings;
+	std::vector<uint32_t> postings;
+
+	word_offsets.reserve(words.size() + 1);
+	posting_offsets.reserve(words.size() + 1);
+
+	for(word_map::iterator it = words.begin(); it != words.end(); ++it)
+	  {
+	    // Packages aren't visited in ID order.
+	    std::vector<uint32_t> &ids = it->second;
+	    std::sort(ids.begin(), ids.end());
+	    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+	    word_offsets.push_back(strings.size());
+	    posting_offsets.push_back(postings.size());
+	    strings += it->first;
+	    postings.insert(postings.end(), ids.begin(), ids.end());
+	  }
+
+	word_offsets.push_back(strings.size());
+	posting_offsets.push_back(postings.size());
+
+	term_index::section header;
+	header.num_words = words.size();
+	header.string_bytes = pad4(strings.size());
+	header.num_postings = postings.size();
+
+	append(out, &header, 1);
+	append(out, &word_offsets.front(), word_offsets.size());
+	append(out, &posting_offsets.front(), posting_offsets.size());
+	append(out, strings.data(), strings.size());
+	append_padding(out);
+	append(out, postings.empty() ? NULL : &postings.front(), postings.size());
+      }
+
+      /** \brief Build the index data of a package cache. */
+      void build_index(pkgCache &cache, pkgRecords &records,
+		       const std::string &key,
+		       std::vector<char> &out)
+      {
+	word_map words[term_index::num_fields];
+
+	for(pkgCache::PkgIterator pkg = cache.PkgBegin(); !pkg.end(); ++pkg)
+	  {
+	    const uint32_t id = pkg->ID;
+
+	    add_words(words[term_index::name_field], pkg.Name(), id);
+
+	    for(pkgCache::VerIterator ver = pkg.VersionList(); !ver.end(); ++ver)
+	      {
+		if(!ver.FileList().end())
+		  add_words(words[term_index::maintainer_field],
+			    records.Lookup(ver.FileList()).Maintainer(), id);
+
+		// Index every translation, so that the index doesn't
+		// depend on the locale.
+		for(pkgCache::DescIterator d = ver.DescriptionList(); !d.end(); ++d)
+		  {
+		    pkgCache::DescFileIterator df = d.FileList();
+		    if(!df.end())
+		      add_words(words[term_index::description_field],
+				records.Lookup(df).LongDesc(), id);
+		  }
+	      }
+	  }
+
+	file_header header;
+	memcpy(header.magic, index_magic, sizeof(header.magic));
+	header.format_version = index_format_version;
+	header.num_fields = term_index::num_fields;
+	header.num_packages = cache.Head().PackageCount;
+	header.key_length = key.size();
+
+	out.clear();
+	append(out, &header, 1);
+	append(out, key.data(), key.size());
+	append_padding(out);
+
+	for(int f = 0; f < term_index::num_fields; ++f)
+	  write_section(words[f], out);
+      }
+
+      /** \brief Identify a package cache.
+       *
+       *  Package IDs are only meaningful for the cache that assigned
+       *  them, and the indexed text comes from the package and
+       *  translation lists.  The cache generation covers the IDs and
+       *  the package lists (see get_cache_generation()), so the key
+       *  adds the name, size and modification time of each
+       *  translation list: a description update or a change to
+       *  Acquire::Languages can leave the package lists alone.
+       *  Neither part looks at the dpkg status file, so installing
+       *  or removing packages keeps the index.
+       */
+      std::string get_cache_key(pkgCache &cache)
+      {
+	// 64-bit FNV-1a.
+	uint64_t translations_hash = 14695981039346656037ULL;
+	for(pkgCache::PkgFileIterator file = cache.FileBegin(); !file.end(); ++file)
+	  {
+	    // Translation lists are the only files that provide no
+	    // packages; the status file does, but isn't a source.
+	    if((file->Flags & pkgCache::Flag::NoPackages) == 0)
+	      continue;
+
+	    const std::string file_info =
+	      ssprintf("%s %llu %llu",
+		       file.FileName() == NULL ? "" : file.FileName(),
+		       (unsigned long long)file->Size,
+		       (unsigned long long)file->mtime);
+
+	    // Include the terminating NUL to separate the files.
+	    for(std::string::size_type i = 0; i <= file_info.size(); ++i)
+	      translations_hash = (translations_hash ^ (unsigned char)file_info.c_str()[i]) * 1099511628211ULL;
+	  }
+
+	return ssprintf("%016llx %016llx",
+			(unsigned long long)get_cache_generation(cache),
+			(unsigned long long)translations_hash);
+      }
+
+      double now()
+      {
+	timeval tv;
+	gettimeofday(&tv, 0);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+      }
+    }
+
+    term_index::term_index()
+      : num_packages(0)
+    {
+    }
+
+    term_index::~term_index()
+    {
+    }
+
+    bool term_index::attach(const char *data, std::size_t size,
+			    const std::string &key)
+    {
+      const char *end = data + size;
+
+      if(size < sizeof(file_header))
+	return false;
+
+      file_header header;
+      memcpy(&header, data, sizeof(header));
+
+      if(memcmp(header.magic, index_magic, sizeof(header.magic)) != 0 ||
+	 header.format_version != index_format_version ||
+	 header.num_fields != num_fields ||
+	 header.key_length != key.size())
+	return false;
+
+      data += sizeof(header);
+      if((std::size_t)(end - data) < pad4(key.size()) ||
+	 key.compare(0, std::string::npos, data, key.size()) != 0)
+	return false;
+
+      data += pad4(key.size());
+
+      for(int f = 0; f < num_fields; ++f)
+	{
+	  field_data &fd = fields[f];
+
+	  if((std::size_t)(end - data) < sizeof(section))
+	    return false;
+
+	  memcpy(&fd.header, data, sizeof(section));
+	  data += sizeof(section);
+
+	  const std::size_t offsets_bytes = (fd.header.num_words + 1) * sizeof(uint32_t);
+	  const std::size_t postings_bytes = fd.header.num_postings * sizeof(uint32_t);
+	  if((std::size_t)(end - data) < 2 * offsets_bytes + fd.header.string_bytes + postings_bytes)
+	    return false;
+
+	  fd.word_offsets = reinterpret_cast<const uint32_t *>(data);
+	  data += offsets_bytes;
+	  fd.posting_offsets = reinterpret_cast<const uint32_t *>(data);
+	  data += offsets_bytes;
+	  fd.strings = data;
+	  data += fd.header.string_bytes;
+	  fd.postings = reinterpret_cast<const uint32_t *>(data);
+	  data += postings_bytes;
+
+	  if(fd.word_offsets[fd.header.num_words] > fd.header.string_bytes ||
+	     fd.posting_offsets[fd.header.num_words] != fd.header.num_postings)
+	    return false;
+	}
+
+      num_packages = header.num_packages;
+      return true;
+    }
+
+    std::shared_ptr<term_index> term_index::load(pkgCache &cache,
+						 pkgRecords &records,
+						 const std::string &filename,
+						 const std::string &key)
+    {
+      logging::LoggerPtr logger(Loggers::getAptitudeSearchIndex());
+
+      std::shared_ptr<term_index> rval(new term_index);
+
+      if(!filename.empty())
+	{
+	  // A missing or unreadable index is simply rebuilt.
+	  _error->PushToStack();
+
+	  std::unique_ptr<FileFd> file(new FileFd);
+	  if(file->Open(filename, FileFd::ReadOnly) && file->Size() > 0)
+	    {
+	      std::unique_ptr<MMap> map(new MMap(*file, MMap::ReadOnly));
+
+	      if(map->Data() != NULL &&
+		 rval->attach(static_cast<const char *>(map->Data()), map->Size(), key))
+		{
+		  LOG_INFO(logger, "Loaded the search index from " << filename);
+
+		  rval->file = std::move(file);
+		  rval->map = std::move(map);
+		  _error->RevertToStack();
+		  return rval;
+		}
+	    }
+
+	  _error->RevertToStack();
+	}
+
+      LOG_INFO(logger, "Building the search index.");
+
+      const double start = now();
+      build_index(cache, records, key, rval->buffer);
+
+      LOG_INFO(logger, "Built the search index (" << rval->buffer.size()
+	       << " bytes) in " << now() - start << "s.");
+
+      if(!rval->attach(&rval->buffer.front(), rval->buffer.size(), key))
+	{
+	  LOG_ERROR(logger, "Internal error: the search index that was just built is invalid.");
+	  return std::shared_ptr<term_index>();
+	}
+
+      if(!filename.empty())
+	{
+	  // Write the index to a new file and move it into place, so
+	  // that other instances never see a partial index.
+	  const std::string newname = filename + ".new";
+
+	  _error->PushToStack();
+	  FileFd out;
+	  bool ok =
+	    out.Open(newname, FileFd::WriteEmpty, 0644) &&
+	    out.Write(&rval->buffer.front(), rval->buffer.size());
+	  ok = out.Close() && ok;
+	  _error->RevertToStack();
+
+	  if(ok && rename(newname.c_str(), filename.c_str()) == 0)
+	    LOG_INFO(logger, "Saved the search index to " << filename);
+	  else
+	    {
+	      LOG_WARN(logger, "Can't save the search index to " << filename);
+	      unlink(newname.c_str());
+	    }
+	}
+
+      return rval;
+    }
+
+    void term_index::find_containing(field f, const std::string &text,
+				     std::vector<bool> &matches) const
+    {
+      const field_data &fd = fields[f];
+
+      for(uint32_t w = 0; w < fd.header.num_words; ++w)
+	{
+	  const char *word_begin = fd.strings + fd.word_offsets[w];
+	  const char *word_end = fd.strings + fd.word_offsets[w + 1];
+
+	  if(std::search(word_begin, word_end, text.begin(), text.end()) == word_end)
+	    continue;
+
+	  for(uint32_t p = fd.posting_offsets[w]; p < fd.posting_offsets[w + 1]; ++p)
+	    {
+	      const uint32_t id = fd.postings[p];
+	      if(id < matches.size())
+		matches[id] = true;
+	    }
+	}
+    }
+
+    void term_index::find_candidates(unsigned int field_mask,
+				     const std::vector<std::string> &runs,
+				     std::vector<bool> &candidates) const
+    {
+      candidates.assign(num_packages, true);
+
+      std::vector<bool> found;
+      for(std::vector<std::string>::const_iterator it = runs.begin();
+	  it != runs.end(); ++it)
+	{
+	  found.assign(num_packages, false);
+
+	  for(int f = 0; f < num_fields; ++f)
+	    if(field_mask & (1 << f))
+	      find_containing(static_cast<field>(f), *it, found);
+
+	  for(uint32_t id = 0; id < num_packages; ++id)
+	    candidates[id] = candidates[id] && found[id];
+	}
+    }
+
+    bool get_regex_literals(const std::string &regex,
+			    std::vector<std::string> &runs)
+    {
+      std::vector<std::string> rval;
+      std::string run;
+
+      for(std::string::size_type i = 0; i < regex.size(); ++i)
+	{
+	  const char c = regex[i];
+
+	  switch(c)
+	    {
+	    case '|':
+	    case '(':
+	    case ')':
+	      // Alternatives and groups can make anything optional;
+	      // don't try to analyze them.
+	      return false;
+
+	    case '*':
+	    case '?':
+	    case '{':
+	      // The previous character is optional.
+	      if(!run.empty())
+		run.erase(run.size() - 1);
+	      if(c == '{')
+		{
+		  i = regex.find('}', i);
+		  if(i == std::string::npos)
+		    return false;
+		}
+	      break;
+
+	    case '[':
+	      {
+		// Skip the bracket expression.  A ']' right after the
+		// '[' or "[^" is part of the expression.
+		std::string::size_type j = i + 1;
+		if(j < regex.size() && regex[j] == '^')
+		  ++j;
+		if(j < regex.size() && regex[j] == ']')
+		  ++j;
+		while(j < regex.size() && regex[j] != ']')
+		  {
+		    if(regex[j] == '[' && j + 1 < regex.size() &&
+		       (regex[j + 1] == ':' || regex[j + 1] == '.' || regex[j + 1] == '='))
+		      {
+			const std::string close = std::string(1, regex[j + 1]) + "]";
+			j = regex.find(close, j + 2);
+			if(j == std::string::npos)
+			  return false;
+			j += 2;
+		      }
+		    else
+		      ++j;
+		  }
+		if(j >= regex.size())
+		  return false;
+		i = j;
+	      }
+	      break;
+
+	    case '\\':
+	      // Skip the escaped character.
+	      ++i;
+	      break;
+
+	    default:
+	      if(is_ascii_alnum(c))
+		{
+		  run.push_back(fold_case(c));
+		  continue;
+		}
+	      break;
+	    }
+
+	  // Anything that isn't a letter or a digit ends the run.
+	  if(!run.empty())
+	    {
+	      if(run.size() >= 2)
+		rval.push_back(run);
+	      run.clear();
+	    }
+	}
+
+      if(run.size() >= 2)
+	rval.push_back(run);
+
+      if(rval.empty())
+	return false;
+
+      runs.insert(runs.end(), rval.begin(), rval.end());
+      return true;
+    }
+
+    namespace
+    {
+      cwidget::threads::mutex term_index_mutex;
+      std::shared_ptr<const term_index> global_term_index;
+      bool global_term_index_loaded = false;
+      // The cache that global_term_index was built for, or NULL if
+      // that cache was closed.
+      const pkgCache *indexed_cache = NULL;
+      // The key of the cache that global_term_index was built for.
+      std::string indexed_key;
+      bool term_index_reset_connected = false;
+
+      void reset_term_index()
+      {
+	cwidget::threads::mutex::lock l(term_index_mutex);
+
+	global_term_index.reset();
+	global_term_index_loaded = false;
+	indexed_cache = NULL;
+	indexed_key.clear();
+      }
+
+      // Keep the index of a closed cache, so that it can be reused
+      // if the next cache has the same key (for instance, when the
+      // cache is reopened after running dpkg).
+      void retire_term_index()
+      {
+	cwidget::threads::mutex::lock l(term_index_mutex);
+
+	indexed_cache = NULL;
+      }
+    }
+
+    std::shared_ptr<const term_index> get_term_index(pkgCache &cache,
+						     pkgRecords &records)
+    {
+      cwidget::threads::mutex::lock l(term_index_mutex);
+
+      if(!term_index_reset_connected)
+	{
+	  cache_closed.connect(sigc::ptr_fun(retire_term_index));
+	  cache_reload_failed.connect(sigc::ptr_fun(reset_term_index));
+	  term_index_reset_connected = true;
+	}
+
+      if(global_term_index_loaded && indexed_cache != &cache)
+	{
+	  const std::string key = get_cache_key(cache);
+
+	  if(global_term_index.get() != NULL && key == indexed_key)
+	    {
+	      LOG_INFO(Loggers::getAptitudeSearchIndex(),
+		       "Reusing the search index of the previous cache.");
+	      indexed_cache = &cache;
+	    }
+	  else
+	    {
+	      global_term_index.reset();
+	      global_term_index_loaded = false;
+	    }
+	}
+
+      if(!global_term_index_loaded)
+	{
+	  global_term_index_loaded = true;
+	  indexed_cache = &cache;
+	  indexed_key.clear();
+
+	  if(aptcfg->FindB(PACKAGE "::Search-Index", true))
+	    {
+	      const std::string cache_dir = get_cache_dir();
+	      const std::string filename =
+		cache_dir.empty() ? std::string() : cache_dir + "/search-index";
+
+	      indexed_key = get_cache_key(cache);
+	      global_term_index = term_index::load(cache, records,
+						   filename,
+						   indexed_key);
+	    }
+	}
+
+      return global_term_index;
+    }
+  }
+}
@@ -0,0 +1,202 @@
+// term_index.h                                      -*-c++-*-
+//
+//   This program is free software; you can redistribute it and/or
+//   modify it under the terms of the GNU General Public License as
+//   published by the Free Software Foundation; either version 2 of
+//   the License, or (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//   General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program; see the file COPYING.  If not, write to
+//   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+//   Boston, MA 02110-1301, USA.
+
+#ifndef TERM_INDEX_H
+#define TERM_INDEX_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+/** \brief An inverted index of the words in package names,
+ *  descriptions and maintainers.
+ *
+ *  \file term_index.h
+ */
+
+class FileFd;
+class MMap;
+class pkgCache;
+class pkgRecords;
+
+namespace aptitude
+{
+  namespace apt
+  {
+    /** \brief Maps the words that occur in some fields of each package
+     *  to the packages that contain them.
+     *
+     *  The index is used to rule packages out before testing a text
+     *  search against them: a package can only match a regular
+     *  expression if each literal run of letters and digits that the
+     *  expression requires is part of some word in the searched
+     *  field.  Words are maximal runs of ASCII letters, digits and
+     *  non-ASCII bytes, folded to lower case; they are collected from
+     *  every version (and every translated description) of each
+     *  package, so the candidates are a superset of the packages that
+     *  can match, whatever the locale.
+     *
+     *  The index is keyed to the binary package cache and stored in
+     *  aptitude's cache directory, so it is only rebuilt when the
+     *  package cache changes.  On disk it is a header followed by one
+     *  section per field; each section holds the sorted words, the
+     *  offset of each word in the string table and the sorted list of
+     *  package IDs containing it.  The file is memory-mapped and used
+     *  in place.
+     */
+    class term_index
+    {
+    public:
+      /** \brief The fields that are indexed. */
+      enum field
+	{
+	  /** \brief The package name. */
+	  name_field,
+	  /** \brief The short and long descriptions. */
+	  description_field,
+	  /** \brief The Maintainer field. */
+	  maintainer_field,
+
+	  num_fields
+	};
+
+      /** \brief The header of a field's section. */
+      struct section
+      {
+	uint32_t num_words;
+	uint32_t string_bytes;
+	uint32_t num_postings;
+      };
+
+    private:
+      // The index file and its memory map, if it was loaded from
+      // disk.  The map is declared last so that it's destroyed
+      // first.
+      std::unique_ptr<FileFd> file;
+      std::unique_ptr<MMap> map;
+      // The index data, if it couldn't be saved.
+      std::vector<char> buffer;
+
+      uint32_t num_packages;
+
+      // Pointers into the index data for each field.
+      struct field_data
+      {
+	section header;
+	const uint32_t *word_offsets;
+	const uint32_t *posting_offsets;
+	const char *strings;
+	const uint32_t *postings;
+      };
+
+      field_data fields[num_fields];
+
+      term_index();
+
+      /** \brief Set up the field pointers.
+       *
+       *  \return \b false if the data is not a valid index for the
+       *  given cache key.
+       */
+      bool attach(const char *data, std::size_t size,
+		  const std::string &key);
+
+    public:
+      ~term_index();
+
+      /** \brief Load the index of the given cache, rebuilding it if
+       *  it is missing or out of date.
+       *
+       *  \param cache     The package cache to index.
+       *  \param records   The records of the package cache.
+       *  \param filename  Where the index is stored, or an empty
+       *                   string to keep it in memory.
+       *  \param key       Identifies the package cache; an index
+       *                   stored with a different key is rebuilt.
+       */
+      static std::shared_ptr<term_index> load(pkgCache &cache,
+					      pkgRecords &records,
+					      const std::string &filename,
+					      const std::string &key);
+
+      /** \brief Get the number of package IDs covered by the index. */
+      uint32_t get_num_packages() const { return num_packages; }
+
+      /** \brief Mark every package whose field f contains a word
+       *  containing the given text.
+       *
+       *  \param f        The field to search.
+       *  \param text     A lower-case string of ASCII letters and digits.
+       *  \param matches  A vector of get_num_packages() entries; the
+       *                  entry of each package that was found is set
+       *                  to \b true.
+       */
+      void find_containing(field f, const std::string &text,
+			   std::vector<bool> &matches) const;
+
+      /** \brief Find the packages that might contain all the given
+       *  runs of text in at least one of the given fields.
+       *
+       *  \param field_mask  A bitmask of (1 << field) values.
+       *  \param runs        Text runs as returned by
+       *                     get_regex_literals().
+       *  \param candidates  Set to a vector of get_num_packages()
+       *                     entries, which are \b true for each
+       *                     package that might match.
+       */
+      void find_candidates(unsigned int field_mask,
+			   const std::vector<std::string> &runs,
+			   std::vector<bool> &candidates) const;
+    };
+
+    /** \brief Find the runs of text that any string matching a
+     *  regular expression must contain.
+     *
+     *  Only runs of ASCII letters and digits of at least two
+     *  characters are returned, folded to lower case; anything the
+     *  expression might or might not match ends a run.
+     *
+     *  \param regex  A POSIX extended regular expression.
+     *  \param runs   The runs are appended to this vector.
+     *
+     *  \return \b false if no runs are required by the expression
+     *  (e.g., because it contains an alternation).
+     */
+    bool get_regex_literals(const std::string &regex,
+			    std::vector<std::string> &runs);
+
+    /** \brief Return the index of the given package cache, loading or
+     *  building it if necessary.
+     *
+     *  When the cache is reopened (for instance, after running
+     *  dpkg), the index is kept if the new cache has the same
+     *  generation and translation lists; otherwise it is loaded
+     *  again or rebuilt.  This may be
+     *  called from several threads at once; only one will build the
+     *  index.
+     *
+     *  \return the index, or an invalid pointer if it is disabled
+     *  (see Aptitude::Search-Index) or can't be built.
+     */
+    std::shared_ptr<const term_index> get_term_index(pkgCache &cache,
+						     pkgRecords &records);
+  }
+}
+
+#endif // TERM_INDEX_H
@@ -0,0 +1,258 @@
+/** \file checkpoint.h */     // -*-c++-*-
+
+//   This program is free software; you can redistribute it and/or
+//   modify it under the terms of the GNU General Public License as
+//   published by the Free Software Foundation; either version 2 of
+//   the License, or (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//   General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program; see the file COPYING.  If not, write to
+//   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+//   Boston, MA 02110-1301, USA.
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "cost.h"
+#include "exceptions.h"
+
+#include <climits>
+#include <istream>
+#include <ostream>
+#include <string>
+
+#include <stdint.h>
+
+/** \brief Low-level encoding of resolver search checkpoints.
+ *
+ *  A checkpoint is a stream of variable-length integers: unsigned
+ *  values are stored seven bits per byte, least significant group
+ *  first, and signed values are zigzag-encoded first so that small
+ *  negative numbers stay short.  This makes the encoding independent
+ *  of the word size and byte order of the host that wrote it.
+ */
+class checkpoint_writer
+{
+  std::ostream &out;
+
+public:
+  explicit checkpoint_writer(std::ostream &_out)
+    : out(_out)
+  {
+  }
+
+  void write_unsigned(uint64_t n)
+  {
+    while(n >= 0x80)
+      {
+	out.put(static_cast<char>((n & 0x7f) | 0x80));
+	n >>= 7;
+      }
+
+    out.put(static_cast<char>(n));
+  }
+
+  void write_int(int64_t n)
+  {
+    write_unsigned((static_cast<uint64_t>(n) << 1) ^ (n < 0 ? ~static_cast<uint64_t>(0) : 0));
+  }
+
+  void write_bool(bool b)
+  {
+    write_unsigned(b ? 1 : 0);
+  }
+
+  void write_string(const std::string &s)
+  {
+    write_unsigned(s.size());
+    out.write(s.data(), s.size());
+  }
+
+  /** \brief Write a cost as its structural level followed by its
+   *  user levels.
+   */
+  void write_cost(const cost &c)
+  {
+    write_int(c.get_structural_level());
+
+    const std::vector<std::pair<std::vector<level>::size_type, level> > &
+      user_levels(c.get_user_levels());
+    write_unsigned(user_levels.size());
+    for(std::vector<std::pair<std::vector<level>::size_type, level> >::const_iterator
+	  it = user_levels.begin(); it != user_levels.end(); ++it)
+      {
+	write_unsigned(it->first);
+	write_unsigned(it->second.get_state());
+	write_int(it->second.get_value());
+      }
+  }
+
+  bool good() const { return out.good(); }
+};
+
+/** \brief Reads the values written by a checkpoint_writer.
+ *
+ *  Every read method throws CheckpointFormatException if the input
+ *  ends early or contains an invalid value.
+ */
+class checkpoint_reader
+{
+  std::istream &in;
+
+public:
+  explicit checkpoint_reader(std::istream &_in)
+    : in(_in)
+  {
+  }
+
+  uint64_t read_unsigned()
+  {
+    uint64_t rval = 0;
+    for(int shift = 0; shift < 64; shift += 7)
+      {
+	const int c = in.get();
+	if(c == std::char_traits<char>::eof())
+	  throw CheckpointFormatException("Unexpected end of file.");
+
+	rval |= static_cast<uint64_t>(c & 0x7f) << shift;
+	if((c & 0x80) == 0)
+	  return rval;
+      }
+
+    throw CheckpointFormatException("Integer too large.");
+  }
+
+  int64_t read_int()
+  {
+    const uint64_t n = read_unsigned();
+    return static_cast<int64_t>((n >> 1) ^ (0 - (n & 1)));
+  }
+
+  /** \brief Read a signed value that must fit in an int. */
+  int read_int32()
+  {
+    const int64_t rval = read_int();
+    if(rval < INT_MIN || rval > INT_MAX)
+      throw CheckpointFormatException("Integer out of range.");
+    return static_cast<int>(rval);
+  }
+
+  /** \brief Read an unsigned value that must be less than the given
+   *  bound.
+   */
+  std::size_t read_index(std::size_t bound)
+  {
+    const uint64_t rval = read_unsigned();
+    if(rval >= bound)
+      throw CheckpointFormatException("Index out of range.");
+    return static_cast<std::size_t>(rval);
+  }
+
+  bool read_bool()
+  {
+    return read_index(2) == 1;
+  }
+
+  std::string read_string()
+  {
+    // Strings in a checkpoint are short; refuse to allocate a huge
+    // buffer for a corrupt length.
+    const std::size_t len = read_index(4096);
+    std::string rval(len, '\0');
+    in.read(&rval[0], len);
+    if(static_cast<std::size_t>(in.gcount()) != len)
+      throw CheckpointFormatException("Unexpected end of file.");
+    return rval;
+  }
+
+  cost read_cost()
+  {
+    const int structural_level = read_int32();
+    // The minimum cost has no structural level set.
+    cost rval = structural_level == INT_MIN
+      ? cost() : cost::make_advance_structural_level(structural_level);
+
+    const std::size_t num_user_levels = read_unsigned();
+    for(std::size_t i = 0; i < num_user_levels; ++i)
+      {
+	const int index = read_index(INT_MAX);
+	const std::size_t state = read_index(3);
+	const int value = read_int32();
+
+	switch(state)
+	  {
+	  case level::added:
+	    rval = rval + cost::make_add_to_user_level(index, value);
+	    break;
+	  case level::lower_bounded:
+	    rval = rval + cost::make_advance_user_level(index, value);
+	    break;
+	  default:
+	    break;
+	  }
+      }
+
+    return rval;
+  }
+};
+
+/** \brief Computes a 64-bit FNV-1a hash of a sequence of values.
+ *
+ *  Unlike boost::hash, the result is the same on every host, so it
+ *  can be stored in a checkpoint and compared on another machine.
+ */
+class checkpoint_fingerprint
+{
+  uint64_t value;
+
+  void add_byte(unsigned char c)
+  {
+    value ^= c;
+    value *= 1099511628211ULL;
+  }
+
+public:
+  checkpoint_fingerprint()
+    : value(14695981039346656037ULL)
+  {
+  }
+
+  void add_int(int64_t n)
+  {
+    const uint64_t u = static_cast<uint64_t>(n);
+    for(int shift = 0; shift < 64; shift += 8)
+      add_byte(static_cast<unsigned char>(u >> shift));
+  }
+
+  void add_string(const std::string &s)
+  {
+    add_int(s.size());
+    for(std::string::const_iterator it = s.begin(); it != s.end(); ++it)
+      add_byte(static_cast<unsigned char>(*it));
+  }
+
+  void add_cost(const cost &c)
+  {
+    add_int(c.get_structural_level());
+
+    const std::vector<std::pair<std::vector<level>::size_type, level> > &
+      user_levels(c.get_user_levels());
+    add_int(user_levels.size());
+    for(std::vector<std::pair<std::vector<level>::size_type, level> >::const_iterator
+	  it = user_levels.begin(); it != user_levels.end(); ++it)
+      {
+	add_int(it->first);
+	add_int(it->second.get_state());
+	add_int(it->second.get_value());
+      }
+  }
+
+  uint64_t get_value() const { return value; }
+};
+
+#endif // CHECKPOINT_H
@@ -149,6 +149,11 @@ private:
   // would be more efficient or not.
   imm::set<choice> not_install_version_choices;
 
+  // The sum of the hashes of every choice in this set.  Summing makes
+  // the hash independent of the order in which choices were added, so
+  // it can be kept up to date as choices are inserted and removed,
+  // and sets that are equal always have the same hash.
+  std::size_t structural_hash;
 
   friend std::ostream &operator<< <PackageUniverse>(std::ostream &out, const generic_choice_set<PackageUniverse> &choices);
 
@@ -215,16 +220,23 @@ private:
 	      parent.install_version_choices.lookup(p);
 
 	    if(!n.isValid())
-	      parent.install_version_choices.put(p, c);
+	      {
+		parent.install_version_choices.put(p, c);
+		parent.structural_hash += hash_value(c);
+	      }
 	    else
 	      {
 		std::pair<package, choice> existing_choice_pair(n.getVal());
 		choice &existing_choice(existing_choice_pair.second);
 
 		if(existing_choice.contains(c))
-		  // Override the existing choice with the new one,
-		  // which is more specific.
-		  parent.install_version_choices.put(p, c);
+		  {
+		    // Override the existing choice with the new one,
+		    // which is more specific.
+		    parent.structural_hash -= hash_value(existing_choice);
+		    parent.install_version_choices.put(p, c);
+		    parent.structural_hash += hash_value(c);
+		  }
 		else if(c.contains(existing_choice))
 		  ; // c is more general than the existing choice.
 		else
@@ -236,7 +248,8 @@ private:
 	  break;
 
 	default:
-	  parent.not_install_version_choices.insert(c);
+	  if(parent.not_install_version_choices.insert(c))
+	    parent.structural_hash += hash_value(c);
 	  break;
 	}
 
@@ -292,14 +305,17 @@ private:
   };
 
   generic_choice_set(const imm::map<package, choice> &_install_version_choices,
-		     const imm::set<choice> &_not_install_version_choices)
+		     const imm::set<choice> &_not_install_version_choices,
+		     std::size_t _structural_hash)
     : install_version_choices(_install_version_choices),
-      not_install_version_choices(_not_install_version_choices)
+      not_install_version_choices(_not_install_version_choices),
+      structural_hash(_structural_hash)
   {
   }
 
 public:
   generic_choice_set()
+    : structural_hash(0)
   {
   }
 
@@ -365,11 +381,22 @@ public:
     switch(c.get_type())
       {
       case choice::install_version:
-	install_version_choices.erase(c.get_ver().get_package());
+	{
+	  const package p(c.get_ver().get_package());
+	  typename imm::map<package, choice>::node n =
+	    install_version_choices.lookup(p);
+
+	  if(n.isValid())
+	    {
+	      structural_hash -= hash_value(n.getVal().second);
+	      install_version_choices.erase(p);
+	    }
+	}
 	break;
 
       default:
-	not_install_version_choices.erase(c);
+	if(not_install_version_choices.erase(c))
+	  structural_hash -= hash_value(c);
 	break;
       }
   }
@@ -482,9 +509,22 @@ public:
     return install_version_choices.size() + not_install_version_choices.size();
   }
 
+  /** \brief Return a hash of the choices in this set.
+   *
+   *  The hash is maintained as choices are added and removed, so this
+   *  takes constant time.  Equal sets have equal hashes.
+   */
+  std::size_t get_hash() const
+  {
+    return structural_hash;
+  }
+
   bool operator==(const generic_choice_set &other) const
   {
+    // Comparing the hashes first means that unequal sets are almost
+    // always told apart without walking either of them.
     return
+      structural_hash == other.structural_hash &&
       install_version_choices == other.install_version_choices &&
       not_install_version_choices == other.not_install_version_choices;
   }
@@ -553,7 +593,8 @@ public:
   generic_choice_set clone() const
   {
     return generic_choice_set(install_version_choices.clone(),
-			      not_install_version_choices.clone());
+			      not_install_version_choices.clone(),
+			      structural_hash);
   }
 
   /** \brief Retrieve the version, if any, that was chosen for the
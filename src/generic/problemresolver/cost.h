@@ -390,6 +390,11 @@ class cost
 
     level get_user_level(std::size_t idx) const;
 
+    const std::vector<std::pair<level_index, level> > &get_user_levels() const
+    {
+      return actions;
+    }
+
     bool get_has_user_levels() const
     {
       return !actions.empty();
@@ -615,6 +620,14 @@ public:
     return get_impl().get_user_level(idx);
   }
 
+  /** \brief Get the user levels that are set in this cost, as
+   *  pairs of level indices and values sorted by index.
+   */
+  const std::vector<std::pair<std::vector<level>::size_type, level> > &get_user_levels() const
+  {
+    return get_impl().get_user_levels();
+  }
+
   /** \brief Check whether the cost contains any values at user
    *  levels.
    */
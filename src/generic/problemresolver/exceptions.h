@@ -125,4 +125,21 @@ class CostOperationMismatchException : public ProblemResolverError {
   }
 };
 
+/** An exception indicating that a search checkpoint could not be
+ *  read.
+ */
+class CheckpointFormatException : public ProblemResolverError {
+  std::string msg;
+public:
+  CheckpointFormatException(const std::string &_msg)
+    : msg(_msg)
+  {
+  }
+
+  std::string errmsg() const
+  {
+    return msg;
+  }
+};
+
 #endif // EXCEPTIONS_H
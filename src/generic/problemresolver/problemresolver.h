@@ -22,7 +22,9 @@
 #define PROBLEMRESOLVER_H
 
 #include <algorithm>
+#include <atomic>
 #include <map>
+#include <memory>
 #include <set>
 #include <vector>
 
@@ -32,6 +34,7 @@
 #include <limits.h>
 
 #include "choice.h"
+#include "checkpoint.h"
 #include "choice_set.h"
 #include "dump_universe.h"
 #include "exceptions.h"
@@ -40,6 +43,7 @@
 #include "solution.h"
 #include "resolver_undo.h"
 #include "search_graph.h"
+#include "step_queue.h"
 #include "cost.h"
 #include "cost_limits.h"
 
@@ -51,6 +55,7 @@
 #include <generic/util/maybe.h>
 
 #include <boost/flyweight.hpp>
+#include <boost/unordered_map.hpp>
 #include <boost/unordered_set.hpp>
 
 /** \brief Generic problem resolver
@@ -505,6 +510,7 @@ public:
   typedef generic_promotion_queue_entry<PackageUniverse> promotion_queue_entry;
 
   typedef typename search_graph::step step;
+  typedef generic_step_queue<PackageUniverse> step_queue;
 
   /** Information about the sizes of the various resolver queues. */
   struct queue_counts
@@ -554,44 +560,6 @@ private:
 
   typedef ExtractPackageId PackageHash;
 
-  /** Compares steps according to their "goodness": their effective
-   *  cost, then thier score, then their contents.
-   *
-   *  The comparisons are reversed, so better solutions compare
-   *  "below" worse ones.
-   */
-  struct step_goodness_compare
-  {
-    const search_graph &graph;
-
-    step_goodness_compare(const search_graph &_graph)
-      : graph(_graph)
-    {
-    }
-
-    bool operator()(int step_num1, int step_num2) const
-    {
-      // Optimization: a step always equals itself.
-      if(step_num1 == step_num2)
-	return false;
-
-      const step &step1(graph.get_step(step_num1));
-      const step &step2(graph.get_step(step_num2));
-
-      // Note that *lower* costs come "before" higher costs, hence the
-      // reversed comparison there.
-      int cost_cmp = step1.final_step_cost.compare(step2.final_step_cost);
-      if(cost_cmp != 0)
-	return cost_cmp < 0;
-      else if(step2.score < step1.score)
-	return true;
-      else if(step1.score < step2.score)
-	return false;
-      else
-	return step2.actions < step1.actions;
-    }
-  };
-
   /** \brief Represents the "essential" information about a step.
    *
    *  This information consists of the step's scores and its actions.
@@ -614,28 +582,12 @@ private:
     choice_set actions;
     std::size_t hash;
 
-    struct combine_hashes
-    {
-      std::size_t &hash;
-
-      combine_hashes(std::size_t &_hash)
-	: hash(_hash)
-      {
-      }
-
-      bool operator()(const choice &c) const
-      {
-	boost::hash_combine(hash, c);
-	return true;
-      }
-    };
-
     void init_hash()
     {
       hash = 0;
       boost::hash_combine(hash, score);
       boost::hash_combine(hash, action_score);
-      actions.for_each(combine_hashes(hash));
+      boost::hash_combine(hash, actions.get_hash());
     }
 
   public:
@@ -671,9 +623,11 @@ private:
       else if(action_score != other.action_score)
 	return false;
 
-      // Speed hack: order by size first to avoid traversing the whole
-      // tree.
-      if(actions.size() != other.actions.size())
+      // Speed hack: compare the hashes and sizes first to avoid
+      // traversing the whole tree.
+      if(hash != other.hash)
+	return false;
+      else if(actions.size() != other.actions.size())
 	return false;
       else
 	return actions == other.actions;
@@ -739,6 +693,275 @@ private:
     }
   };
 
+  /** \brief Used to convert a flattened copy of a choice set, plus
+   *  one extra installation, into a model of Installation.
+   *
+   *  Unlike choice_set_installation, looking up a version never
+   *  touches the reference counts of an immutable tree, so any number
+   *  of threads can query the same overrides concurrently.
+   */
+  class speculative_installation
+  {
+    const boost::unordered_map<package, version> &overrides;
+    const resolver_initial_state<PackageUniverse> &initial_state;
+    const version &extra_version;
+
+  public:
+    speculative_installation(const boost::unordered_map<package, version> &_overrides,
+			     const resolver_initial_state<PackageUniverse> &_initial_state,
+			     const version &_extra_version)
+      : overrides(_overrides),
+	initial_state(_initial_state),
+	extra_version(_extra_version)
+    {
+    }
+
+    version version_of(const package &p) const
+    {
+      if(p == extra_version.get_package())
+	return extra_version;
+
+      typename boost::unordered_map<package, version>::const_iterator
+	found = overrides.find(p);
+      if(found != overrides.end())
+	return found->second;
+      else
+	return initial_state.version_of(p);
+    }
+  };
+
+  /** \brief The dependencies that are broken by installing a single
+   *  version on top of a set of choices.
+   */
+  struct newly_broken_deps
+  {
+    /** \brief Broken reverse dependencies of the old version and then
+     *  of the new version, in iteration order.
+     */
+    std::vector<dep> revdeps;
+
+    /** \brief Broken forward dependencies of the new version, in
+     *  iteration order.
+     */
+    std::vector<dep> deps;
+  };
+
+  /** \brief Find the dependencies that are broken under the given
+   *  installation and that involve either the old or the new version
+   *  of a package.
+   *
+   *  This only reads from the universe and from the installation, so
+   *  it is safe to run in a worker thread as long as the installation
+   *  is.
+   */
+  template<typename Installation>
+  static void find_newly_broken_deps(const Installation &installation,
+				     const version &old_version,
+				     const version &new_version,
+				     newly_broken_deps &out)
+  {
+    // Check reverse deps of the old version.
+    for(typename version::revdep_iterator rdi = old_version.revdeps_begin();
+	!rdi.end(); ++rdi)
+      {
+	dep rd(*rdi);
+
+	if(rd.broken_under(installation))
+	  out.revdeps.push_back(rd);
+      }
+
+    for(typename version::revdep_iterator rdi = new_version.revdeps_begin();
+	!rdi.end(); ++rdi)
+      {
+	dep rd(*rdi);
+
+	if(rd.broken_under(installation))
+	  out.revdeps.push_back(rd);
+      }
+
+    for(typename version::dep_iterator di = new_version.deps_begin();
+	!di.end(); ++di)
+      {
+	dep d(*di);
+
+	if(d.broken_under(installation))
+	  out.deps.push_back(d);
+      }
+  }
+
+  /** \brief A single successor whose broken dependencies are computed
+   *  ahead of time by speculate_successors().
+   */
+  struct speculation_job
+  {
+    int parent_step_num;
+    /** \brief The parent's actions, flattened; shared by all the jobs
+     *  for a given parent.
+     */
+    std::shared_ptr<const boost::unordered_map<package, version> > overrides;
+    version old_version;
+    version new_version;
+    newly_broken_deps result;
+  };
+
+  /** \brief Worker threads that compute speculation jobs.
+   *
+   *  The threads are started once and then wait for work between
+   *  calls to run(), so that each step of the search doesn't pay for
+   *  creating and joining threads.  Jobs are handed out one at a
+   *  time from a shared counter, and the calling thread takes part
+   *  in the work as well.
+   */
+  class speculation_pool
+  {
+    const resolver_initial_state<PackageUniverse> &initial_state;
+
+    cwidget::threads::mutex mutex;
+    /** \brief Signalled when a batch of jobs is posted or when the
+     *  pool is shutting down.
+     */
+    cwidget::threads::condition work_posted;
+    /** \brief Signalled when the last worker finishes a batch. */
+    cwidget::threads::condition work_finished;
+
+    // The following are protected by the mutex.
+
+    /** \brief The jobs of the current batch. */
+    std::vector<speculation_job> *jobs;
+    /** \brief Incremented each time a batch is posted. */
+    unsigned long batch_num;
+    /** \brief The number of workers that haven't finished the
+     *  current batch.
+     */
+    std::size_t num_busy;
+    bool stopping;
+
+    /** \brief The index of the next job that isn't taken yet. */
+    std::atomic<std::size_t> next_job;
+
+    std::vector<std::shared_ptr<cwidget::threads::thread> > workers;
+
+    void run_jobs(std::vector<speculation_job> &batch_jobs)
+    {
+      for(std::size_t i = next_job++; i < batch_jobs.size(); i = next_job++)
+	{
+	  speculation_job &job(batch_jobs[i]);
+	  speculative_installation installation(*job.overrides,
+						initial_state,
+						job.new_version);
+	  find_newly_broken_deps(installation,
+				 job.old_version,
+				 job.new_version,
+				 job.result);
+	}
+    }
+
+    void worker_loop()
+    {
+      unsigned long last_batch_num = 0;
+
+      while(true)
+	{
+	  std::vector<speculation_job> *batch_jobs;
+	  {
+	    cwidget::threads::mutex::lock l(mutex);
+	    while(!stopping && batch_num == last_batch_num)
+	      work_posted.wait(l);
+
+	    if(stopping)
+	      return;
+
+	    last_batch_num = batch_num;
+	    batch_jobs = jobs;
+	  }
+
+	  run_jobs(*batch_jobs);
+
+	  cwidget::threads::mutex::lock l(mutex);
+	  if(--num_busy == 0)
+	    work_finished.wake_all();
+	}
+    }
+
+    struct worker_bootstrap
+    {
+      speculation_pool &pool;
+
+      worker_bootstrap(speculation_pool &_pool)
+	: pool(_pool)
+      {
+      }
+
+      void operator()() const
+      {
+	pool.worker_loop();
+      }
+    };
+
+    speculation_pool(const speculation_pool &);
+    speculation_pool &operator=(const speculation_pool &);
+
+  public:
+    /** \brief Start a pool of the given number of threads, counting
+     *  the one that calls run().
+     */
+    speculation_pool(const resolver_initial_state<PackageUniverse> &_initial_state,
+		     int num_threads)
+      : initial_state(_initial_state),
+	jobs(NULL),
+	batch_num(0),
+	num_busy(0),
+	stopping(false),
+	next_job(0)
+    {
+      for(int i = 1; i < num_threads; ++i)
+	workers.push_back(std::make_shared<cwidget::threads::thread>(worker_bootstrap(*this)));
+    }
+
+    ~speculation_pool()
+    {
+      {
+	cwidget::threads::mutex::lock l(mutex);
+	stopping = true;
+	work_posted.wake_all();
+      }
+
+      for(typename std::vector<std::shared_ptr<cwidget::threads::thread> >::const_iterator it =
+	    workers.begin(); it != workers.end(); ++it)
+	(*it)->join();
+    }
+
+    /** \brief Return the number of threads, counting the one that
+     *  calls run().
+     */
+    int get_num_threads() const
+    {
+      return static_cast<int>(workers.size()) + 1;
+    }
+
+    /** \brief Compute the given jobs and wait until they are all
+     *  done.
+     */
+    void run(std::vector<speculation_job> &batch_jobs)
+    {
+      {
+	cwidget::threads::mutex::lock l(mutex);
+	jobs = &batch_jobs;
+	next_job = 0;
+	num_busy = workers.size();
+	++batch_num;
+	work_posted.wake_all();
+      }
+
+      run_jobs(batch_jobs);
+
+      cwidget::threads::mutex::lock l(mutex);
+      while(num_busy > 0)
+	work_finished.wait(l);
+      jobs = NULL;
+    }
+  };
+
   /** \brief The initial state of the resolver.
    *
    *  If this is not NULL, we need to use a more clever technique to
@@ -767,6 +990,25 @@ private:
    */
   int future_horizon;
 
+  /** \brief The number of threads used to expand the open queue
+   *  speculatively; 1 disables speculative expansion.
+   */
+  int num_threads;
+
+  /** \brief The threads used for speculative expansion; started the
+   *  first time they are needed.
+   */
+  std::unique_ptr<speculation_pool> speculation_threads;
+
+  /** \brief Broken dependencies of successors that were computed
+   *  ahead of time, indexed by the parent step number and then by the
+   *  version that the successor installs.
+   *
+   *  Entries are dropped once the parent's successors have been
+   *  generated (or once the parent is discarded).
+   */
+  boost::unordered_map<int, boost::unordered_map<version, newly_broken_deps> > speculated_successors;
+
   /** The universe in which we are solving problems. */
   const PackageUniverse universe;
 
@@ -811,7 +1053,7 @@ private:
    *
    *  Steps are sorted by cost, then by score, then by their contents.
    */
-  std::set<int, step_goodness_compare> pending;
+  step_queue pending;
 
   /** \brief Counts how many steps are deferred. */
   int num_deferred;
@@ -822,7 +1064,7 @@ private:
    *  The main reason this is persistent at the moment is so we don't
    *  lose solutions if find_next_solution() throws an exception.
    */
-  std::set<int, step_goodness_compare> pending_future_solutions;
+  step_queue pending_future_solutions;
 
   /** \brief Stores already-seen search nodes that had their
    *  successors generated.
@@ -1006,6 +1248,11 @@ private:
   /** \brief Stores the approved and rejected status of dependencies. */
   std::map<dep, approved_or_rejected_info> user_approved_or_rejected_broken_deps;
 
+  /** \brief The value of get_checkpoint_fingerprint(), once it has
+   *  been computed.
+   */
+  mutable maybe<uint64_t> checkpoint_fingerprint_value;
+
   /** \brief Expression class that calls back into the resolver when
    *         the value of its sub-expression changes.
    *
@@ -1408,8 +1655,10 @@ private:
     LOG_TRACE(logger, "Setting the final cost of step " << step_num
 	      << " to " << new_final_step_cost);
 
-    bool was_in_pending =  (pending.erase(step_num) > 0);
-    bool was_in_pending_future_solutions =  (pending_future_solutions.erase(step_num) > 0);
+    bool was_in_pending =
+      pending.update_cost(step_num, new_final_step_cost);
+    bool was_in_pending_future_solutions =
+      pending_future_solutions.update_cost(step_num, new_final_step_cost);
 
 
     if(is_defer_cost(s.final_step_cost))
@@ -1423,12 +1672,6 @@ private:
     s.final_step_cost = new_final_step_cost;
 
 
-    if(was_in_pending)
-      pending.insert(step_num);
-    if(was_in_pending_future_solutions)
-      pending_future_solutions.insert(step_num);
-
-
     if(is_defer_cost(s.final_step_cost))
       {
 	if(was_in_pending)
@@ -3284,61 +3527,55 @@ private:
    *  set.
    *
    *  c must already be contained in s.actions.
+   *
+   *  \param precomputed  If not NULL, the dependencies that installing
+   *                      c breaks, as computed ahead of time by
+   *                      speculate_successors().
    */
-  void add_new_unresolved_deps(step &s, const choice &c)
+  void add_new_unresolved_deps(step &s, const choice &c,
+			       const newly_broken_deps *precomputed)
   {
     switch(c.get_type())
       {
       case choice::install_version:
 	{
-	  choice_set_installation
-	    test_installation(s.actions, initial_state);
-
 	  version new_version = c.get_ver();
 	  version old_version = initial_state.version_of(new_version.get_package());
 
 	  LOG_TRACE(logger, "Finding new unresolved dependencies in step "
 		    << s.step_num << " caused by replacing "
-		    << old_version << " with " << new_version << ".");
+		    << old_version << " with " << new_version
+		    << (precomputed == NULL ? "." : " (precomputed)."));
 
-	  // Check reverse deps of the old version.
-	  for(typename version::revdep_iterator rdi = old_version.revdeps_begin();
-	      !rdi.end(); ++rdi)
+	  newly_broken_deps computed;
+	  if(precomputed == NULL)
 	    {
-	      dep rd(*rdi);
+	      choice_set_installation
+		test_installation(s.actions, initial_state);
 
-	      if(rd.broken_under(test_installation))
-		{
-		  if(!(rd.is_soft() &&
-		       s.actions.contains(choice::make_break_soft_dep(rd, -1))))
-		    add_unresolved_dep(s, rd);
-		}
+	      find_newly_broken_deps(test_installation,
+				     old_version, new_version,
+				     computed);
+	      precomputed = &computed;
 	    }
 
-	  for(typename version::revdep_iterator rdi = new_version.revdeps_begin();
-	      !rdi.end(); ++rdi)
+	  for(typename std::vector<dep>::const_iterator it =
+		precomputed->revdeps.begin();
+	      it != precomputed->revdeps.end(); ++it)
 	    {
-	      dep rd(*rdi);
+	      const dep &rd(*it);
 
-	      if(rd.broken_under(test_installation))
-		{
-		  if(!(rd.is_soft() &&
-		       s.actions.contains(choice::make_break_soft_dep(rd, -1))))
-		    add_unresolved_dep(s, rd);
-		}
+	      if(!(rd.is_soft() &&
+		   s.actions.contains(choice::make_break_soft_dep(rd, -1))))
+		add_unresolved_dep(s, rd);
 	    }
 
-	  for(typename version::dep_iterator di = new_version.deps_begin();
-	      !di.end(); ++di)
-	    {
-	      dep d(*di);
-
-	      if(d.broken_under(test_installation))
-		// Note: no need to test if this was chosen to be
-		// broken, because it can't possibly have been
-		// broken until now.
-		add_unresolved_dep(s, d);
-	    }
+	  // Note: no need to test if these were chosen to be broken,
+	  // because they can't possibly have been broken until now.
+	  for(typename std::vector<dep>::const_iterator it =
+		precomputed->deps.begin();
+	      it != precomputed->deps.end(); ++it)
+	    add_unresolved_dep(s, *it);
 	}
 
 	break;
@@ -3592,7 +3829,20 @@ private:
     // by each solver of a dependency.  \todo If the solvers were
     // stored in a central list, the number of promotion lookups
     // required could be vastly decreased.
-    add_new_unresolved_deps(output, c);
+    const newly_broken_deps *precomputed = NULL;
+    if(c.get_type() == choice::install_version)
+      {
+	typename boost::unordered_map<int, boost::unordered_map<version, newly_broken_deps> >::const_iterator
+	  found_parent = speculated_successors.find(parent.step_num);
+	if(found_parent != speculated_successors.end())
+	  {
+	    typename boost::unordered_map<version, newly_broken_deps>::const_iterator
+	      found = found_parent->second.find(c.get_ver());
+	    if(found != found_parent->second.end())
+	      precomputed = &found->second;
+	  }
+      }
+    add_new_unresolved_deps(output, c, precomputed);
 
     // 6. Find incipient promotions for the new step.
     find_new_incipient_promotions(output, c);
@@ -3605,12 +3855,16 @@ private:
     LOG_TRACE(logger, "Generated step " << output.step_num
 	      << " (" << output.actions.size() << " actions): " << output.actions << ";T" << output.final_step_cost
 	      << "S" << output.score);
+  }
 
-    if(is_discard_cost(output.final_step_cost))
+  /** \brief Place a newly generated step in the open queue. */
+  void enqueue_step(const step &s)
+  {
+    if(is_discard_cost(s.final_step_cost))
       // TODO: this is wrong!  Should check for deferral, not discarding.
       ++num_deferred;
 
-    pending.insert(output.step_num);
+    pending.insert(s.step_num);
   }
 
   class do_generate_single_successor
@@ -3652,6 +3906,7 @@ private:
       resolver.generate_single_successor(parent,
 					 output,
 					 solver);
+      resolver.enqueue_step(output);
 
       return true;
     }
@@ -3753,14 +4008,15 @@ public:
      unfixed_soft_cost(_unfixed_soft_cost),
      minimum_score(-infinity),
      future_horizon(_future_horizon),
+     num_threads(1),
      universe(_universe), finished(false),
      solver_executing(false), solver_cancelled(false),
-     pending(step_goodness_compare(graph)),
+     pending(graph),
      num_deferred(0),
-     pending_future_solutions(step_goodness_compare(graph)),
+     pending_future_solutions(graph),
      closed(),
      promotions(_universe, *this),
-     promotion_queue_tail(new promotion_queue_entry(0, 0)),
+     promotion_queue_tail(promotion_queue_entry::create(0, 0)),
      version_costs(new cost[_universe.get_version_count()])
   {
     logger->connect_message_logged(sigc::mem_fun(*this, &generic_problem_resolver::do_log));
@@ -3854,6 +4110,29 @@ public:
     debug = new_debug;
   }
 
+  /** \brief Set the number of threads used to expand the open queue.
+   *
+   *  With more than one thread, the dependencies broken by the
+   *  successors of the most promising pending steps are computed in
+   *  parallel before those steps are processed.  The search itself
+   *  stays serial, so the solutions that are produced and their order
+   *  do not depend on this setting.
+   */
+  void set_threads(int new_num_threads)
+  {
+    num_threads = std::max(new_num_threads, 1);
+    if(speculation_threads.get() != NULL &&
+       speculation_threads->get_num_threads() != num_threads)
+      speculation_threads.reset();
+  }
+
+  int get_threads() const { return num_threads; }
+
+  /** \brief Return the number of search steps that were created
+   *  since the last reset.
+   */
+  unsigned int get_num_steps() const { return graph.get_num_steps(); }
+
   /** Clears all the internal state of the solver, discards solutions,
    *  zeroes out scores.  Call this routine after changing the state
    *  of packages to avoid inconsistent results.
@@ -3863,9 +4142,10 @@ public:
     finished=false;
     pending.clear();
     pending_future_solutions.clear();
-    promotion_queue_tail = std::make_shared<promotion_queue_entry>(0, 0);
+    promotion_queue_tail = promotion_queue_entry::create(0, 0);
     graph.clear();
     closed.clear();
+    speculated_successors.clear();
 
     for(size_t i=0; i<universe.get_version_count(); ++i)
       weights.version_scores[i]=0;
@@ -4222,7 +4502,7 @@ public:
     if(pending.empty())
       return cost_limits::minimum_cost;
     else
-      return graph.get_step(*pending.begin()).final_step_cost;
+      return graph.get_step(pending.top()).final_step_cost;
   }
 
 private:
@@ -4234,7 +4514,7 @@ private:
     if(pending.empty())
       return false;
 
-    const step &s = graph.get_step(*pending.begin());
+    const step &s = graph.get_step(pending.top());
 
     return
       !is_discard_cost(s.final_step_cost) &&
@@ -4249,7 +4529,7 @@ private:
     if(pending_future_solutions.empty())
       return false;
 
-    const step &s = graph.get_step(*pending_future_solutions.begin());
+    const step &s = graph.get_step(pending_future_solutions.top());
 
     return
       !is_discard_cost(s.final_step_cost) &&
@@ -4425,6 +4705,164 @@ private:
       }
   }
 
+  /** \brief Collects the install-version solvers of a dependency. */
+  class collect_install_version_solvers
+  {
+    std::vector<version> &out;
+
+  public:
+    collect_install_version_solvers(std::vector<version> &_out)
+      : out(_out)
+    {
+    }
+
+    bool operator()(const std::pair<choice, typename step::solver_information> &solver_pair) const
+    {
+      if(solver_pair.first.get_type() == choice::install_version)
+	out.push_back(solver_pair.first.get_ver());
+
+      return true;
+    }
+  };
+
+  /** \brief Compute, in parallel, the dependencies broken by the
+   *  successors of the most promising pending steps.
+   *
+   *  The successors themselves are still generated one at a time by
+   *  generate_successors(); the results computed here are only
+   *  consulted by add_new_unresolved_deps().  Since they are a pure
+   *  function of the parent's actions and of the new choice, the
+   *  search proceeds exactly as it would with a single thread.
+   *
+   *  Workers never touch the immutable trees in the search graph
+   *  (their reference counts are not thread-safe): each parent's
+   *  install choices are flattened into a hash table first.
+   */
+  void speculate_successors()
+  {
+    if(num_threads <= 1)
+      return;
+
+    std::vector<speculation_job> jobs;
+    int num_parents = 0;
+
+    typename step_queue::ordered_walk walk(pending);
+    int step_num;
+    while(num_parents < num_threads && walk.next(step_num))
+      {
+	const step &s(graph.get_step(step_num));
+
+	// Deferred and discarded steps sort last, and won't be
+	// expanded anytime soon.
+	if(is_defer_cost(s.final_step_cost) ||
+	   is_discard_cost(s.final_step_cost))
+	  break;
+
+	if(speculated_successors.find(s.step_num) != speculated_successors.end())
+	  continue;
+
+	// Pick the dependency exactly as generate_successors() will.
+	typename imm::set<std::pair<int, dep> >::node best =
+	  s.unresolved_deps_by_num_solvers.get_minimum();
+	if(!best.isValid())
+	  continue;
+
+	typename imm::map<dep, typename step::flyweight_dep_solvers>::node bestSolvers =
+	  s.unresolved_deps.lookup(best.getVal().second);
+	if(!bestSolvers.isValid())
+	  continue;
+
+	std::vector<version> solvers;
+	const typename step::dep_solvers &bestDepSolvers(bestSolvers.getVal().second);
+	bestDepSolvers.for_each_solver(collect_install_version_solvers(solvers));
+	if(solvers.empty())
+	  continue;
+
+	std::shared_ptr<boost::unordered_map<package, version> > overrides =
+	  std::make_shared<boost::unordered_map<package, version> >();
+	for(typename choice_set::const_iterator cIt = s.actions.begin();
+	    cIt != s.actions.end(); ++cIt)
+	  if(cIt->get_type() == choice::install_version)
+	    (*overrides)[cIt->get_ver().get_package()] = cIt->get_ver();
+
+	// Make sure that the parent has an entry even if all its
+	// successors are computed by the main thread, so that it isn't
+	// examined again.
+	speculated_successors[s.step_num];
+	++num_parents;
+
+	for(typename std::vector<version>::const_iterator vIt = solvers.begin();
+	    vIt != solvers.end(); ++vIt)
+	  {
+	    speculation_job job;
+	    job.parent_step_num = s.step_num;
+	    job.overrides = overrides;
+	    job.old_version = initial_state.version_of(vIt->get_package());
+	    job.new_version = *vIt;
+	    jobs.push_back(job);
+	  }
+      }
+
+    if(jobs.empty())
+      return;
+
+    if(speculation_threads.get() == NULL)
+      speculation_threads.reset(new speculation_pool(initial_state, num_threads));
+
+    speculation_threads->run(jobs);
+
+    for(typename std::vector<speculation_job>::iterator it = jobs.begin();
+	it != jobs.end(); ++it)
+      std::swap(speculated_successors[it->parent_step_num][it->new_version],
+		it->result);
+
+    LOG_DEBUG(logger, "Speculatively computed " << jobs.size()
+	      << " successors of " << num_parents << " steps using "
+	      << num_threads << " threads.");
+  }
+
+  /** \brief Queue a step that solves every dependency as a solution.
+   *
+   *  The solution is also remembered, so that it isn't returned
+   *  again in the future.
+   */
+  void add_solution_step(step &s)
+  {
+    choice_set generalized_actions;
+    for(typename choice_set::const_iterator it = s.actions.begin();
+	it != s.actions.end(); ++it)
+      generalized_actions.insert_or_narrow(it->generalize());
+    promotion already_generated_promotion(generalized_actions,
+					  cost_limits::already_generated_cost);
+    add_promotion(s.step_num, already_generated_promotion);
+
+    s.is_blessed_solution = true;
+    pending_future_solutions.insert(s.step_num);
+  }
+
+  /** \brief Create the root of the search graph, the step that
+   *  contains no actions.
+   */
+  step &add_root_step()
+  {
+    step &root = graph.add_step();
+    root.action_score = 0;
+    root.score = initial_broken.size() * weights.broken_score;
+    if(initial_broken.empty())
+      root.score += weights.full_solution_score;
+
+    root.base_step_cost = cost_limits::minimum_cost;
+    root.effective_step_cost = cost_limits::minimum_cost;
+    root.final_step_cost = cost_limits::minimum_cost;
+    root.promotion_queue_location = promotion_queue_tail;
+
+    for(typename imm::set<dep>::const_iterator it = initial_broken.begin();
+	it != initial_broken.end(); ++it)
+      add_unresolved_dep(root, *it);
+
+    return root;
+  }
+
   /** \brief Process the given step number and generate its
    *  successors.
    */
@@ -4459,10 +4897,12 @@ private:
 	if(is_already_seen(step_num))
 	  {
 	    LOG_DEBUG(logger, "Dropping already visited search node in step " << s.step_num);
+	    speculated_successors.erase(step_num);
 	  }
 	else if(irrelevant(s))
 	  {
 	    LOG_DEBUG(logger, "Dropping irrelevant step " << s.step_num);
+	    speculated_successors.erase(step_num);
 	  }
 	// The step might have been promoted to the defer structural level by
 	// check_for_new_promotions.
@@ -4486,23 +4926,13 @@ private:
 			 << ": " << s.actions << ";T" << s.final_step_cost
 			 << "S" << s.score);
 
-		// Remember this solution, so we don't try to return it
-		// again in the future.
-		choice_set generalized_actions;
-		for(typename choice_set::const_iterator it = s.actions.begin();
-		    it != s.actions.end(); ++it)
-		  generalized_actions.insert_or_narrow(it->generalize());
-		promotion already_generated_promotion(generalized_actions,
-						      cost_limits::already_generated_cost);
-		add_promotion(step_num, already_generated_promotion);
-
-		s.is_blessed_solution = true;
-		pending_future_solutions.insert(step_num);
+		add_solution_step(s);
 	      }
 	    // Nope, let's go enqueue successor nodes.
 	    else
 	      {
 		generate_successors(step_num, visited_packages);
+		speculated_successors.erase(step_num);
                 const step &first_child = graph.get_step(s.first_child);
 
 		// If we enqueued *exactly* one successor, then this
@@ -4590,20 +5020,7 @@ public:
       {
 	LOG_INFO(logger, "Starting a new search.");
 
-	step &root = graph.add_step();
-	root.action_score = 0;
-	root.score = initial_broken.size() * weights.broken_score;
-	if(initial_broken.empty())
-	  root.score += weights.full_solution_score;
-
-	root.base_step_cost = cost_limits::minimum_cost;
-	root.effective_step_cost = cost_limits::minimum_cost;
-	root.final_step_cost = cost_limits::minimum_cost;
-	root.promotion_queue_location = promotion_queue_tail;
-
-	for(typename imm::set<dep>::const_iterator it = initial_broken.begin();
-	    it != initial_broken.end(); ++it)
-	  add_unresolved_dep(root, *it);
+	step &root = add_root_step();
 
 	LOG_TRACE(logger, "Inserting the root at step " << root.step_num
 		  << " with cost " << root.final_step_cost);
@@ -4627,9 +5044,10 @@ public:
 
 	update_counts_cache();
 
+	speculate_successors();
 
-	int curr_step_num = *pending.begin();
-	pending.erase(pending.begin());
+	int curr_step_num = pending.top();
+	pending.pop();
 
 	++odometer;
 
@@ -4666,7 +5084,7 @@ public:
 
     if(pending_future_solutions_contains_candidate())
       {
-	int best_future_solution = *pending_future_solutions.begin();
+	int best_future_solution = pending_future_solutions.top();
 	step &best_future_solution_step = graph.get_step(best_future_solution);
 	if(!is_defer_cost(best_future_solution_step.final_step_cost) &&
            !is_discard_cost(best_future_solution_step.final_step_cost))
@@ -4688,7 +5106,7 @@ public:
 	    LOG_INFO(logger, "--- Returning the future solution "
 		     << rval << " from step " << best_future_solution);
 
-	    pending_future_solutions.erase(pending_future_solutions.begin());
+	    pending_future_solutions.pop();
 
 	    return rval;
 	  }
@@ -4716,6 +5134,626 @@ public:
     throw NoMoreSolutions();
   }
 
+private:
+  /** \brief Translates versions and dependencies to and from the
+   *  numbers that identify them in a checkpoint.
+   *
+   *  Versions are identified by their ID, and dependencies by the ID
+   *  of their source version and their position in its list of
+   *  dependencies.
+   */
+  class checkpoint_index
+  {
+    std::vector<version> versions;
+    std::vector<std::vector<dep> > deps_by_source;
+    boost::unordered_map<dep, std::pair<int, int> > dep_locations;
+
+    void write_dep(checkpoint_writer &writer, const dep &d) const
+    {
+      const std::pair<int, int> &location(dep_locations.find(d)->second);
+      writer.write_unsigned(location.first);
+      writer.write_unsigned(location.second);
+    }
+
+    dep read_dep(checkpoint_reader &reader) const
+    {
+      const std::vector<dep> &deps(deps_by_source[reader.read_index(deps_by_source.size())]);
+      return deps[reader.read_index(deps.size())];
+    }
+
+  public:
+    explicit checkpoint_index(const PackageUniverse &universe)
+      : versions(universe.get_version_count()),
+	deps_by_source(universe.get_version_count())
+    {
+      for(typename PackageUniverse::package_iterator pIt = universe.packages_begin();
+	  !pIt.end(); ++pIt)
+	for(typename package::version_iterator vIt = (*pIt).versions_begin();
+	    !vIt.end(); ++vIt)
+	  {
+	    const version v(*vIt);
+	    std::vector<dep> &deps(deps_by_source[v.get_id()]);
+
+	    versions[v.get_id()] = v;
+	    for(typename version::dep_iterator dIt = v.deps_begin();
+		!dIt.end(); ++dIt)
+	      {
+		dep_locations[*dIt] = std::make_pair(v.get_id(), static_cast<int>(deps.size()));
+		deps.push_back(*dIt);
+	      }
+	  }
+    }
+
+    /** \brief Return \b true if the given choice can be stored in a
+     *  checkpoint.
+     */
+    bool can_write(const choice &c) const
+    {
+      switch(c.get_type())
+	{
+	case choice::install_version:
+	  return !c.get_has_dep() || dep_locations.find(c.get_dep()) != dep_locations.end();
+
+	case choice::break_soft_dep:
+	  return dep_locations.find(c.get_dep()) != dep_locations.end();
+	}
+
+      return false;
+    }
+
+    void write_version(checkpoint_writer &writer, const version &v) const
+    {
+      writer.write_unsigned(v.get_id());
+    }
+
+    version read_version(checkpoint_reader &reader) const
+    {
+      return versions[reader.read_index(versions.size())];
+    }
+
+    void write_choice(checkpoint_writer &writer, const choice &c) const
+    {
+      switch(c.get_type())
+	{
+	case choice::install_version:
+	  writer.write_unsigned(c.get_has_dep()
+				? (c.get_from_dep_source() ? 2 : 1)
+				: 0);
+	  write_version(writer, c.get_ver());
+	  if(c.get_has_dep())
+	    write_dep(writer, c.get_dep());
+	  break;
+
+	case choice::break_soft_dep:
+	  writer.write_unsigned(3);
+	  write_dep(writer, c.get_dep());
+	  break;
+	}
+    }
+
+    choice read_choice(checkpoint_reader &reader) const
+    {
+      switch(reader.read_index(4))
+	{
+	case 0:
+	  return choice::make_install_version(read_version(reader), -1);
+
+	case 1:
+	  {
+	    const version v(read_version(reader));
+	    return choice::make_install_version(v, read_dep(reader), -1);
+	  }
+
+	case 2:
+	  {
+	    const version v(read_version(reader));
+	    return choice::make_install_version_from_dep_source(v, read_dep(reader), -1);
+	  }
+
+	default:
+	  return choice::make_break_soft_dep(read_dep(reader), -1);
+	}
+    }
+
+    void write_dep_list(checkpoint_writer &writer, const std::vector<dep> &deps) const
+    {
+      writer.write_unsigned(deps.size());
+      for(typename std::vector<dep>::const_iterator it = deps.begin();
+	  it != deps.end(); ++it)
+	write_dep(writer, *it);
+    }
+
+    void read_dep_list(checkpoint_reader &reader, std::vector<dep> &out) const
+    {
+      const uint64_t count = reader.read_unsigned();
+      for(uint64_t i = 0; i < count; ++i)
+	out.push_back(read_dep(reader));
+    }
+
+    bool has_dep(const dep &d) const
+    {
+      return dep_locations.find(d) != dep_locations.end();
+    }
+  };
+
+  struct compare_choices_by_id
+  {
+    bool operator()(const choice &c1, const choice &c2) const
+    {
+      return c1.get_id() < c2.get_id();
+    }
+  };
+
+  /** \brief Retrieve the actions of a step in the order in which they
+   *  were taken.
+   *
+   *  \return \b false if one of the actions can't be stored in a
+   *  checkpoint.
+   */
+  bool get_checkpoint_path(const checkpoint_index &index,
+			   const step &s,
+			   std::vector<choice> &out) const
+  {
+    for(typename choice_set::const_iterator it = s.actions.begin();
+	it != s.actions.end(); ++it)
+      {
+	if(!index.can_write(*it))
+	  return false;
+
+	out.push_back(*it);
+      }
+
+    std::sort(out.begin(), out.end(), compare_choices_by_id());
+    return true;
+  }
+
+  static void write_choice_lists(checkpoint_writer &writer,
+				 const checkpoint_index &index,
+				 const std::vector<std::vector<choice> > &lists)
+  {
+    writer.write_unsigned(lists.size());
+    for(typename std::vector<std::vector<choice> >::const_iterator it =
+	  lists.begin(); it != lists.end(); ++it)
+      {
+	writer.write_unsigned(it->size());
+	for(typename std::vector<choice>::const_iterator cIt = it->begin();
+	    cIt != it->end(); ++cIt)
+	  index.write_choice(writer, *cIt);
+      }
+  }
+
+  static void read_choice_lists(checkpoint_reader &reader,
+				const checkpoint_index &index,
+				std::vector<std::vector<choice> > &out)
+  {
+    const uint64_t count = reader.read_unsigned();
+    for(uint64_t i = 0; i < count; ++i)
+      {
+	out.push_back(std::vector<choice>());
+	std::vector<choice> &choices(out.back());
+
+	const uint64_t num_choices = reader.read_unsigned();
+	for(uint64_t j = 0; j < num_choices; ++j)
+	  choices.push_back(index.read_choice(reader));
+      }
+  }
+
+  static const char *get_checkpoint_magic()
+  {
+    return "aptitude-resolver-checkpoint";
+  }
+
+  /** \brief The version of the format written by save_checkpoint(). */
+  static const int checkpoint_format_version = 1;
+
+  /** \brief Compute a hash of everything that the search depends
+   *  on: the package universe, the initial state, and the scores
+   *  and costs assigned to versions.
+   *
+   *  A checkpoint can only be resumed by a resolver with the same
+   *  fingerprint.  Computing it visits the whole universe, so it is
+   *  only done the first time a checkpoint is saved or loaded; the
+   *  scores and costs can't change by then.
+   */
+  uint64_t get_checkpoint_fingerprint() const
+  {
+    if(checkpoint_fingerprint_value.get_has_value())
+      return checkpoint_fingerprint_value.get_value();
+
+    checkpoint_fingerprint fingerprint;
+
+    fingerprint.add_int(universe.get_package_count());
+    fingerprint.add_int(universe.get_version_count());
+
+    for(typename PackageUniverse::package_iterator pIt = universe.packages_begin();
+	!pIt.end(); ++pIt)
+      {
+	const package p(*pIt);
+
+	fingerprint.add_string(p.get_name());
+	fingerprint.add_int(initial_state.version_of(p).get_id());
+
+	for(typename package::version_iterator vIt = p.versions_begin();
+	    !vIt.end(); ++vIt)
+	  {
+	    const version v(*vIt);
+
+	    fingerprint.add_int(v.get_id());
+	    fingerprint.add_string(v.get_name());
+	    fingerprint.add_int(weights.version_scores[v.get_id()]);
+	    fingerprint.add_cost(version_costs[v.get_id()]);
+
+	    for(typename version::dep_iterator dIt = v.deps_begin();
+		!dIt.end(); ++dIt)
+	      {
+		const dep d(*dIt);
+
+		fingerprint.add_int(d.is_soft() ? 1 : 0);
+		for(typename dep::solver_iterator sIt = d.solvers_begin();
+		    !sIt.end(); ++sIt)
+		  fingerprint.add_int((*sIt).get_id());
+		fingerprint.add_int(-1);
+	      }
+	  }
+      }
+
+    fingerprint.add_int(weights.step_score);
+    fingerprint.add_int(weights.broken_score);
+    fingerprint.add_int(weights.unfixed_soft_score);
+    fingerprint.add_int(weights.full_solution_score);
+    fingerprint.add_cost(unfixed_soft_cost);
+
+    for(typename std::vector<std::pair<imm::set<version>, int> >::const_iterator it =
+	  weights.get_joint_scores_list().begin();
+	it != weights.get_joint_scores_list().end(); ++it)
+      {
+	fingerprint.add_int(it->first.size());
+	for(typename imm::set<version>::const_iterator vIt = it->first.begin();
+	    vIt != it->first.end(); ++vIt)
+	  fingerprint.add_int(vIt->get_id());
+	fingerprint.add_int(it->second);
+      }
+
+    checkpoint_fingerprint_value = maybe<uint64_t>(fingerprint.get_value());
+    return checkpoint_fingerprint_value.get_value();
+  }
+
+  /** \brief Retrieve the versions and dependencies that the user
+   *  rejected or approved, as they are stored in a checkpoint.
+   */
+  void get_checkpoint_constraints(const checkpoint_index &index,
+				  std::vector<version> &rejected,
+				  std::vector<version> &mandated,
+				  std::vector<dep> &hardened,
+				  std::vector<dep> &approved_broken) const
+  {
+    for(typename std::map<version, approved_or_rejected_info>::const_iterator it =
+	  user_approved_or_rejected_versions.begin();
+	it != user_approved_or_rejected_versions.end(); ++it)
+      {
+	if(it->second.get_rejected()->get_value())
+	  rejected.push_back(it->first);
+	if(it->second.get_approved()->get_value())
+	  mandated.push_back(it->first);
+      }
+
+    for(typename std::map<dep, approved_or_rejected_info>::const_iterator it =
+	  user_approved_or_rejected_broken_deps.begin();
+	it != user_approved_or_rejected_broken_deps.end(); ++it)
+      if(index.has_dep(it->first))
+	{
+	  if(it->second.get_rejected()->get_value())
+	    hardened.push_back(it->first);
+	  if(it->second.get_approved()->get_value())
+	    approved_broken.push_back(it->first);
+	}
+  }
+
+  /** \brief Test whether two lists hold the same elements, in any
+   *  order.
+   */
+  template<typename T>
+  static bool same_elements(const std::vector<T> &v1,
+			    const std::vector<T> &v2)
+  {
+    return
+      v1.size() == v2.size() &&
+      std::set<T>(v1.begin(), v1.end()) == std::set<T>(v2.begin(), v2.end());
+  }
+
+  /** \brief Recreate a saved step by applying its actions one at a
+   *  time, starting from the root.
+   *
+   *  The steps on the way are shared between the paths that have a
+   *  common prefix, and are added to the closed set, since the search
+   *  that saved them had already expanded them.  They aren't linked
+   *  into the search tree as parents of the steps that are rebuilt,
+   *  because they are missing the siblings of those steps; so
+   *  promotions found in the rebuilt subtrees don't propagate above
+   *  them.
+   *
+   *  \return the number of the step containing all the actions.
+   */
+  int replay_checkpoint_path(int root_num,
+			     const std::vector<choice> &path,
+			     boost::unordered_map<std::pair<int, choice>, int> &replayed)
+  {
+    int step_num = root_num;
+
+    for(typename std::vector<choice>::const_iterator it = path.begin();
+	it != path.end(); ++it)
+      {
+	const std::pair<int, choice> key(step_num, *it);
+	typename boost::unordered_map<std::pair<int, choice>, int>::const_iterator
+	  found = replayed.find(key);
+
+	if(found != replayed.end())
+	  step_num = found->second;
+	else
+	  {
+	    step &parent = graph.get_step(step_num);
+	    step &output = graph.add_step();
+	    generate_single_successor(parent, output, *it);
+
+	    if(it + 1 != path.end())
+	      closed[step_contents(output.score, output.action_score, output.actions)] =
+		output.step_num;
+
+	    step_num = output.step_num;
+	    replayed[key] = step_num;
+	  }
+      }
+
+    return step_num;
+  }
+
+public:
+  /** \brief Write the state of the search to a checkpoint.
+   *
+   *  The checkpoint holds the user's constraints, the promotions
+   *  that were learned, the steps in the open queue and the
+   *  solutions that were found, so that load_checkpoint() can
+   *  continue the search in another process, for instance after
+   *  find_next_solution() threw NoMoreTime.
+   *
+   *  This must not be called while the resolver is running.
+   */
+  void save_checkpoint(std::ostream &out) const
+  {
+    const checkpoint_index index(universe);
+
+    std::vector<version> rejected, mandated;
+    std::vector<dep> hardened, approved_broken;
+    get_checkpoint_constraints(index, rejected, mandated,
+			       hardened, approved_broken);
+
+    // Promotions at the "already generated" level are recreated along
+    // with the solutions, and deferrals are recomputed from the
+    // constraints.  Promotions with a validity condition depend on
+    // constraints that might be retracted, so they're dropped.
+    std::vector<std::vector<choice> > promotion_choices;
+    std::vector<cost> promotion_costs;
+    for(typename promotion_set::const_iterator it = promotions.begin();
+	it != promotions.end(); ++it)
+      {
+	const promotion &p(*it);
+	const int structural_level = p.get_cost().get_structural_level();
+
+	if(p.get_valid_condition().valid() ||
+	   structural_level == cost_limits::already_generated_structural_level ||
+	   structural_level == cost_limits::defer_structural_level)
+	  continue;
+
+	std::vector<choice> choices;
+	bool ok = true;
+	for(typename choice_set::const_iterator cIt = p.get_choices().begin();
+	    ok && cIt != p.get_choices().end(); ++cIt)
+	  {
+	    ok = index.can_write(*cIt);
+	    choices.push_back(*cIt);
+	  }
+
+	if(ok)
+	  {
+	    promotion_choices.push_back(choices);
+	    promotion_costs.push_back(p.get_cost());
+	  }
+      }
+
+    std::vector<std::vector<choice> > open_steps;
+    typename step_queue::ordered_walk walk(pending);
+    int step_num;
+    while(walk.next(step_num))
+      {
+	const step &s(graph.get_step(step_num));
+	if(is_discard_cost(s.final_step_cost))
+	  break;
+
+	std::vector<choice> path;
+	if(get_checkpoint_path(index, s, path))
+	  open_steps.push_back(path);
+      }
+
+    // Include the solutions that were already returned, since the
+    // process that resumes the search hasn't seen them.
+    std::vector<std::vector<choice> > solutions;
+    for(unsigned int i = 0; i < graph.get_num_steps(); ++i)
+      {
+	const step &s(graph.get_step(i));
+	std::vector<choice> path;
+	if(s.is_blessed_solution && get_checkpoint_path(index, s, path))
+	  solutions.push_back(path);
+      }
+
+    checkpoint_writer writer(out);
+    writer.write_string(get_checkpoint_magic());
+    writer.write_unsigned(checkpoint_format_version);
+    writer.write_unsigned(get_checkpoint_fingerprint());
+
+    writer.write_unsigned(rejected.size());
+    for(typename std::vector<version>::const_iterator it = rejected.begin();
+	it != rejected.end(); ++it)
+      index.write_version(writer, *it);
+    writer.write_unsigned(mandated.size());
+    for(typename std::vector<version>::const_iterator it = mandated.begin();
+	it != mandated.end(); ++it)
+      index.write_version(writer, *it);
+    index.write_dep_list(writer, hardened);
+    index.write_dep_list(writer, approved_broken);
+
+    write_choice_lists(writer, index, promotion_choices);
+    for(typename std::vector<cost>::const_iterator it = promotion_costs.begin();
+	it != promotion_costs.end(); ++it)
+      writer.write_cost(*it);
+
+    write_choice_lists(writer, index, open_steps);
+    write_choice_lists(writer, index, solutions);
+
+    LOG_INFO(logger, "Saved a search checkpoint with "
+	     << open_steps.size() << " open steps, "
+	     << solutions.size() << " solutions and "
+	     << promotion_choices.size() << " promotions.");
+  }
+
+  /** \brief Continue a search that was saved by save_checkpoint().
+   *
+   *  The checkpoint is only used if it was written by a resolver for
+   *  the same problem: the package universe, the initial state, the
+   *  scores and costs of versions, and the versions and dependencies
+   *  that the user rejected or approved must be the same.  The
+   *  user's constraints are never taken from the checkpoint, since
+   *  the open steps and promotions in it were found under them.  So
+   *  this must be called after the scores, costs and constraints are
+   *  set up, and before the search starts.
+   *
+   *  The steps in the checkpoint are rebuilt from their actions, so
+   *  the restored search has the same frontier as the saved one,
+   *  but it doesn't contain the steps that were already expanded.
+   *
+   *  \return \b true if the checkpoint was loaded; \b false if it
+   *  was for a different problem or couldn't be read, in which case
+   *  the resolver is unchanged.
+   */
+  bool load_checkpoint(std::istream &in)
+  {
+    if(!fresh())
+      {
+	LOG_ERROR(logger, "Can't load a search checkpoint after the search has started.");
+	return false;
+      }
+
+    const checkpoint_index index(universe);
+    checkpoint_reader reader(in);
+
+    std::vector<version> rejected, mandated;
+    std::vector<dep> hardened, approved_broken;
+    std::vector<std::vector<choice> > promotion_choices;
+    std::vector<cost> promotion_costs;
+    std::vector<std::vector<choice> > open_steps, solutions;
+
+    try
+      {
+	if(reader.read_string() != get_checkpoint_magic())
+	  throw CheckpointFormatException("Not a resolver checkpoint.");
+
+	if(reader.read_unsigned() != checkpoint_format_version)
+	  throw CheckpointFormatException("Unsupported checkpoint format.");
+
+	const uint64_t fingerprint = reader.read_unsigned();
+
+	uint64_t count = reader.read_unsigned();
+	for(uint64_t i = 0; i < count; ++i)
+	  rejected.push_back(index.read_version(reader));
+	count = reader.read_unsigned();
+	for(uint64_t i = 0; i < count; ++i)
+	  mandated.push_back(index.read_version(reader));
+	index.read_dep_list(reader, hardened);
+	index.read_dep_list(reader, approved_broken);
+
+	// Compare the constraints first, since they're cheap to check.
+	std::vector<version> current_rejected, current_mandated;
+	std::vector<dep> current_hardened, current_approved_broken;
+	get_checkpoint_constraints(index, current_rejected, current_mandated,
+				   current_hardened, current_approved_broken);
+
+	if(!same_elements(rejected, current_rejected) ||
+	   !same_elements(mandated, current_mandated) ||
+	   !same_elements(hardened, current_hardened) ||
+	   !same_elements(approved_broken, current_approved_broken))
+	  {
+	    LOG_INFO(logger, "Ignoring a search checkpoint that was saved with different rejected and approved actions.");
+	    return false;
+	  }
+
+	if(fingerprint != get_checkpoint_fingerprint())
+	  {
+	    LOG_INFO(logger, "Ignoring a search checkpoint that was saved for a different problem.");
+	    return false;
+	  }
+
+	read_choice_lists(reader, index, promotion_choices);
+	for(std::size_t i = 0; i < promotion_choices.size(); ++i)
+	  promotion_costs.push_back(reader.read_cost());
+
+	read_choice_lists(reader, index, open_steps);
+	read_choice_lists(reader, index, solutions);
+      }
+    catch(const ProblemResolverError &e)
+      {
+	LOG_ERROR(logger, "Can't read the search checkpoint: " << e.errmsg());
+	return false;
+      }
+
+    // Create the root before adding the promotions, so that they are
+    // applied to it (and through it, to every rebuilt step) when its
+    // successors are generated.
+    step &root = add_root_step();
+    const int root_num = root.step_num;
+    closed[step_contents(root.score, root.action_score, root.actions)] = root_num;
+
+    for(std::size_t i = 0; i < promotion_choices.size(); ++i)
+      {
+	choice_set choices;
+	for(typename std::vector<choice>::const_iterator it =
+	      promotion_choices[i].begin();
+	    it != promotion_choices[i].end(); ++it)
+	  choices.insert_or_narrow(*it);
+
+	add_promotion(promotion(choices, promotion_costs[i]));
+      }
+
+    boost::unordered_map<std::pair<int, choice>, int> replayed;
+
+    for(typename std::vector<std::vector<choice> >::const_iterator it =
+	  open_steps.begin(); it != open_steps.end(); ++it)
+      enqueue_step(graph.get_step(replay_checkpoint_path(root_num, *it, replayed)));
+
+    for(typename std::vector<std::vector<choice> >::const_iterator it =
+	  solutions.begin(); it != solutions.end(); ++it)
+      {
+	step &s(graph.get_step(replay_checkpoint_path(root_num, *it, replayed)));
+	if(s.unresolved_deps.empty())
+	  add_solution_step(s);
+	else
+	  {
+	    LOG_ERROR(logger, "The saved solution " << s.actions
+		      << " doesn't solve every dependency; queuing it as a partial solution.");
+	    enqueue_step(s);
+	  }
+      }
+
+    graph.run_scheduled_promotion_propagations(promotion_adder(*this));
+    process_pending_promotions();
+    update_counts_cache();
+
+    LOG_INFO(logger, "Resumed a search checkpoint with "
+	     << open_steps.size() << " open steps, "
+	     << solutions.size() << " solutions and "
+	     << promotion_choices.size() << " promotions.");
+
+    return true;
+  }
+
   void dump_scores(std::ostream &out)
   {
     out << "{" << std::endl;
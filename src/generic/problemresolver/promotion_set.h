@@ -21,6 +21,7 @@
 #define PROMOTION_SET_H
 
 #include <algorithm>
+#include <iterator>
 #include <list>
 #include <map>
 #include <set>
@@ -282,9 +283,20 @@ class promotion_set_callbacks
  *  the structure of choices (e.g., it indexes choices to break soft
  *  dependencies differently from choices to install versions).
  *
- *  Iterators on the promotion set are stable (erasing an iterator
- *  will of course invalidate it, but other iterators will still be
- *  valid).
+ *  Promotions are stored in a single vector and referred to by their
+ *  index in it.  The index of each choice is a sorted list of the IDs
+ *  of the promotions that contain it, so the promotions matched by a
+ *  set of choices are found by merging the lists for its elements and
+ *  counting how often each ID occurs, or (when looking for supersets)
+ *  by intersecting the lists.  Queries keep their counts in local
+ *  storage rather than in the stored promotions, so they don't modify
+ *  the set and any number of threads can run them at once, as long as
+ *  nothing is inserted or erased in the meantime.
+ *
+ *  Erasing an iterator will of course invalidate it, but other
+ *  iterators remain valid.  Inserting a promotion may invalidate all
+ *  iterators, because the storage of erased promotions is reclaimed
+ *  at that point.
  *
  *  \sa generic_choice, generic_choice_set
  */
@@ -304,64 +316,26 @@ private:
   logging::LoggerPtr logger;
   promotion_set_callbacks<PackageUniverse> &callbacks;
 
-  struct entry;
-
-  /** \brief The structure used to store information about
-   *  a promotion.
-   */
-  struct entry
-  {
-    promotion p;
-
-    /** \brief An expression that will retract this entry when it
-     *  becomes true.
-     *
-     *  Stored via a ref_ptr and not as a member partly because
-     *  otherwise I'd need a nasty hack to avoid circular references,
-     *  and partly because currently most promotions don't have a
-     *  validity condition, so this lets us save some space (by
-     *  storing NULL for most promotions).
-     */
-    cwidget::util::ref_ptr<expression<bool> > retraction_expression;
+  /** \brief The position of a promotion in the entries vector. */
+  typedef unsigned int entry_id;
 
-    /** \brief Used when searching for a promotion.
-     *
-     *  True if this was touched by the current search.
-     *
-     *  Never copied when entries are copied.
-     */
-    mutable bool active : 1;
+  /** \brief The ID stored in end iterators. */
+  static const entry_id no_entry = static_cast<entry_id>(-1);
 
-    /** \brief Used when searching for a promotion.
-     *
-     *  Never copied when entries are copied.
-     */
-    mutable unsigned int hit_count : (8*(sizeof(int))-1);
-
-    entry(const promotion &_p)
-      : p(_p),
-	retraction_expression(),
-	active(false),
-	hit_count(0)
-    {
-    }
-  };
-
-  typedef std::list<entry> entries_holder;
-  typedef typename entries_holder::const_iterator entry_const_ref;
-  typedef typename entries_holder::iterator entry_ref;
+  /** \brief A list of entry IDs in increasing order. */
+  typedef std::vector<entry_id> posting_list;
 
   /** \brief An expression that ejects a promotion from its parent set
    *  when that promotion becomes invalid.
    */
   class eject_promotion_when_invalid : public expression_wrapper<bool>
   {
-    entry_ref entry_to_drop;
+    entry_id entry_to_drop;
     generic_promotion_set *parent;
 
     eject_promotion_when_invalid(const cwidget::util::ref_ptr<expression<bool> > &
 				 promotion_valid_expression,
-				 const entry_ref &_entry_to_drop,
+				 entry_id _entry_to_drop,
 				 generic_promotion_set *_parent)
       : expression_wrapper<bool>(promotion_valid_expression),
 	entry_to_drop(_entry_to_drop),
@@ -373,7 +347,7 @@ private:
   public:
     static cwidget::util::ref_ptr<eject_promotion_when_invalid>
     create(const cwidget::util::ref_ptr<expression<bool> > &promotion_valid_expression,
-	   const entry_ref &entry_to_drop,
+	   entry_id entry_to_drop,
 	   generic_promotion_set *parent)
     {
       return new eject_promotion_when_invalid(promotion_valid_expression,
@@ -381,6 +355,14 @@ private:
 					      parent);
     }
 
+    /** \brief Update the entry to drop after the entries of the
+     *  parent set were renumbered.
+     */
+    void set_entry_to_drop(entry_id new_entry_to_drop)
+    {
+      entry_to_drop = new_entry_to_drop;
+    }
+
     void dump(std::ostream &out)
     {
       out << "drop-if(" << get_child() << ")";
@@ -405,8 +387,48 @@ private:
     }
   };
 
-  /** \brief Stores the promotions that exist. */
-  entries_holder entries;
+  /** \brief The structure used to store information about
+   *  a promotion.
+   */
+  struct entry
+  {
+    promotion p;
+
+    /** \brief An expression that will retract this entry when it
+     *  becomes true.
+     *
+     *  Stored via a ref_ptr and not as a member partly because
+     *  otherwise I'd need a nasty hack to avoid circular references,
+     *  and partly because currently most promotions don't have a
+     *  validity condition, so this lets us save some space (by
+     *  storing NULL for most promotions).
+     */
+    cwidget::util::ref_ptr<eject_promotion_when_invalid> retraction_expression;
+
+    /** \brief \b false if this promotion was erased and its slot
+     *  hasn't been reclaimed yet.
+     */
+    bool live;
+
+    entry(const promotion &_p)
+      : p(_p),
+	retraction_expression(),
+	live(true)
+    {
+    }
+  };
+
+  /** \brief Stores the promotions that exist, in the order in which
+   *  they were inserted.
+   *
+   *  Erased promotions leave a dead slot behind so that the IDs of
+   *  the other promotions don't change; the dead slots are squeezed
+   *  out by compact() once they outnumber the live ones.
+   */
+  std::vector<entry> entries;
+
+  /** \brief The number of live entries. */
+  unsigned int num_live_entries;
 
   // The number of promotions that would produce a conflict.  Used
   // only for the sake of display.
@@ -414,16 +436,14 @@ private:
 
   /** \brief An entry in the index related to install_version entries.
    *
-   *  This stores the choice that generated this index entry (used for
-   *  quick comparisons), as well as a reference to the entry object
-   *  in one of the main entry lists.
+   *  This stores the IDs of the entries in which the version appears.
    */
   struct install_version_index_entry
   {
     /** \brief The entries that contain this version, not installed
      *  from the dependency source.
      */
-    std::vector<entry_ref> not_from_dep_source_entries;
+    posting_list not_from_dep_source_entries;
 
     /** \brief The entries that contain this version installed from
      *  the dependency source, indexed by the dependency they solved.
@@ -440,7 +460,7 @@ private:
      *  should be a win, since the promotion set is a read-mostly
      *  structure.
      */
-    boost::unordered_map<dep, std::vector<entry_ref> > from_dep_source_entries;
+    boost::unordered_map<dep, posting_list> from_dep_source_entries;
   };
 
   /** \brief The version count used to set up the internal index. */
@@ -465,7 +485,7 @@ private:
 
   // The index for break_soft_dep choices is (conceptually) just a map
   // that takes a dependency to a list of the entries that contain it.
-  typedef std::vector<entry_ref> break_soft_dep_index_entry;
+  typedef posting_list break_soft_dep_index_entry;
 
   // And in fact, that's also what it actually is.  We don't use an
   // array here because there are lots of dependencies (e.g., around
@@ -477,6 +497,14 @@ private:
   // understand the cost/benefit tradeoffs to using one.
   boost::unordered_map<dep, break_soft_dep_index_entry> break_soft_dep_index;
 
+  /** \brief Remove an ID from a posting list. */
+  static void drop_from_posting_list(posting_list &entries,
+				     entry_id victim)
+  {
+    auto found = std::equal_range(entries.begin(), entries.end(), victim);
+    entries.erase(found.first, found.second);
+  }
+
   // Used to drop backpointers to an entry, one choice at a time.  Not
   // as efficient as the bulk operations below, but more general.
   class drop_choice
@@ -484,19 +512,12 @@ private:
     install_version_index_entry **install_version_index;
     boost::unordered_map<dep, break_soft_dep_index_entry> &break_soft_dep_index;
     // The entry being removed.
-    entry_ref victim;
-
-    static void do_drop(std::vector<entry_ref> &entries,
-			const entry_ref &victim)
-    {
-      auto new_end = std::remove(entries.begin(), entries.end(), victim);
-      entries.erase(new_end, entries.end());
-    }
+    entry_id victim;
 
   public:
     drop_choice(install_version_index_entry **_install_version_index,
 		boost::unordered_map<dep, break_soft_dep_index_entry> &_break_soft_dep_index,
-		const entry_ref &_victim)
+		entry_id _victim)
       : install_version_index(_install_version_index),
 	break_soft_dep_index(_break_soft_dep_index),
 	victim(_victim)
@@ -515,17 +536,17 @@ private:
 	      {
 		if(!c.get_from_dep_source())
 		  {
-		    do_drop(index_entry->not_from_dep_source_entries, victim);
+		    drop_from_posting_list(index_entry->not_from_dep_source_entries, victim);
 		    for(auto it = index_entry->from_dep_source_entries.begin();
 			it != index_entry->from_dep_source_entries.end();
 			++it)
-		      do_drop(it->second, victim);
+		      drop_from_posting_list(it->second, victim);
 		  }
 		else
 		  {
 		    const auto found = index_entry->from_dep_source_entries.find(c.get_dep());
 		    if(found != index_entry->from_dep_source_entries.end())
-		      do_drop(found->second, victim);
+		      drop_from_posting_list(found->second, victim);
 		  }
 	      }
 	  }
@@ -535,7 +556,7 @@ private:
 	  {
 	    const auto found = break_soft_dep_index.find(c.get_dep());
 	    if(found != break_soft_dep_index.end())
-	      do_drop(found->second, victim);
+	      drop_from_posting_list(found->second, victim);
 	  }
 	  break;
 	}
@@ -544,92 +565,170 @@ private:
     }
   };
 
-  void eject(const entry_ref &victim)
+  void eject(entry_id victim)
   {
-    promotion p(victim->p);
+    promotion p(entries[victim].p);
 
-    erase(iterator(victim));
+    erase(iterator(this, victim));
     callbacks.promotion_retracted(p);
   }
 
+  /** \brief Mark an entry as dead, releasing its promotion. */
+  void kill_entry(entry_id victim)
+  {
+    entry &e(entries[victim]);
+
+    if(e.p.get_cost().get_structural_level() >= cost_limits::conflict_structural_level)
+      --num_conflicts;
+
+    e.p = promotion();
+    e.retraction_expression = cwidget::util::ref_ptr<eject_promotion_when_invalid>();
+    e.live = false;
+    --num_live_entries;
+  }
+
+  /** \brief Replace each ID in a posting list by its new value. */
+  static void renumber_posting_list(posting_list &entries,
+				    const std::vector<entry_id> &new_ids)
+  {
+    for(auto it = entries.begin(); it != entries.end(); ++it)
+      *it = new_ids[*it];
+  }
+
+  /** \brief Squeeze the dead slots out of the entries vector.
+   *
+   *  The live entries keep their relative order, so the posting lists
+   *  stay sorted when they are renumbered.
+   */
+  void compact()
+  {
+    LOG_DEBUG(logger, "Compacting the promotion set: dropping "
+	      << entries.size() - num_live_entries << " dead entries.");
+
+    std::vector<entry_id> new_ids(entries.size(), 0);
+    entry_id next_id = 0;
+    for(entry_id id = 0; id < entries.size(); ++id)
+      if(entries[id].live)
+	{
+	  new_ids[id] = next_id;
+	  if(next_id != id)
+	    entries[next_id] = entries[id];
+	  if(entries[next_id].retraction_expression.valid())
+	    entries[next_id].retraction_expression->set_entry_to_drop(next_id);
+	  ++next_id;
+	}
+    entries.erase(entries.begin() + next_id, entries.end());
+
+    for(int i = 0; i < num_versions; ++i)
+      {
+	install_version_index_entry *index_entry = install_version_index[i];
+	if(index_entry != NULL)
+	  {
+	    renumber_posting_list(index_entry->not_from_dep_source_entries, new_ids);
+	    for(auto it = index_entry->from_dep_source_entries.begin();
+		it != index_entry->from_dep_source_entries.end(); ++it)
+	      renumber_posting_list(it->second, new_ids);
+	  }
+      }
+
+    for(auto it = break_soft_dep_index.begin(); it != break_soft_dep_index.end(); ++it)
+      renumber_posting_list(it->second, new_ids);
+  }
+
 public:
   typedef unsigned int size_type;
-  size_type size() const { return entries.size(); }
+  size_type size() const { return num_live_entries; }
   size_type conflicts_size() const { return num_conflicts; }
 
 private:
   // The iterators on this set hide the entry objects and other
   // metadata, returning only the promotions.
-  template<typename entry_iter>
+  template<typename Parent>
   class iterator_base
   {
-    entry_iter entry_it;
+    Parent *parent;
+    entry_id id;
 
     friend class generic_promotion_set;
+    template<typename OtherParent> friend class iterator_base;
 
-    // This overload is used for non-end iterators.
-    iterator_base(entry_iter _entry_it)
-      : entry_it(_entry_it)
+    // Skip the dead entries starting at the current one.  Iterators
+    // that run off the end all hold no_entry, so that end() stays
+    // the same when entries are added.
+    void settle()
     {
+      while(id < parent->entries.size() && !parent->entries[id].live)
+	++id;
+
+      if(id >= parent->entries.size())
+	id = no_entry;
+    }
+
+    iterator_base(Parent *_parent, entry_id _id)
+      : parent(_parent), id(_id)
+    {
+      settle();
     }
 
   public:
     iterator_base()
+      : parent(NULL), id(no_entry)
     {
     }
 
     const promotion &operator*() const
     {
-      return entry_it->p;
+      return parent->entries[id].p;
     }
 
     const promotion *operator->() const
     {
-      return &entry_it->p;
+      return &parent->entries[id].p;
     }
 
     iterator_base &operator++()
     {
-      ++entry_it;
+      ++id;
+      settle();
       return *this;
     }
 
-    template<typename other_entry_iter>
-    bool operator==(const iterator_base<other_entry_iter> &other) const
+    template<typename OtherParent>
+    bool operator==(const iterator_base<OtherParent> &other) const
     {
-      return entry_it == other.entry_it;
+      return id == other.id;
     }
 
-    template<typename other_entry_iter>
-    bool operator!=(const iterator_base<other_entry_iter> &other) const
+    template<typename OtherParent>
+    bool operator!=(const iterator_base<OtherParent> &other) const
     {
-      return entry_it != other.entry_it;
+      return id != other.id;
     }
   };
 
 public:
-  typedef iterator_base<typename entries_holder::const_iterator> const_iterator;
+  typedef iterator_base<const generic_promotion_set> const_iterator;
 
-  typedef iterator_base<typename entries_holder::iterator> iterator;
+  typedef iterator_base<generic_promotion_set> iterator;
 
   const_iterator begin() const
   {
-    return const_iterator(entries.begin());
+    return const_iterator(this, 0);
   }
 
   iterator begin()
   {
-    return iterator(entries.begin());
+    return iterator(this, 0);
   }
 
   const_iterator end() const
   {
-    return const_iterator(entries.end());
+    return const_iterator(this, no_entry);
   }
 
   iterator end()
   {
-    return iterator(entries.end());
+    return iterator(this, no_entry);
   }
 
   void erase(const iterator &victim)
@@ -646,9 +745,9 @@ public:
 	LOG_TRACE(logger, "Ejecting promotion: " << p);
 	p.get_choices().for_each(drop_choice(install_version_index,
 					     break_soft_dep_index,
-					     victim.entry_it));
+					     victim.id));
 
-	entries.erase(victim.entry_it);
+	kill_entry(victim.id);
       }
   }
 
@@ -656,7 +755,7 @@ private:
   /** \brief Find the list of index entries associated with the given
    *  choice, or NULL if it is not indexed.
    */
-  const std::vector<entry_ref> *find_index_list(const choice &c) const
+  const posting_list *find_index_list(const choice &c) const
   {
     switch(c.get_type())
       {
@@ -734,8 +833,8 @@ private:
       }
   }
 
-  /** \brief Apply an operation to each entry that matches the input
-   * set.
+  /** \brief Collect the index lists of the entries that match each
+   *  element of the input set.
    *
    *  The one catch here is that this isn't a simple subset relation.
    *  We look for sets where the value stored in the promotion
@@ -753,62 +852,37 @@ private:
    *  regardless of whether the search node's version is from a
    *  dependency source.
    *
-   *  This function is used when traversing a set of choices to find a
-   *  sub- or super-set of a collection of choices.  It is not a
-   *  generic traversal function.  In particular, it will abort early
-   *  if it detects that there will never be any matching promotions.
-   *  (if we're trying to find supersets of an input set and one
-   *  element is not matched by anything, we can abort immediately)
+   *  The index lists are built so that the list for a choice holds
+   *  every entry containing a choice that contains it; see
+   *  install_version_index_entry.
    *
-   *  The only reason this is generalized is because we use a two pass
-   *  algorithm.  In the first pass, we count how many times we
-   *  "touch" each entry; in the second pass, we find matching entries
-   *  according to the output rule and zero out all the counts we set
-   *  in the first pass.  Using a generic traversal function means
-   *  that the traversal logic is automatically the same in both
-   *  passes.  This also makes it easy to have different "readouts",
-   *  so (eg) most of the time we can just return "true, it matched"
-   *  or "false, it didn't match", but if we're trying to throw out
-   *  conflicts that are redundant with something we inserted, we'll
-   *  instead build up a list of the matching conflicts.
+   *  This will abort early if it detects that there will never be any
+   *  matching promotions (if we're trying to find supersets of an
+   *  input set and one element is not matched by anything, we can
+   *  abort immediately).
    */
-  template<typename Op>
-  struct traverse_intersections
+  struct collect_posting_lists
   {
     const generic_promotion_set &parent;
     // If \b true, we are looking for a subset of the input.  If \b
-    // false, we are looking for a superset.  This affects how we
-    // compare choices when they are not identical, but one is a
-    // "subset" of the other.
+    // false, we are looking for a superset, and stop when a choice
+    // has no index list.
     bool subset_mode;
-    Op op;
+    std::vector<const posting_list *> &output;
 
   public:
-    traverse_intersections(const generic_promotion_set &_parent,
-			   bool _subset_mode,
-			   const Op &_op)
+    collect_posting_lists(const generic_promotion_set &_parent,
+			  bool _subset_mode,
+			  std::vector<const posting_list *> &_output)
       : parent(_parent),
 	subset_mode(_subset_mode),
-	op(_op)
+	output(_output)
     {
     }
 
-    /** \brief Extract the operation.
-     *
-     *  Useful for operations that accumulate information in the
-     *  operation structure.
-     */
-    const Op &get_op() const { return op; }
-
-    /** \brief For all the entries in this structure containing a
-     *  choice that contains (if subset_mode is true) or that is
-     *  contained by (if subset_mode is false) the choice c, increment
-     *  the overlap count stored in the entry.
-     */
     bool operator()(const choice &c) const
     {
-      // The list of entries that we need to operate on.
-      const std::vector<entry_ref> *entries = parent.find_index_list(c);
+      const posting_list *entries = parent.find_index_list(c);
 
       if(entries == NULL || entries->empty())
 	{
@@ -817,7 +891,7 @@ private:
 	  // superset of the input set.
 	  if(!subset_mode)
 	    {
-	      LOG_DEBUG(parent.logger, "traverse_intersections: breaking out of set traversal at "
+	      LOG_DEBUG(parent.logger, "collect_posting_lists: breaking out of set traversal at "
 			<< c << " because nothing matches it and we are looking for a superset.");
 	      return false;
 	    }
@@ -826,56 +900,151 @@ private:
 	}
       else
 	{
-	  for(auto it = entries->cbegin(); it != entries->cend(); ++it)
-	    if(!op(*it))
-	      return false;
-
+	  output.push_back(entries);
 	  return true;
 	}
     }
   };
 
-  // Sets visited entries to be active, and increments their hit
-  // counts.
-  struct increment_entry_count_op
+  /** \brief The unread part of a posting list that is being merged. */
+  struct posting_cursor
   {
-    logging::LoggerPtr logger;
+    const entry_id *pos;
+    const entry_id *end;
 
-    increment_entry_count_op(const logging::LoggerPtr &_logger)
-      : logger(_logger)
+    posting_cursor(const posting_list &l)
+      : pos(l.data()), end(l.data() + l.size())
     {
     }
+  };
 
-    bool operator()(entry_ref r) const
+  /** \brief Orders posting cursors so that the one with the smallest
+   *  next ID is at the top of a heap.
+   */
+  struct posting_cursor_greater
+  {
+    bool operator()(const posting_cursor &c1, const posting_cursor &c2) const
     {
-      LOG_TRACE(logger, "increment_entry_count: incrementing the hit count for " << r->p);
-      r->active = true;
-      ++r->hit_count;
-
-      return true;
+      return *c1.pos > *c2.pos;
     }
   };
 
-  // To find a subset of an input set S, we find an entry that is hit
-  // by S exactly as many times as it has elements.  This works
-  // because we assume that it's impossible for an element of S to hit
-  // two distinct elements (no two choices in a search node can match
-  // each other).
-  //
+  /** \brief Count how often each entry occurs in a collection of
+   *  posting lists.
+   *
+   *  The lists are merged with a heap of cursors, so each entry that
+   *  occurs in any of them is visited exactly once, in increasing
+   *  order of ID, along with the number of lists that hold it.
+   *
+   *  To find a subset of an input set S, we look for an entry that
+   *  is hit by S exactly as many times as it has elements.  This
+   *  works because we assume that it's impossible for an element of S
+   *  to hit two distinct elements (no two choices in a search node
+   *  can match each other).
+   *
+   *  \param lists  The lists to merge.
+   *  \param op     A function object invoked as op(e, hits) for each
+   *                entry e that occurs in the lists.
+   */
+  template<typename Op>
+  void count_hits(const std::vector<const posting_list *> &lists,
+		  Op &op) const
+  {
+    std::vector<posting_cursor> heap;
+    heap.reserve(lists.size());
+    for(auto it = lists.begin(); it != lists.end(); ++it)
+      if(!(*it)->empty())
+	heap.push_back(posting_cursor(**it));
+
+    const posting_cursor_greater greater;
+    std::make_heap(heap.begin(), heap.end(), greater);
+
+    while(!heap.empty())
+      {
+	const entry_id id = *heap.front().pos;
+	unsigned int hits = 0;
+
+	do
+	  {
+	    std::pop_heap(heap.begin(), heap.end(), greater);
+	    posting_cursor &cursor(heap.back());
+	    while(cursor.pos != cursor.end && *cursor.pos == id)
+	      {
+		++hits;
+		++cursor.pos;
+	      }
+
+	    if(cursor.pos == cursor.end)
+	      heap.pop_back();
+	    else
+	      std::push_heap(heap.begin(), heap.end(), greater);
+	  } while(!heap.empty() && *heap.front().pos == id);
+
+	op(entries[id], hits);
+      }
+  }
+
+  /** \brief Compute the entries that occur in every one of a
+   *  collection of posting lists.
+   *
+   *  \param lists   The lists to intersect; must not be empty.  They
+   *                 are reordered by length.
+   *  \param output  A list in which to store the IDs of the entries
+   *                 that occur in every list, in increasing order.
+   */
+  static void intersect_posting_lists(std::vector<const posting_list *> &lists,
+				      posting_list &output)
+  {
+    // Start from the shortest list, so that there are as few
+    // candidates as possible from the outset.
+    std::sort(lists.begin(), lists.end(),
+	      [](const posting_list *l1, const posting_list *l2)
+	      {
+		return l1->size() < l2->size();
+	      });
+
+    output = *lists.front();
+    posting_list tmp;
+    for(auto it = lists.begin() + 1; it != lists.end() && !output.empty(); ++it)
+      {
+	const posting_list &other(**it);
+	tmp.clear();
+
+	// If the other list is much longer than the candidate list,
+	// look each candidate up instead of walking the whole list.
+	if(other.size() / 16 > output.size())
+	  {
+	    auto lower = other.begin();
+	    for(auto out_it = output.begin(); out_it != output.end(); ++out_it)
+	      {
+		lower = std::lower_bound(lower, other.end(), *out_it);
+		if(lower == other.end())
+		  break;
+		else if(*lower == *out_it)
+		  tmp.push_back(*out_it);
+	      }
+	  }
+	else
+	  std::set_intersection(output.begin(), output.end(),
+				other.begin(), other.end(),
+				std::back_inserter(tmp));
+
+	output.swap(tmp);
+      }
+  }
+
   // This computes the upper bound of all the elements that were
   // matched.  We don't return all elements because we don't need to
   // (this represents testing whether a set matches an existing
-  // promotion).  NB: the only reason for returning a promotion
-  // pointer rather than a boolean is so that we can provide
-  // diagnostic logging.
+  // promotion).
   class find_entry_subset_op
   {
     // A collection of conditions under which the returned promotion
     // is true.  Each intersected promotion's validity condition is
     // thrown in here.
-    mutable std::vector<cwidget::util::ref_ptr<expression<bool> > > rval_valid_conditions;
+    std::vector<cwidget::util::ref_ptr<expression<bool> > > rval_valid_conditions;
     // The cost to return.
-    mutable cost rval_cost;
+    cost rval_cost;
 
     logging::LoggerPtr logger;
 
@@ -895,127 +1064,32 @@ private:
       return rval_cost;
     }
 
-    bool operator()(entry_ref r) const
+    void operator()(const entry &e, unsigned int hits)
     {
-      if(r->active)
+      if(hits == e.p.get_choices().size())
 	{
-	  if(r->hit_count == r->p.get_choices().size())
+	  if(e.p.get_cost().is_above_or_equal(rval_cost))
 	    {
-	      if(r->p.get_cost().is_above_or_equal(rval_cost))
-		{
-		  cost new_cost =
-		    cost::least_upper_bound(r->p.get_cost(), rval_cost);
-
-		  LOG_DEBUG(logger, "find_entry_subset_op: resetting the hit count for "
-			    << r->p << " to 0 and incorporating it into the result (return value: "
-			    << rval_cost << " -> " << new_cost);
-
-		  rval_cost = new_cost;
-		  rval_valid_conditions.push_back(r->p.get_valid_condition());
-		}
-	      else
-		LOG_TRACE(logger, "find_entry_subset_op: resetting the hit count for "
-			  << r->p << " to 0, but not incorporating it into the result, because its cost "
-			  << r->p.get_cost() << " is lower than the current highest cost "
-			  << rval_cost);
-	    }
-	  else
-	    LOG_TRACE(logger, "find_entry_subset_op: " << r->p
-		      << " is not matched (needed " << r->p.get_choices().size()
-		      << " hits, but got only " << r->hit_count);
-
-	  r->active = false;
-	  r->hit_count = 0;
-	}
-      else
-	// Note that if the hit-count is 0, we must have already
-	// processed this entry.
-	LOG_TRACE(logger, "find_entry_subset_op: skipping already processed promotion " << r->p);
-
-      return true;
-    }
-  };
-
-  /** \brief Retrieve all the supersets of the input set: entries
-   *  whose trigger sets are supersets of the input promotion, and
-   *  whose costs are less than or equal to the input set's
-   *  cost (bearing mind that costs are only
-   *  partially ordered).
-   *
-   *  As a side effect, resets all hit counts to 0.
-   *
-   *  This is used to purge redundant entries when a new entry is
-   *  inserted.
-   */
-  class find_entry_supersets_op
-  {
-    // Where to store the output entry references.
-    std::vector<entry_ref> &output_entries;
-    // How many hits to require from each entry we process.
-    unsigned int required_hits;
-    // costs smaller than or equal to this limit are not
-    // returned:
-    cost maximum_cost;
-    logging::LoggerPtr logger;
+	      cost new_cost =
+		cost::least_upper_bound(e.p.get_cost(), rval_cost);
 
-  public:
-    /** \brief Create a find-supersets operation.
-     *
-     *  \param _output_entries   The location in which to place the
-     *                           supersets that are found.
-     *  \param _required_hits    The number of elements in the set
-     *                           that we are searching for supersets
-     *                           of; only entries with this many hits
-     *                           are returned.
-     *  \param _maximum_cost     The maximum cost to examine; only entries
-     *                           with this cost or lower are returned.
-     *  \param _logger           The logger to use to write messages
-     *                           about this process.
-     */
-    find_entry_supersets_op(std::vector<entry_ref> &_output_entries,
-			    unsigned int _required_hits,
-			    const cost &_maximum_cost,
-			    const logging::LoggerPtr &_logger)
-      : output_entries(_output_entries),
-	required_hits(_required_hits),
-	maximum_cost(_maximum_cost),
-	logger(_logger)
-    {
-    }
+	      LOG_DEBUG(logger, "find_entry_subset_op: incorporating "
+			<< e.p << " into the result (return value: "
+			<< rval_cost << " -> " << new_cost);
 
-    bool operator()(entry_ref r) const
-    {
-      if(r->active)
-	{
-	  if(cost::greatest_lower_bound(maximum_cost,
-						  r->p.get_cost()) != r->p.get_cost())
-	    {
-	      LOG_DEBUG(logger, "find_entry_supersets_op: resetting the hit count for "
-		       << r->p << " to 0, but not returning it, because its cost "
-		       << r->p.get_cost() << " is not below the maximum cost "
-		       << maximum_cost);
-	    }
-	  else if(r->hit_count == required_hits)
-	    {
-	      LOG_DEBUG(logger, "find_entry_supersets_op: resetting the hit count for " << r->p << " to 0 and adding it to the output list.");
-	      output_entries.push_back(r);
+	      rval_cost = new_cost;
+	      rval_valid_conditions.push_back(e.p.get_valid_condition());
 	    }
 	  else
-	    {
-	      if(r->hit_count > required_hits)
-		// Something is quite wrong if this happens.
-		LOG_ERROR(logger, "find_entry_supersets_op: resetting the hit count for " << r->p << " to 0, but not returning it: invalid hit count " << r->hit_count << " (expected maximum of " << required_hits << ")");
-	      else
-		LOG_TRACE(logger, "find_entry_supersets_op: resetting the hit count for " << r->p << " to 0, but not returning it: it only has " << r->hit_count << " hits (needed " << required_hits << ")");
-	    }
-
-	  r->active = false;
-	  r->hit_count = 0;
+	    LOG_TRACE(logger, "find_entry_subset_op: not incorporating "
+		      << e.p << " into the result, because its cost "
+		      << e.p.get_cost() << " is lower than the current highest cost "
+		      << rval_cost);
 	}
       else
-	LOG_TRACE(logger, "find_entry_supersets_op: skipping already processed promotion " << r->p);
-
-      return true;
+	LOG_TRACE(logger, "find_entry_subset_op: " << e.p
+		  << " is not matched (needed " << e.p.get_choices().size()
+		  << " hits, but got only " << hits);
     }
   };
 
@@ -1029,16 +1103,11 @@ public:
   {
     LOG_TRACE(logger, "Entering find_highest_promotion_cost(" << choices << ")");
 
-    traverse_intersections<increment_entry_count_op>
-      increment_f(*this, true, increment_entry_count_op(logger));
-    traverse_intersections<find_entry_subset_op>
-      find_result_f(*this, true, find_entry_subset_op(logger));
-    const find_entry_subset_op &find_result(find_result_f.get_op());
+    std::vector<const posting_list *> lists;
+    choices.for_each(collect_posting_lists(*this, true, lists));
 
-    choices.for_each(increment_f);
-    // We have to run this even if the increment aborted, since we
-    // need to reset all the counters to 0 for the next run.
-    choices.for_each(find_result_f);
+    find_entry_subset_op find_result(logger);
+    count_hits(lists, find_result);
 
     return find_result.get_rval_cost();
   }
@@ -1136,34 +1205,24 @@ public:
     {
     }
 
-    bool operator()(entry_ref r) const
+    void operator()(const entry &e, unsigned int hits) const
     {
-      if(r->active)
+      if(hits + 1 == e.p.get_choices().size())
 	{
-	  if((unsigned)r->hit_count + 1 == r->p.get_choices().size())
-	    {
-	      LOG_DEBUG(logger, "find_incipient_entry_subset_op: generating incipient output entries for " << r->p << " and resetting its hit count to 0.");
-	      update_incipient_output<T> updater(r->p, output_domain, output_incipient);
-	      r->p.get_choices().for_each(updater);
-	    }
-	  else if(r->hit_count == r->p.get_choices().size())
-	    {
-	      if(output_non_incipient.get_has_value())
-		output_non_incipient =
-		  promotion::least_upper_bound(output_non_incipient.get_value(), r->p);
-	      else
-		output_non_incipient = r->p;
-	    }
+	  LOG_DEBUG(logger, "find_incipient_entry_subset_op: generating incipient output entries for " << e.p << ".");
+	  update_incipient_output<T> updater(e.p, output_domain, output_incipient);
+	  e.p.get_choices().for_each(updater);
+	}
+      else if(hits == e.p.get_choices().size())
+	{
+	  if(output_non_incipient.get_has_value())
+	    output_non_incipient =
+	      promotion::least_upper_bound(output_non_incipient.get_value(), e.p);
 	  else
-	    LOG_DEBUG(logger, "find_incipient_entry_subset_op: " << r->p << " is not an incipient promotion; resetting its hit count to 0 and not returning it.");
-
-	  r->active = false;
-	  r->hit_count = 0;
+	    output_non_incipient = e.p;
 	}
       else
-	LOG_TRACE(logger, "find_incipient_entry_subset_op: skipping already processed promotion " << r->p);
-
-      return true;
+	LOG_DEBUG(logger, "find_incipient_entry_subset_op: " << e.p << " is not an incipient promotion; not returning it.");
     }
   };
 
@@ -1191,13 +1250,13 @@ public:
 
     bool operator()(const choice &c, const T &t) const
     {
-      const std::vector<entry_ref> *entries = promotions.find_index_list(c);
+      const posting_list *entries = promotions.find_index_list(c);
 
       if(entries != NULL)
 	{
 	  for(auto it = entries->cbegin(); it != entries->cend(); ++it)
 	    {
-	      const promotion &p((*it)->p);
+	      const promotion &p(promotions.entries[*it].p);
 
 	      if(p.get_choices().size() == 1)
 		{
@@ -1259,19 +1318,15 @@ public:
   {
     LOG_TRACE(logger, "Entering find_highest_incipient_promotions(" << choices << ", " << output_domain << ")");
 
-    traverse_intersections<increment_entry_count_op>
-      increment_f(*this, true, increment_entry_count_op(logger));
-    traverse_intersections<find_incipient_entry_subset_op<T> >
-      find_result_f(*this, true,
-		    find_incipient_entry_subset_op<T>(output_domain,
-						      output_incipient,
-						      output_non_incipient,
-						      logger));
+    std::vector<const posting_list *> lists;
+    choices.for_each(collect_posting_lists(*this, true, lists));
 
-    choices.for_each(increment_f);
-    // We have to run this even if the increment aborted, since we
-    // need to reset all the counters to 0 for the next run.
-    choices.for_each(find_result_f);
+    const find_incipient_entry_subset_op<T>
+      find_result(output_domain,
+		  output_incipient,
+		  output_non_incipient,
+		  logger);
+    count_hits(lists, find_result);
 
     // The above code won't find promotions that include only values
     // in the output domain.  Look for those by hand.
@@ -1451,7 +1506,7 @@ public:
   {
     LOG_TRACE(logger, "Entering find_highest_promotion_containing(" << choices << ", " << c << ")");
 
-    const std::vector<entry_ref> *index_entries = find_index_list(c);
+    const posting_list *index_entries = find_index_list(c);
 
     if(index_entries == NULL || index_entries->empty())
       {
@@ -1487,7 +1542,7 @@ public:
 				  num_mismatches,
 				  contains_match);
 
-	    const promotion &p((*it)->p);
+	    const promotion &p(entries[*it].p);
 	    p.get_choices().for_each(all_choices_found_f);
 	    if(contains_match)
 	      {
@@ -1551,7 +1606,7 @@ public:
   {
     LOG_TRACE(logger, "Entering find_highest_incipient_promotions_containing(" << choices << ", " << c << ", " << output_domain << ")");
 
-    const std::vector<entry_ref> *index_entries = find_index_list(c);
+    const posting_list *index_entries = find_index_list(c);
 
     if(index_entries == NULL || index_entries->empty())
       {
@@ -1576,7 +1631,7 @@ public:
 
 	for(auto it = index_entries->cbegin(); it != index_entries->cend(); ++it)
 	  {
-	    const promotion &p((*it)->p);
+	    const promotion &p(entries[*it].p);
 
 	    LOG_TRACE(logger, "find_highest_incipient_promotion_containing: testing " << p << ".");
 
@@ -1614,23 +1669,43 @@ private:
    *  cost)
    *
    *  \param p      The promotion whose supersets should be returned.
-   *  \param output A vector in which to store the results.
+   *  \param output A list in which to store the IDs of the results,
+   *                in increasing order.
    */
   void find_superseded_entries(const promotion &p,
-			       std::vector<entry_ref> &output) const
+			       posting_list &output) const
   {
-    traverse_intersections<increment_entry_count_op>
-      increment_f(*this, false, increment_entry_count_op(logger));
-    traverse_intersections<find_entry_supersets_op>
-      find_results_f(*this, false,
-		     find_entry_supersets_op(output,
-					     p.get_choices().size(),
-					     p.get_cost(),
-					     logger));
-
     const choice_set &choices(p.get_choices());
-    choices.for_each(increment_f);
-    choices.for_each(find_results_f);
+    const cost &maximum_cost(p.get_cost());
+
+    // Every choice in the promotion must hit a superset of it, so
+    // the candidates are the entries that are in all the index lists.
+    std::vector<const posting_list *> lists;
+    if(!choices.for_each(collect_posting_lists(*this, false, lists)) ||
+       lists.empty())
+      return;
+
+    posting_list candidates;
+    intersect_posting_lists(lists, candidates);
+
+    for(auto it = candidates.begin(); it != candidates.end(); ++it)
+      {
+	const entry &e(entries[*it]);
+
+	// Costs that are not smaller than or equal to the new
+	// promotion's cost are not returned.
+	if(cost::greatest_lower_bound(maximum_cost,
+				      e.p.get_cost()) != e.p.get_cost())
+	  LOG_DEBUG(logger, "find_superseded_entries: not returning "
+		    << e.p << ", because its cost "
+		    << e.p.get_cost() << " is not below the maximum cost "
+		    << maximum_cost);
+	else
+	  {
+	    LOG_DEBUG(logger, "find_superseded_entries: adding " << e.p << " to the output list.");
+	    output.push_back(*it);
+	  }
+      }
   }
 
   /** \brief Collect the versions and soft dependencies related
@@ -1697,35 +1772,23 @@ private:
 						   logger));
   }
 
-  /** \brief Collect the versions and soft dependencies related to
-   *  each choice in a cost.
-   */
-  static void collect_indexers(const std::list<entry> &cost_entries,
-			       boost::unordered_set<version> &installed_versions,
-			       boost::unordered_set<dep> &broken_soft_deps,
-			       const logging::LoggerPtr &logger)
-  {
-    for(auto it = cost_entries.cbegin(); it != cost_entries.cend(); ++it)
-      collect_indexers(*it, installed_versions, broken_soft_deps, logger);
-  }
-
   /** \brief Drop entries from the given vector, using the given
    *  predicate to decide which ones to drop.
    */
   template<typename Pred>
-  static void erase_vector_entries(std::vector<entry_ref> &entries,
-				   const logging::LoggerPtr &logger,
-				   const Pred &pred)
+  void erase_vector_entries(posting_list &ids,
+			    const Pred &pred) const
   {
     if(logger->isEnabledFor(logging::TRACE_LEVEL))
       {
-	for(auto it = entries.cbegin(); it != entries.cend(); ++it)
+	for(auto it = ids.cbegin(); it != ids.cend(); ++it)
 	  if(pred(*it))
-	    LOG_TRACE(logger, "  Removing " << (*it)->p);
+	    LOG_TRACE(logger, "  Removing " << entries[*it].p);
       }
 
-    auto new_end = std::remove_if(entries.begin(), entries.end(), pred);
-    entries.erase(new_end, entries.end());
+    // remove_if is stable, so the list stays sorted.
+    auto new_end = std::remove_if(ids.begin(), ids.end(), pred);
+    ids.erase(new_end, ids.end());
   }
 
   /** \brief Remove all the promotion index entries for the given
@@ -1748,13 +1811,13 @@ private:
 	  {
 	    LOG_TRACE(logger, "Purging dead references from the index entries for " << *it << ":");
 	    erase_vector_entries(index_entry->not_from_dep_source_entries,
-				 logger, pred);
+				 pred);
 	    bool from_dep_source_map_empty = true;
 	    for(auto from_dep_source_it = index_entry->from_dep_source_entries.begin();
 		from_dep_source_it != index_entry->from_dep_source_entries.end();
 		++from_dep_source_it)
 	      {
-		erase_vector_entries(from_dep_source_it->second, logger, pred);
+		erase_vector_entries(from_dep_source_it->second, pred);
 		if(!from_dep_source_it->second.empty())
 		  from_dep_source_map_empty = false;
 	      }
@@ -1787,8 +1850,8 @@ private:
 	else
 	  {
 	    LOG_TRACE(logger, "Purging dead references from the index entries for " << *it << ":");
-	    std::vector<entry_ref> &index_entries = found->second;
-	    erase_vector_entries(index_entries, logger, pred);
+	    posting_list &index_entries = found->second;
+	    erase_vector_entries(index_entries, pred);
 
 	    if(index_entries.empty())
 	      {
@@ -1805,17 +1868,21 @@ private:
    */
   struct make_index_entries
   {
-    // A reference to the newly inserted promotion.
-    entry_ref new_entry;
+    // The ID of the newly inserted promotion.  It is larger than
+    // every other ID, so appending it keeps the index lists sorted.
+    entry_id new_entry;
+    const promotion &new_promotion;
     install_version_index_entry **install_version_index;
     boost::unordered_map<dep, break_soft_dep_index_entry> &break_soft_dep_index;
     logging::LoggerPtr logger;
 
-    make_index_entries(entry_ref _new_entry,
+    make_index_entries(entry_id _new_entry,
+		       const promotion &_new_promotion,
 		       install_version_index_entry **_install_version_index,
 		       boost::unordered_map<dep, break_soft_dep_index_entry> &_break_soft_dep_index,
 		       const logging::LoggerPtr &_logger)
       : new_entry(_new_entry),
+	new_promotion(_new_promotion),
 	install_version_index(_install_version_index),
 	break_soft_dep_index(_break_soft_dep_index),
 	logger(_logger)
@@ -1829,10 +1896,10 @@ private:
 	case choice::install_version:
 	  if(!c.get_from_dep_source())
 	    LOG_TRACE(logger, "Inserting an index entry: " << c.get_ver()
-		      << " |-> " << new_entry->p);
+		      << " |-> " << new_promotion);
 	  else
 	    LOG_TRACE(logger, "Inserting an index entry: " << c.get_ver()
-		      << "[" << c.get_dep() << "] |-> " << new_entry->p);
+		      << "[" << c.get_dep() << "] |-> " << new_promotion);
 	  {
 	    const int id = c.get_ver().get_id();
 	    install_version_index_entry *index_entry = install_version_index[id];
@@ -1862,7 +1929,7 @@ private:
 		if(found == index_entry->from_dep_source_entries.end())
 		  {
 		    LOG_DEBUG(logger, "Creating a new from-dep index cell for " << c.get_dep());
-		    found = index_entry->from_dep_source_entries.insert(found, std::make_pair(c.get_dep(), std::vector<entry_ref>()));
+		    found = index_entry->from_dep_source_entries.insert(found, std::make_pair(c.get_dep(), posting_list()));
 		    // Make sure the new cell contains all the entries
 		    // in the not-from-dep-source list.
 		    found->second.insert(found->second.end(),
@@ -1878,7 +1945,7 @@ private:
 
 	case choice::break_soft_dep:
 	  LOG_TRACE(logger, "Inserting an index entry: "
-		    << c.get_dep() << " |-> " << new_entry->p);
+		    << c.get_dep() << " |-> " << new_promotion);
 	  {
 	    const dep &d(c.get_dep());
 	    // We could just do a straightforward insertion, but doing
@@ -1906,21 +1973,21 @@ private:
     }
   };
 
-  /** \brief Predicate testing whether an entry reference is in 
-   *  a set of dropped entries.
+  /** \brief Predicate testing whether an entry ID is in a sorted
+   *  list of dropped entries.
    */
-  struct entry_ref_in_dropped_set_pred
+  struct entry_id_in_dropped_set_pred
   {
-    const boost::unordered_set<const entry *> &dropped_set;
+    const posting_list &dropped_set;
 
-    entry_ref_in_dropped_set_pred(const boost::unordered_set<const entry *> &_dropped_set)
+    entry_id_in_dropped_set_pred(const posting_list &_dropped_set)
       : dropped_set(_dropped_set)
     {
     }
 
-    bool operator()(entry_ref r) const
+    bool operator()(entry_id id) const
     {
-      return dropped_set.find(&*r) != dropped_set.end();
+      return std::binary_search(dropped_set.begin(), dropped_set.end(), id);
     }
   };
 
@@ -1957,7 +2024,7 @@ public:
       }
     else
       {
-	std::vector<entry_ref> superseded_entries;
+	posting_list superseded_entries;
 	find_superseded_entries(p, superseded_entries);
 
 	if(!superseded_entries.empty())
@@ -1968,19 +2035,10 @@ public:
 	  boost::unordered_set<dep> broken_soft_deps;
 
 	  for(auto it = superseded_entries.cbegin(); it != superseded_entries.cend(); ++it)
-	    collect_indexers(**it, installed_versions, broken_soft_deps, logger);
+	    collect_indexers(entries[*it], installed_versions, broken_soft_deps, logger);
 
 	  LOG_TRACE(logger, "Removing index entries associated with the superseded entries.");
-	  // Build a set of pointers that we'll use to figure out
-	  // which references-to-entries need to be dropped.
-	  //
-	  // Note: This relies on knowing that pointers to entries are
-	  // stable as long as we don't modify the lists that contain
-	  // them.
-	  boost::unordered_set<const entry *> superseded_entries_set;
-	  for(auto it = superseded_entries.cbegin(); it != superseded_entries.cend(); ++it)
-	    superseded_entries_set.insert(&**it);
-	  entry_ref_in_dropped_set_pred dropped_f(superseded_entries_set);
+	  entry_id_in_dropped_set_pred dropped_f(superseded_entries);
 	  drop_install_version_index_entries(installed_versions,
 					     dropped_f);
 	  drop_broken_soft_dep_index_entries(broken_soft_deps,
@@ -1990,30 +2048,33 @@ public:
 	LOG_TRACE(logger, "Removing the superseded entries themselves.");
 	for(auto it = superseded_entries.cbegin(); it != superseded_entries.cend(); ++it)
 	  {
-	    entry_ref ent(*it);
-	    LOG_TRACE(logger, "Removing " << ent->p);
-
-	    if(ent->p.get_cost().get_structural_level() >= cost_limits::conflict_structural_level)
-	      --num_conflicts;
-
-	    entries.erase(ent);
+	    LOG_TRACE(logger, "Removing " << entries[*it].p);
+	    kill_entry(*it);
           }
 
+	// Reclaim the slots of erased entries once they make up most
+	// of the vector.
+	const std::size_t num_dead_entries = entries.size() - num_live_entries;
+	if(num_dead_entries >= 64 && num_dead_entries > num_live_entries)
+	  compact();
+
 	LOG_TRACE(logger, "Inserting " << p);
 
-	// Insert the new entry into the list of entries in this cost.
-	const entry_ref new_entry =
-	  entries.insert(entries.end(), entry(p));
+	// Insert the new entry at the end of the list of entries.
+	const entry_id new_entry = entries.size();
+	entries.push_back(entry(p));
+	++num_live_entries;
 	if(p.get_cost().get_structural_level() >= cost_limits::conflict_structural_level)
 	  ++num_conflicts;
 
 	LOG_TRACE(logger, "Building index entries for " << p);
 	p.get_choices().for_each(make_index_entries(new_entry,
+						    entries[new_entry].p,
 						    install_version_index,
 						    break_soft_dep_index,
 						    logger));
 
-	return iterator(new_entry);
+	return iterator(this, new_entry);
       }
   }
 
@@ -2021,6 +2082,7 @@ public:
   void clear()
   {
     entries.clear();
+    num_live_entries = 0;
     break_soft_dep_index.clear();
     num_conflicts = 0;
     for(int i = 0; i < num_versions; ++i)
@@ -2034,6 +2096,7 @@ public:
 			promotion_set_callbacks<PackageUniverse> &_callbacks)
     : logger(aptitude::Loggers::getAptitudeResolverSearchCosts()),
       callbacks(_callbacks),
+      num_live_entries(0),
       num_conflicts(0),
       num_versions(u.get_version_count()),
       install_version_index(new install_version_index_entry*[num_versions])
@@ -34,6 +34,7 @@
 #include <generic/util/compare3.h>
 #include <generic/util/immlist.h>
 #include <generic/util/immset.h>
+#include <generic/util/node_pool.h>
 
 #include <boost/flyweight.hpp>
 #include <boost/flyweight/hashed_factory.hpp>
@@ -56,39 +57,14 @@ public:
   typedef generic_choice_set<PackageUniverse> choice_set;
 
 private:
-  class combine_reason_hashes
-  {
-    std::size_t &target;
-  public:
-    combine_reason_hashes(std::size_t &_target)
-      : target(_target)
-    {
-    }
-
-    bool operator()(const choice &c) const
-    {
-      boost::hash_combine(target, c);
-
-      return true;
-    }
-  };
-
   class choice_set_with_hash
   {
     choice_set choices;
     std::size_t hash;
 
-    static std::size_t get_choice_set_hash(const choice_set &choices)
-    {
-      std::size_t rval = 0;
-      choices.for_each(combine_reason_hashes(rval));
-
-      return rval;
-    }
-
   public:
     choice_set_with_hash(const choice_set &_choices)
-      : choices(_choices), hash(get_choice_set_hash(choices))
+      : choices(_choices), hash(_choices.get_hash())
     {
     }
 
@@ -582,6 +558,19 @@ public:
   {
   }
 
+  /** \brief Create a promotion queue entry with no successor link or
+   *  stored promotion.
+   *
+   *  The entry and its reference count are allocated from a pool:
+   *  every promotion adds an entry to the queue.
+   */
+  static std::shared_ptr<generic_promotion_queue_entry>
+  create(unsigned int action_sum, unsigned int index)
+  {
+    return std::allocate_shared<generic_promotion_queue_entry>(aptitude::util::node_pool_allocator<generic_promotion_queue_entry>(),
+							       action_sum, index);
+  }
+
   /** \brief Retrieve the sum of the number of actions in all previous
    *  promotions in the queue.
    */
@@ -603,7 +592,7 @@ public:
     // Check that we don't have any contents yet.
     eassert(!contents);
 
-    std::shared_ptr<generic_promotion_queue_entry> sp_gpqe = std::make_shared<generic_promotion_queue_entry>(generic_promotion_queue_entry(action_sum + p.get_choices().size(), index + 1));
+    std::shared_ptr<generic_promotion_queue_entry> sp_gpqe = create(action_sum + p.get_choices().size(), index + 1);
     contents = std::make_pair(p, sp_gpqe);
   }
 
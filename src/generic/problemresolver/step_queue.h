@@ -0,0 +1,424 @@
+/** \file step_queue.h */     // -*-c++-*-
+
+//   This program is free software; you can redistribute it and/or
+//   modify it under the terms of the GNU General Public License as
+//   published by the Free Software Foundation; either version 2 of
+//   the License, or (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//   General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program; see the file COPYING.  If not, write to
+//   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+//   Boston, MA 02110-1301, USA.
+
+#ifndef STEP_QUEUE_H
+#define STEP_QUEUE_H
+
+#include "cost.h"
+#include "search_graph.h"
+
+#include <cwidget/generic/util/eassert.h>
+
+#include <boost/functional/hash.hpp>
+#include <boost/unordered_map.hpp>
+
+#include <algorithm>
+#include <queue>
+#include <utility>
+#include <vector>
+
+/** \brief A priority queue of search steps, best step first.
+ *
+ *  Steps are ordered by their final cost (lowest first), then by
+ *  their score (highest first), then by their actions.  This is the
+ *  same order, and the queue has the same semantics, as a std::set
+ *  of step numbers sorted that way, which is what the resolver used
+ *  before: in particular, a step is not inserted if an equivalent
+ *  step (one with the same cost, score and actions) is already
+ *  present, and erasing a step erases any equivalent step.  So the
+ *  search visits steps in exactly the same order.
+ *
+ *  The queue is an indexed 4-ary heap.  Each entry holds a copy of
+ *  the step's cost and score, so most comparisons don't touch the
+ *  step itself; the actions are only compared to break ties.  The
+ *  position of each step in the heap is recorded, so a step whose
+ *  cost changes can be moved up or down in place (see update_cost()).
+ *  Equivalent steps are found through a hash of each step's score
+ *  and actions.
+ */
+template<typename PackageUniverse>
+class generic_step_queue
+{
+public:
+  typedef generic_search_graph<PackageUniverse> search_graph;
+  typedef typename search_graph::step step;
+  typedef generic_choice<PackageUniverse> choice;
+
+private:
+  static const std::size_t arity = 4;
+
+  struct entry
+  {
+    int step_num;
+    int score;
+    cost final_step_cost;
+    std::size_t hash;
+
+    entry(int _step_num, int _score, const cost &_final_step_cost,
+	  std::size_t _hash)
+      : step_num(_step_num), score(_score),
+	final_step_cost(_final_step_cost), hash(_hash)
+    {
+    }
+  };
+
+  const search_graph &graph;
+
+  std::vector<entry> heap;
+
+  // The index in the heap of each step, or -1 if it isn't in the
+  // queue; indexed by step number.
+  std::vector<int> positions;
+
+  // Maps the hash of each queued step's score and actions to its
+  // step number.
+  typedef boost::unordered_multimap<std::size_t, int> hash_index;
+  hash_index steps_by_hash;
+
+  static std::size_t get_hash(const step &s)
+  {
+    std::size_t rval = s.actions.get_hash();
+    boost::hash_combine(rval, s.score);
+    return rval;
+  }
+
+  /** \brief Return \b true if e1 should be processed before e2. */
+  bool before(const entry &e1, const entry &e2) const
+  {
+    if(e1.step_num == e2.step_num)
+      return false;
+
+    // Equal costs share a flyweight, so this skips the comparison in
+    // the common case.
+    const int cost_cmp =
+      e1.final_step_cost == e2.final_step_cost
+      ? 0 : e1.final_step_cost.compare(e2.final_step_cost);
+    if(cost_cmp != 0)
+      return cost_cmp < 0;
+    else if(e2.score < e1.score)
+      return true;
+    else if(e1.score < e2.score)
+      return false;
+    else
+      return graph.get_step(e2.step_num).actions < graph.get_step(e1.step_num).actions;
+  }
+
+  bool equivalent(const entry &e1, const entry &e2) const
+  {
+    return !before(e1, e2) && !before(e2, e1);
+  }
+
+  /** \brief Find a queued step equivalent to the given entry.
+   *
+   *  \param except  A step to ignore, or -1.
+   *
+   *  \return the step's number, or -1 if there is none.
+   */
+  int find_equivalent_except(const entry &e, int except) const
+  {
+    std::pair<typename hash_index::const_iterator,
+	      typename hash_index::const_iterator>
+      found(steps_by_hash.equal_range(e.hash));
+
+    for(typename hash_index::const_iterator it = found.first;
+	it != found.second; ++it)
+      if(it->second != except)
+	{
+	  const entry &other(heap[positions[it->second]]);
+	  if(equivalent(e, other))
+	    return it->second;
+	}
+
+    return -1;
+  }
+
+  int find_equivalent(const entry &e) const
+  {
+    return find_equivalent_except(e, -1);
+  }
+
+  void remove_from_index(const entry &e)
+  {
+    std::pair<typename hash_index::iterator,
+	      typename hash_index::iterator>
+      found(steps_by_hash.equal_range(e.hash));
+
+    for(typename hash_index::iterator it = found.first;
+	it != found.second; ++it)
+      if(it->second == e.step_num)
+	{
+	  steps_by_hash.erase(it);
+	  return;
+	}
+
+    eassert(!"A queued step is missing from the hash index.");
+  }
+
+  void place(std::size_t i, const entry &e)
+  {
+    heap[i] = e;
+    positions[e.step_num] = i;
+  }
+
+  void sift_up(std::size_t i)
+  {
+    const entry e(heap[i]);
+
+    while(i > 0)
+      {
+	const std::size_t parent = (i - 1) / arity;
+	if(!before(e, heap[parent]))
+	  break;
+
+	place(i, heap[parent]);
+	i = parent;
+      }
+
+    place(i, e);
+  }
+
+  void sift_down(std::size_t i)
+  {
+    const entry e(heap[i]);
+    const std::size_t size = heap.size();
+
+    while(true)
+      {
+	const std::size_t first_child = i * arity + 1;
+	if(first_child >= size)
+	  break;
+
+	const std::size_t last_child = std::min(first_child + arity, size);
+	std::size_t best = first_child;
+	for(std::size_t child = first_child + 1; child < last_child; ++child)
+	  if(before(heap[child], heap[best]))
+	    best = child;
+
+	if(!before(heap[best], e))
+	  break;
+
+	place(i, heap[best]);
+	i = best;
+      }
+
+    place(i, e);
+  }
+
+  /** \brief Remove the entry at the given heap index. */
+  void remove_at(std::size_t i)
+  {
+    const entry removed(heap[i]);
+    remove_from_index(removed);
+    positions[removed.step_num] = -1;
+
+    const entry last(heap.back());
+    heap.pop_back();
+
+    if(i < heap.size())
+      {
+	place(i, last);
+	if(i > 0 && before(last, heap[(i - 1) / arity]))
+	  sift_up(i);
+	else
+	  sift_down(i);
+      }
+  }
+
+  entry make_entry(int step_num) const
+  {
+    const step &s(graph.get_step(step_num));
+    return entry(step_num, s.score, s.final_step_cost, get_hash(s));
+  }
+
+  bool insert_entry(const entry &e)
+  {
+    if(find_equivalent(e) != -1)
+      return false;
+
+    if(positions.size() <= static_cast<std::size_t>(e.step_num))
+      positions.resize(e.step_num + 1, -1);
+
+    heap.push_back(e);
+    positions[e.step_num] = heap.size() - 1;
+    steps_by_hash.insert(std::make_pair(e.hash, e.step_num));
+    sift_up(heap.size() - 1);
+
+    return true;
+  }
+
+public:
+  explicit generic_step_queue(const search_graph &_graph)
+    : graph(_graph)
+  {
+  }
+
+  bool empty() const { return heap.empty(); }
+  std::size_t size() const { return heap.size(); }
+
+  /** \brief Return the number of the best step in the queue. */
+  int top() const
+  {
+    eassert(!heap.empty());
+    return heap.front().step_num;
+  }
+
+  /** \brief Remove the best step from the queue. */
+  void pop()
+  {
+    eassert(!heap.empty());
+    remove_at(0);
+  }
+
+  /** \brief Add a step to the queue.
+   *
+   *  \return \b false if an equivalent step was already queued, in
+   *  which case the step isn't added.
+   */
+  bool insert(int step_num)
+  {
+    return insert_entry(make_entry(step_num));
+  }
+
+  /** \brief Remove the step, or a step equivalent to it, from the
+   *  queue.
+   *
+   *  \return the number of steps that were removed (0 or 1).
+   */
+  std::size_t erase(int step_num)
+  {
+    const int equivalent = find_equivalent(make_entry(step_num));
+    if(equivalent == -1)
+      return 0;
+
+    remove_at(positions[equivalent]);
+    return 1;
+  }
+
+  /** \brief Change the cost of a step in the queue.
+   *
+   *  This must be called before the step's final_step_cost is
+   *  changed; it has the same effect as erasing the step, changing
+   *  its cost and inserting it again, but if the step itself is in
+   *  the queue it is moved to its new place without being removed.
+   *
+   *  \return \b true if the step or a step equivalent to it was in
+   *  the queue.
+   */
+  bool update_cost(int step_num, const cost &new_cost)
+  {
+    entry e(make_entry(step_num));
+    const int equivalent = find_equivalent(e);
+    if(equivalent == -1)
+      return false;
+
+    e.final_step_cost = new_cost;
+
+    if(equivalent != step_num)
+      {
+	remove_at(positions[equivalent]);
+	insert_entry(e);
+	return true;
+      }
+
+    const std::size_t pos = positions[step_num];
+    heap[pos].final_step_cost = new_cost;
+
+    // If the new cost makes the step equivalent to another queued
+    // step, reinserting it would have dropped it.
+    const int other = find_equivalent_except(e, step_num);
+    if(other != -1)
+      remove_at(pos);
+    else if(pos > 0 && before(e, heap[(pos - 1) / arity]))
+      sift_up(pos);
+    else
+      sift_down(pos);
+
+    return true;
+  }
+
+  /** \brief Remove every step from the queue. */
+  void clear()
+  {
+    heap.clear();
+    positions.clear();
+    steps_by_hash.clear();
+  }
+
+  /** \brief Visits the queued steps in order, best first.
+   *
+   *  Only the part of the heap that is visited is examined, so
+   *  looking at the first few steps is cheap.  The queue must not be
+   *  modified while it is being walked.
+   */
+  class ordered_walk
+  {
+    class index_compare
+    {
+      const generic_step_queue *queue;
+
+    public:
+      index_compare(const generic_step_queue *_queue)
+	: queue(_queue)
+      {
+      }
+
+      bool operator()(std::size_t i1, std::size_t i2) const
+      {
+	return queue->before(queue->heap[i2], queue->heap[i1]);
+      }
+    };
+
+    const generic_step_queue &queue;
+
+    // The heap indices whose parents were visited.
+    std::priority_queue<std::size_t, std::vector<std::size_t>, index_compare> frontier;
+
+  public:
+    explicit ordered_walk(const generic_step_queue &_queue)
+      : queue(_queue), frontier(index_compare(&_queue))
+    {
+      if(!queue.heap.empty())
+	frontier.push(0);
+    }
+
+    /** \brief Retrieve the next step.
+     *
+     *  \param step_num  Set to the number of the next step.
+     *
+     *  \return \b false if every step was visited.
+     */
+    bool next(int &step_num)
+    {
+      if(frontier.empty())
+	return false;
+
+      const std::size_t i = frontier.top();
+      frontier.pop();
+
+      step_num = queue.heap[i].step_num;
+
+      const std::size_t first_child = i * arity + 1;
+      const std::size_t last_child = std::min(first_child + arity, queue.heap.size());
+      for(std::size_t child = first_child; child < last_child; ++child)
+	frontier.push(child);
+
+      return true;
+    }
+  };
+};
+
+#endif // STEP_QUEUE_H
@@ -34,7 +34,10 @@
 #include <cwidget/generic/util/eassert.h>
 #include <cwidget/generic/util/ssprintf.h>
 
+#include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
 
 using namespace std;
 
@@ -307,9 +310,11 @@ int parse_int(const std::string &s)
   return rval;
 }
 
-void run_test_file(istream &f, bool show_world)
+// Returns the number of search steps that the resolver took.
+unsigned long run_test_file(istream &f, bool show_world, int num_threads)
 {
   dummy_universe_ref universe=NULL;
+  unsigned long num_steps=0;
 
   f >> ws;
 
@@ -319,7 +324,7 @@ void run_test_file(istream &f, bool show_world)
 
       if(f.eof())
 	// This is the only place where EOF is valid.
-	return;
+	return num_steps;
 
       f >> s >> ws;
 
@@ -401,6 +406,7 @@ void run_test_file(istream &f, bool show_world)
 				  universe);
 
 	  resolver.set_debug(true);
+	  resolver.set_threads(num_threads);
 
 	  read_scores(f, universe, resolver);
 
@@ -518,16 +524,22 @@ void run_test_file(istream &f, bool show_world)
 	      else
 		throw ParseError("Expected ANY or '<', got "+s);
 	    }
+
+	  num_steps += resolver.get_num_steps();
 	}
       else
 	throw ParseError("Expected UNIVERSE or TEST, got "+s);
     }
+
+  return num_steps;
 }
 
 int main(int argc, char **argv)
 {
   int rval=0;
   bool show_world=false;
+  bool show_stats=false;
+  int num_threads=1;
 
   for(int i=1; i<argc; ++i)
     {
@@ -538,6 +550,18 @@ int main(int argc, char **argv)
           continue;
         }
 
+      if(!strcmp(argv[i], "--stats"))
+	{
+	  show_stats=true;
+	  continue;
+	}
+
+      if(!strncmp(argv[i], "--threads=", 10))
+	{
+	  num_threads=atoi(argv[i]+10);
+	  continue;
+	}
+
       ifstream f(argv[i]);
 
       if(!f)
@@ -549,7 +573,19 @@ int main(int argc, char **argv)
       try
 	{
 	  f >> ws;
-	  run_test_file(f, show_world);
+
+	  timeval start, end;
+	  gettimeofday(&start, 0);
+	  const unsigned long num_steps = run_test_file(f, show_world, num_threads);
+	  gettimeofday(&end, 0);
+
+	  if(show_stats)
+	    {
+	      const double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+	      cerr << argv[i] << ": " << num_steps << " steps in "
+		   << elapsed << " seconds ("
+		   << (elapsed > 0 ? num_steps / elapsed : 0) << " steps/second)" << endl;
+	    }
 	}
       catch(const cwidget::util::Exception &e)
 	{
@@ -558,6 +594,13 @@ int main(int argc, char **argv)
 	}
     }
 
+  if(show_stats)
+    {
+      rusage usage;
+      if(getrusage(RUSAGE_SELF, &usage) == 0)
+	cerr << "Peak RSS: " << usage.ru_maxrss << " kB" << endl;
+    }
+
   return rval;
 }
 
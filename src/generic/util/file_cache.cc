@@ -17,6 +17,10 @@
 //   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
 //   Boston, MA 02110-1301, USA.
 
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
 #include "file_cache.h"
 
 #include "sqlite.h"
@@ -30,8 +34,12 @@
 
 #include <boost/format.hpp>
 #include <boost/iostreams/copy.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
 #include <boost/iostreams/device/file.hpp>
 #include <boost/iostreams/filter/gzip.hpp>
+#ifdef HAVE_BOOST_IOSTREAMS_FILTER_ZSTD_HPP
+#include <boost/iostreams/filter/zstd.hpp>
+#endif
 #include <boost/iostreams/filtering_stream.hpp>
 #include <boost/iostreams/invert.hpp>
 #include <boost/iostreams/operations.hpp>
@@ -42,7 +50,12 @@
 
 #include <loggers.h>
 
+#include <atomic>
+#include <functional>
+#include <list>
 #include <memory>
+#include <unordered_map>
+#include <vector>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -101,6 +114,159 @@ release upgrade23;							\
 
 	  store->exec(sql);
 	}
+
+	// Version 4 added the Codec column to the blobs table, which
+	// names the compression method of each blob.  All the blobs
+	// written by earlier versions were compressed with zlib.
+	void version_3_to_version_4(const std::shared_ptr<db> &store)
+	{
+	  LOG_INFO(Loggers::getAptitudeDownloadCache(),
+		   "Upgrading the cache from version 3 to version 4.");
+
+	  store->exec("savepoint upgrade34");
+
+	  std::shared_ptr<statement> get_version_statement =
+	    statement::prepare(*store, "select version from format");
+	  {
+	    statement::execution get_version_execution(*get_version_statement);
+	    if(!get_version_execution.step())
+	      throw FileCacheException("Can't read the cache version number.");
+	    else
+	      {
+		int database_version = get_version_statement->get_int(0);
+		if(database_version != 3)
+		  throw FileCacheException("Wrong database version number for this upgrade.");
+	      }
+	  }
+
+	  const char * const sql = "                                    \
+alter table blobs							\
+add column Codec  text  default 'zlib'  not null;			\
+									\
+update format								\
+set version = 4;							\
+									\
+release upgrade34;							\
+";
+
+	  store->exec(sql);
+	}
+      }
+
+      /** \brief Get the name under which a compression method is
+       *  stored in the Codec column of the blobs table.
+       */
+      const char *get_codec_name(file_cache::compression_method method)
+      {
+	switch(method)
+	  {
+	  case file_cache::compress_none:
+	    return "none";
+	  case file_cache::compress_zlib:
+	    return "zlib";
+	  case file_cache::compress_zstd:
+	    return "zstd";
+	  }
+
+	return "zlib";
+      }
+
+      /** \brief Clamp a compression level to the range that the
+       *  given method accepts.
+       *
+       *  The level is configured once for all the methods, so it
+       *  might be out of range for the one in use: zlib rejects
+       *  levels above 9, for instance.  0 (the default level of the
+       *  method) is returned unchanged.
+       */
+      int clamp_compression_level(file_cache::compression_method method,
+				  int level)
+      {
+	int max_level;
+	switch(method)
+	  {
+	  case file_cache::compress_zlib:
+	    max_level = 9;
+	    break;
+
+	  case file_cache::compress_zstd:
+	    // Higher levels need the "ultra" mode and a lot of memory.
+	    max_level = 19;
+	    break;
+
+	  case file_cache::compress_none:
+	  default:
+	    return 0;
+	  }
+
+	if(level < 0)
+	  return 1;
+	else if(level > max_level)
+	  return max_level;
+	else
+	  return level;
+      }
+
+      /** \brief Add a filter that compresses its input with the given
+       *  method to a stream.
+       *
+       *  \param level  The compression level, or 0 for the default
+       *                level of the method.
+       */
+      void push_compressor(io::filtering_ostream &out,
+			   file_cache::compression_method method,
+			   int level)
+      {
+	switch(method)
+	  {
+	  case file_cache::compress_none:
+	    break;
+
+	  case file_cache::compress_zlib:
+	    out.push(io::zlib_compressor(level == 0
+					 ? io::zlib::default_compression
+					 : level));
+	    break;
+
+	  case file_cache::compress_zstd:
+#ifdef HAVE_BOOST_IOSTREAMS_FILTER_ZSTD_HPP
+	    out.push(io::zstd_compressor(level == 0
+					 ? io::zstd::default_compression
+					 : static_cast<uint32_t>(level)));
+	    break;
+#else
+	    throw FileCacheException("zstd compression is not supported.");
+#endif
+	  }
+      }
+
+      /** \brief Add a filter that decompresses blobs with the given
+       *  codec to a stream.
+       */
+      void push_decompressor(io::filtering_ostream &out,
+			     const std::string &codec)
+      {
+	file_cache::compression_method method;
+	if(!file_cache::parse_compression_method(codec, method) ||
+	   !file_cache::is_compression_method_supported(method))
+	  throw FileCacheException((boost::format("Unsupported compression method \"%s\".")
+				    % codec).str());
+
+	switch(method)
+	  {
+	  case file_cache::compress_none:
+	    break;
+
+	  case file_cache::compress_zlib:
+	    out.push(io::zlib_decompressor());
+	    break;
+
+	  case file_cache::compress_zstd:
+#ifdef HAVE_BOOST_IOSTREAMS_FILTER_ZSTD_HPP
+	    out.push(io::zstd_decompressor());
+#endif
+	    break;
+	  }
       }
 
 
@@ -140,12 +306,17 @@ release upgrade23;							\
 	 */
 	int max_size;
 
+	/** \brief How new items are compressed. */
+	compression_method compression;
+	/** \brief The compression level of new items (0 for the default). */
+	int compression_level;
+
 	// Used to ensure that only one thread is accessing the
 	// database connection at once.  Several sqlite3 functions
 	// (e.g., sqlite3_last_insert_rowid()) are not threadsafe.
 	cw::threads::mutex store_mutex;
 
-	static const int current_version_number = 3;
+	static const int current_version_number = 4;
 
 	void create_new_database()
 	{
@@ -169,6 +340,7 @@ create table cache ( CacheId integer primary key,			\
                      Key text not null );				\
 									\
 create table blobs ( BlobId integer primary key,			\
+                     Codec text not null,				\
                      Data blob not null );				\
 									\
 create index cache_by_blob_id on cache (BlobId);			\
@@ -276,6 +448,9 @@ insert into globals(TotalBlobSize) values(0);				\
 			    upgrade::version_2_to_version_3(store);
 			    // Fallthrough.
 			  case 3:
+			    upgrade::version_3_to_version_4(store);
+			    // Fallthrough.
+			  case 4:
 			    break;
 
 			  }
@@ -354,10 +529,14 @@ insert into globals(TotalBlobSize) values(0);				\
 	}
 
       public:
-	file_cache_sqlite(const std::string &_filename, int _max_size)
+	file_cache_sqlite(const std::string &_filename, int _max_size,
+			  compression_method _compression,
+			  int _compression_level)
 	  : store(db::create(_filename)),
 	    filename(_filename),
-	    max_size(_max_size)
+	    max_size(_max_size),
+	    compression(_compression),
+	    compression_level(_compression_level)
 	{
 	  // Set up the database.  First, check the format:
 	  sqlite::db::statement_proxy check_for_format_statement =
@@ -390,33 +569,38 @@ insert into globals(TotalBlobSize) values(0);				\
 	      // file to a temporary location.  Without this step,
 	      // there's no way to know the size of the compressed
 	      // data, but we need that size in order to insert it
-	      // into the cache database.
-	      temp::name tn("cacheContentCompressed");
+	      // into the cache database.  Uncompressed items are
+	      // copied straight from the input file.
+	      temp::name tn;
 
-	      const std::string compressed_path(tn.get_name());
+	      std::string compressed_path(path);
 
 	      // The size of the input file -- used only for logging
 	      // so we can see how well it was compressed.
 	      std::streamsize input_size = -1;
 
 	      // Compress the input file.
-	      //
-	      // TODO: make the compression level an option.  Maybe
-	      // also support other algorithms, although that needs a
-	      // schema change (an extra column in the blobs table
-	      // giving the compressor that was used).
-	      {
-		io::filtering_ostream compressed_out(io::zlib_compressor(9) | io::file_sink(compressed_path));
+	      if(compression != compress_none)
+		{
+		  tn = temp::name("cacheContentCompressed");
+		  compressed_path = tn.get_name();
 
-		input_size = io::copy(io::file(path), compressed_out);
-	      }
+		  {
+		    io::filtering_ostream compressed_out;
+		    push_compressor(compressed_out, compression, compression_level);
+		    compressed_out.push(io::file_sink(compressed_path));
 
-	      if(input_size < 0)
-		throw FileCacheException((boost::format("Unable to compress \"%s\" to \"%s\".")
-					  % path % compressed_path).str());
+		    input_size = io::copy(io::file(path), compressed_out);
+		  }
 
-	      LOG_TRACE(Loggers::getAptitudeDownloadCache(),
-			"Compressed \"" << path << "\" to \"" << compressed_path << "\"");
+		  if(input_size < 0)
+		    throw FileCacheException((boost::format("Unable to compress \"%s\" to \"%s\".")
+					      % path % compressed_path).str());
+
+		  LOG_TRACE(Loggers::getAptitudeDownloadCache(),
+			    "Compressed \"" << path << "\" to \"" << compressed_path
+			    << "\" with " << get_codec_name(compression));
+		}
 
 	      // Here's the plan:
 	      //
@@ -456,6 +640,9 @@ insert into globals(TotalBlobSize) values(0);				\
 
 	      off_t compressed_size = buf.st_size;
 
+	      if(compression == compress_none)
+		input_size = compressed_size;
+
 	      if(compressed_size == 0 && input_size > 0)
 		throw FileCacheException("Sanity-check failed: a non-empty file was compressed to zero bytes!.");
 
@@ -553,8 +740,9 @@ insert into globals(TotalBlobSize) values(0);				\
 		    // incrementally.
 		    {
 		      sqlite::db::statement_proxy insert_blob_statement =
-			store->get_cached_statement("insert into blobs (Data) values (zeroblob(?))");
+			store->get_cached_statement("insert into blobs (Data, Codec) values (zeroblob(?), ?)");
 		      insert_blob_statement->bind_int64(1, compressed_size);
+		      insert_blob_statement->bind_string(2, get_codec_name(compression));
 		      insert_blob_statement->exec();
 		    }
 
@@ -659,7 +847,21 @@ insert into globals(TotalBlobSize) values(0);				\
 	    }
 	}
 
-	temp::name getItem(const std::string &key, time_t &mtime)
+	/** \brief Look up an item and decompress its contents.
+	 *
+	 *  \param key          The key under which the item was stored.
+	 *  \param mtime        Set to the modification time of the item.
+	 *  \param open_output  Called with the decompression stream if
+	 *                      the item is found; pushes the device
+	 *                      that receives the contents onto the
+	 *                      stream and returns a description of it
+	 *                      for the log.
+	 *
+	 *  \return \b true if the item was found and extracted.
+	 */
+	template<typename OpenOutput>
+	bool extractItem(const std::string &key, time_t &mtime,
+			 const OpenOutput &open_output)
 	{
 	  cw::threads::mutex::lock l(store_mutex);
 
@@ -671,11 +873,11 @@ insert into globals(TotalBlobSize) values(0);				\
 	  // 1) In an sqlite transaction:
 	  //    1.a) Look up the cache entry corresponding
 	  //         to this key.
-	  //    1.a.i)  If there is no entry, return an invalid name.
+	  //    1.a.i)  If there is no entry, return false.
 	  //    1.a.ii) If there is an entry,
 	  //        1.a.ii.A) Update its last use field.
-	  //        1.a.ii.B) Extract it to a temporary file
-	  //                  and return it.
+	  //        1.a.ii.B) Decompress it to the output and
+	  //                  return true.
 	  try
 	    {
 	      store->exec("begin transaction");
@@ -683,11 +885,12 @@ insert into globals(TotalBlobSize) values(0);				\
 	      try
 		{
 		  sqlite::db::statement_proxy find_cache_entry_statement =
-		    store->get_cached_statement("select CacheId, BlobId, ModificationTime from cache where Key = ?");
+		    store->get_cached_statement("select cache.CacheId, cache.BlobId, cache.ModificationTime, blobs.Codec from cache inner join blobs on blobs.BlobId = cache.BlobId where cache.Key = ?");
 
 		  bool found = false;
 		  sqlite3_int64 oldCacheId = -1;
 		  sqlite3_int64 blobId = -1;
+		  std::string codec;
 		  find_cache_entry_statement->bind_string(1, key);
 		  {
 		    statement::execution find_cache_entry_execution(*find_cache_entry_statement);
@@ -698,6 +901,7 @@ insert into globals(TotalBlobSize) values(0);				\
 			oldCacheId = find_cache_entry_statement->get_int64(0);
 			blobId     = find_cache_entry_statement->get_int64(1);
 			mtime      = find_cache_entry_statement->get_int64(2);
+			codec      = find_cache_entry_statement->get_string(3);
 		      }
 		    else
 		      // 1.a.i: no matching entry
@@ -706,7 +910,7 @@ insert into globals(TotalBlobSize) values(0);				\
 				  boost::format("No entry for \"%s\" found in the cache.") % key);
 
 			store->exec("rollback");
-			return temp::name();
+			return false;
 		      }
 		  }
 
@@ -723,18 +927,14 @@ insert into globals(TotalBlobSize) values(0);				\
 		    update_last_use_statement->exec();
 		  }
 
-		  // TODO: I should consolidate the temporary
-		  // directories aptitude creates.
-		  temp::name rval("cacheExtracted");
-
+		  std::string output_description;
 		  int extracted_size = -1;
 		  {
 		    // Decompress the data as it's written to the
-		    // output file.
-		    io::filtering_ostream outfile(io::zlib_decompressor() | io::file_sink(rval.get_name()));
-		    if(!outfile.good())
-		      throw FileCacheException(((boost::format("Can't open \"%s\" for writing"))
-						% rval.get_name()).str());
+		    // output.
+		    io::filtering_ostream outfile;
+		    push_decompressor(outfile, codec);
+		    output_description = open_output(outfile);
 
 		    std::shared_ptr<sqlite::blob> blob_data =
 		      sqlite::blob::open(*store,
@@ -751,9 +951,10 @@ insert into globals(TotalBlobSize) values(0);				\
 		    int blob_offset = 0;
 
 		    LOG_TRACE(Loggers::getAptitudeDownloadCache(),
-			      boost::format("Extracting %d bytes to \"%s\".") % amount_to_read % rval.get_name());
+			      boost::format("Extracting %d bytes (%s) to %s.")
+			      % amount_to_read % codec % output_description);
 
-		    // Copy the blob into the temporary file.
+		    // Copy the blob into the output.
 		    while(amount_to_read > 0)
 		      {
 			int curr_amt;
@@ -774,11 +975,11 @@ insert into globals(TotalBlobSize) values(0);				\
 		  }
 
 		  LOG_INFO(Loggers::getAptitudeDownloadCache(),
-			   boost::format("Extracted %d bytes corresponding to \"%s\" to \"%s\".")
-			   % extracted_size % key % rval.get_name());
+			   boost::format("Extracted %d bytes corresponding to \"%s\" to %s.")
+			   % extracted_size % key % output_description);
 
 		  store->exec("commit");
-		  return rval;
+		  return true;
 		}
 	      catch(...)
 		{
@@ -800,6 +1001,286 @@ insert into globals(TotalBlobSize) values(0);				\
 		  throw;
 		}
 	    }
+	  catch(cw::util::Exception &ex)
+	    {
+	      LOG_WARN(Loggers::getAptitudeDownloadCache(),
+		       boost::format("Can't get the cache entry for \"%s\": %s")
+		       % key % ex.errmsg());
+	      return false;
+	    }
+	  catch(std::exception &ex)
+	    {
+	      LOG_WARN(Loggers::getAptitudeDownloadCache(),
+		       boost::format("Can't get the cache entry for \"%s\": %s")
+		       % key % ex.what());
+	      return false;
+	    }
+	}
+
+	temp::name getItem(const std::string &key, time_t &mtime)
+	{
+	  temp::name rval;
+
+	  const bool found =
+	    extractItem(key, mtime,
+			[&rval] (io::filtering_ostream &out)
+			{
+			  // TODO: I should consolidate the temporary
+			  // directories aptitude creates.
+			  rval = temp::name("cacheExtracted");
+
+			  io::file_sink sink(rval.get_name());
+			  if(!sink.is_open())
+			    throw FileCacheException(((boost::format("Can't open \"%s\" for writing"))
+						      % rval.get_name()).str());
+
+			  out.push(sink);
+			  return "\"" + rval.get_name() + "\"";
+			});
+
+	  if(!found)
+	    return temp::name();
+	  else
+	    return rval;
+	}
+      };
+
+      /** \brief An in-memory cache.
+       *
+       *  Items are stored uncompressed in a hash table that is split
+       *  into shards, each with its own lock, so threads looking up
+       *  different keys rarely wait for each other.  The size limit
+       *  applies to the cache as a whole, so any item up to that size
+       *  can be stored; when the cache is full, the least recently
+       *  used items of all the shards are dropped first.
+       */
+      class file_cache_memory : public file_cache
+      {
+	struct entry
+	{
+	  std::string key;
+	  std::shared_ptr<const std::string> contents;
+	  time_t mtime;
+	  /** \brief The value of use_clock when the entry was last used. */
+	  unsigned long long last_used;
+	};
+
+	typedef std::list<entry> entry_list;
+
+	struct shard
+	{
+	  cw::threads::mutex mutex;
+	  /** \brief The entries of the shard, most recently used first. */
+	  entry_list entries;
+	  std::unordered_map<std::string, entry_list::iterator> entries_by_key;
+	};
+
+	// Small caches are split into fewer shards; there is little
+	// to gain from more locks when only a few items fit.
+	static const std::size_t min_shard_size = 128 * 1024;
+	static const std::size_t max_num_shards = 16;
+
+	std::vector<std::unique_ptr<shard> > shards;
+	std::size_t max_size;
+	/** \brief The total size of the entries in all the shards. */
+	std::atomic<std::size_t> total_size;
+	/** \brief Incremented each time an entry is used. */
+	std::atomic<unsigned long long> use_clock;
+
+	shard &get_shard(const std::string &key)
+	{
+	  return *shards[std::hash<std::string>()(key) % shards.size()];
+	}
+
+	/** \brief Find an item and mark it as recently used.
+	 *
+	 *  \return \b false if there is no item with the given key.
+	 */
+	bool find(const std::string &key,
+		  std::shared_ptr<const std::string> &contents,
+		  time_t &mtime)
+	{
+	  shard &s(get_shard(key));
+	  cw::threads::mutex::lock l(s.mutex);
+
+	  std::unordered_map<std::string, entry_list::iterator>::const_iterator
+	    found = s.entries_by_key.find(key);
+	  if(found == s.entries_by_key.end())
+	    {
+	      LOG_TRACE(Loggers::getAptitudeDownloadCache(),
+			boost::format("No entry for \"%s\" found in the memory cache.") % key);
+	      return false;
+	    }
+
+	  s.entries.splice(s.entries.begin(), s.entries, found->second);
+	  found->second->last_used = ++use_clock;
+	  contents = found->second->contents;
+	  mtime = found->second->mtime;
+	  return true;
+	}
+
+	/** \brief Drop the least recently used entries until the cache
+	 *  fits in its size limit.
+	 */
+	void shrink()
+	{
+	  while(total_size.load() > max_size)
+	    {
+	      // Find the shard whose least recently used entry is the
+	      // oldest.  The shards are locked one at a time, so the
+	      // entry might be used before it is dropped; in that case
+	      // just look again.
+	      shard *oldest_shard = NULL;
+	      unsigned long long oldest_use = 0;
+	      for(std::vector<std::unique_ptr<shard> >::const_iterator it = shards.begin();
+		  it != shards.end(); ++it)
+		{
+		  cw::threads::mutex::lock l((*it)->mutex);
+		  if(!(*it)->entries.empty() &&
+		     (oldest_shard == NULL || (*it)->entries.back().last_used < oldest_use))
+		    {
+		      oldest_shard = it->get();
+		      oldest_use = (*it)->entries.back().last_used;
+		    }
+		}
+
+	      if(oldest_shard == NULL)
+		return;
+
+	      cw::threads::mutex::lock l(oldest_shard->mutex);
+	      if(oldest_shard->entries.empty() ||
+		 oldest_shard->entries.back().last_used != oldest_use)
+		continue;
+
+	      const entry &oldest(oldest_shard->entries.back());
+
+	      LOG_TRACE(Loggers::getAptitudeDownloadCache(),
+			boost::format("Dropping \"%s\" from the memory cache to save %d bytes.")
+			% oldest.key % oldest.contents->size());
+
+	      total_size -= oldest.contents->size();
+	      oldest_shard->entries_by_key.erase(oldest.key);
+	      oldest_shard->entries.pop_back();
+	    }
+	}
+
+      public:
+	explicit file_cache_memory(int _max_size)
+	  : max_size(static_cast<std::size_t>(_max_size)),
+	    total_size(0),
+	    use_clock(0)
+	{
+	  std::size_t num_shards = max_size / min_shard_size;
+	  if(num_shards < 1)
+	    num_shards = 1;
+	  else if(num_shards > max_num_shards)
+	    num_shards = max_num_shards;
+
+	  for(std::size_t i = 0; i < num_shards; ++i)
+	    shards.push_back(std::unique_ptr<shard>(new shard));
+	}
+
+	void putItem(const std::string &key,
+		     const std::string &path,
+		     time_t mtime)
+	{
+	  // Read the file before taking the shard lock.
+	  std::shared_ptr<std::string> contents = std::make_shared<std::string>();
+	  try
+	    {
+	      io::file_source in(path);
+	      if(!in.is_open())
+		throw FileCacheException((boost::format("Can't open \"%s\" to store it in the cache.")
+					  % path).str());
+
+	      io::copy(in, io::back_inserter(*contents));
+	    }
+	  catch(cw::util::Exception &ex)
+	    {
+	      LOG_WARN(Loggers::getAptitudeDownloadCache(),
+		       boost::format("Can't cache \"%s\" as \"%s\": %s")
+		       % path % key % ex.errmsg());
+	      return;
+	    }
+	  catch(std::exception &ex)
+	    {
+	      LOG_WARN(Loggers::getAptitudeDownloadCache(),
+		       boost::format("Can't cache \"%s\" as \"%s\": %s")
+		       % path % key % ex.what());
+	      return;
+	    }
+
+	  {
+	    shard &s(get_shard(key));
+	    cw::threads::mutex::lock l(s.mutex);
+
+	    // Drop the old contents even if the new ones don't fit, so
+	    // that they can't hide newer contents in another cache.
+	    std::unordered_map<std::string, entry_list::iterator>::iterator
+	      found = s.entries_by_key.find(key);
+	    if(found != s.entries_by_key.end())
+	      {
+		total_size -= found->second->contents->size();
+		s.entries.erase(found->second);
+		s.entries_by_key.erase(found);
+	      }
+
+	    if(contents->size() > max_size)
+	      {
+		LOG_INFO(Loggers::getAptitudeDownloadCache(),
+			 "Refusing to cache \"" << path << "\" in memory as \"" << key
+			 << "\": its size " << contents->size()
+			 << " is greater than the cache size limit " << max_size);
+		return;
+	      }
+
+	    entry new_entry;
+	    new_entry.key = key;
+	    new_entry.contents = contents;
+	    new_entry.mtime = mtime;
+	    new_entry.last_used = ++use_clock;
+
+	    s.entries.push_front(new_entry);
+	    s.entries_by_key[key] = s.entries.begin();
+	    total_size += contents->size();
+	  }
+
+	  // The new entry is the most recently used one, so it's only
+	  // dropped if other threads store more items meanwhile.
+	  shrink();
+
+	  LOG_INFO(Loggers::getAptitudeDownloadCache(),
+		   boost::format("Cached \"%s\" in memory as \"%s\" (size: %d)")
+		   % path % key % contents->size());
+	}
+
+	temp::name getItem(const std::string &key, time_t &mtime)
+	{
+	  std::shared_ptr<const std::string> contents;
+	  if(!find(key, contents, mtime))
+	    return temp::name();
+
+	  // The file is written without holding the shard lock; the
+	  // contents are kept alive by the shared pointer even if the
+	  // entry is dropped meanwhile.
+	  try
+	    {
+	      temp::name rval("cacheExtracted");
+
+	      io::file_sink out(rval.get_name());
+	      if(!out.is_open())
+		throw FileCacheException(((boost::format("Can't open \"%s\" for writing"))
+					  % rval.get_name()).str());
+
+	      io::write(out, contents->data(), contents->size());
+	      out.close();
+
+	      LOG_INFO(Loggers::getAptitudeDownloadCache(),
+		       boost::format("Extracted %d bytes corresponding to \"%s\" to \"%s\".")
+		       % contents->size() % key % rval.get_name());
+
+	      return rval;
+	    }
 	  catch(cw::util::Exception &ex)
 	    {
 	      LOG_WARN(Loggers::getAptitudeDownloadCache(),
@@ -862,27 +1343,69 @@ insert into globals(TotalBlobSize) values(0);				\
       };
     }
 
-    std::shared_ptr<file_cache> file_cache::create(const std::string &filename,
-						     int memory_size,
-						     int disk_size)
+    bool file_cache::parse_compression_method(const std::string &name,
+					      compression_method &method)
+    {
+      if(name == "none")
+	method = compress_none;
+      else if(name == "zlib")
+	method = compress_zlib;
+      else if(name == "zstd")
+	method = compress_zstd;
+      else
+	return false;
+
+      return true;
+    }
+
+    bool file_cache::is_compression_method_supported(compression_method method)
+    {
+      switch(method)
+	{
+	case compress_none:
+	case compress_zlib:
+	  return true;
+
+	case compress_zstd:
+#ifdef HAVE_BOOST_IOSTREAMS_FILTER_ZSTD_HPP
+	  return true;
+#else
+	  return false;
+#endif
+	}
+
+      return false;
+    }
+
+    std::shared_ptr<file_cache> file_cache::create_compressed(const std::string &filename,
+								int memory_size,
+								int disk_size,
+								compression_method compression,
+								int compression_level)
     {
       std::shared_ptr<file_cache_multilevel> rval = std::make_shared<file_cache_multilevel>();
 
-      if(memory_size > 0)
+      if(!is_compression_method_supported(compression))
 	{
-	  try
-	    {
-	      // \note A boost::multi_index_container might be more
-	      // efficient for the in-memory cache.  OTOH, it would
-	      // require more code.
-	      rval->push_back(std::make_shared<file_cache_sqlite>(":memory:", memory_size));
-	    }
-	  catch(const cw::util::Exception &ex)
-	    {
-	      LOG_WARN(Loggers::getAptitudeDownloadCache(),
-		       "Unable to create the in-memory cache: " << ex.errmsg());
-	    }
+	  LOG_WARN(Loggers::getAptitudeDownloadCache(),
+		   "The compression method \"" << get_codec_name(compression)
+		   << "\" is not supported; using zlib instead.");
+	  compression = compress_zlib;
+	  compression_level = 0;
 	}
+
+      const int clamped_level = clamp_compression_level(compression, compression_level);
+      if(clamped_level != compression_level && compression != compress_none)
+	{
+	  LOG_WARN(Loggers::getAptitudeDownloadCache(),
+		   "The compression level " << compression_level
+		   << " is out of range for \"" << get_codec_name(compression)
+		   << "\"; using " << clamped_level << " instead.");
+	  compression_level = clamped_level;
+	}
+
+      if(memory_size > 0)
+	rval->push_back(std::make_shared<file_cache_memory>(memory_size));
       else
 	LOG_INFO(Loggers::getAptitudeDownloadCache(),
 		 "In-memory cache disabled.");
@@ -892,7 +1415,9 @@ insert into globals(TotalBlobSize) values(0);				\
 	{
 	  try
 	    {
-	      rval->push_back(std::make_shared<file_cache_sqlite>(filename, disk_size));
+	      rval->push_back(std::make_shared<file_cache_sqlite>(filename, disk_size,
+								  compression,
+								  compression_level));
 	    }
 	  catch(const cw::util::Exception &ex)
 	    {
@@ -907,6 +1432,14 @@ insert into globals(TotalBlobSize) values(0);				\
       return rval;
     }
 
+    std::shared_ptr<file_cache> file_cache::create(const std::string &filename,
+						     int memory_size,
+						     int disk_size)
+    {
+      return create_compressed(filename, memory_size, disk_size,
+			       compress_zstd, 0);
+    }
+
     file_cache::~file_cache()
     {
     }
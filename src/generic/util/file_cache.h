@@ -20,6 +20,7 @@
 #include <cwidget/generic/util/exception.h>
 
 #include <memory>
+#include <string>
 
 #include <time.h>
 
@@ -48,13 +49,45 @@ namespace aptitude
      *  aptitude uses this to store downloaded blobs of data:
      *  changelogs, screenshots, etc.
      *
-     *  \note The implementation is based on SQLite, and only hidden
+     *  \note The on-disk cache is based on SQLite, and only hidden
      *  behind an abstract interface so that its details aren't
-     *  unnecessarily exposed.
+     *  unnecessarily exposed.  The in-memory cache is a hash table
+     *  of uncompressed items, which is searched first.
      */
     class file_cache
     {
     public:
+      /** \brief The ways in which the contents of an item can be
+       *  compressed.
+       */
+      enum compression_method
+	{
+	  /** \brief Store the contents as they are. */
+	  compress_none,
+	  /** \brief Compress the contents with zlib. */
+	  compress_zlib,
+	  /** \brief Compress the contents with Zstandard. */
+	  compress_zstd
+	};
+
+      /** \brief Look up a compression method by name.
+       *
+       *  \param name    "none", "zlib" or "zstd".
+       *  \param method  Set to the method with the given name.
+       *
+       *  \return \b false if the name is unknown.
+       */
+      static bool parse_compression_method(const std::string &name,
+					   compression_method &method);
+
+      /** \brief Test whether aptitude was built with support for the
+       *  given compression method.
+       *
+       *  Items stored with an unsupported method can't be read, and
+       *  are treated as missing.
+       */
+      static bool is_compression_method_supported(compression_method method);
+
       /** \brief Store a file in the cache.
        *
        *  \param key   The key under which the file is to be stored.
@@ -116,10 +149,30 @@ namespace aptitude
        *                        stored.
        *  \param memory_size    The maximum allowed size in bytes of the in-memory
        *                        cache. (if zero, only an on-disk cache
-       *                        will be used)
+       *                        will be used)  Items are kept
+       *                        uncompressed in memory.
        *  \param disk_size      The maximum allowed size in bytes of the on-disk
        *                        cache.  (if zero, only a memory cache
        *                        will be used)
+       *  \param compression    How to compress new items on disk; if the method
+       *                        is not supported, zlib is used instead.
+       *  \param compression_level  The compression level to use, or
+       *                        0 for the default level of the method.
+       *                        Levels outside the range of the method
+       *                        (1-9 for zlib, 1-19 for zstd) are
+       *                        clamped to it.
+       */
+      static std::shared_ptr<file_cache> create_compressed(const std::string &filename,
+							   int memory_size,
+							   int disk_size,
+							   compression_method compression,
+							   int compression_level);
+
+      /** \brief Open or create a new file cache that compresses new
+       *  items with zstd at its default level, or with zlib if zstd
+       *  is not supported.
+       *
+       *  \sa create_compressed()
        */
       static std::shared_ptr<file_cache> create(const std::string &filename,
 						int memory_size,
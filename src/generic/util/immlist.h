@@ -18,7 +18,9 @@
 //   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
 //   Boston, MA 02110-1301, USA.
 
+#include <cwidget/generic/util/eassert.h>
 #include <cwidget/generic/util/ref_ptr.h>
+#include "node_pool.h"
 #include "refcounted_base.h"
 
 #include <algorithm>
@@ -55,6 +57,17 @@ namespace imm
       {
       }
 
+      static void *operator new(std::size_t size)
+      {
+	eassert(size == sizeof(node));
+	return aptitude::util::node_pool<sizeof(node)>::allocate();
+      }
+
+      static void operator delete(void *p)
+      {
+	aptitude::util::node_pool<sizeof(node)>::deallocate(p);
+      }
+
       const T &get_head() const { return head; }
       const cwidget::util::ref_ptr<node> &get_tail() const { return tail; }
       size_type get_size() const { return size; }
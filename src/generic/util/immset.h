@@ -29,6 +29,7 @@
 #include <boost/compressed_pair.hpp>
 
 #include "compare3.h"
+#include "node_pool.h"
 
 /** \brief A class to represent immutable sets
  *
@@ -169,6 +170,19 @@ namespace imm
       {
       }
 
+      // Nodes are allocated from a pool, since the resolver creates
+      // and destroys huge numbers of them.
+      static void *operator new(std::size_t size)
+      {
+	eassert(size == sizeof(impl));
+	return aptitude::util::node_pool<sizeof(impl)>::allocate();
+      }
+
+      static void operator delete(void *p)
+      {
+	aptitude::util::node_pool<sizeof(impl)>::deallocate(p);
+      }
+
       impl *clone(const AccumOps &ops) const
       {
 	return new impl(val, left.clone(ops), right.clone(ops), ops);
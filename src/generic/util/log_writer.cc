@@ -0,0 +1,177 @@
+/** \file log_writer.cc */   // -*-c++-*-
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; see the file COPYING.  If not, write to
+// the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+// Boston, MA 02110-1301, USA.
+
+#include "log_writer.h"
+
+// System includes:
+#include <cwidget/generic/threads/threads.h>
+
+#include <fstream>
+#include <vector>
+
+using cwidget::threads::condition;
+using cwidget::threads::mutex;
+using cwidget::threads::thread;
+
+namespace aptitude
+{
+  namespace util
+  {
+    log_writer::~log_writer()
+    {
+    }
+
+    namespace
+    {
+      class log_writer_impl : public log_writer
+      {
+        std::ofstream out;
+
+        // The ring buffer: count lines starting at slots[head].
+        std::vector<std::string> slots;
+        std::size_t head;
+        std::size_t count;
+
+        // The number of lines ever queued, and the number that have
+        // been written; used by flush().
+        unsigned long long num_queued;
+        unsigned long long num_written;
+
+        bool stopping;
+
+        mutex state_mutex;
+        // Signalled when lines are queued or the writer is stopping.
+        condition not_empty;
+        // Signalled when lines are taken off the queue.
+        condition not_full;
+        // Signalled when a batch of lines has been written.
+        condition written;
+
+        std::unique_ptr<thread> writer_thread;
+
+        class writer_thread_bootstrap
+        {
+          log_writer_impl &parent;
+
+        public:
+          writer_thread_bootstrap(log_writer_impl &_parent)
+            : parent(_parent)
+          {
+          }
+
+          void operator()() const
+          {
+            parent.run();
+          }
+        };
+
+        void run()
+        {
+          std::vector<std::string> batch;
+
+          while(true)
+            {
+              {
+                mutex::lock l(state_mutex);
+
+                while(count == 0 && !stopping)
+                  not_empty.wait(l);
+
+                if(count == 0)
+                  return;
+
+                batch.resize(count);
+                for(std::size_t i = 0; i < count; ++i)
+                  batch[i].swap(slots[(head + i) % slots.size()]);
+
+                head = (head + count) % slots.size();
+                count = 0;
+                not_full.wake_all();
+              }
+
+              // Write without holding the lock, so that other
+              // threads can keep queueing lines.
+              for(std::vector<std::string>::const_iterator it =
+                    batch.begin(); it != batch.end(); ++it)
+                out << *it;
+              out << std::flush;
+
+              {
+                mutex::lock l(state_mutex);
+
+                num_written += batch.size();
+                written.wake_all();
+              }
+            }
+        }
+
+      public:
+        log_writer_impl(const std::string &filename, std::size_t capacity)
+          : out(filename.c_str(), std::ios::app),
+            slots(capacity > 0 ? capacity : 1),
+            head(0),
+            count(0),
+            num_queued(0),
+            num_written(0),
+            stopping(false)
+        {
+          writer_thread.reset(new thread(writer_thread_bootstrap(*this)));
+        }
+
+        ~log_writer_impl()
+        {
+          {
+            mutex::lock l(state_mutex);
+
+            stopping = true;
+            not_empty.wake_all();
+          }
+
+          writer_thread->join();
+        }
+
+        void write(const std::string &line)
+        {
+          mutex::lock l(state_mutex);
+
+          while(count == slots.size())
+            not_full.wait(l);
+
+          slots[(head + count) % slots.size()] = line;
+          ++count;
+          ++num_queued;
+          not_empty.wake_one();
+        }
+
+        void flush()
+        {
+          mutex::lock l(state_mutex);
+
+          const unsigned long long target = num_queued;
+          while(num_written < target)
+            written.wait(l);
+        }
+      };
+    }
+
+    std::shared_ptr<log_writer> create_log_writer(const std::string &filename,
+                                                  std::size_t capacity)
+    {
+      return std::make_shared<log_writer_impl>(filename, capacity);
+    }
+  }
+}
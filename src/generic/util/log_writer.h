@@ -0,0 +1,76 @@
+/** \file log_writer.h */   // -*-c++-*-
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; see the file COPYING.  If not, write to
+// the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+// Boston, MA 02110-1301, USA.
+
+#ifndef APTITUDE_UTIL_LOG_WRITER_H
+#define APTITUDE_UTIL_LOG_WRITER_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace aptitude
+{
+  namespace util
+  {
+    /** \brief Appends lines of text to a log file from a background
+     *  thread.
+     *
+     *  Lines are queued in a fixed-size ring buffer and written in
+     *  batches, so the thread that logs a message only pays for
+     *  copying it into the queue; it blocks only if the writer falls
+     *  a whole buffer behind.  Lines are written in the order they
+     *  were queued, and none are dropped.
+     */
+    class log_writer
+    {
+    public:
+      virtual ~log_writer() = 0;
+
+      /** \brief Queue a line to be written.
+       *
+       *  This function is thread-safe.
+       *
+       *  \param line  The text to write, including its trailing
+       *               newline.
+       */
+      virtual void write(const std::string &line) = 0;
+
+      /** \brief Wait until every line queued so far has been written
+       *  to the file.
+       */
+      virtual void flush() = 0;
+    };
+
+    /** \brief Create a log writer.
+     *
+     *  If the writer is destroyed, the lines still in its queue are
+     *  written and its thread is stopped.  A writer that is meant to
+     *  outlive everything that logs (such as the one for
+     *  Aptitude::Logging::File, which is never destroyed) should
+     *  instead be flushed before the program exits; its thread then
+     *  ends with the process.
+     *
+     *  \param filename  The file to append to.  If it can't be
+     *                   opened, lines are silently discarded.
+     *  \param capacity  The number of lines that can be queued.
+     */
+    std::shared_ptr<log_writer> create_log_writer(const std::string &filename,
+                                                  std::size_t capacity);
+  }
+}
+
+#endif // APTITUDE_UTIL_LOG_WRITER_H
@@ -112,7 +112,7 @@ namespace aptitude
                          const std::shared_ptr<LoggingSystem::Impl> &_loggingSystem)
         : Logger(_parent.get() == NULL
                  ? getDefaultLevel()
-                 : _parent->effectiveLevel),
+                 : _parent->getEffectiveLevel()),
           category(_category),
           parent(_parent),
           loggingSystemWeak(_loggingSystem)
@@ -124,26 +124,29 @@ namespace aptitude
                              log_level logLevel,
                              const std::string &msg)
       {
-        // \note shared_from_this() could be costly; it would be more
-        // efficient to receive the logger as a parameter, but that
-        // would clutter the interface.
-
+        // shared_from_this() costs an atomic increment, so don't
+        // call it unless someone is listening.  The hierarchy is
+        // walked through plain pointers: each logger holds a
+        // reference to its parent.
+        bool listened = false;
+        for(const Impl *logger = this; logger != NULL && !listened;
+            logger = logger->parent.get())
+          listened = !logger->signal_message_logged.empty();
+
+        if(!listened)
+          return;
 
         // We emit this log message at each level of the hierarchy,
         // but the logger passed along always refers to where the
         // message started.
         const std::shared_ptr<Impl> self = shared_from_this();
-        std::shared_ptr<Impl> logger = self;
-        while(logger.get() != NULL)
-          {
-            logger->signal_message_logged(sourceFilename,
-                                          sourceLineNumber,
-                                          logLevel,
-                                          self,
-                                          msg);
-
-            logger = logger->parent;
-          }
+        for(Impl *logger = this; logger != NULL;
+            logger = logger->parent.get())
+          logger->signal_message_logged(sourceFilename,
+                                        sourceLineNumber,
+                                        logLevel,
+                                        self,
+                                        msg);
       }
 
       const std::string &Logger::Impl::getCategory() const
@@ -302,7 +305,7 @@ namespace aptitude
             if(parent.get() == NULL)
               newEffectiveLevel = Logger::Impl::getDefaultLevel();
             else
-              newEffectiveLevel = parent->effectiveLevel;
+              newEffectiveLevel = parent->getEffectiveLevel();
           }
         else
           newEffectiveLevel = *level;
@@ -26,6 +26,7 @@
 #include <sigc++/connection.h>
 #include <sigc++/slot.h>
 
+#include <atomic>
 #include <memory>
 #include <sstream>
 
@@ -83,8 +84,11 @@ namespace aptitude
         // above this level will be logged.  Defaults to ERROR.
         //
         // This is provided as a concrete member in the base class so
-        // that "is logging enabled?" tests can be inlined.
-        log_level effectiveLevel;
+        // that "is logging enabled?" tests can be inlined.  It's
+        // atomic so that those tests can run in any thread without
+        // locking; a relaxed read is enough, since a message that
+        // races with a change of level can go either way.
+        std::atomic<log_level> effectiveLevel;
 
         class Impl;
 
@@ -111,13 +115,19 @@ namespace aptitude
          */
         bool isEnabledFor(log_level l) const
         {
+          const log_level level =
+            effectiveLevel.load(std::memory_order_relaxed);
+
           return
-            effectiveLevel != OFF_LEVEL &&
-            l >= effectiveLevel;
+            level != OFF_LEVEL &&
+            l >= level;
         }
 
         /** \brief Retrieve the effective log level of this logger. */
-        log_level getEffectiveLevel() const { return effectiveLevel; }
+        log_level getEffectiveLevel() const
+        {
+          return effectiveLevel.load(std::memory_order_relaxed);
+        }
 
         /** \brief Unconditionally log a message to this logger.
          *
@@ -191,11 +201,27 @@ namespace aptitude
         static LoggerPtr getLogger(const std::string &category);
       };
 
+/** \brief The lowest level of log message that is compiled in.
+ *
+ *  Messages below this level are removed by the compiler, along with
+ *  the code that builds them.  Define this (e.g., to
+ *  ::aptitude::util::logging::DEBUG_LEVEL) to build a binary in which
+ *  LOG_TRACE() costs nothing at all.
+ */
+#ifndef APTITUDE_LOGGING_MIN_LEVEL
+#define APTITUDE_LOGGING_MIN_LEVEL ::aptitude::util::logging::TRACE_LEVEL
+#endif
+
+// The logger is bound to a reference rather than copied, so a
+// disabled message costs one load and one comparison, without
+// touching the logger's reference count.
 #define LOG_LEVEL(level, logger, msg)                                   \
       do                                                                \
         {                                                               \
-          ::aptitude::util::logging::log_level __aptitude_util_logging_level = (level); \
-          ::aptitude::util::logging::LoggerPtr __aptitude_util_logging_logger = (logger); \
+          const ::aptitude::util::logging::log_level __aptitude_util_logging_level = (level); \
+          if(__aptitude_util_logging_level < APTITUDE_LOGGING_MIN_LEVEL) \
+            break;                                                      \
+          const ::aptitude::util::logging::LoggerPtr &__aptitude_util_logging_logger = (logger); \
           if(__aptitude_util_logging_logger->isEnabledFor(__aptitude_util_logging_level)) \
             {                                                           \
               std::ostringstream __aptitude_util_logging_stream;        \
@@ -0,0 +1,321 @@
+// node_pool.h                                       -*-c++-*-
+//
+//   This program is free software; you can redistribute it and/or
+//   modify it under the terms of the GNU General Public License as
+//   published by the Free Software Foundation; either version 2 of
+//   the License, or (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//   General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program; see the file COPYING.  If not, write to
+//   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+//   Boston, MA 02110-1301, USA.
+
+#ifndef NODE_POOL_H
+#define NODE_POOL_H
+
+#include <cwidget/generic/threads/threads.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+#include <stdlib.h>
+
+/** \brief Pooled allocation of small, fixed-size objects.
+ *
+ *  \file node_pool.h
+ */
+
+namespace aptitude
+{
+  namespace util
+  {
+    /** \brief Allocates blocks of one size out of large chunks.
+     *
+     *  The problem resolver creates and destroys millions of tree
+     *  nodes and list cells, each of them only a few dozen bytes
+     *  long.  Taking them from a pool replaces most calls to the
+     *  general-purpose allocator with a pointer bump or a free-list
+     *  pop, and keeps nodes that are created together close together
+     *  in memory.
+     *
+     *  Each thread owns the chunks it carves blocks from, and keeps
+     *  a private free list of blocks in those chunks, so allocating
+     *  and freeing blocks on one thread doesn't take any lock.  A
+     *  block that is freed by a different thread is pushed onto a
+     *  lock-free list belonging to the owner of its chunk; the owner
+     *  takes the whole list back once its private free list runs
+     *  out.  This matters for the resolver, whose nodes are built by
+     *  the background thread but mostly destroyed by the UI thread
+     *  when a search is thrown away.
+     *
+     *  When a thread exits, the chunks it owned are handed to the
+     *  next thread that uses the pool.  Chunks are never returned to
+     *  the system.
+     *
+     *  \tparam Size  The size of the objects to allocate.
+     */
+    template<std::size_t Size>
+    class node_pool
+    {
+      struct free_block
+      {
+	free_block *next;
+      };
+
+      struct pool_state
+      {
+	free_block *free_list;
+	char *next_block;
+	char *chunk_end;
+
+	/** \brief Blocks in this state's chunks that other threads
+	 *  freed.
+	 */
+	std::atomic<free_block *> remote_free_list;
+
+	pool_state()
+	  : free_list(NULL), next_block(NULL), chunk_end(NULL),
+	    remote_free_list(NULL)
+	{
+	}
+      };
+
+      /** \brief Stored in the first block of each chunk. */
+      struct chunk_header
+      {
+	pool_state *owner;
+      };
+
+      static const std::size_t alignment = alignof(std::max_align_t);
+
+      static const std::size_t block_size =
+	((Size < sizeof(chunk_header) ? sizeof(chunk_header) : Size)
+	 + alignment - 1) / alignment * alignment;
+
+      static constexpr std::size_t round_up_to_power_of_two(std::size_t n,
+							     std::size_t p = 1)
+      {
+	return p >= n ? p : round_up_to_power_of_two(n, p * 2);
+      }
+
+      // At least 64 blocks per chunk.  Chunks are aligned on their
+      // size, so the header of a block's chunk can be found by
+      // masking the block's address.
+      static const std::size_t chunk_size =
+	round_up_to_power_of_two(block_size * 65 > 65536 ? block_size * 65 : 65536);
+
+      /** \brief Hands the current thread's state to the orphan list
+       *  when the thread exits.
+       */
+      struct thread_state_releaser
+      {
+	~thread_state_releaser()
+	{
+	  pool_state *&state(get_current_state());
+	  if(state != NULL)
+	    {
+	      cwidget::threads::mutex::lock l(get_orphans_mutex());
+	      get_orphans().push_back(state);
+	      state = NULL;
+	    }
+	}
+      };
+
+      static cwidget::threads::mutex &get_orphans_mutex()
+      {
+	static cwidget::threads::mutex orphans_mutex;
+	return orphans_mutex;
+      }
+
+      /** \brief States whose thread exited, and the chunks they own. */
+      static std::vector<pool_state *> &get_orphans()
+      {
+	static std::vector<pool_state *> orphans;
+	return orphans;
+      }
+
+      /** \brief The state used by the current thread, or NULL if it
+       *  hasn't allocated anything yet.
+       *
+       *  This is a plain pointer so that it can still be read while
+       *  the thread's destructors run.
+       */
+      static pool_state *&get_current_state()
+      {
+	static thread_local pool_state *state = NULL;
+	return state;
+      }
+
+      static pool_state &get_thread_state()
+      {
+	pool_state *&state(get_current_state());
+	if(state == NULL)
+	  {
+	    static thread_local thread_state_releaser releaser;
+	    (void)releaser;
+
+	    cwidget::threads::mutex::lock l(get_orphans_mutex());
+	    std::vector<pool_state *> &orphans(get_orphans());
+	    if(orphans.empty())
+	      state = new pool_state;
+	    else
+	      {
+		state = orphans.back();
+		orphans.pop_back();
+	      }
+	  }
+
+	return *state;
+      }
+
+      // Every chunk that was allocated, so that the memory stays
+      // reachable while no thread owns it.
+      static cwidget::threads::mutex &get_chunks_mutex()
+      {
+	static cwidget::threads::mutex chunks_mutex;
+	return chunks_mutex;
+      }
+
+      static std::vector<void *> &get_chunks()
+      {
+	static std::vector<void *> chunks;
+	return chunks;
+      }
+
+      static void new_chunk(pool_state &state)
+      {
+	void *chunk;
+	if(posix_memalign(&chunk, chunk_size, chunk_size) != 0)
+	  throw std::bad_alloc();
+
+	{
+	  cwidget::threads::mutex::lock l(get_chunks_mutex());
+	  get_chunks().push_back(chunk);
+	}
+
+	static_cast<chunk_header *>(chunk)->owner = &state;
+
+	state.next_block = static_cast<char *>(chunk) + block_size;
+	state.chunk_end = static_cast<char *>(chunk) + chunk_size / block_size * block_size;
+      }
+
+    public:
+      /** \brief Allocate a block of at least Size bytes. */
+      static void *allocate()
+      {
+	pool_state &state(get_thread_state());
+
+	if(state.free_list == NULL)
+	  state.free_list = state.remote_free_list.exchange(NULL, std::memory_order_acquire);
+
+	if(state.free_list != NULL)
+	  {
+	    free_block * const rval = state.free_list;
+	    state.free_list = rval->next;
+	    return rval;
+	  }
+
+	if(state.next_block == state.chunk_end)
+	  new_chunk(state);
+
+	void * const rval = state.next_block;
+	state.next_block += block_size;
+	return rval;
+      }
+
+      /** \brief Return a block obtained from allocate() to the pool.
+       *
+       *  This may be called on any thread.
+       */
+      static void deallocate(void *p)
+      {
+	if(p == NULL)
+	  return;
+
+	free_block * const block = static_cast<free_block *>(p);
+	const chunk_header * const header =
+	  reinterpret_cast<const chunk_header *>(reinterpret_cast<std::uintptr_t>(p) & ~(chunk_size - 1));
+	pool_state * const owner = header->owner;
+
+	if(owner == get_current_state())
+	  {
+	    block->next = owner->free_list;
+	    owner->free_list = block;
+	  }
+	else
+	  {
+	    free_block *head = owner->remote_free_list.load(std::memory_order_relaxed);
+	    do
+	      block->next = head;
+	    while(!owner->remote_free_list.compare_exchange_weak(head, block,
+								 std::memory_order_release,
+								 std::memory_order_relaxed));
+	  }
+      }
+    };
+
+    /** \brief A standard allocator that takes single objects from a
+     *  node_pool.
+     *
+     *  Arrays are allocated with operator new.  This is mainly meant
+     *  to be used with std::allocate_shared(), which allocates the
+     *  object and its reference count as a single block.
+     */
+    template<typename T>
+    class node_pool_allocator
+    {
+    public:
+      typedef T value_type;
+
+      node_pool_allocator()
+      {
+      }
+
+      template<typename U>
+      node_pool_allocator(const node_pool_allocator<U> &)
+      {
+      }
+
+      T *allocate(std::size_t n)
+      {
+	static_assert(alignof(T) <= alignof(std::max_align_t),
+		      "node_pool_allocator can't allocate over-aligned types");
+
+	if(n == 1)
+	  return static_cast<T *>(node_pool<sizeof(T)>::allocate());
+	else
+	  return static_cast<T *>(::operator new(n * sizeof(T)));
+      }
+
+      void deallocate(T *p, std::size_t n)
+      {
+	if(n == 1)
+	  node_pool<sizeof(T)>::deallocate(p);
+	else
+	  ::operator delete(p);
+      }
+
+      template<typename U>
+      bool operator==(const node_pool_allocator<U> &) const
+      {
+	return true;
+      }
+
+      template<typename U>
+      bool operator!=(const node_pool_allocator<U> &) const
+      {
+	return false;
+      }
+    };
+  }
+}
+
+#endif // NODE_POOL_H
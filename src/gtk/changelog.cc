@@ -42,9 +42,6 @@
 #include <generic/apt/download_queue.h>
 #include <generic/apt/pkg_changelog.h>
 
-#include <generic/util/file_cache.h>
-#include <generic/util/job_queue_thread.h>
-
 #include <gtk/hyperlink.h>
 #include <gtk/gui.h>
 #include <gtk/progress.h>
@@ -578,7 +575,6 @@ namespace gui
 				   from,
 				   to,
 				   source_package,
-				   false,
 				   &post_thunk);
       }
 
@@ -605,13 +601,9 @@ namespace gui
      *
      *  \param entry         The download job to process.
      *
-     *  \param digested_file The pre-digested changelog, if one is
-     *                       available.
-     *
      *  This function must be invoked in the main thread.
      */
-    void process_changelog_job(const std::shared_ptr<preprocessed_changelog_job> &entry,
-			       const temp::name &digested_file)
+    void process_changelog_job(const std::shared_ptr<preprocessed_changelog_job> &entry)
     {
       logging::LoggerPtr logger = aptitude::Loggers::getAptitudeGtkChangelog();
 
@@ -666,221 +658,65 @@ namespace gui
       else
 	{
 
-	  // The normal flow here is that the download invokes
+	  // When the download finishes, it invokes
 	  // parse_and_view_changelog_download_trampoline, which tells
 	  // the parse thread to parse the changelog and invoke
 	  // finish_changelog_download_slot in the main thread when
 	  // it's done.
+	  Glib::RefPtr<Gtk::TextBuffer::Mark> endMark;
+	  Glib::RefPtr<Gtk::TextBuffer::ChildAnchor> anchor =
+	    Gtk::TextBuffer::ChildAnchor::create();
 
-	  // However, if we have a pre-digested changelog, we can call
-	  // out to the parse thread directly, bypassing the download
-	  // process.
-	  if(digested_file.valid())
-	    {
-	      LOG_TRACE(aptitude::Loggers::getAptitudeGtkChangelog(),
-			"Using a predigested file to display the changelog of "
-			<< target_info->get_source_package() << " "
-			<< target_info->get_source_version());
-
-	      Glib::RefPtr<Gtk::TextBuffer::Mark> endMark;
-
-	      {
-		const Gtk::TextBuffer::iterator begin_iter =
-		  textBuffer->get_iter_at_mark(beginMark);
-		const Gtk::TextBuffer::iterator end_iter =
-		  textBuffer->insert(begin_iter,
-				     cw::util::ssprintf(_("Parsing the changelog of %s version %s..."),
-							target_info->get_source_package().c_str(),
-							target_info->get_source_version().c_str()));
-
-		endMark = textBuffer->create_mark(end_iter);
-	      }
-
-	      // Bind up the buffer location, the buffer pointer, and the
-	      // source version with the finalization code (so we can
-	      // invoke it when the changelog downloads).
-	      //
-	      // The changelog continuation is triggered in the background
-	      // thread, so we need to safely wrap it and post it to the
-	      // main thread.
-	      const bool only_new = entry->get_only_new();
-	      std::shared_ptr<finish_changelog_download_info> download_info =
-		std::make_shared<finish_changelog_download_info>(beginMark, endMark, textBuffer,
-								 *current_info,
-								 only_new ? current_info->get_source_version() : "",
-								 only_new);
-
-	      const sigc::slot1<void, cw::util::ref_ptr<aptitude::apt::changelog> > finish_changelog_download_slot =
-		sigc::bind(sigc::ptr_fun(&finish_changelog_download),
-			   download_info);
-
-	      const safe_slot1<void, cw::util::ref_ptr<aptitude::apt::changelog> > finish_changelog_download_safe_slot =
-		make_safe_slot(finish_changelog_download_slot);
-
-	      parse_changelog_background(digested_file,
-					 finish_changelog_download_safe_slot,
-					 only_new ? current_info->get_source_version() : "",
-					 target_info->get_source_version(),
-					 target_info->get_source_package(),
-					 true,
-					 &post_thunk);
-	    }
-	  else
-	    {
-	      Glib::RefPtr<Gtk::TextBuffer::Mark> endMark;
-	      Glib::RefPtr<Gtk::TextBuffer::ChildAnchor> anchor =
-		Gtk::TextBuffer::ChildAnchor::create();
-
-	      {
-		const Gtk::TextBuffer::iterator begin_iter =
-		  textBuffer->get_iter_at_mark(beginMark);
-		Gtk::TextBuffer::iterator end_iter =
-		  textBuffer->insert(begin_iter,
-				     cw::util::ssprintf(_("Downloading the changelog of %s version %s..."),
-							   target_info->get_source_package().c_str(),
-							   target_info->get_source_version().c_str()));
-
-		end_iter = textBuffer->insert(end_iter, "\n");
-
-		end_iter = textBuffer->insert_child_anchor(end_iter, anchor);
-
-		end_iter = textBuffer->insert(end_iter, "\n");
-
-		endMark = textBuffer->create_mark(end_iter);
-	      }
-
-	      // A std::shared_ptr is used here instead of manage()
-	      // because I want to ensure that the C++ object is
-	      // destroyed when it runs out of references.  In
-	      // particular: if there is no text view any more, we
-	      // won't be able to add the progress bar to it and it
-	      // would never be deleted if I was relying on manage().
-	      // This way, the progress bar will be valid as long as I
-	      // need it, then get deleted.  (at least, I hope that's
-	      // what will happen)
-	      std::shared_ptr<Gtk::ProgressBar> progressBar(std::make_shared<Gtk::ProgressBar>());
-
-	      entry->add_child_at_anchor(*progressBar, anchor);
-	      progressBar->show();
-
-	      const bool only_new = entry->get_only_new();
-	      std::shared_ptr<finish_changelog_download_info> download_info =
-		std::make_shared<finish_changelog_download_info>(beginMark, endMark, textBuffer,
-								 *current_info,
-								 only_new ? current_info->get_source_version() : "",
-								 only_new);
-
-	      std::shared_ptr<changelog_download_callbacks> callbacks =
-		std::make_shared<changelog_download_callbacks>(download_info,
-							       only_new ? current_info->get_source_version() : "",
-							       target_info->get_source_version(),
-							       target_info->get_source_package(),
-							       target_info->get_source_version(),
-							       progressBar);
-
-	      aptitude::apt::get_changelog(target_info, callbacks, &post_thunk);
-	    }
-	}
-    }
-
-
-
-    // The following code powers the thread that checks for parsed
-    // (pre-digested) changelogs in the cache, handing each one that it
-    // finds off to the "display parsed changelog" code.  Each request
-    // contains a list of download jobs, and the ones whose parses are
-    // not found in the cache are passed off to be downloaded and/or
-    // parsed.
-
-    class check_cache_for_parsed_changelogs_job
-    {
-      std::shared_ptr<preprocessed_changelog_job> request;
-
-    public:
-      check_cache_for_parsed_changelogs_job(const std::shared_ptr<preprocessed_changelog_job> &_request)
-	: request(_request)
-      {
-      }
+	  {
+	    const Gtk::TextBuffer::iterator begin_iter =
+	      textBuffer->get_iter_at_mark(beginMark);
+	    Gtk::TextBuffer::iterator end_iter =
+	      textBuffer->insert(begin_iter,
+				 cw::util::ssprintf(_("Downloading the changelog of %s version %s..."),
+						    target_info->get_source_package().c_str(),
+						    target_info->get_source_version().c_str()));
 
-      const std::shared_ptr<preprocessed_changelog_job> &get_request() const { return request; }
-    };
+	    end_iter = textBuffer->insert(end_iter, "\n");
 
-    // TODO: show the individual requests.
-    std::ostream &operator<<(std::ostream &out,
-			     const check_cache_for_parsed_changelogs_job &job)
-    {
-      return out << "(job: " << *job.get_request() << ")";
-    }
+	    end_iter = textBuffer->insert_child_anchor(end_iter, anchor);
 
-    /** \brief A thread that preprocesses changelog jobs by checking for
-     *  parsed changelogs in the cache.
-     */
-    class check_cache_for_parsed_changelogs_thread
-      : public aptitude::util::job_queue_thread<check_cache_for_parsed_changelogs_thread,
-						check_cache_for_parsed_changelogs_job>
-    {
-      // Set to true when the global signal handlers are connected up.
-      static bool signals_connected;
-    public:
-      static logging::LoggerPtr get_log_category()
-      {
-	return aptitude::Loggers::getAptitudeGtkChangelogCache();
-      }
+	    end_iter = textBuffer->insert(end_iter, "\n");
 
-      check_cache_for_parsed_changelogs_thread()
-      {
-	if(!signals_connected)
-	  {
-	    cache_closed.connect(sigc::ptr_fun(&check_cache_for_parsed_changelogs_thread::stop));
-	    cache_reloaded.connect(sigc::ptr_fun(&check_cache_for_parsed_changelogs_thread::start));
-	    signals_connected = true;
+	    endMark = textBuffer->create_mark(end_iter);
 	  }
-      }
-
-      void process_job(const check_cache_for_parsed_changelogs_job &job)
-      {
-	logging::LoggerPtr logger(get_log_category());
 
-	const std::shared_ptr<preprocessed_changelog_job> &req = job.get_request();
-
-	temp::name predigested_file;
-
-	std::string uri;
-	if(!req->get_only_new())
-	  uri = ssprintf("changelog://%s/%s",
-			 req->get_target_info()->get_source_package().c_str(),
-			 req->get_target_info()->get_source_version().c_str());
-	else
-	  uri = ssprintf("delta-changelog://%s/%s/%s",
-			 req->get_target_info()->get_source_package().c_str(),
-			 req->get_current_info()->get_source_version().c_str(),
-			 req->get_target_info()->get_source_version().c_str());
-
-
-	LOG_TRACE(logger,
-		  "Changelog preparation thread: checking for the changelog of "
-		  << req->get_target_info()->get_source_package()
-		  << " " << req->get_target_info()->get_source_version()
-		  << " under the cache URI "
-		  << uri);
-
-	auto download_cache = get_download_cache();
-	predigested_file = download_cache && download_cache->getItem(uri);
-	if (predigested_file.valid())
-	  LOG_TRACE(logger, "Changelog preparation thread: found a predigested changelog for "
-		    << req->get_target_info()->get_source_package()
-		    << " " << req->get_target_info()->get_source_version()
-		    << " in the file " << predigested_file.get_name());
-
-	sigc::slot<void, std::shared_ptr<preprocessed_changelog_job>, temp::name>
-	  process_changelog_job_slot = sigc::ptr_fun(&process_changelog_job);
-
-	post_event(safe_bind(make_safe_slot(process_changelog_job_slot),
-			     req,
-			     predigested_file));
-      }
-    };
-    bool check_cache_for_parsed_changelogs_thread::signals_connected = false;
+	  // A std::shared_ptr is used here instead of manage()
+	  // because I want to ensure that the C++ object is
+	  // destroyed when it runs out of references.  In
+	  // particular: if there is no text view any more, we
+	  // won't be able to add the progress bar to it and it
+	  // would never be deleted if I was relying on manage().
+	  // This way, the progress bar will be valid as long as I
+	  // need it, then get deleted.  (at least, I hope that's
+	  // what will happen)
+	  std::shared_ptr<Gtk::ProgressBar> progressBar(std::make_shared<Gtk::ProgressBar>());
+
+	  entry->add_child_at_anchor(*progressBar, anchor);
+	  progressBar->show();
+
+	  const bool only_new = entry->get_only_new();
+	  std::shared_ptr<finish_changelog_download_info> download_info =
+	    std::make_shared<finish_changelog_download_info>(beginMark, endMark, textBuffer,
+							     *current_info,
+							     only_new ? current_info->get_source_version() : "",
+							     only_new);
+
+	  std::shared_ptr<changelog_download_callbacks> callbacks =
+	    std::make_shared<changelog_download_callbacks>(download_info,
+							   only_new ? current_info->get_source_version() : "",
+							   target_info->get_source_version(),
+							   target_info->get_source_package(),
+							   target_info->get_source_version(),
+							   progressBar);
+
+	  aptitude::apt::get_changelog(target_info, callbacks, &post_thunk);
+	}
+    }
   }
 
 
@@ -888,33 +724,21 @@ namespace gui
 
   // The top-level entry point for changelog fetching.
   //
-  // The overall changelog fetch process has three steps:
-  //
-  // 1. First, we check whether the changelog exists as a parsed entry
-  //    in the cache.  The URI used is one of:
-  //
-  //        changelog://PACKAGE/NEW_VERSION
-  //        delta-changelog://PACKAGE/CURRENT_VERSION/NEW_VERSION
+  // The overall changelog fetch process has two steps:
   //
-  //    In the second case, only "new" entries are present.  The
-  //    source package name is always used.
+  // 1. First, we check whether the changelog exists on disk or in the
+  //    file cache.
   //
-  // 2. Second, we check whether the remaining changelogs exist on
-  //    disk or in the file cache.
+  // 2. Otherwise, it is retrieved over the network.
   //
-  // 3. Finally, any changelogs not resolved by steps 1 and 2 are
-  //    retrieved over the network.
+  // Both steps are implemented in src/generic/pkg_changelog.{cc,h}
+  // using the central download queue.  (TODO: the code in this file
+  // should probably be generalized for use with, e.g., the curses
+  // frontend)
   //
-  // Step 1 is implemented in this file; 2 and 3 are implemented in
-  // src/generic/pkg_changelog.{cc,h} using the central download
-  // queue.  (TODO: the code in this file should probably be
-  // generalized for use with, e.g., the curses frontend)
-  //
-  // Changelogs retrieved in steps 2 and 3 are parsed, then cached for
-  // later use in step 1.  To conserve time, aptitude looks in the
-  // file cache for the parsed changelog once more before proceeding
-  // to parse it (the parse process is quite slow, hence all this
-  // caching).
+  // The changelog is then parsed in the background.  Only the raw
+  // changelog is cached: parsing it stops at the oldest version that
+  // is displayed, so it's cheap enough to redo each time.
 
 
 
@@ -943,8 +767,13 @@ namespace gui
 						   text_view_add_child_at_anchor,
 						   ver, only_new);
 
-    check_cache_for_parsed_changelogs_job job(preprocessed);
-    check_cache_for_parsed_changelogs_thread::add_job(job);
+    // Start the download once the caller is done with the iterator
+    // that's returned, since processing the job rewrites the text.
+    sigc::slot<void, std::shared_ptr<preprocessed_changelog_job> >
+      process_changelog_job_slot = sigc::ptr_fun(&process_changelog_job);
+
+    post_event(safe_bind(make_safe_slot(process_changelog_job_slot),
+			 preprocessed));
 
 
     return end;
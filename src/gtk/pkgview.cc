@@ -512,25 +512,36 @@ namespace gui
 
     bool limited = limit.valid();
 
-    std::vector<std::pair<pkgCache::PkgIterator, ref_ptr<structural_match> > > matches;
+    boost::dynamic_bitset<> matches;
     ref_ptr<search_cache> search_info(search_cache::create());
     if(limited)
       {
-	search(limit, search_info, matches, *apt_cache_file, *apt_package_records);
+	match_all_packages(limit, search_info, matches, *apt_cache_file, *apt_package_records);
+
+	// Filter useless packages up-front, so that they aren't
+	// counted in the total.
+	for(pkgCache::PkgIterator pkg = (*apt_cache_file)->PkgBegin();
+	    !pkg.end(); ++pkg)
+	  if(matches[pkg->ID] &&
+	     pkg.VersionList().end() && pkg.ProvidesList().end())
+	    matches.reset(pkg->ID);
 
 	int num = 0;
-	const int total = static_cast<int>(matches.size());
+	const int total = static_cast<int>(matches.count());
 
-	for(std::vector<std::pair<pkgCache::PkgIterator, ref_ptr<structural_match> > >::const_iterator
-	      it = matches.begin(); it != matches.end(); ++it)
+	for(pkgCache::PkgIterator pkg = (*apt_cache_file)->PkgBegin();
+	    !pkg.end(); ++pkg)
 	  {
+	    if(!matches[pkg->ID])
+	      continue;
+
 	    if(canceled->is_canceled())
 	      return;
 
 	    post_event(safe_bind(progress_callback, num, total));
 
 	    ++num;
-	    generator->add(it->first);
+	    generator->add(pkg);
 	  }
 
 	post_event(safe_bind(progress_callback, total, total));
@@ -229,6 +229,11 @@ namespace aptitude
     return Logger::getLogger("aptitude.resolver.search.costs");
   }
 
+  LoggerPtr Loggers::getAptitudeSearchIndex()
+  {
+    return Logger::getLogger("aptitude.searchIndex");
+  }
+
   LoggerPtr Loggers::getAptitudeTemp()
   {
     return Logger::getLogger("aptitude.temp");
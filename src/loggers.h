@@ -293,6 +293,13 @@ namespace aptitude
      */
     static logging::LoggerPtr getAptitudeResolverThread();
 
+    /** \brief The logger for the on-disk index used to speed up
+     *  text searches.
+     *
+     *  Name: aptitude.searchIndex
+     */
+    static logging::LoggerPtr getAptitudeSearchIndex();
+
     /** \brief The logger for messages related to temporary files. */
     static logging::LoggerPtr getAptitudeTemp();
 
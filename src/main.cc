@@ -41,6 +41,7 @@
 
 #include <generic/problemresolver/exceptions.h>
 
+#include <generic/util/log_writer.h>
 #include <generic/util/logging.h>
 #include <generic/util/temp.h>
 #include <generic/util/util.h>
@@ -59,6 +60,7 @@
 #include <cwidget/dialogs.h>
 
 #include <cmdline/cmdline_apt_proxy.h>
+#include <cmdline/cmdline_benchmark_resolver.h>
 #include <cmdline/cmdline_changelog.h>
 #include <cmdline/cmdline_check_resolver.h>
 #include <cmdline/cmdline_clean.h>
@@ -96,6 +98,9 @@
 
 #include <fstream>
 #include <locale>
+#include <sstream>
+
+#include <stdlib.h>
 
 #include "loggers.h"
 #include "progress.h"
@@ -560,9 +565,9 @@ void handle_message_logged(const char *sourceFilename,
                            log_level level,
                            LoggerPtr logger,
                            const std::string &msg,
-                           const std::string &filename)
+                           aptitude::util::log_writer *writer)
 {
-  if(filename == "-")
+  if(writer == NULL)
     {
       // HACK: Block logging to stdout if running in curses (c.f. problemresolver.h)
       if(cw::rootwin == (cw::cwindow) NULL)
@@ -575,19 +580,40 @@ void handle_message_logged(const char *sourceFilename,
     }
   else
     {
-      std::ofstream f(filename.c_str(), std::ios::app);
-      if(f)
-        do_message_logged(f,
-                          sourceFilename,
-                          sourceLineNumber,
-                          level,
-                          logger,
-                          msg);
+      // Format the message here, so that it has the time and thread
+      // of the caller, but leave the file I/O to the writer thread.
+      std::ostringstream line;
+      do_message_logged(line,
+                        sourceFilename,
+                        sourceLineNumber,
+                        level,
+                        logger,
+                        msg);
+      writer->write(line.str());
       // Since logging is just for debugging, I don't do anything if
       // the log file can't be opened.
     }
 }
 
+namespace
+{
+  // The writer for Aptitude::Logging::File, if it names a file.  Like
+  // the logging system itself, it is deliberately leaked, so that
+  // messages logged while the program is shutting down are safe; its
+  // thread is never stopped, so flush_log_file() is registered with
+  // atexit() to write out whatever is still queued.
+  std::shared_ptr<aptitude::util::log_writer> *log_file_writer = NULL;
+
+  // How many log messages can be waiting to be written.
+  const std::size_t log_file_queue_size = 4096;
+
+  void flush_log_file()
+  {
+    if(log_file_writer != NULL)
+      (*log_file_writer)->flush();
+  }
+}
+
 
 /** Signal handler
  *
@@ -1104,9 +1130,20 @@ int main(int argc, char *argv[])
   apply_config_file_logging_levels(aptcfg);
 
   if(!log_file.empty())
-    Logger::getLogger("")
-      ->connect_message_logged(sigc::bind(sigc::ptr_fun(&handle_message_logged),
-                                          log_file));
+    {
+      aptitude::util::log_writer *writer = NULL;
+      if(log_file != "-")
+        {
+          log_file_writer =
+            new std::shared_ptr<aptitude::util::log_writer>(aptitude::util::create_log_writer(log_file, log_file_queue_size));
+          writer = log_file_writer->get();
+          atexit(flush_log_file);
+        }
+
+      Logger::getLogger("")
+        ->connect_message_logged(sigc::bind(sigc::ptr_fun(&handle_message_logged),
+                                            writer));
+    }
 
   temp::initialize("aptitude");
 
@@ -1297,6 +1334,8 @@ int main(int argc, char *argv[])
 	    return cmdline_dump_resolver(argc-optind, argv+optind, status_fname);
 	  else if(!strcasecmp(argv[optind], "check-resolver"))
 	    return cmdline_check_resolver(argc-optind, argv+optind, status_fname);
+	  else if(!strcasecmp(argv[optind], "benchmark-resolver"))
+	    return cmdline_benchmark_resolver(argc-optind, argv+optind, status_fname);
 	  else if(!strcasecmp(argv[optind], "help"))
 	    {
 	      usage();
@@ -538,7 +538,7 @@ public:
 
   virtual void add_package(const pkgCache::PkgIterator &pkg, pkg_subtree *root)
   {
-    if(matching::get_match(filter, pkg, search_info, *apt_cache_file, *apt_package_records).valid())
+    if(matching::matches(filter, pkg, search_info, *apt_cache_file, *apt_package_records))
       chain->add_package(pkg, root);
   }
 
@@ -1208,8 +1208,20 @@ public:
     for(vector<match_entry>::const_iterator i = subgroups.begin();
 	i != subgroups.end(); ++i)
 	{
-	  ref_ptr<matching::structural_match> res(matching::get_match(i->pattern, pkg, search_info, *apt_cache_file, *apt_package_records));
-	  if(res.valid())
+	  // The structural match is only needed to fill in the match
+	  // groups that the title refers to; otherwise it's cheaper to
+	  // just test the pattern.
+	  ref_ptr<matching::structural_match> res;
+	  bool matched;
+	  if(!i->passthrough && i->tree_name.find(L'\\') != wstring::npos)
+	    {
+	      res = matching::get_match(i->pattern, pkg, search_info, *apt_cache_file, *apt_package_records);
+	      matched = res.valid();
+	    }
+	  else
+	    matched = matching::matches(i->pattern, pkg, search_info, *apt_cache_file, *apt_package_records);
+
+	  if(matched)
 	    {
 	      pkg_grouppolicy_factory * const local_chain =
 		i->chain != NULL ? i->chain : chain;
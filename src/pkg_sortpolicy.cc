@@ -26,12 +26,54 @@
 
 #include <cwidget/widgets/subtree.h>
 
+#include <algorithm>
+
+#include <limits.h>
+
 namespace cw = cwidget;
 namespace cwidget
 {
   using namespace widgets;
 }
 
+/** Rank the given items by a policy's own comparison, for policies
+ *  whose keys aren't numbers: equal items get the same rank.
+ */
+template<typename Policy>
+static
+void get_rank_keys(const Policy &policy,
+		   bool reversed,
+		   const std::vector<pkg_sort_item> &items,
+		   long long *keys, std::size_t stride)
+{
+  std::vector<std::size_t> order(items.size());
+  for(std::size_t i = 0; i < order.size(); ++i)
+    order[i] = i;
+
+  std::sort(order.begin(), order.end(),
+	    [&policy, &items] (std::size_t i, std::size_t j)
+	    {
+	      return policy.do_compare(items[i].first, items[i].second,
+				       items[j].first, items[j].second) < 0;
+	    });
+
+  long long rank = 0;
+  for(std::size_t k = 0; k < order.size(); ++k)
+    {
+      const pkg_sort_item &item(items[order[k]]);
+
+      if(k > 0)
+	{
+	  const pkg_sort_item &prev(items[order[k - 1]]);
+	  if(policy.do_compare(prev.first, prev.second,
+			       item.first, item.second) != 0)
+	    ++rank;
+	}
+
+      keys[order[k] * stride] = reversed ? -rank : rank;
+    }
+}
+
 // Blah, this is the easiest way to define trivial subclasses:
 // (not that far from lambda, actually)
 // Yes, I hate typing more than I have to.
@@ -57,6 +99,55 @@ public:						\
       return get_chain()->compare(pkg1, ver1, pkg2, ver2);\
     else					\
       return get_reversed()?-rval:rval;		\
+  }						\
+						\
+  void get_keys(const std::vector<pkg_sort_item> &items,	\
+		long long *keys, std::size_t stride) const	\
+  {						\
+    get_rank_keys(*this, get_reversed(), items, keys, stride);	\
+  }						\
+};						\
+						\
+pkg_sortpolicy *name(pkg_sortpolicy *chain, bool reversed)	\
+{						\
+  return new name##_impl(chain, reversed);	\
+}						\
+
+// Like PKG_SORTPOLICY_SUBCLASS, for policies that order packages by a
+// number: "code" computes the number of pkg and ver.
+#define PKG_SORTPOLICY_KEY_SUBCLASS(name,code)	\
+class name##_impl:public pkg_sortpolicy		\
+{						\
+public:						\
+  name##_impl(pkg_sortpolicy *_chain, bool _reversed)\
+  :pkg_sortpolicy(_chain, _reversed) {}		\
+						\
+						\
+  static inline long long get_key(const pkgCache::PkgIterator &pkg, \
+				  const pkgCache::VerIterator &ver) \
+  {						\
+    code					\
+  }						\
+						\
+  int compare(const pkgCache::PkgIterator &pkg1, const pkgCache::VerIterator &ver1, \
+	      const pkgCache::PkgIterator &pkg2, const pkgCache::VerIterator &ver2) const \
+  {						\
+    const long long key1=get_key(pkg1, ver1);	\
+    const long long key2=get_key(pkg2, ver2);	\
+    if(key1==key2)				\
+      return get_chain() ? get_chain()->compare(pkg1, ver1, pkg2, ver2) : 0;\
+    else					\
+      return (key1<key2) != get_reversed() ? -1 : 1;	\
+  }						\
+						\
+  void get_keys(const std::vector<pkg_sort_item> &items,	\
+		long long *keys, std::size_t stride) const	\
+  {						\
+    for(std::size_t i=0; i<items.size(); ++i)	\
+      {						\
+	const long long key=get_key(items[i].first, items[i].second);	\
+	keys[i*stride]=get_reversed() ? -key : key;	\
+      }						\
   }						\
 };						\
 						\
@@ -120,6 +211,79 @@ int pkg_sortpolicy_wrapper::compare(cw::treeitem *item1,
     return 0; // punt!
 }
 
+std::vector<std::size_t>
+pkg_sortpolicy_wrapper::get_order(const std::vector<cw::treeitem *> &items) const
+{
+  std::vector<std::size_t> others;
+  std::vector<std::size_t> packages;
+  std::vector<pkg_sort_item> package_items;
+
+  for(std::size_t i = 0; i < items.size(); ++i)
+    {
+      pkgCache::PkgIterator pkg;
+      pkgCache::VerIterator ver;
+
+      if(find_package_and_ver(items[i], pkg, ver))
+	{
+	  packages.push_back(i);
+	  package_items.push_back(pkg_sort_item(pkg, ver));
+	}
+      else
+	others.push_back(i);
+    }
+
+  // As in compare(), non-package stuff goes above all package stuff.
+  std::stable_sort(others.begin(), others.end(),
+		   [&items] (std::size_t i, std::size_t j)
+		   {
+		     return wcscmp(items[i]->tag(), items[j]->tag()) < 0;
+		   });
+
+  const std::vector<std::size_t> package_order(pkg_sort_keys(chain, package_items).get_order());
+
+  std::vector<std::size_t> order(others);
+  for(std::vector<std::size_t>::const_iterator it = package_order.begin();
+      it != package_order.end(); ++it)
+    order.push_back(packages[*it]);
+
+  return order;
+}
+
+pkg_sort_keys::pkg_sort_keys(const pkg_sortpolicy *policy,
+			     const std::vector<pkg_sort_item> &items)
+  : num_fields(0), num_items(items.size())
+{
+  for(const pkg_sortpolicy *p = policy; p != NULL; p = p->get_chain())
+    ++num_fields;
+
+  keys.resize(num_fields * items.size());
+  if(keys.empty())
+    return;
+
+  std::size_t field = 0;
+  for(const pkg_sortpolicy *p = policy; p != NULL; p = p->get_chain())
+    {
+      p->get_keys(items, &keys[field], num_fields);
+      ++field;
+    }
+}
+
+std::vector<std::size_t> pkg_sort_keys::get_order() const
+{
+  std::vector<std::size_t> order(num_items);
+  for(std::size_t i = 0; i < num_items; ++i)
+    order[i] = i;
+
+  if(num_fields > 0)
+    std::stable_sort(order.begin(), order.end(),
+		     [this] (std::size_t i, std::size_t j)
+		     {
+		       return compare(i, j) < 0;
+		     });
+
+  return order;
+}
+
 // TODO: Make these compare functions a simple less-than.  Only a
 // couple of places rely on these being able to do 3-way compare.
 // By-name sorting could then reuse pkg_name_lt.
@@ -136,75 +300,42 @@ PKG_SORTPOLICY_SUBCLASS(pkg_sortpolicy_name,
                         return cmp;);
 
 // installed-size-sorting, treats virtual packages as 0-size
-PKG_SORTPOLICY_SUBCLASS(pkg_sortpolicy_installed_size,
-			if(ver1.end() && ver2.end())
-			  return 0;
-			else if(ver1.end())
-			  return 1;
-			else if(ver2.end())
-			  return -1;
-			else if(ver1->InstalledSize<ver2->InstalledSize)
-			  return -1;
-			else if(ver1->InstalledSize>ver2->InstalledSize)
-			  return 1;
-			else
-			  return 0;);
+PKG_SORTPOLICY_KEY_SUBCLASS(pkg_sortpolicy_installed_size,
+			    // Virtual packages go last.
+			    if(ver.end())
+			      return LLONG_MAX;
+			    else
+			      return ver->InstalledSize;);
 
 // installed-size-change-sorting, treats virtual packages as 0-size
-PKG_SORTPOLICY_SUBCLASS(pkg_sortpolicy_installed_size_change,
-
-			const pkgCache::VerIterator& pkg1_desired = install_version(pkg1, (aptitudeDepCache &) (*apt_cache_file));
-			const pkgCache::VerIterator& pkg2_desired = install_version(pkg2, (aptitudeDepCache &) (*apt_cache_file));
+PKG_SORTPOLICY_KEY_SUBCLASS(pkg_sortpolicy_installed_size_change,
 
-			signed long long pkg1_instsizechange = 0;
-			if (pkg1.CurrentVer())    { pkg1_instsizechange -= pkg1.CurrentVer()->InstalledSize; }
-			if (! pkg1_desired.end()) { pkg1_instsizechange += pkg1_desired->InstalledSize;      }
+			    const pkgCache::VerIterator& desired = install_version(pkg, (aptitudeDepCache &) (*apt_cache_file));
 
-			signed long long pkg2_instsizechange = 0;
-			if (pkg2.CurrentVer())    { pkg2_instsizechange -= pkg2.CurrentVer()->InstalledSize; }
-			if (! pkg2_desired.end()) { pkg2_instsizechange += pkg2_desired->InstalledSize;      }
+			    signed long long instsizechange = 0;
+			    if (pkg.CurrentVer()) { instsizechange -= pkg.CurrentVer()->InstalledSize; }
+			    if (! desired.end())  { instsizechange += desired->InstalledSize;          }
 
-
-			if (pkg1_instsizechange > pkg2_instsizechange) {
-			  return +1;
-			}
-			else if (pkg1_instsizechange == pkg2_instsizechange) {
-			  return 0;
-			}
-			else {
-			  return -1;
-			}
+			    return instsizechange;
 	);
 
 // Priority sorting
-PKG_SORTPOLICY_SUBCLASS(pkg_sortpolicy_priority,
-			int pri1=ver1.end()?0:ver1->Priority;
-			int pri2=ver2.end()?0:ver2->Priority;
-			if(pri1<pri2)
-			  return -1;
-			else if(pri1==pri2)
-			  return 0;
-			else // if(pri1>pri2)
-			  return 1;);
+PKG_SORTPOLICY_KEY_SUBCLASS(pkg_sortpolicy_priority,
+			    return ver.end()?0:ver->Priority;);
 
 // debsize-sorting, treats virtual packages as 0-size
-PKG_SORTPOLICY_SUBCLASS(pkg_sortpolicy_debsize,
-			if(ver1.end() && ver2.end())
-			  return 0;
-			else if(ver1.end())
-			  return 1;
-			else if(ver2.end())
-			  return -1;
-			else if(ver1->Size<ver2->Size)
-			  return -1;
-			else if(ver1->Size>ver2->Size)
-			  return 1;
-			else
-			  return 0;);
+PKG_SORTPOLICY_KEY_SUBCLASS(pkg_sortpolicy_debsize,
+			    // Virtual packages go last.
+			    if(ver.end())
+			      return LLONG_MAX;
+			    else
+			      return ver->Size;);
 
 // Sort by version number
 PKG_SORTPOLICY_SUBCLASS(pkg_sortpolicy_ver,
-			if(ver1.end())
+			if(ver1.end() && ver2.end())
+			  return 0;
+			else if(ver1.end())
 			  return -1;
 			else if(ver2.end())
 			  return 1;
@@ -24,6 +24,10 @@
 #include <apt-pkg/pkgcache.h>
 #include <cwidget/widgets/treeitem.h>
 
+#include <cstddef>
+#include <utility>
+#include <vector>
+
 /** \brief Package sorting policies
  *
  * 
@@ -34,11 +38,17 @@
  * 
  *  \file pkg_sortpolicy.h
  */
+
+/** \brief A package and the version of it to sort by. */
+typedef std::pair<pkgCache::PkgIterator, pkgCache::VerIterator> pkg_sort_item;
+
 class pkg_sortpolicy
 {
   pkg_sortpolicy *chain;
 
   bool reversed;
+
+  friend class pkg_sort_keys;
 protected:
   const pkg_sortpolicy *get_chain() const {return chain;}
   bool get_reversed() const {return reversed;}
@@ -50,6 +60,73 @@ public:
 
   virtual int compare(const pkgCache::PkgIterator &pkg1, const pkgCache::VerIterator &ver1,
 		      const pkgCache::PkgIterator &pkg2, const pkgCache::VerIterator &ver2) const=0;
+
+  /** \brief Compute the sort key of this policy (but not of its
+   *  chain) for each of the given items.
+   *
+   *  Two items have the same key if and only if this policy
+   *  considers them equal, and the order of the keys is the order of
+   *  the items, reversed if the policy is.
+   *
+   *  \param items   The items to compute keys for.
+   *  \param keys    Where to store the key of the first item.
+   *  \param stride  The distance between the keys of two
+   *                 consecutive items.
+   */
+  virtual void get_keys(const std::vector<pkg_sort_item> &items,
+			long long *keys, std::size_t stride) const=0;
+};
+
+/** \brief The sort keys of a list of items under a chain of sort
+ *  policies.
+ *
+ *  Each policy in the chain contributes one integer to the key of
+ *  each item; the keys are extracted once, into a single array, so
+ *  sorting a large list compares short rows of integers instead of
+ *  calling the virtual compare() chain for each pair of items.
+ */
+class pkg_sort_keys
+{
+  std::size_t num_fields;
+  std::size_t num_items;
+  // The keys of each item, one row of num_fields numbers per item.
+  std::vector<long long> keys;
+
+public:
+  /** \brief Extract the keys of the given items.
+   *
+   *  \param policy  The sort policy chain, or \b NULL to consider all
+   *                 items equal.
+   *  \param items   The items to sort.
+   */
+  pkg_sort_keys(const pkg_sortpolicy *policy,
+		const std::vector<pkg_sort_item> &items);
+
+  /** \brief Compare the items with the given indices.
+   *
+   *  \return a negative number, zero or a positive number if the
+   *  first item sorts before, with or after the second one.
+   */
+  int compare(std::size_t i, std::size_t j) const
+  {
+    const long long *key1 = keys.data() + i * num_fields;
+    const long long *key2 = keys.data() + j * num_fields;
+
+    for(std::size_t f = 0; f < num_fields; ++f)
+      {
+	if(key1[f] != key2[f])
+	  return key1[f] < key2[f] ? -1 : 1;
+      }
+
+    return 0;
+  }
+
+  /** \brief Return the indices of the items in sorted order.
+   *
+   *  The sort is stable: items with equal keys keep their relative
+   *  order.
+   */
+  std::vector<std::size_t> get_order() const;
 };
 
 // This is an experiment..I'm using factories to avoid a massively oversized
@@ -77,6 +154,15 @@ public:
   pkg_sortpolicy_wrapper(pkg_sortpolicy *_chain):chain(_chain) {}
 
   int compare(cwidget::widgets::treeitem *item1, cwidget::widgets::treeitem *item2) const;
+
+  /** \brief Return the indices of the given tree items in sorted
+   *  order.
+   *
+   *  This gives the same order as a stable sort using compare(), but
+   *  the package of each item is looked up once and the items are
+   *  sorted by their pkg_sort_keys.
+   */
+  std::vector<std::size_t> get_order(const std::vector<cwidget::widgets::treeitem *> &items) const;
   bool operator()(cwidget::widgets::treeitem *item1, cwidget::widgets::treeitem *item2)
   {
     return (compare(item1, item2)<0);
@@ -19,6 +19,7 @@
 //  Boston, MA 02110-1301, USA.
 
 #include "pkg_subtree.h"
+#include "pkg_sortpolicy.h"
 
 #include <generic/apt/apt.h>
 
@@ -48,6 +49,34 @@ void pkg_subtree::paint(cw::tree *win, int y, bool hierarchical,
   cw::subtree<pkg_tree_node>::paint(win, y, hierarchical, name_to_paint);
 }
 
+void pkg_subtree::sort(cw::sortpolicy &sort_method)
+{
+  pkg_sortpolicy_wrapper * const sorter =
+    dynamic_cast<pkg_sortpolicy_wrapper *>(&sort_method);
+
+  if(sorter == NULL)
+    {
+      cw::subtree<pkg_tree_node>::sort(sort_method);
+      return;
+    }
+
+  std::vector<pkg_tree_node *> children;
+  std::vector<cw::treeitem *> items;
+  for(child_iterator i=get_children_begin(); i!=get_children_end(); i++)
+    {
+      (*i)->sort(sort_method);
+      children.push_back(*i);
+      items.push_back(*i);
+    }
+
+  const std::vector<std::size_t> order(sorter->get_order(items));
+
+  // Store the children back into the list in their new order.
+  std::vector<std::size_t>::const_iterator it = order.begin();
+  for(child_iterator i=get_children_begin(); i!=get_children_end(); i++, it++)
+    *i = children[*it];
+}
+
 const wchar_t *pkg_subtree::tag()
 {
   return name.c_str();
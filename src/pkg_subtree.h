@@ -70,6 +70,16 @@ public:
 
   virtual void paint(cwidget::widgets::tree *win, int y, bool hierarchical,
 		     const cwidget::style &st);
+
+  using cwidget::widgets::subtree<pkg_tree_node>::sort;
+
+  /** \brief Sort this tree and its children.
+   *
+   *  Package sort policies (pkg_sortpolicy_wrapper) compute the sort
+   *  keys of all the children at once; other policies are applied as
+   *  usual.
+   */
+  virtual void sort(cwidget::widgets::sortpolicy &sort_method);
   virtual const wchar_t *tag();
   virtual const wchar_t *label();
 
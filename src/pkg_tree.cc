@@ -40,6 +40,7 @@
 
 #include <generic/apt/apt.h>
 #include <generic/apt/config_signal.h>
+#include <generic/apt/matching/compile_pattern.h>
 #include <generic/apt/matching/match.h>
 #include <generic/apt/matching/parse.h>
 #include <generic/apt/matching/pattern.h>
@@ -100,10 +101,21 @@ pkg_tree::pkg_tree(const std::string &def_grouping,
 void pkg_tree::handle_cache_close()
 {
   set_root(NULL);
+
+  package_states_changed_connection.disconnect();
+  limit_matches.clear();
+  changed_packages.clear();
+}
+
+void pkg_tree::handle_package_states_changed(const std::set<pkgCache::PkgIterator> *changed)
+{
+  if(changed != NULL)
+    changed_packages.insert(changed->begin(), changed->end());
 }
 
 pkg_tree::~pkg_tree()
 {
+  package_states_changed_connection.disconnect();
   delete sorting;
 }
 
@@ -155,8 +167,6 @@ void pkg_tree::set_sorting(const std::wstring &s)
 
 bool pkg_tree::build_tree(OpProgress &progress)
 {
-  bool rval;
-
   if(!initialized)
     {
       cache_closed.connect(sigc::mem_fun(*this, &pkg_tree::handle_cache_close));
@@ -166,6 +176,33 @@ bool pkg_tree::build_tree(OpProgress &progress)
       initialized=true;
     }
 
+  changed_packages.clear();
+  limit_matches.clear();
+
+  if(grouping && apt_cache_file)
+    {
+      package_states_changed_connection.disconnect();
+      package_states_changed_connection =
+	(*apt_cache_file)->package_states_changed.connect(sigc::mem_fun(*this, &pkg_tree::handle_package_states_changed));
+
+      if(limit.valid())
+	{
+	  ref_ptr<matching::search_cache> search_info(matching::search_cache::create());
+
+	  matching::match_all_packages(limit, search_info,
+				       limit_matches,
+				       *apt_cache_file,
+				       *apt_package_records);
+	}
+    }
+
+  return populate_tree(progress);
+}
+
+bool pkg_tree::populate_tree(OpProgress &progress)
+{
+  bool rval;
+
   reset_incsearch();
 
   set_root(NULL);
@@ -182,75 +219,39 @@ bool pkg_tree::build_tree(OpProgress &progress)
 
       mytree->set_depth(-1);
 
-      if(limit.valid())
-	{
-	  ref_ptr<matching::search_cache> search_info(matching::search_cache::create());
+      const bool limited = limit.valid();
 
-	  std::vector<std::pair<pkgCache::PkgIterator, cwidget::util::ref_ptr<matching::structural_match> > > matches;
-	  matching::search(limit, search_info,
-			   matches,
-			   *apt_cache_file,
-			   *apt_package_records);
+      int progress_num = 0;
+      int progress_total = limited
+	? limit_matches.count()
+	: (*apt_cache_file)->Head().PackageCount;
+      // only update if we're going to increase 10% or so, minimum 1 (to
+      // avoid divide by zero)
+      int update_progress_10pct = std::max(progress_total / 10, 1);
 
+      for(pkgCache::PkgIterator pkg = (*apt_cache_file)->PkgBegin(); !pkg.end(); ++pkg)
+	{
+	  if(limited && !limit_matches[pkg->ID])
+	    continue;
 
-	  int progress_num = 0;
-	  int progress_total = matches.size();
-	  // only update if we're going to increase 10% or so, minimum 1 (to
-	  // avoid divide by zero)
-	  int update_progress_10pct = std::max(progress_total / 10, 1);
+	  cache_empty = false;
 
-	  for(std::vector<std::pair<pkgCache::PkgIterator, cwidget::util::ref_ptr<matching::structural_match> > >::const_iterator
-		it = matches.begin(); it != matches.end(); ++it)
+	  // don't update on every cycle
+	  if ((++progress_num % update_progress_10pct) == 1)
 	    {
-	      pkgCache::PkgIterator pkg(it->first);
-
-	      cache_empty = false;
-
-	      // don't update on every cycle
-	      if ((++progress_num % update_progress_10pct) == 1)
-		{
-		  progress.OverallProgress(progress_num, progress_total, 1, _("Building view"));
-		}
-
-	      // Filter useless packages up-front.
-	      if(pkg.VersionList().end() && pkg.ProvidesList().end())
-		continue;
-
-	      empty = false;
-	      grouper->add_package(pkg, mytree);
+	      progress.OverallProgress(progress_num, progress_total, 1, _("Building view"));
 	    }
 
-	  progress.OverallProgress(progress_total, progress_total, 1, _("Building view"));
-	}
-      else
-	{
-	  int progress_num = 0;
-	  int progress_total = (*apt_cache_file)->Head().PackageCount;
-	  // only update if we're going to increase 10% or so, minimum 1 (to
-	  // avoid divide by zero)
-	  int update_progress_10pct = std::max(progress_total / 10, 1);
-
-	  for(pkgCache::PkgIterator pkg = (*apt_cache_file)->PkgBegin(); !pkg.end(); ++pkg)
-	    {
-	      cache_empty = false;
-
-	      // don't update on every cycle
-	      if ((++progress_num % update_progress_10pct) == 1)
-		{
-		  progress.OverallProgress(progress_num, progress_total, 1, _("Building view"));
-		}
+	  // Filter useless packages up-front.
+	  if(pkg.VersionList().end() && pkg.ProvidesList().end())
+	    continue;
 
-	      // Filter useless packages up-front.
-	      if(pkg.VersionList().end() && pkg.ProvidesList().end())
-		continue;
-
-	      empty = false;
-	      grouper->add_package(pkg, mytree);
-	    }
-
-	  progress.OverallProgress(progress_total, progress_total, 1, _("Building view"));
+	  empty = false;
+	  grouper->add_package(pkg, mytree);
 	}
 
+      progress.OverallProgress(progress_total, progress_total, 1, _("Building view"));
+
       pkg_sortpolicy_wrapper sorter(sorting);
       mytree->sort(sorter);
 
@@ -268,6 +269,41 @@ bool pkg_tree::build_tree(OpProgress &progress)
   return rval;
 }
 
+bool pkg_tree::rematch_limit(const std::set<pkgCache::PkgIterator> &changed)
+{
+  if(limit_matches.size() != (*apt_cache_file)->Head().PackageCount ||
+     matching::pattern_depends_on_other_packages(limit))
+    return false;
+
+  ref_ptr<matching::search_cache> search_info(matching::search_cache::create());
+
+  for(std::set<pkgCache::PkgIterator>::const_iterator it = changed.begin();
+      it != changed.end(); ++it)
+    limit_matches[(*it)->ID] = matching::matches(limit, *it, search_info,
+						 *apt_cache_file,
+						 *apt_package_records);
+
+  return true;
+}
+
+void pkg_tree::update_tree()
+{
+  std::set<pkgCache::PkgIterator> changed;
+  changed.swap(changed_packages);
+
+  if(changed.empty() || !grouping || !apt_cache_file)
+    return;
+
+  if(limit.valid() && !rematch_limit(changed))
+    {
+      build_tree();
+      return;
+    }
+
+  OpProgress progress;
+  populate_tree(progress);
+}
+
 bool pkg_tree::build_tree()
 {
   progress_ref p=gen_progress_bar();
@@ -29,6 +29,12 @@
 
 #include <generic/apt/matching/pattern.h>
 
+#include <boost/dynamic_bitset.hpp>
+
+#include <sigc++/connection.h>
+
+#include <set>
+
 /** \brief Uses the cwidget::widgets::tree classes to display a tree containing packages
  *
  * 
@@ -67,8 +73,41 @@ class pkg_tree:public apt_undo_tree
   static cwidget::widgets::editline::history_list limit_history, grouping_history,
     sorting_history;
 
+  /** \brief The packages that matched the limit when the tree was
+   *  last built or updated, indexed by package ID.
+   *
+   *  Empty if there is no limit.
+   */
+  boost::dynamic_bitset<> limit_matches;
+
+  /** \brief The packages whose state changed since the tree was
+   *  last built or updated.
+   */
+  std::set<pkgCache::PkgIterator> changed_packages;
+
+  sigc::connection package_states_changed_connection;
+
   void handle_cache_close();
 
+  void handle_package_states_changed(const std::set<pkgCache::PkgIterator> *changed);
+
+  /** \brief Test the given packages against the limit again.
+   *
+   *  \return \b false if the limit has to be evaluated against the
+   *  whole cache instead: it wasn't evaluated against this cache
+   *  yet, or it looks at other packages (e.g., through ?depends or
+   *  ?broken), whose matches might have changed as well.
+   */
+  bool rematch_limit(const std::set<pkgCache::PkgIterator> &changed);
+
+  /** \brief Replace the tree by running every package that matched
+   *  the limit through the grouping policy.
+   *
+   *  \return \b false if the package cache is not empty but no
+   *  package was placed in the tree.
+   */
+  bool populate_tree(OpProgress &progress);
+
   /** Set up the limit and handle a few other things. */
   void init(const char *limitstr);
 protected:
@@ -131,6 +170,18 @@ public:
    */
   bool build_tree();
 
+  /** \brief Regroup the tree after some packages changed state.
+   *
+   *  Only the packages whose state changed since the tree was last
+   *  built or regrouped are tested against the limit again; the
+   *  result for every other package is reused.  Every package that
+   *  matches is then grouped and sorted again, since the grouping
+   *  policies can't move or remove a package once it has been
+   *  added.  Unlike build_tree(), the tree is replaced even if it
+   *  becomes empty.
+   */
+  void update_tree();
+
   void set_grouping(pkg_grouppolicy_factory *_grouping);
   void set_grouping(const std::wstring &s);
   void set_sorting(pkg_sortpolicy *_sorting);
@@ -566,7 +566,7 @@ void pkg_ver_item::select(undo_group *undo)
 				       undo);
 	  // Only put a Hold on it if we were installing a different version
 	  // (as opposed to deleting the package altogether)
-	  (*apt_cache_file)->get_ext_state(version.ParentPkg()).selection_state=pkgCache::State::Install;
+	  (*apt_cache_file)->modify_ext_state(version.ParentPkg()).selection_state=pkgCache::State::Install;
 	}
     }
   else
@@ -587,7 +587,7 @@ void pkg_ver_item::remove(undo_group *undo)
       if((*apt_cache_file)[version.ParentPkg()].iFlags&pkgDepCache::ReInstall)
 	{
 	  (*apt_cache_file)->mark_keep(version.ParentPkg(), false, false, undo);
-	  (*apt_cache_file)->get_ext_state(version.ParentPkg()).selection_state=pkgCache::State::Install;
+	  (*apt_cache_file)->modify_ext_state(version.ParentPkg()).selection_state=pkgCache::State::Install;
 	}
       else
 	(*apt_cache_file)->mark_delete(version.ParentPkg(), false, false, undo);
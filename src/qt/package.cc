@@ -127,7 +127,7 @@ namespace aptitude
       package::tag_iterator package::tags_begin() const
       {
         if(!tags)
-          tags = aptitude::apt::get_tags(pkg);
+          load_tags();
 
         return (*tags).begin();
       }
@@ -135,11 +135,21 @@ namespace aptitude
       package::tag_iterator package::tags_end() const
       {
         if(!tags)
-          tags = aptitude::apt::get_tags(pkg);
+          load_tags();
 
         return (*tags).end();
       }
 
+      void package::load_tags() const
+      {
+        const tag_set pkg_tags(get_tags(pkg));
+
+        tags = std::vector<tag>();
+        for(tag_set::const_iterator it = pkg_tags.begin();
+            it != pkg_tags.end(); ++it)
+          tags->push_back(*it);
+      }
+
       void package::load_versions() const
       {
         versions = std::vector<version_ptr>();
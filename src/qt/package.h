@@ -47,6 +47,7 @@
 #endif
 
 using aptitude::apt::tag;
+using aptitude::apt::tag_set;
 using boost::optional;
 
 namespace aptitude
@@ -83,10 +84,13 @@ namespace aptitude
         mutable boost::optional<std::string> section;
         mutable boost::optional<std::string> short_desc_fallback;
         mutable boost::optional<std::string> source_package;
-        mutable boost::optional<std::set<tag> > tags;
+        // A copy of the tags: a tag_set is only valid until the tag
+        // database is reloaded, which can happen while this object lives.
+        mutable boost::optional<std::vector<tag> > tags;
         mutable boost::optional<std::vector<version_ptr> > versions;
 
         void load_versions() const;
+        void load_tags() const;
 
         /** \brief Create a new package object for the given PkgIterator. */
         explicit package(const pkgCache::PkgIterator &_pkg);
@@ -98,7 +102,7 @@ namespace aptitude
         ~package();
 
         typedef std::vector<version_ptr>::const_iterator version_iterator;
-        typedef std::set<tag>::const_iterator tag_iterator;
+        typedef std::vector<tag>::const_iterator tag_iterator;
 
         /** \brief Retrieve all available versions of this package. */
         version_iterator versions_begin() const;
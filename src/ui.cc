@@ -1519,7 +1519,7 @@ static void do_show_preview()
 static void fixer_dialog_done()
 {
   if(active_preview_tree.valid())
-    active_preview_tree->build_tree();
+    active_preview_tree->update_tree();
   do_package_run_or_show_preview();
 }
 
@@ -1583,7 +1583,7 @@ static void auto_fix_broken()
     delete undo;
 
   if(active_preview_tree.valid())
-    active_preview_tree->build_tree();
+    active_preview_tree->update_tree();
 }
 
 
@@ -1766,8 +1766,8 @@ void do_package_run_or_show_preview()
 	}
       else
 	{
-	  active_preview_tree->build_tree();
-	  // We need to rebuild the tree since this is called after a
+	  active_preview_tree->update_tree();
+	  // We need to update the tree since this is called after a
 	  // broken-fixing operation.  This feels like a hack, though..
 	  active_preview->show();
 	}
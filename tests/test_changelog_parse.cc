@@ -0,0 +1,221 @@
+// Tests for the Debian changelog parser.
+//
+//   This program is free software; you can redistribute it and/or
+//   modify it under the terms of the GNU General Public License as
+//   published by the Free Software Foundation; either version 2 of
+//   the License, or (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//   General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program; see the file COPYING.  If not, write to
+//   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+//   Boston, MA 02110-1301, USA.
+
+// Local includes:
+#include <generic/apt/changelog_parse.h>
+#include <generic/util/temp.h>
+
+// System includes:
+#include <apt-pkg/configuration.h>
+#include <apt-pkg/error.h>
+#include <apt-pkg/fileutl.h>
+#include <apt-pkg/init.h>
+#include <apt-pkg/pkgsystem.h>
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+namespace cw = cwidget;
+
+using aptitude::apt::changelog;
+using aptitude::apt::changelog_entry;
+using aptitude::apt::parse_changelog;
+
+namespace
+{
+  const std::string sampleChangelog = "zenity (2.28.0-1) unstable; urgency=low\n\
+\n\
+  * New upstream release.\n\
+  * debian/control:\n\
+    - Bumped standards-version to 3.8.3. No changes needed.\n\
+\n\
+  * debian/rules:\n\
+    - simple-patchsys include removed.\n\
+\n\
+ -- Andrea Veri <andrea.veri89@gmail.com>  Thu, 24 Sep 2009 18:47:12 +0200\n\
+\n\
+zenity (2.26.0-2) unstable  experimental; urgency=MEDIUM, binary-only=yes\n\
+\n\
+  * Only conflict with libgtkada-bin << 2.12.0-4, add replaces.\n\
+    Closes: #533867.\n\
+\n\
+ -- Josselin Mouette <joss@debian.org>  Tue, 18 Aug 2009 18:23:10 +0200\n\
+\n\
+zenity (2.26.0-1) unstable; urgency=low\n\
+\n\
+  * New upstream release.\n\
+\n\
+ -- Josselin Mouette <joss@debian.org>  Mon, 16 Mar 2009 12:00:00 +0100\n\
+\n\
+Local variables:\n\
+mode: debian-changelog\n\
+End:\n";
+}
+
+class ChangelogParseTest : public CppUnit::TestFixture
+{
+  CPPUNIT_TEST_SUITE(ChangelogParseTest);
+
+  CPPUNIT_TEST(testParse);
+  CPPUNIT_TEST(testFrom);
+  CPPUNIT_TEST(testCompressed);
+  CPPUNIT_TEST(testInvalid);
+
+  CPPUNIT_TEST_SUITE_END();
+
+  static void write_file(const std::string &filename,
+			 const std::string &contents,
+			 FileFd::CompressMode compression)
+  {
+    FileFd out;
+    CPPUNIT_ASSERT(out.Open(filename,
+			    FileFd::WriteOnly | FileFd::Create | FileFd::Empty,
+			    compression));
+    CPPUNIT_ASSERT(out.Write(contents.c_str(), contents.size()));
+    CPPUNIT_ASSERT(out.Close());
+  }
+
+  /** \brief Return the versions in the changelog, separated by
+   *  spaces.
+   */
+  static std::string versions(const cw::util::ref_ptr<changelog> &cl)
+  {
+    std::string rval;
+    for(changelog::const_iterator it = cl->begin(); it != cl->end(); ++it)
+      {
+	if(!rval.empty())
+	  rval += " ";
+	rval += (*it)->get_version();
+      }
+
+    return rval;
+  }
+
+public:
+  void setUp()
+  {
+    temp::initialize("testChangelogParse");
+
+    // The parser compares versions using the system's versioning
+    // scheme.
+    if(_system == NULL)
+      {
+	CPPUNIT_ASSERT(pkgInitConfig(*_config));
+	CPPUNIT_ASSERT(pkgInitSystem(*_config, _system));
+      }
+  }
+
+  void tearDown()
+  {
+    temp::shutdown();
+  }
+
+  void testParse()
+  {
+    temp::name tn("changelog");
+    write_file(tn.get_name(), sampleChangelog, FileFd::None);
+
+    cw::util::ref_ptr<changelog> cl(parse_changelog(tn.get_name()));
+    CPPUNIT_ASSERT(cl.valid());
+    CPPUNIT_ASSERT_EQUAL(std::string("2.28.0-1 2.26.0-2 2.26.0-1"), versions(cl));
+
+    const cw::util::ref_ptr<changelog_entry> &first(*cl->begin());
+    CPPUNIT_ASSERT_EQUAL(std::string("zenity"), first->get_source());
+    CPPUNIT_ASSERT_EQUAL(std::string("unstable"), first->get_distribution());
+    CPPUNIT_ASSERT_EQUAL(std::string("low"), first->get_urgency());
+    CPPUNIT_ASSERT_EQUAL(std::string("Andrea Veri <andrea.veri89@gmail.com>"),
+			 first->get_maintainer());
+    CPPUNIT_ASSERT_EQUAL(std::string("Thu, 24 Sep 2009 18:47:12 +0200"),
+			 first->get_date_str());
+    CPPUNIT_ASSERT(first->get_could_parse_date());
+
+    // The text is laid out as parsechangelog used to write it.
+    CPPUNIT_ASSERT_EQUAL(std::string("zenity (2.28.0-1) unstable; urgency=low\n\
+ .\n\
+   * New upstream release.\n\
+   * debian/control:\n\
+     - Bumped standards-version to 3.8.3. No changes needed.\n\
+ .\n\
+   * debian/rules:\n\
+     - simple-patchsys include removed."),
+			 first->get_changes());
+
+    const cw::util::ref_ptr<changelog_entry> &second(*(cl->begin() + 1));
+    CPPUNIT_ASSERT_EQUAL(std::string("unstable experimental"), second->get_distribution());
+    CPPUNIT_ASSERT_EQUAL(std::string("medium"), second->get_urgency());
+
+    bool found_closes = false;
+    const std::string &changes(second->get_changes());
+    const std::vector<aptitude::apt::changelog_element> &elements =
+      second->get_elements()->get_elements();
+    for(std::vector<aptitude::apt::changelog_element>::const_iterator it =
+	  elements.begin(); it != elements.end(); ++it)
+      if(it->get_type() == aptitude::apt::changelog_element::closes_type)
+	{
+	  CPPUNIT_ASSERT_EQUAL(std::string("533867"),
+			       std::string(changes, it->get_begin(),
+					   it->get_end() - it->get_begin()));
+	  found_closes = true;
+	}
+    CPPUNIT_ASSERT(found_closes);
+  }
+
+  void testFrom()
+  {
+    temp::name tn("changelog");
+    write_file(tn.get_name(), sampleChangelog, FileFd::None);
+
+    // The entry for the starting version is included...
+    CPPUNIT_ASSERT_EQUAL(std::string("2.28.0-1 2.26.0-2"),
+			 versions(parse_changelog(tn.get_name(), "2.26.0-2")));
+    // ...and if it isn't in the changelog, nothing older is.
+    CPPUNIT_ASSERT_EQUAL(std::string("2.28.0-1"),
+			 versions(parse_changelog(tn.get_name(), "2.27")));
+    CPPUNIT_ASSERT_EQUAL(std::string(""),
+			 versions(parse_changelog(tn.get_name(), "3.0")));
+  }
+
+  void testCompressed()
+  {
+    // The compression is detected from the extension.
+    temp::name tn("changelog");
+    const std::string filename(tn.get_name() + ".gz");
+    write_file(filename, sampleChangelog, FileFd::Gzip);
+
+    cw::util::ref_ptr<changelog> cl(parse_changelog(filename, "2.26.0-1"));
+    unlink(filename.c_str());
+
+    CPPUNIT_ASSERT(cl.valid());
+    CPPUNIT_ASSERT_EQUAL(std::string("2.28.0-1 2.26.0-2 2.26.0-1"), versions(cl));
+  }
+
+  void testInvalid()
+  {
+    temp::name tn("changelog");
+    write_file(tn.get_name(), "This is not a changelog.\n\n  Really.\n", FileFd::None);
+
+    CPPUNIT_ASSERT(!parse_changelog(tn.get_name()).valid());
+    CPPUNIT_ASSERT(!parse_changelog(tn.get_name() + ".missing").valid());
+    _error->Discard();
+  }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(ChangelogParseTest);
@@ -46,6 +46,7 @@ class Choice_Set_Test : public CppUnit::TestFixture
   CPPUNIT_TEST(testRemoveOverlaps);
   CPPUNIT_TEST(testGetVersionOf);
   CPPUNIT_TEST(testClone);
+  CPPUNIT_TEST(testHash);
   CPPUNIT_TEST(testContainsChoice);
   CPPUNIT_TEST(testContainsChoiceSet);
   // No test for for_each(), because it's tested in testInsertNarrow
@@ -367,6 +368,47 @@ public:
     CPPUNIT_ASSERT_EQUAL(s, s.clone());
   }
 
+  // Check that the hash depends only on the contents of the set, not
+  // on how it was built.
+  void testHash()
+  {
+    choice_set s1;
+    s1.insert_or_narrow(make_install_version(av1));
+    s1.insert_or_narrow(make_install_version(cv3));
+    s1.insert_or_narrow(make_break_soft_dep(av2d1));
+    s1.insert_or_narrow(make_install_version_from_dep_source(av1, av3d1));
+
+    choice_set s2;
+    s2.insert_or_narrow(make_break_soft_dep(bv2d1));
+    s2.insert_or_narrow(make_break_soft_dep(av2d1));
+    s2.insert_or_narrow(make_install_version_from_dep_source(av1, av3d1));
+    s2.insert_or_narrow(make_install_version(bv1));
+    s2.insert_or_narrow(make_install_version_from_dep_source(cv3, bv2d1));
+    s2.insert_or_narrow(make_install_version(cv3));
+    s2.insert_or_narrow(make_install_version(av1));
+    s2.remove_overlaps(make_install_version(bv1));
+    s2.remove_overlaps(make_break_soft_dep(bv2d1));
+    s2.remove_overlaps(make_install_version_from_dep_source(cv3, bv2d1));
+    s2.insert_or_narrow(make_install_version(cv3));
+
+    CPPUNIT_ASSERT_EQUAL(s1, s2);
+    CPPUNIT_ASSERT_EQUAL(s1.get_hash(), s2.get_hash());
+    CPPUNIT_ASSERT_EQUAL(s1.get_hash(), s1.clone().get_hash());
+
+    // Removing a choice that isn't in the set leaves the hash alone.
+    s2.remove_overlaps(make_break_soft_dep(av3d1));
+    CPPUNIT_ASSERT_EQUAL(s1.get_hash(), s2.get_hash());
+
+    s2.remove_overlaps(make_break_soft_dep(av2d1));
+    CPPUNIT_ASSERT(s1 != s2);
+
+    choice_set empty;
+    s2.remove_overlaps(make_install_version(av1));
+    s2.remove_overlaps(make_install_version(cv3));
+    CPPUNIT_ASSERT_EQUAL(empty, s2);
+    CPPUNIT_ASSERT_EQUAL(empty.get_hash(), s2.get_hash());
+  }
+
   void testGetVersionOf()
   {
     choice_set s;
@@ -12,8 +12,12 @@
 
 #include <apt-pkg/fileutl.h>
 
+#include <atomic>
+#include <chrono>
 #include <fstream>
 #include <memory>
+#include <sstream>
+#include <thread>
 
 #include <libgen.h>
 
@@ -149,6 +153,23 @@ public:
       }									\
   } while(0)
 
+// Read an item of the cache into memory; returns false if the key
+// isn't in the cache.
+bool readCachedItem(const std::shared_ptr<file_cache> &cache,
+		    const std::string &key,
+		    std::string &contents)
+{
+  temp::name found(cache->getItem(key));
+  if(!found.valid())
+    return false;
+
+  std::ifstream in(found.get_name().c_str());
+  std::ostringstream buf;
+  buf << in.rdbuf();
+  contents = buf.str();
+  return true;
+}
+
 struct fileCacheTestInfo
 {
   temp::name infilename1;
@@ -304,6 +325,110 @@ BOOST_FIXTURE_TEST_CASE(fileCacheModifiedTime, usingTemp)
   BOOST_CHECK_EQUAL(mtime3, testInfo.time3);
 }
 
+BOOST_AUTO_TEST_CASE(fileCacheParseCompressionMethod)
+{
+  file_cache::compression_method method = file_cache::compress_zlib;
+
+  BOOST_CHECK(file_cache::parse_compression_method("none", method));
+  BOOST_CHECK_EQUAL(method, file_cache::compress_none);
+
+  BOOST_CHECK(file_cache::parse_compression_method("zlib", method));
+  BOOST_CHECK_EQUAL(method, file_cache::compress_zlib);
+
+  BOOST_CHECK(file_cache::parse_compression_method("zstd", method));
+  BOOST_CHECK_EQUAL(method, file_cache::compress_zstd);
+
+  BOOST_CHECK(!file_cache::parse_compression_method("lz4", method));
+  BOOST_CHECK(!file_cache::parse_compression_method("", method));
+
+  BOOST_CHECK(file_cache::is_compression_method_supported(file_cache::compress_none));
+  BOOST_CHECK(file_cache::is_compression_method_supported(file_cache::compress_zlib));
+}
+
+// The compression methods to test; the ones that aren't supported
+// are skipped.
+const file_cache::compression_method test_compression_methods[] =
+  {
+    file_cache::compress_none,
+    file_cache::compress_zlib,
+    file_cache::compress_zstd
+  };
+
+BOOST_FIXTURE_TEST_CASE(fileCacheCompressionMethods, usingTemp)
+{
+  for(file_cache::compression_method method : test_compression_methods)
+    {
+      if(!file_cache::is_compression_method_supported(method))
+	continue;
+
+      BOOST_TEST_MESSAGE("Testing compression method " << method);
+
+      temp::name tn("cache");
+
+      // Even uncompressed, the test files fit in the cache.
+      std::shared_ptr<file_cache> cache(file_cache::create_compressed(tn.get_name(), 0, 1000,
+							              method, 0));
+
+      fileCacheTestInfo testInfo;
+      setupFileCacheTest(cache, testInfo);
+
+      CHECK_CACHED_VALUE(cache, testInfo.key1, testInfo.infileData1, testInfo.time1);
+      CHECK_CACHED_VALUE(cache, testInfo.key2, testInfo.infileData2, testInfo.time2);
+      CHECK_CACHED_VALUE(cache, testInfo.key3, testInfo.infileData3, testInfo.time3);
+    }
+}
+
+// The compression level is shared by all the methods, so levels
+// that a method doesn't accept are clamped to its range.
+BOOST_FIXTURE_TEST_CASE(fileCacheCompressionLevelOutOfRange, usingTemp)
+{
+  const int test_levels[] = { -5, 1, 9, 10, 19, 100 };
+
+  for(file_cache::compression_method method : test_compression_methods)
+    {
+      if(!file_cache::is_compression_method_supported(method))
+	continue;
+
+      for(int level : test_levels)
+	{
+	  BOOST_TEST_MESSAGE("Testing compression method " << method
+			     << " at level " << level);
+
+	  temp::name tn("cache");
+	  std::shared_ptr<file_cache> cache(file_cache::create_compressed(tn.get_name(), 0, 1000,
+							                  method, level));
+
+	  fileCacheTestInfo testInfo;
+	  setupFileCacheTest(cache, testInfo);
+
+	  CHECK_CACHED_VALUE(cache, testInfo.key1, testInfo.infileData1, testInfo.time1);
+	  CHECK_CACHED_VALUE(cache, testInfo.key2, testInfo.infileData2, testInfo.time2);
+	}
+    }
+}
+
+// Items stored with one compression method must still be readable
+// after the cache is reopened with another one.
+BOOST_FIXTURE_TEST_CASE(fileCacheMixedCompressionMethods, usingTemp)
+{
+  temp::name tn("cache");
+
+  fileCacheTestInfo testInfo;
+
+  {
+    std::shared_ptr<file_cache> cache(file_cache::create_compressed(tn.get_name(), 0, 1000,
+							            file_cache::compress_none, 0));
+    setupFileCacheTest(cache, testInfo);
+  }
+
+  std::shared_ptr<file_cache> cache(file_cache::create_compressed(tn.get_name(), 0, 1000,
+						                  file_cache::compress_zlib, 0));
+
+  CHECK_CACHED_VALUE(cache, testInfo.key1, testInfo.infileData1, testInfo.time1);
+  CHECK_CACHED_VALUE(cache, testInfo.key2, testInfo.infileData2, testInfo.time2);
+  CHECK_CACHED_VALUE(cache, testInfo.key3, testInfo.infileData3, testInfo.time3);
+}
+
 void runDropLeastRecentlyUsedTest(const boost::function<std::shared_ptr<file_cache> (std::string)> &cache_k)
 {
   // Check that we can control which of the three entries is dropped
@@ -384,6 +509,102 @@ BOOST_FIXTURE_TEST_CASE(fileCacheDropLeastRecentlyUsedDisk, usingTemp)
 						   boost::lambda::_1, 0, 1000));
 }
 
+BOOST_FIXTURE_TEST_CASE(fileCacheDropLeastRecentlyUsedMemory, usingTemp)
+{
+  temp::name tn("cache");
+
+  runDropLeastRecentlyUsedTest(boost::lambda::bind(&file_cache::create,
+						   boost::lambda::_1, 1000, 0));
+}
+
+// Any item up to the size of the memory cache can be stored, however
+// the cache is split up internally.
+BOOST_FIXTURE_TEST_CASE(fileCacheMemoryLargeItems, usingTemp)
+{
+  const int memory_size = 512 * 1024;
+
+  const std::string large(400 * 1024, 'x');
+  const std::string small(100 * 1024, 'y');
+
+  temp::name large_file("large");
+  temp::name small_file("small");
+  {
+    std::ofstream out(large_file.get_name().c_str());
+    out.write(large.data(), large.size());
+  }
+  {
+    std::ofstream out(small_file.get_name().c_str());
+    out.write(small.data(), small.size());
+  }
+
+  temp::name tn("cache");
+  std::shared_ptr<file_cache> cache(file_cache::create(tn.get_name(),
+						       memory_size, 0));
+
+  std::string contents;
+  cache->putItem("large", large_file.get_name());
+  BOOST_REQUIRE(readCachedItem(cache, "large", contents));
+  BOOST_CHECK(contents == large);
+
+  // The two items fit together; a third one pushes out the least
+  // recently used one, whichever part of the cache it is in.
+  cache->putItem("small1", small_file.get_name());
+  BOOST_CHECK(readCachedItem(cache, "large", contents));
+  cache->putItem("small2", small_file.get_name());
+  BOOST_CHECK(!readCachedItem(cache, "small1", contents));
+  BOOST_CHECK(readCachedItem(cache, "large", contents));
+  BOOST_CHECK(readCachedItem(cache, "small2", contents));
+}
+
+// Read and replace items of a large memory cache from several
+// threads at once.
+BOOST_FIXTURE_TEST_CASE(fileCacheMemoryConcurrentAccess, usingTemp)
+{
+  const int num_threads = 4;
+  const int num_keys = 64;
+  const int num_rounds = 200;
+
+  temp::name tn("cache");
+  std::shared_ptr<file_cache> cache(file_cache::create(tn.get_name(),
+						       4 * 1024 * 1024, 0));
+
+  fileCacheTestInfo testInfo;
+  setupFileCacheTest(cache, testInfo);
+
+  const std::string data1(testInfo.infileData1.begin(), testInfo.infileData1.end());
+  const std::string data2(testInfo.infileData2.begin(), testInfo.infileData2.end());
+
+  for(int i = 0; i < num_keys; ++i)
+    cache->putItem((boost::format("key%d") % i).str(),
+		   testInfo.infilename1.get_name(), testInfo.time1);
+
+  std::atomic<int> num_bad_reads(0);
+  std::vector<std::thread> threads;
+  for(int t = 0; t < num_threads; ++t)
+    threads.push_back(std::thread([&, t] ()
+      {
+	for(int round = 0; round < num_rounds; ++round)
+	  {
+	    const std::string key((boost::format("key%d") % ((round * num_threads + t) % num_keys)).str());
+
+	    if(round % 10 == t)
+	      cache->putItem(key, testInfo.infilename2.get_name(), testInfo.time2);
+	    else
+	      {
+		std::string contents;
+		if(!readCachedItem(cache, key, contents) ||
+		   (contents != data1 && contents != data2))
+		  ++num_bad_reads;
+	      }
+	  }
+      }));
+
+  for(std::thread &thread : threads)
+    thread.join();
+
+  BOOST_CHECK_EQUAL(num_bad_reads.load(), 0);
+}
+
 // The changelog that's expected to be in the upgrade test database.
 const std::string expectedZenityChangelog = "Source: zenity\n\
 Version: 2.28.0-1\n\
@@ -428,7 +649,7 @@ Changes: \n\
 // cache format and didn't provide an upgrade path, so it isn't
 // included in the test.
 const int min_database_test_upgrade_version = 2;
-const int max_database_test_upgrade_version = 3;
+const int max_database_test_upgrade_version = 4;
 
 extern char *argv0;
 
@@ -474,6 +695,8 @@ void testCacheUpgradeFrom(int version)
 
   CHECK_CACHED_VALUE(cache, "delta-changelog://zenity/2.26.0-2/2.28.0-1",
 		     expectedZenityChangelog, 0);
+  CHECK_CACHED_VALUE(cache, "delta-changelog://zenity/2.26.0-2/2.28.0-1",
+			expectedZenityChangelog, 0);
 }
 
 // This should use parameterized test cases via BOOST_PARAM_TEST_CASE,
@@ -489,3 +712,55 @@ BOOST_FIXTURE_TEST_CASE(testCacheUpgrade, usingTemp)
       testCacheUpgradeFrom(version);
     }
 }
+
+// Not really a test: reports how long it takes to store and
+// retrieve changelog-sized items with each compression method.  Run
+// the test suite with --log_level=message to see the timings.
+BOOST_FIXTURE_TEST_CASE(fileCacheBenchmark, usingTemp)
+{
+  typedef std::chrono::steady_clock clock;
+
+  const int num_items = 20;
+
+  std::string data;
+  while(data.size() < 256 * 1024)
+    data += expectedZenityChangelog;
+
+  temp::name infile("testInFile");
+  {
+    std::ofstream out(infile.get_name().c_str());
+    out.write(data.data(), data.size());
+  }
+
+  for(file_cache::compression_method method : test_compression_methods)
+    {
+      if(!file_cache::is_compression_method_supported(method))
+	continue;
+
+      temp::name tn("cache");
+      std::shared_ptr<file_cache> cache(file_cache::create_compressed(tn.get_name(), 0,
+								      64 * 1024 * 1024,
+								      method, 0));
+
+      const clock::time_point start = clock::now();
+
+      for(int i = 0; i < num_items; ++i)
+	cache->putItem((boost::format("key%d") % i).str(), infile.get_name());
+
+      const clock::time_point stored = clock::now();
+
+      for(int i = 0; i < num_items; ++i)
+	{
+	  temp::name found(cache->getItem((boost::format("key%d") % i).str()));
+	  BOOST_CHECK(found.valid());
+	}
+
+      const clock::time_point extracted = clock::now();
+
+      typedef std::chrono::duration<double, std::milli> milliseconds;
+      BOOST_TEST_MESSAGE("Compression method " << method << ": "
+			 << num_items << " items of " << data.size() << " bytes: "
+			 << "putItem " << milliseconds(stored - start).count() << " ms, "
+			 << "getItem " << milliseconds(extracted - stored).count() << " ms");
+    }
+}
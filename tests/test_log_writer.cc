@@ -0,0 +1,89 @@
+/** \file test_log_writer.cc */
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; see the file COPYING.  If not, write to
+// the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+// Boston, MA 02110-1301, USA.
+
+// Local includes:
+#include <generic/util/log_writer.h>
+
+// System includes:
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+using aptitude::util::create_log_writer;
+using aptitude::util::log_writer;
+
+namespace
+{
+  class LogWriterTest : public testing::Test
+  {
+  protected:
+    std::string filename;
+
+    void SetUp()
+    {
+      char name[] = "/tmp/aptitude-test-log-writer.XXXXXX";
+      const int fd = mkstemp(name);
+      ASSERT_GE(fd, 0);
+      close(fd);
+      filename = name;
+    }
+
+    void TearDown()
+    {
+      if(!filename.empty())
+        unlink(filename.c_str());
+    }
+
+    std::string readFile() const
+    {
+      std::ifstream in(filename.c_str());
+      std::ostringstream contents;
+      contents << in.rdbuf();
+      return contents.str();
+    }
+  };
+}
+
+TEST_F(LogWriterTest, testFlushWritesEverything)
+{
+  std::shared_ptr<log_writer> writer = create_log_writer(filename, 4);
+
+  std::string expected;
+  // More lines than fit in the queue.
+  for(int i = 0; i < 100; ++i)
+    {
+      std::ostringstream line;
+      line << "line " << i << std::endl;
+      writer->write(line.str());
+      expected += line.str();
+    }
+
+  writer->flush();
+  EXPECT_EQ(expected, readFile());
+}
+
+TEST_F(LogWriterTest, testDestroyWritesEverything)
+{
+  create_log_writer(filename, 16)->write("only line\n");
+
+  EXPECT_EQ("only line\n", readFile());
+}
@@ -20,6 +20,7 @@
 #include <cppunit/extensions/HelperMacros.h>
 
 #include <generic/apt/matching/compare_patterns.h>
+#include <generic/apt/matching/compile_pattern.h>
 #include <generic/apt/matching/parse.h>
 #include <generic/apt/matching/pattern.h>
 #include <generic/apt/matching/serialize.h>
@@ -809,6 +810,71 @@ namespace
   };
 
   const int num_test_patterns = sizeof(test_patterns) / sizeof(test_patterns[0]);
+
+  // Each pattern is parsed, compiled and compared against the parse
+  // of the expected evaluation plan.
+  struct compile_test
+  {
+    std::string input_pattern;
+    std::string expected_plan;
+  };
+
+  compile_test compile_tests[] = {
+    { "?description(foo) ?installed", "?installed ?description(foo)" },
+
+    { "?depends(?name(foo)) | ?name(bar) | ?automatic",
+      "?automatic | ?name(bar) | ?depends(?name(foo))" },
+
+    // Terms of equal cost keep their order.
+    { "?maintainer(foo) ?description(bar) ?broken ?installed",
+      "?broken ?installed ?maintainer(foo) ?description(bar)" },
+
+    // Sub-patterns are compiled even if they aren't moved.
+    { "!(?description(foo) ?installed)",
+      "!(?installed ?description(foo))" },
+
+    // Siblings of a ?for stay where they are.
+    { "?description(foo) ?for x: ?installed",
+      "?description(foo) ?for x: ?installed" },
+  };
+
+  const int num_compile_tests = sizeof(compile_tests) / sizeof(compile_tests[0]);
+
+  // Patterns that are built by hand, since the sub-patterns that
+  // refer to an enclosing ?for can't be parsed on their own.  Only
+  // those that don't use the stack have their dependency matches
+  // memoized.
+  struct uses_stack_test
+  {
+    ref_ptr<pattern> p;
+    bool expected_uses_stack;
+  };
+
+  uses_stack_test uses_stack_tests[] = {
+    { pattern::make_installed(), false },
+
+    { pattern::make_depends(pkgCache::Dep::Depends, false,
+			    pattern::make_and(pattern::make_name("foo"),
+					      pattern::make_reverse_depends(pkgCache::Dep::Depends, false,
+									    pattern::make_installed()))),
+      false },
+
+    { pattern::make_equal(0), true },
+
+    { pattern::make_bind(0, pattern::make_installed()), true },
+
+    { pattern::make_for("x", pattern::make_true()), true },
+
+    { pattern::make_depends(pkgCache::Dep::Depends, false,
+			    pattern::make_or(pattern::make_name("foo"),
+					     pattern::make_equal(0))),
+      true },
+
+    { pattern::make_not(pattern::make_widen(pattern::make_bind(1, pattern::make_automatic()))),
+      true },
+  };
+
+  const int num_uses_stack_tests = sizeof(uses_stack_tests) / sizeof(uses_stack_tests[0]);
 }
 
 class MatchingTest : public CppUnit::TestFixture
@@ -820,6 +886,8 @@ class MatchingTest : public CppUnit::TestFixture
   CPPUNIT_TEST(testParseThenSerialize);
   CPPUNIT_TEST(testSerialize);
   CPPUNIT_TEST(testSerializationParse);
+  CPPUNIT_TEST(testCompile);
+  CPPUNIT_TEST(testUsesStack);
 
   CPPUNIT_TEST_SUITE_END();
 
@@ -999,6 +1067,40 @@ public:
 						      test.expected_pattern));
       }
   }
+
+  void testCompile()
+  {
+    for(int i = 0; i < num_compile_tests; ++i)
+      {
+	const compile_test &test(compile_tests[i]);
+
+	ref_ptr<pattern> parsed(parse(test.input_pattern));
+	ref_ptr<pattern> expected(parse(test.expected_plan));
+	_error->DumpErrors();
+	CPPUNIT_ASSERT(parsed.valid());
+	CPPUNIT_ASSERT(expected.valid());
+
+	ref_ptr<pattern> compiled(compile_pattern(parsed));
+
+	CPPUNIT_ASSERT_EQUAL_MESSAGE(ssprintf("Comparing %s and %s",
+					      serialize_pattern(compiled).c_str(),
+					      test.expected_plan.c_str()),
+				     0,
+				     compare_patterns(compiled, expected));
+      }
+  }
+
+  void testUsesStack()
+  {
+    for(int i = 0; i < num_uses_stack_tests; ++i)
+      {
+	const uses_stack_test &test(uses_stack_tests[i]);
+
+	CPPUNIT_ASSERT_EQUAL_MESSAGE(serialize_pattern(test.p),
+				     test.expected_uses_stack,
+				     pattern_uses_stack(test.p));
+      }
+  }
 };
 
 CPPUNIT_TEST_SUITE_REGISTRATION(MatchingTest);
@@ -0,0 +1,127 @@
+// Tests for the pooled node allocator.
+//
+//   This program is free software; you can redistribute it and/or
+//   modify it under the terms of the GNU General Public License as
+//   published by the Free Software Foundation; either version 2 of
+//   the License, or (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//   General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program; see the file COPYING.  If not, write to
+//   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+//   Boston, MA 02110-1301, USA.
+
+// Local includes:
+#include <generic/util/node_pool.h>
+
+// System includes:
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <cwidget/generic/threads/threads.h>
+
+#include <set>
+#include <vector>
+
+namespace cw = cwidget;
+
+namespace
+{
+  // Sizes that no other code in the test program pools, so that each
+  // test starts out with a fresh pool.
+  typedef aptitude::util::node_pool<200> same_thread_pool;
+  typedef aptitude::util::node_pool<216> cross_thread_pool;
+
+  const std::size_t num_blocks = 5000;
+
+  /** \brief Allocate num_blocks blocks on a separate thread. */
+  struct allocate_blocks
+  {
+    std::vector<void *> &blocks;
+
+    allocate_blocks(std::vector<void *> &_blocks)
+      : blocks(_blocks)
+    {
+    }
+
+    void operator()() const
+    {
+      for(std::size_t i = 0; i < num_blocks; ++i)
+	blocks.push_back(cross_thread_pool::allocate());
+    }
+  };
+}
+
+class NodePoolTest : public CppUnit::TestFixture
+{
+  CPPUNIT_TEST_SUITE(NodePoolTest);
+
+  CPPUNIT_TEST(testReuse);
+  CPPUNIT_TEST(testCrossThreadFree);
+
+  CPPUNIT_TEST_SUITE_END();
+
+public:
+  void testReuse()
+  {
+    std::set<void *> allocated;
+    for(std::size_t i = 0; i < num_blocks; ++i)
+      CPPUNIT_ASSERT(allocated.insert(same_thread_pool::allocate()).second);
+
+    for(std::set<void *>::const_iterator it = allocated.begin();
+	it != allocated.end(); ++it)
+      same_thread_pool::deallocate(*it);
+
+    for(std::size_t i = 0; i < num_blocks; ++i)
+      CPPUNIT_ASSERT(allocated.find(same_thread_pool::allocate()) != allocated.end());
+  }
+
+  // Blocks allocated by one thread and freed by another must go back
+  // to the thread that allocated them, like the resolver's nodes do
+  // when the UI thread throws a search away.
+  void testCrossThreadFree()
+  {
+    std::vector<void *> first, second;
+
+    {
+      const allocate_blocks allocate_first(first);
+      cw::threads::thread t(allocate_first);
+      t.join();
+    }
+
+    const std::set<void *> allocated(first.begin(), first.end());
+    CPPUNIT_ASSERT_EQUAL(num_blocks, allocated.size());
+
+    for(std::vector<void *>::const_iterator it = first.begin();
+	it != first.end(); ++it)
+      cross_thread_pool::deallocate(*it);
+
+    // The first thread exited, so the second one takes over its
+    // chunks, and with them the blocks freed here.
+    {
+      const allocate_blocks allocate_second(second);
+      cw::threads::thread t(allocate_second);
+      t.join();
+    }
+
+    CPPUNIT_ASSERT_EQUAL(num_blocks, second.size());
+    for(std::vector<void *>::const_iterator it = second.begin();
+	it != second.end(); ++it)
+      CPPUNIT_ASSERT(allocated.find(*it) != allocated.end());
+
+    // Freeing them on the main thread again and allocating here
+    // doesn't hand them out twice.
+    for(std::vector<void *>::const_iterator it = second.begin();
+	it != second.end(); ++it)
+      cross_thread_pool::deallocate(*it);
+
+    std::set<void *> third;
+    for(std::size_t i = 0; i < num_blocks; ++i)
+      CPPUNIT_ASSERT(third.insert(cross_thread_pool::allocate()).second);
+  }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(NodePoolTest);
@@ -0,0 +1,314 @@
+// Tests for the binary package state files.
+//
+//   This program is free software; you can redistribute it and/or
+//   modify it under the terms of the GNU General Public License as
+//   published by the Free Software Foundation; either version 2 of
+//   the License, or (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//   General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program; see the file COPYING.  If not, write to
+//   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+//   Boston, MA 02110-1301, USA.
+
+// Local includes:
+#include <generic/apt/pkgstates_journal.h>
+#include <generic/util/temp.h>
+
+// System includes:
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+using aptitude::apt::encode_package_state;
+using aptitude::apt::decode_package_state;
+using aptitude::apt::package_state_record;
+using aptitude::apt::pkgstates_journal;
+
+class PkgstatesJournalTest : public CppUnit::TestFixture
+{
+  CPPUNIT_TEST_SUITE(PkgstatesJournalTest);
+
+  CPPUNIT_TEST(testEncodeDecode);
+  CPPUNIT_TEST(testMissing);
+  CPPUNIT_TEST(testAppend);
+  CPPUNIT_TEST(testTruncatedJournal);
+  CPPUNIT_TEST(testStaleJournal);
+  CPPUNIT_TEST(testCompaction);
+
+  CPPUNIT_TEST_SUITE_END();
+
+  static package_state_record make_record(const std::string &name,
+					  int selection_state)
+  {
+    package_state_record rval;
+    rval.name = name;
+    rval.arch = "amd64";
+    rval.selection_state = selection_state;
+    rval.has_dselect_state = true;
+    return rval;
+  }
+
+  static std::vector<std::string> encode_all(const std::vector<package_state_record> &records)
+  {
+    std::vector<std::string> rval;
+    for(std::vector<package_state_record>::const_iterator it = records.begin();
+	it != records.end(); ++it)
+      rval.push_back(encode_package_state(*it));
+    return rval;
+  }
+
+  static off_t file_size(const std::string &filename)
+  {
+    struct stat buf;
+    CPPUNIT_ASSERT_EQUAL(0, stat(filename.c_str(), &buf));
+    return buf.st_size;
+  }
+
+  static void assertSameRecord(const package_state_record &expected,
+			       const package_state_record &actual)
+  {
+    CPPUNIT_ASSERT_EQUAL(expected.name, actual.name);
+    CPPUNIT_ASSERT_EQUAL(expected.arch, actual.arch);
+    CPPUNIT_ASSERT_EQUAL(expected.unseen, actual.unseen);
+    CPPUNIT_ASSERT_EQUAL(expected.upgrade, actual.upgrade);
+    CPPUNIT_ASSERT_EQUAL(expected.reinstall, actual.reinstall);
+    CPPUNIT_ASSERT_EQUAL(expected.auto_new_install, actual.auto_new_install);
+    CPPUNIT_ASSERT_EQUAL(expected.remove_reason, actual.remove_reason);
+    CPPUNIT_ASSERT_EQUAL(expected.selection_state, actual.selection_state);
+    CPPUNIT_ASSERT_EQUAL(expected.dselect_state, actual.dselect_state);
+    CPPUNIT_ASSERT_EQUAL(expected.candver, actual.candver);
+    CPPUNIT_ASSERT_EQUAL(expected.forbidver, actual.forbidver);
+    CPPUNIT_ASSERT_EQUAL(expected.user_tags, actual.user_tags);
+  }
+
+  /** \brief Read the states and return the selection state of each
+   *  package, as "name=state" separated by spaces.
+   */
+  static std::string read_states(const std::string &filename)
+  {
+    pkgstates_journal journal(filename);
+    std::vector<pkgstates_journal::stored_record> records;
+    CPPUNIT_ASSERT(journal.read(records));
+
+    std::string rval;
+    for(std::vector<pkgstates_journal::stored_record>::const_iterator
+	  it = records.begin(); it != records.end(); ++it)
+      {
+	if(!rval.empty())
+	  rval += " ";
+	rval += it->state.name + "=" + std::to_string(it->state.selection_state);
+      }
+
+    return rval;
+  }
+
+public:
+  void setUp()
+  {
+    temp::initialize("testPkgstatesJournal");
+  }
+
+  void tearDown()
+  {
+    temp::shutdown();
+  }
+
+  void testEncodeDecode()
+  {
+    package_state_record record(make_record("libfoo", 1));
+    record.unseen = true;
+    record.reinstall = true;
+    record.remove_reason = 3;
+    record.dselect_state = 2;
+    record.candver = "1.2-3";
+    record.forbidver = "1.3";
+    record.user_tags = "tag1 tag2";
+
+    const std::string payload(encode_package_state(record));
+
+    package_state_record decoded;
+    CPPUNIT_ASSERT(decode_package_state(payload.data(), payload.size(), decoded));
+    assertSameRecord(record, decoded);
+
+    CPPUNIT_ASSERT(!decode_package_state(payload.data(), payload.size() - 1, decoded));
+    CPPUNIT_ASSERT(!decode_package_state(payload.data(), 4, decoded));
+  }
+
+  void testMissing()
+  {
+    temp::name tn("pkgstates");
+    pkgstates_journal journal(tn.get_name());
+    std::vector<pkgstates_journal::stored_record> records;
+
+    CPPUNIT_ASSERT(!journal.exists());
+    CPPUNIT_ASSERT(!journal.read(records));
+    CPPUNIT_ASSERT(records.empty());
+  }
+
+  void testAppend()
+  {
+    temp::name tn("pkgstates");
+
+    std::vector<package_state_record> states;
+    states.push_back(make_record("a", 1));
+    states.push_back(make_record("b", 1));
+    states.push_back(make_record("c", 1));
+
+    {
+      pkgstates_journal journal(tn.get_name());
+      std::vector<pkgstates_journal::stored_record> records;
+      CPPUNIT_ASSERT(!journal.read(records));
+
+      // With no base file, everything is written to it.
+      CPPUNIT_ASSERT(journal.save(std::vector<std::string>(), encode_all(states)));
+    }
+
+    CPPUNIT_ASSERT_EQUAL(std::string("a=1 b=1 c=1"), read_states(tn.get_name()));
+    const off_t base_size = file_size(tn.get_name());
+    const off_t empty_journal_size = file_size(tn.get_name() + ".journal");
+
+    {
+      pkgstates_journal journal(tn.get_name());
+      std::vector<pkgstates_journal::stored_record> records;
+      CPPUNIT_ASSERT(journal.read(records));
+
+      std::vector<package_state_record> changed;
+      changed.push_back(make_record("b", 2));
+      changed.push_back(make_record("d", 3));
+      states[1] = changed[0];
+      states.push_back(changed[1]);
+
+      CPPUNIT_ASSERT(journal.save(encode_all(changed), encode_all(states)));
+
+      changed.clear();
+      changed.push_back(make_record("b", 4));
+      states[1] = changed[0];
+      CPPUNIT_ASSERT(journal.save(encode_all(changed), encode_all(states)));
+    }
+
+    // Only the journal grew.
+    CPPUNIT_ASSERT_EQUAL(base_size, file_size(tn.get_name()));
+    CPPUNIT_ASSERT(file_size(tn.get_name() + ".journal") > empty_journal_size);
+
+    CPPUNIT_ASSERT_EQUAL(std::string("a=1 b=4 c=1 d=3"), read_states(tn.get_name()));
+
+    pkgstates_journal journal(tn.get_name());
+    std::vector<pkgstates_journal::stored_record> records;
+    CPPUNIT_ASSERT(journal.read(records));
+    CPPUNIT_ASSERT_EQUAL(states.size(), records.size());
+    for(std::size_t i = 0; i < states.size(); ++i)
+      {
+	assertSameRecord(states[i], records[i].state);
+	CPPUNIT_ASSERT_EQUAL(aptitude::apt::package_state_checksum(encode_package_state(states[i])),
+			     records[i].checksum);
+      }
+  }
+
+  void testTruncatedJournal()
+  {
+    temp::name tn("pkgstates");
+    const std::string journal_name(tn.get_name() + ".journal");
+
+    std::vector<package_state_record> states;
+    states.push_back(make_record("a", 1));
+
+    {
+      pkgstates_journal journal(tn.get_name());
+      CPPUNIT_ASSERT(journal.save(std::vector<std::string>(), encode_all(states)));
+
+      std::vector<package_state_record> changed;
+      changed.push_back(make_record("a", 2));
+      CPPUNIT_ASSERT(journal.save(encode_all(changed), encode_all(changed)));
+      changed[0] = make_record("b", 3);
+      CPPUNIT_ASSERT(journal.save(encode_all(changed), encode_all(changed)));
+    }
+
+    CPPUNIT_ASSERT_EQUAL(std::string("a=2 b=3"), read_states(tn.get_name()));
+
+    // Cut the last record short, as if we were interrupted while
+    // writing it.
+    CPPUNIT_ASSERT_EQUAL(0, truncate(journal_name.c_str(), file_size(journal_name) - 3));
+    CPPUNIT_ASSERT_EQUAL(std::string("a=2"), read_states(tn.get_name()));
+
+    // The next record replaces the damaged one.
+    {
+      pkgstates_journal journal(tn.get_name());
+      std::vector<pkgstates_journal::stored_record> records;
+      CPPUNIT_ASSERT(journal.read(records));
+
+      std::vector<package_state_record> changed;
+      changed.push_back(make_record("c", 4));
+      CPPUNIT_ASSERT(journal.save(encode_all(changed), encode_all(changed)));
+    }
+
+    CPPUNIT_ASSERT_EQUAL(std::string("a=2 c=4"), read_states(tn.get_name()));
+  }
+
+  void testStaleJournal()
+  {
+    temp::name tn("pkgstates");
+    temp::name saved("saved-journal");
+    const std::string journal_name(tn.get_name() + ".journal");
+
+    std::vector<package_state_record> states;
+    states.push_back(make_record("a", 1));
+
+    pkgstates_journal journal(tn.get_name());
+    CPPUNIT_ASSERT(journal.save(std::vector<std::string>(), encode_all(states)));
+
+    std::vector<package_state_record> changed;
+    changed.push_back(make_record("a", 2));
+    CPPUNIT_ASSERT(journal.save(encode_all(changed), encode_all(changed)));
+    CPPUNIT_ASSERT_EQUAL(0, link(journal_name.c_str(), saved.get_name().c_str()));
+
+    // Compact, then put the old journal back, as if we were
+    // interrupted between writing the base file and the journal.
+    states[0] = make_record("a", 3);
+    CPPUNIT_ASSERT(journal.rewrite(encode_all(states)));
+    CPPUNIT_ASSERT_EQUAL(0, rename(saved.get_name().c_str(), journal_name.c_str()));
+
+    CPPUNIT_ASSERT_EQUAL(std::string("a=3"), read_states(tn.get_name()));
+  }
+
+  void testCompaction()
+  {
+    temp::name tn("pkgstates");
+
+    std::vector<package_state_record> states;
+    for(int i = 0; i < 10; ++i)
+      states.push_back(make_record("p" + std::to_string(i), 1));
+
+    pkgstates_journal journal(tn.get_name());
+    CPPUNIT_ASSERT(journal.save(std::vector<std::string>(), encode_all(states)));
+    const off_t empty_journal_size = file_size(tn.get_name() + ".journal");
+
+    // Keep changing one package until the journal is compacted.
+    bool compacted = false;
+    for(int i = 0; i < 5000 && !compacted; ++i)
+      {
+	std::vector<package_state_record> changed;
+	changed.push_back(make_record("p0", 2 + i % 2));
+	states[0] = changed[0];
+
+	CPPUNIT_ASSERT(!journal.needs_compaction(0));
+	compacted = journal.needs_compaction(1);
+	CPPUNIT_ASSERT(journal.save(encode_all(changed), encode_all(states)));
+      }
+
+    CPPUNIT_ASSERT(compacted);
+    CPPUNIT_ASSERT_EQUAL(empty_journal_size, file_size(tn.get_name() + ".journal"));
+    CPPUNIT_ASSERT_EQUAL(states[0].selection_state,
+			 read_states(tn.get_name()).at(3) - '0');
+  }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(PkgstatesJournalTest);
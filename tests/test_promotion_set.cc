@@ -67,6 +67,7 @@ class Promotion_SetTest : public CppUnit::TestFixture
 
   CPPUNIT_TEST(testFindHighestPromotion);
   CPPUNIT_TEST(testErase);
+  CPPUNIT_TEST(testCompaction);
 
   CPPUNIT_TEST_SUITE_END();
 
@@ -763,6 +764,63 @@ public:
     CPPUNIT_ASSERT(promotion() == p.find_highest_promotion_containing(search2, make_install_version_from_dep_source(bv3, bv2d1)));
     CPPUNIT_ASSERT(promotion() == p.find_highest_promotion_containing(search2, make_install_version(cv2)));
   }
+
+  // Supersede the same promotion many times, so that the dead entries
+  // it leaves behind are reclaimed, and check that the entries that
+  // survive are still indexed correctly.
+  void testCompaction()
+  {
+    dummy_universe_ref u(parseUniverse(dummy_universe_1));
+    dummy_promotion_set_callbacks callbacks;
+    dummy_promotion_set p(u, callbacks);
+
+    package a(u.find_package("a"));
+    package b(u.find_package("b"));
+    package c(u.find_package("c"));
+
+    version av1(a.version_from_name("v1"));
+    version bv2(b.version_from_name("v2"));
+    version cv3(c.version_from_name("v3"));
+
+    choice_set c_choices;
+    c_choices.insert_or_narrow(make_install_version(cv3));
+    promotion c_promotion(c_choices, make_cost(500));
+    CPPUNIT_ASSERT(p.insert(c_promotion) != p.end());
+
+    choice_set ab_choices;
+    ab_choices.insert_or_narrow(make_install_version(av1));
+    ab_choices.insert_or_narrow(make_install_version(bv2));
+
+    for(int i = 1; i <= 200; ++i)
+      {
+	promotion ab_promotion(ab_choices, make_cost(i));
+	CPPUNIT_ASSERT(p.insert(ab_promotion) != p.end());
+	CPPUNIT_ASSERT_EQUAL(2U, p.size());
+      }
+
+    imm::set<promotion> expected_promotions;
+    expected_promotions.insert(c_promotion);
+    expected_promotions.insert(promotion(ab_choices, make_cost(200)));
+    CPPUNIT_ASSERT_EQUAL(2U, empirical_promotions_size(p));
+    CPPUNIT_ASSERT_EQUAL(expected_promotions, get_promotions(p));
+
+    CPPUNIT_ASSERT_EQUAL(make_cost(200), p.find_highest_promotion_cost(ab_choices));
+    CPPUNIT_ASSERT_EQUAL(make_cost(500), p.find_highest_promotion_cost(c_choices));
+
+    choice_set abc_choices(ab_choices);
+    abc_choices.insert_or_narrow(make_install_version(cv3));
+    CPPUNIT_ASSERT_EQUAL(c_promotion,
+			 p.find_highest_promotion_containing(abc_choices,
+							     make_install_version(cv3)));
+
+    // A lower-cost superset is redundant.
+    CPPUNIT_ASSERT(p.insert(promotion(abc_choices, make_cost(10))) == p.end());
+
+    p.erase(p.begin());
+    CPPUNIT_ASSERT_EQUAL(1U, p.size());
+    CPPUNIT_ASSERT(cost_limits::minimum_cost == p.find_highest_promotion_cost(c_choices));
+    CPPUNIT_ASSERT_EQUAL(make_cost(200), p.find_highest_promotion_cost(ab_choices));
+  }
 };
 
 CPPUNIT_TEST_SUITE_REGISTRATION(Promotion_SetTest);
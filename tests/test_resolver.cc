@@ -120,6 +120,31 @@ UNIVERSE [ \
   SOFTDEP a v1 -?> < b v2  b v3 > \
 ]";
 
+// Has several solutions, each found after expanding a number of
+// steps with many successors; used to check that speculative
+// expansion on several threads doesn't change the search.
+const char *dummy_universe_7 = "\
+UNIVERSE [ \
+  PACKAGE car < v1 > v1 \
+  PACKAGE engine < v1 v2 UNINST > UNINST \
+  PACKAGE turbo < v1 UNINST > v1 \
+  PACKAGE wheel < v2 v3 UNINST > UNINST \
+  PACKAGE tyre < v1 v2 UNINST > UNINST \
+  PACKAGE door < v1 v2 UNINST > UNINST \
+  PACKAGE window < v0 v1 v2 UNINST > UNINST \
+  PACKAGE glass < v1 v2 UNINST > UNINST \
+\
+  DEP car v1 -> < engine v1  engine v2 > \
+  DEP car v1 -> < wheel v2  wheel v3 > \
+  DEP car v1 -> < door v1  door v2 > \
+  DEP wheel v3 -> < tyre v1  tyre v2 > \
+  DEP door v2 -> < window v0  window v1  window v2 > \
+  DEP window v1 -> < glass v1 > \
+  DEP window v2 -> < glass v2 > \
+  DEP tyre v2 -> < glass v1  glass UNINST > \
+  DEP engine v2 -> < turbo UNINST > \
+]";
+
 // Done this way so meaningful line numbers are generated.
 #define assertEqEquivalent(x1, x2) \
   do {									\
@@ -207,6 +232,8 @@ class ResolverTest : public CppUnit::TestFixture
   CPPUNIT_TEST(testJointScores);
   CPPUNIT_TEST(testDropSolutionSupersets);
   CPPUNIT_TEST(testBreakSoftDepCost);
+  CPPUNIT_TEST(testCheckpoint);
+  CPPUNIT_TEST(testThreads);
 
   CPPUNIT_TEST_SUITE_END();
 
@@ -1599,6 +1626,146 @@ private:
       CPPUNIT_ASSERT_EQUAL(cost::make_add_to_user_level(0, 1), sols[1].get_cost());
     }
   }
+
+  // Check that a search saved to a checkpoint can be resumed by
+  // another resolver, and that the resumed search produces the same
+  // solutions as an uninterrupted one.
+  void testCheckpoint()
+  {
+    dummy_universe_ref u = parseUniverse(dummy_universe_3);
+
+    std::vector<solution> expected;
+    {
+      dummy_resolver r(10, -300, -100, 100000, 50000,
+                       cost_limits::minimum_cost,
+                       50,
+                       imm::map<dummy_universe::package, dummy_universe::version>(),
+                       u);
+      find_all_solutions(r, 1000, NULL, expected);
+    }
+    CPPUNIT_ASSERT(!expected.empty());
+
+    std::stringstream checkpoint;
+    {
+      dummy_resolver r(10, -300, -100, 100000, 50000,
+                       cost_limits::minimum_cost,
+                       50,
+                       imm::map<dummy_universe::package, dummy_universe::version>(),
+                       u);
+
+      try
+        {
+          r.find_next_solution(1, NULL);
+          CPPUNIT_FAIL("Expected the resolver to run out of time.");
+        }
+      catch(NoMoreTime)
+        {
+        }
+
+      r.save_checkpoint(checkpoint);
+    }
+
+    {
+      std::istringstream in(checkpoint.str());
+      dummy_resolver r(10, -300, -100, 100000, 50000,
+                       cost_limits::minimum_cost,
+                       50,
+                       imm::map<dummy_universe::package, dummy_universe::version>(),
+                       u);
+
+      CPPUNIT_ASSERT(r.load_checkpoint(in));
+
+      std::vector<solution> sols;
+      find_all_solutions(r, 1000, NULL, sols);
+
+      CPPUNIT_ASSERT_EQUAL(expected.size(), sols.size());
+      for(std::vector<solution>::size_type i = 0; i < sols.size(); ++i)
+        assertSameEffect(expected[i].get_choices(), sols[i].get_choices());
+    }
+
+    // A resolver for a different problem ignores the checkpoint.
+    {
+      std::istringstream in(checkpoint.str());
+      dummy_resolver r(10, -300, -100, 100000, 50000,
+                       cost_limits::minimum_cost,
+                       50,
+                       imm::map<dummy_universe::package, dummy_universe::version>(),
+                       u);
+      r.set_version_score(u.find_package("b").version_from_name("v2"), -1000);
+
+      CPPUNIT_ASSERT(!r.load_checkpoint(in));
+      CPPUNIT_ASSERT(r.fresh());
+    }
+
+    // So does a resolver whose user rejected an action that the
+    // saved search didn't reject.
+    {
+      std::istringstream in(checkpoint.str());
+      dummy_resolver r(10, -300, -100, 100000, 50000,
+                       cost_limits::minimum_cost,
+                       50,
+                       imm::map<dummy_universe::package, dummy_universe::version>(),
+                       u);
+      r.reject_version(u.find_package("b").version_from_name("v2"));
+
+      CPPUNIT_ASSERT(!r.load_checkpoint(in));
+      CPPUNIT_ASSERT(r.fresh());
+    }
+
+    // So does a resolver given a truncated checkpoint.
+    {
+      std::istringstream in(checkpoint.str().substr(0, checkpoint.str().size() / 2));
+      dummy_resolver r(10, -300, -100, 100000, 50000,
+                       cost_limits::minimum_cost,
+                       50,
+                       imm::map<dummy_universe::package, dummy_universe::version>(),
+                       u);
+
+      CPPUNIT_ASSERT(!r.load_checkpoint(in));
+      CPPUNIT_ASSERT(r.fresh());
+    }
+  }
+
+  // Check that speculatively expanding steps on several threads gives
+  // the same solutions, in the same order and with the same costs, as
+  // a single thread.
+  void testThreads()
+  {
+    dummy_universe_ref u = parseUniverse(dummy_universe_7);
+
+    std::vector<solution> expected;
+    {
+      dummy_resolver r(10, -300, -100, 100000, 50000,
+                       cost_limits::minimum_cost,
+                       50,
+                       imm::map<dummy_universe::package, dummy_universe::version>(),
+                       u);
+      find_all_solutions(r, 100000, NULL, expected);
+    }
+    CPPUNIT_ASSERT(expected.size() > 1);
+
+    const int thread_counts[] = { 2, 4, 16 };
+    for(int num_threads : thread_counts)
+      {
+        dummy_resolver r(10, -300, -100, 100000, 50000,
+                         cost_limits::minimum_cost,
+                         50,
+                         imm::map<dummy_universe::package, dummy_universe::version>(),
+                         u);
+        r.set_threads(num_threads);
+
+        std::vector<solution> sols;
+        find_all_solutions(r, 100000, NULL, sols);
+
+        CPPUNIT_ASSERT_EQUAL(expected.size(), sols.size());
+        for(std::vector<solution>::size_type i = 0; i < sols.size(); ++i)
+          {
+            assertSameEffect(expected[i].get_choices(), sols[i].get_choices());
+            CPPUNIT_ASSERT_EQUAL(expected[i].get_cost(), sols[i].get_cost());
+            CPPUNIT_ASSERT_EQUAL(expected[i].get_score(), sols[i].get_score());
+          }
+      }
+  }
 };
 
 CPPUNIT_TEST_SUITE_REGISTRATION(ResolverTest);
@@ -0,0 +1,238 @@
+// Tests for the search term index.
+//
+//   This program is free software; you can redistribute it and/or
+//   modify it under the terms of the GNU General Public License as
+//   published by the Free Software Foundation; either version 2 of
+//   the License, or (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//   General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program; see the file COPYING.  If not, write to
+//   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+//   Boston, MA 02110-1301, USA.
+
+// Local includes:
+#include <generic/apt/term_index.h>
+#include <generic/util/temp.h>
+
+// System includes:
+#include <apt-pkg/cachefile.h>
+#include <apt-pkg/configuration.h>
+#include <apt-pkg/error.h>
+#include <apt-pkg/fileutl.h>
+#include <apt-pkg/init.h>
+#include <apt-pkg/pkgcache.h>
+#include <apt-pkg/pkgrecords.h>
+#include <apt-pkg/pkgsystem.h>
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+using aptitude::apt::get_regex_literals;
+using aptitude::apt::term_index;
+
+namespace
+{
+  const std::string sampleStatus = "Package: zenity\n\
+Status: install ok installed\n\
+Priority: optional\n\
+Section: gnome\n\
+Maintainer: Debian GNOME Maintainers <pkg-gnome-maintainers@lists.alioth.debian.org>\n\
+Architecture: all\n\
+Version: 2.28.0-1\n\
+Description: Display graphical dialog boxes from shell scripts\n\
+ Zenity allows you to display dialog boxes from the command line.\n\
+\n\
+Package: xterm\n\
+Status: install ok installed\n\
+Priority: optional\n\
+Section: x11\n\
+Maintainer: Debian X Strike Force <debian-x@lists.debian.org>\n\
+Architecture: all\n\
+Version: 261-1\n\
+Description: X terminal emulator\n\
+ xterm is a terminal emulator for the X Window System.\n\
+\n";
+}
+
+class TermIndexTest : public CppUnit::TestFixture
+{
+  CPPUNIT_TEST_SUITE(TermIndexTest);
+
+  CPPUNIT_TEST(testRegexLiterals);
+  CPPUNIT_TEST(testRegexNoLiterals);
+  CPPUNIT_TEST(testBuildAndFind);
+
+  CPPUNIT_TEST_SUITE_END();
+private:
+  /** \brief Return the names of the packages that are set in the
+   *  given vector, separated by spaces and in ID order.
+   */
+  static std::string package_names(pkgCache &cache,
+				   const std::vector<bool> &found)
+  {
+    std::vector<std::string> names(cache.Head().PackageCount);
+    for(pkgCache::PkgIterator pkg = cache.PkgBegin(); !pkg.end(); ++pkg)
+      if(found[pkg->ID])
+	names[pkg->ID] = pkg.Name();
+
+    std::string rval;
+    for(std::vector<std::string>::const_iterator it = names.begin();
+	it != names.end(); ++it)
+      if(!it->empty())
+	{
+	  if(!rval.empty())
+	    rval += " ";
+	  rval += *it;
+	}
+
+    return rval;
+  }
+
+  static std::string find_containing(const term_index &index,
+				     pkgCache &cache,
+				     term_index::field f,
+				     const std::string &text)
+  {
+    std::vector<bool> found(index.get_num_packages());
+    index.find_containing(f, text, found);
+    return package_names(cache, found);
+  }
+
+  // Check the runs of a regex; "expected" is a space-separated list.
+  void assertLiterals(const std::string &regex,
+		      const std::string &expected)
+  {
+    std::vector<std::string> runs;
+    CPPUNIT_ASSERT(get_regex_literals(regex, runs));
+
+    std::string joined;
+    for(std::vector<std::string>::const_iterator it = runs.begin();
+	it != runs.end(); ++it)
+      {
+	if(!joined.empty())
+	  joined += " ";
+	joined += *it;
+      }
+
+    CPPUNIT_ASSERT_EQUAL(expected, joined);
+  }
+
+  void assertNoLiterals(const std::string &regex)
+  {
+    std::vector<std::string> runs;
+    CPPUNIT_ASSERT(!get_regex_literals(regex, runs));
+    CPPUNIT_ASSERT(runs.empty());
+  }
+
+  void testRegexLiterals()
+  {
+    assertLiterals("apt", "apt");
+    assertLiterals("FooBar", "foobar");
+    assertLiterals("^lib.*-dev$", "lib dev");
+    assertLiterals("pythons?", "python");
+    assertLiterals("perl5*", "perl");
+    assertLiterals("ab[cd]ef", "ab ef");
+    assertLiterals("[]ab]cd", "cd");
+    assertLiterals("[[:alpha:]]xy", "xy");
+    assertLiterals("gn\\.me", "gn me");
+    assertLiterals("a{2}bc", "bc");
+    assertLiterals("xz+utils", "xz utils");
+  }
+
+  void testRegexNoLiterals()
+  {
+    assertNoLiterals("");
+    assertNoLiterals("x");
+    assertNoLiterals(".*");
+    assertNoLiterals("foo|bar");
+    assertNoLiterals("(foo)bar");
+    assertNoLiterals("[abc");
+    assertNoLiterals("ab?");
+  }
+
+  void testBuildAndFind()
+  {
+    temp::initialize("testTermIndex");
+
+    {
+      // Build a package cache from a status file alone.
+      temp::name status("status");
+      temp::name lists("lists");
+      temp::name index_file("index");
+
+      {
+	FileFd out(status.get_name(), FileFd::WriteOnly | FileFd::Create | FileFd::Empty);
+	CPPUNIT_ASSERT(out.Write(sampleStatus.c_str(), sampleStatus.size()));
+      }
+      CPPUNIT_ASSERT_EQUAL(0, mkdir(lists.get_name().c_str(), 0700));
+
+      CPPUNIT_ASSERT(pkgInitConfig(*_config));
+      _config->Set("APT::Architecture", "amd64");
+      _config->Set("Dir::State::status", status.get_name());
+      _config->Set("Dir::State::Lists", lists.get_name());
+      _config->Set("Dir::Etc::sourcelist", lists.get_name() + "/sources.list");
+      _config->Set("Dir::Etc::sourceparts", lists.get_name());
+      _config->Set("Dir::Cache::pkgcache", "");
+      _config->Set("Dir::Cache::srcpkgcache", "");
+      CPPUNIT_ASSERT(pkgInitSystem(*_config, _system));
+
+      pkgCacheFile cache_file;
+      pkgCache * const cache = cache_file.GetPkgCache();
+      CPPUNIT_ASSERT(cache != NULL);
+      pkgRecords records(*cache);
+
+      // Build the index, then load it back from the file.
+      for(int pass = 0; pass < 2; ++pass)
+	{
+	  std::shared_ptr<term_index> index =
+	    term_index::load(*cache, records, index_file.get_name(), "test");
+	  CPPUNIT_ASSERT(index.get() != NULL);
+	  CPPUNIT_ASSERT_EQUAL((uint32_t)cache->Head().PackageCount,
+			       index->get_num_packages());
+
+	  CPPUNIT_ASSERT_EQUAL(std::string("zenity"),
+			       find_containing(*index, *cache, term_index::name_field, "eni"));
+	  CPPUNIT_ASSERT_EQUAL(std::string("zenity"),
+			       find_containing(*index, *cache, term_index::description_field, "dialog"));
+	  CPPUNIT_ASSERT_EQUAL(std::string("xterm"),
+			       find_containing(*index, *cache, term_index::maintainer_field, "strike"));
+	  CPPUNIT_ASSERT_EQUAL(std::string(""),
+			       find_containing(*index, *cache, term_index::name_field, "dialog"));
+
+	  // Every run has to be found, but each may be in any of the
+	  // given fields.
+	  std::vector<std::string> runs;
+	  runs.push_back("terminal");
+	  runs.push_back("xterm");
+	  std::vector<bool> candidates;
+	  index->find_candidates((1 << term_index::name_field) |
+				 (1 << term_index::description_field),
+				 runs, candidates);
+	  CPPUNIT_ASSERT_EQUAL(std::string("xterm"), package_names(*cache, candidates));
+
+	  runs.push_back("zenity");
+	  index->find_candidates((1 << term_index::name_field) |
+				 (1 << term_index::description_field),
+				 runs, candidates);
+	  CPPUNIT_ASSERT_EQUAL(std::string(""), package_names(*cache, candidates));
+	}
+
+      rmdir(lists.get_name().c_str());
+      _error->Discard();
+    }
+
+    temp::shutdown();
+  }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(TermIndexTest);